@@ -388,6 +388,51 @@ g_tcp_set_keepalive(int sck)
     return ret;
 }
 
+/*****************************************************************************/
+/* the maximum segment size of a connected TCP socket */
+/* returns error, not a TCP socket for one */
+int
+g_tcp_get_mss(int sck, int *bytes)
+{
+    int option_value;
+    socklen_t option_len;
+
+    option_value = 0;
+    option_len = sizeof(option_value);
+    if (getsockopt(sck, IPPROTO_TCP, TCP_MAXSEG, (char *)&option_value,
+                   &option_len) != 0)
+    {
+        return 1;
+    }
+    *bytes = option_value;
+    return 0;
+}
+
+/*****************************************************************************/
+/* let other sockets bind to the same address, the kernel shares incoming
+   connections out between them, call before binding
+   returns error, not supported on this platform for one */
+int
+g_sck_set_reuseport(int sck)
+{
+#if defined(SO_REUSEPORT)
+    int option_value;
+
+    option_value = 1;
+    if (setsockopt(sck, SOL_SOCKET, SO_REUSEPORT, (char *)&option_value,
+                   sizeof(option_value)) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Error setting SO_REUSEPORT: %s",
+            g_get_strerror());
+        return 1;
+    }
+    return 0;
+#else
+    LOG(LOG_LEVEL_ERROR, "SO_REUSEPORT is not supported");
+    return 1;
+#endif
+}
+
 /*****************************************************************************/
 /* returns a newly created socket or -1 on error */
 /* in win32 a socket is an unsigned int, in linux, it's an int */
@@ -2696,6 +2741,28 @@ g_file_get_size(const char *filename)
 #endif
 }
 
+/*****************************************************************************/
+/* returns file modification time in seconds since the epoch, -1 on error */
+long
+g_file_get_mtime(const char *filename)
+{
+#if defined(_WIN32)
+    return -1;
+#else
+    struct stat st;
+
+    if (stat(filename, &st) == 0)
+    {
+        return (long)(st.st_mtime);
+    }
+    else
+    {
+        return -1;
+    }
+
+#endif
+}
+
 /*****************************************************************************/
 /* returns device number, -1 on error */
 int
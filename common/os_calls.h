@@ -67,6 +67,8 @@ void     g_hexdump(const char *p, int len);
 int      g_getchar(void);
 int      g_tcp_set_no_delay(int sck);
 int      g_tcp_set_keepalive(int sck);
+int      g_tcp_get_mss(int sck, int *bytes);
+int      g_sck_set_reuseport(int sck);
 int      g_tcp_socket(void);
 int      g_sck_set_send_buffer_bytes(int sck, int bytes);
 int      g_sck_get_send_buffer_bytes(int sck, int *bytes);
@@ -253,6 +255,7 @@ int      g_create_path(const char *path);
 int      g_remove_dir(const char *dirname);
 int      g_file_delete(const char *filename);
 int      g_file_get_size(const char *filename);
+long     g_file_get_mtime(const char *filename);
 int      g_file_get_device_number(const char *filename);
 int      g_file_get_inode_num(const char *filename);
 long     g_load_library(char *in);
@@ -0,0 +1,421 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * wait for many objects with a persistent interest set
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "arch.h"
+#include "defines.h"
+#include "log.h"
+#include "os_calls.h"
+#include "reactor.h"
+
+#if defined(__linux__)
+#define REACTOR_CTL_ADD EPOLL_CTL_ADD
+#define REACTOR_CTL_MOD EPOLL_CTL_MOD
+#define REACTOR_CTL_DEL EPOLL_CTL_DEL
+#else
+/* poll() has no interest set to change */
+#define REACTOR_CTL_ADD 1
+#define REACTOR_CTL_MOD 2
+#define REACTOR_CTL_DEL 3
+#endif
+
+/* most ready objects handled by one reactor_wait(), the rest are
+ * found by the next one */
+#define REACTOR_MAX_EVENTS 256
+
+struct reactor_item
+{
+    tintptr obj; /* as added, for the callback */
+    int events; /* in the interest set */
+    unsigned int gen; /* changed on remove so stale events are dropped */
+    reactor_callback callback; /* NULL if not added */
+    void *arg;
+};
+
+struct reactor
+{
+    int pid; /* a forked child must not change the parent's epoll set */
+    int epoll_fd; /* -1 if poll is used */
+    struct reactor_item *items; /* indexed by fd */
+    int num_items;
+#if defined(__linux__)
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+#else
+    int num_objs; /* objects added */
+    struct pollfd *events;
+    unsigned int *gens; /* gen of each events[] entry */
+    int events_size;
+#endif
+};
+
+/*****************************************************************************/
+static int
+obj_to_fd(tintptr obj)
+{
+    /* as g_obj_wait(), a wait object is read from the low 16 bits */
+    return (int) (obj & 0xffff);
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+reactor_ctl(struct reactor *self, int op, int fd, int events)
+{
+#if defined(__linux__)
+    struct epoll_event event;
+
+    g_memset(&event, 0, sizeof(event));
+    event.events = ((events & REACTOR_READ) ? EPOLLIN : 0) |
+                   ((events & REACTOR_WRITE) ? EPOLLOUT : 0);
+    event.data.u64 = ((uint64_t) self->items[fd].gen << 32) | (uint32_t) fd;
+    if (epoll_ctl(self->epoll_fd, op, fd, &event) != 0)
+    {
+        /* the fd was closed and its number reused without
+         * reactor_remove_obj() */
+        if ((op == EPOLL_CTL_MOD) && (errno == ENOENT))
+        {
+            op = EPOLL_CTL_ADD;
+        }
+        else if ((op == EPOLL_CTL_ADD) && (errno == EEXIST))
+        {
+            op = EPOLL_CTL_MOD;
+        }
+        else if (op == EPOLL_CTL_DEL)
+        {
+            /* gone anyway */
+            return 0;
+        }
+        else
+        {
+            LOG(LOG_LEVEL_ERROR, "reactor_ctl: epoll_ctl fd %d failed: %s",
+                fd, g_get_strerror());
+            return 1;
+        }
+        if (epoll_ctl(self->epoll_fd, op, fd, &event) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "reactor_ctl: epoll_ctl fd %d failed: %s",
+                fd, g_get_strerror());
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+/*****************************************************************************/
+struct reactor *
+reactor_create(void)
+{
+    struct reactor *self;
+
+    self = g_new0(struct reactor, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->pid = g_getpid();
+    self->epoll_fd = -1;
+#if defined(__linux__)
+    self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epoll_fd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "reactor_create: epoll_create1 failed: %s",
+            g_get_strerror());
+        g_free(self);
+        return NULL;
+    }
+#endif
+    return self;
+}
+
+/*****************************************************************************/
+void
+reactor_delete(struct reactor *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    if (self->epoll_fd >= 0)
+    {
+        g_file_close(self->epoll_fd);
+    }
+    g_free(self->items);
+#if !defined(__linux__)
+    g_free(self->events);
+    g_free(self->gens);
+#endif
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+reactor_add_obj(struct reactor *self, tintptr obj, int events,
+                reactor_callback callback, void *arg)
+{
+    struct reactor_item *items;
+    struct reactor_item *item;
+    int num_items;
+    int fd;
+
+    fd = obj_to_fd(obj);
+    if ((self == NULL) || (obj <= 0) || (fd <= 0) || (callback == NULL))
+    {
+        return 1;
+    }
+    if (fd >= self->num_items)
+    {
+        num_items = MAX(fd + 1, self->num_items * 2);
+        num_items = MAX(num_items, 64);
+        items = (struct reactor_item *)
+                realloc(self->items, num_items * sizeof(items[0]));
+        if (items == NULL)
+        {
+            return 1;
+        }
+        g_memset(items + self->num_items, 0,
+                 (num_items - self->num_items) * sizeof(items[0]));
+        self->items = items;
+        self->num_items = num_items;
+    }
+    item = self->items + fd;
+    events &= REACTOR_READ | REACTOR_WRITE;
+    if (item->callback == NULL)
+    {
+        if (reactor_ctl(self, REACTOR_CTL_ADD, fd, events) != 0)
+        {
+            return 1;
+        }
+#if !defined(__linux__)
+        self->num_objs++;
+#endif
+    }
+    else if (item->events != events)
+    {
+        if (reactor_ctl(self, REACTOR_CTL_MOD, fd, events) != 0)
+        {
+            return 1;
+        }
+    }
+    item->obj = obj;
+    item->events = events;
+    item->callback = callback;
+    item->arg = arg;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+reactor_set_obj_events(struct reactor *self, tintptr obj, int events)
+{
+    struct reactor_item *item;
+    int fd;
+
+    fd = obj_to_fd(obj);
+    if ((self == NULL) || (obj <= 0) || (fd <= 0) || (fd >= self->num_items))
+    {
+        return 1;
+    }
+    item = self->items + fd;
+    if (item->callback == NULL)
+    {
+        return 1;
+    }
+    events &= REACTOR_READ | REACTOR_WRITE;
+    if (item->events != events)
+    {
+        if (reactor_ctl(self, REACTOR_CTL_MOD, fd, events) != 0)
+        {
+            return 1;
+        }
+        item->events = events;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+reactor_remove_obj(struct reactor *self, tintptr obj)
+{
+    struct reactor_item *item;
+    int fd;
+
+    fd = obj_to_fd(obj);
+    if ((self == NULL) || (obj <= 0) || (fd <= 0) || (fd >= self->num_items))
+    {
+        return 0;
+    }
+    item = self->items + fd;
+    if (item->callback == NULL)
+    {
+        return 0;
+    }
+    if (g_getpid() == self->pid)
+    {
+        reactor_ctl(self, REACTOR_CTL_DEL, fd, 0);
+    }
+#if !defined(__linux__)
+    self->num_objs--;
+#endif
+    item->obj = 0;
+    item->events = 0;
+    item->gen++;
+    item->callback = NULL;
+    item->arg = NULL;
+    return 0;
+}
+
+/*****************************************************************************/
+/* calls the callback of a ready object unless it was removed by an
+ * earlier callback of the same wait */
+static int
+reactor_dispatch(struct reactor *self, int fd, unsigned int gen, int ready)
+{
+    struct reactor_item *item;
+
+    if ((fd <= 0) || (fd >= self->num_items))
+    {
+        return 0;
+    }
+    item = self->items + fd;
+    ready &= item->events;
+    if ((item->callback == NULL) || (item->gen != gen) || (ready == 0))
+    {
+        return 0;
+    }
+    return item->callback(self, item->obj, ready, item->arg);
+}
+
+/*****************************************************************************/
+int
+reactor_wait(struct reactor *self, int mstimeout)
+{
+    int count;
+    int index;
+    int ready;
+    int rv;
+#if defined(__linux__)
+    uint64_t data;
+#else
+    struct reactor_item *item;
+    int size;
+    int fd;
+#endif
+
+    if (mstimeout < 1)
+    {
+        mstimeout = -1;
+    }
+
+#if defined(__linux__)
+    count = epoll_wait(self->epoll_fd, self->events, REACTOR_MAX_EVENTS,
+                       mstimeout);
+#else
+    /* poll() has no interest set, so it is built for every wait */
+    size = MAX(self->num_objs, 1);
+    if (size > self->events_size)
+    {
+        g_free(self->events);
+        g_free(self->gens);
+        self->events = g_new(struct pollfd, size);
+        self->gens = g_new(unsigned int, size);
+        if ((self->events == NULL) || (self->gens == NULL))
+        {
+            g_free(self->events);
+            g_free(self->gens);
+            self->events = NULL;
+            self->gens = NULL;
+            self->events_size = 0;
+            return 1;
+        }
+        self->events_size = size;
+    }
+    count = 0;
+    for (fd = 0; (fd < self->num_items) && (count < size); fd++)
+    {
+        item = self->items + fd;
+        if (item->callback != NULL)
+        {
+            self->events[count].fd = fd;
+            self->events[count].events =
+                ((item->events & REACTOR_READ) ? POLLIN : 0) |
+                ((item->events & REACTOR_WRITE) ? POLLOUT : 0);
+            self->events[count].revents = 0;
+            self->gens[count] = item->gen;
+            count++;
+        }
+    }
+    count = poll(self->events, count, mstimeout) < 0 ? -1 : count;
+#endif
+
+    if (count < 0)
+    {
+        /* as g_obj_wait(), these are not really errors */
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+                (errno != EINPROGRESS) && (errno != EINTR))
+        {
+            return 1;
+        }
+        return 0;
+    }
+
+    rv = 0;
+    for (index = 0; (index < count) && (rv == 0); index++)
+    {
+#if defined(__linux__)
+        ready = 0;
+        if (self->events[index].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            ready |= REACTOR_READ;
+        }
+        if (self->events[index].events & EPOLLOUT)
+        {
+            ready |= REACTOR_WRITE;
+        }
+        data = self->events[index].data.u64;
+        rv = reactor_dispatch(self, (int) (uint32_t) data,
+                              (unsigned int) (data >> 32), ready);
+#else
+        ready = 0;
+        if (self->events[index].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ready |= REACTOR_READ;
+        }
+        if (self->events[index].revents & POLLOUT)
+        {
+            ready |= REACTOR_WRITE;
+        }
+        rv = reactor_dispatch(self, self->events[index].fd,
+                              self->gens[index], ready);
+#endif
+    }
+    return rv;
+}
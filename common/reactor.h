@@ -0,0 +1,132 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/reactor.h
+ * @brief   Wait for many objects, calling a handler for the ready ones
+ *
+ * A replacement for g_obj_wait() in loops that wait on many objects.
+ * Each object is added once with a callback and stays in the interest
+ * set (epoll on Linux) until it is removed. reactor_wait() calls only
+ * the callbacks of the objects found ready, so a wakeup costs nothing
+ * for the objects that have nothing to do.
+ *
+ * An object that is closed must be removed with reactor_remove_obj()
+ * first. trans_delete() does this for a transport added with
+ * trans_add_to_reactor().
+ */
+
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include "arch.h"
+
+#define REACTOR_READ  1
+#define REACTOR_WRITE 2
+
+struct reactor;
+
+/**
+ * Called by reactor_wait() for a ready object
+ *
+ * The callback may add and remove objects, including its own.
+ *
+ * @param reactor reactor
+ * @param obj Ready object
+ * @param events REACTOR_READ and/or REACTOR_WRITE. An error or hang up
+ *               on the object is reported as REACTOR_READ so that the
+ *               read finds it.
+ * @param arg Argument given to reactor_add_obj()
+ * @return 0 for success, non-zero stops reactor_wait()
+ */
+typedef int (*reactor_callback)(struct reactor *reactor, tintptr obj,
+                                int events, void *arg);
+
+/**
+ * Create new reactor
+ *
+ * @return reactor, or NULL on error
+ */
+struct reactor *
+reactor_create(void);
+
+/**
+ * Delete a reactor
+ *
+ * The objects in it are not closed.
+ *
+ * @param self reactor to delete (may be NULL)
+ */
+void
+reactor_delete(struct reactor *self);
+
+/**
+ * Add an object to the interest set
+ *
+ * Objects are wait objects or sockets as for g_obj_wait(). Adding an
+ * object again replaces its events, callback and argument.
+ *
+ * @param self reactor
+ * @param obj Object to wait for, 0 or less is an error
+ * @param events REACTOR_READ and/or REACTOR_WRITE
+ * @param callback Called when the object is ready
+ * @param arg Passed to callback
+ * @return 0 for success
+ */
+int
+reactor_add_obj(struct reactor *self, tintptr obj, int events,
+                reactor_callback callback, void *arg);
+
+/**
+ * Change the events waited for on an added object
+ *
+ * @param self reactor
+ * @param obj Object
+ * @param events REACTOR_READ and/or REACTOR_WRITE, or 0 to wait for
+ *               nothing but keep the object
+ * @return 0 for success, non-zero if the object was not added
+ */
+int
+reactor_set_obj_events(struct reactor *self, tintptr obj, int events);
+
+/**
+ * Remove an object before it is closed
+ *
+ * A ready object removed by a callback is not passed to its own
+ * callback later in the same reactor_wait().
+ *
+ * @param self reactor (may be NULL)
+ * @param obj Object to remove, may not have been added
+ * @return 0 for success
+ */
+int
+reactor_remove_obj(struct reactor *self, tintptr obj);
+
+/**
+ * Wait for the added objects and call the callbacks of the ready ones
+ *
+ * @param self reactor
+ * @param mstimeout Timeout in milliseconds, less than 1 to wait forever
+ * @return 0 for success, including a timeout or a signal. Otherwise
+ *         the non-zero value returned by a callback, or 1 if the wait
+ *         failed.
+ */
+int
+reactor_wait(struct reactor *self, int mstimeout);
+
+#endif
@@ -32,6 +32,9 @@
 #include <pthread.h>
 #include <semaphore.h>
 #endif
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 #include "arch.h"
 #include "thread_calls.h"
 #include "os_calls.h"
@@ -227,3 +230,20 @@ tc_sem_inc(tbus sem)
     return 0;
 #endif
 }
+
+/*****************************************************************************/
+/* returns the number of online processors, at least 1 */
+int
+tc_get_cpu_count(void)
+{
+    int rv;
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    rv = (int)si.dwNumberOfProcessors;
+#else
+    rv = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (rv < 1) ? 1 : rv;
+}
@@ -45,5 +45,7 @@ int
 tc_sem_dec(tbus sem);
 int
 tc_sem_inc(tbus sem);
+int
+tc_get_cpu_count(void);
 
 #endif
@@ -0,0 +1,205 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * thread pool
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "thread_calls.h"
+#include "thread_pool.h"
+
+struct thread_pool_worker
+{
+    struct thread_pool *pool;
+    int index; /* 1 based, 0 is the thread calling thread_pool_run() */
+};
+
+struct thread_pool
+{
+    int num_workers;
+    struct thread_pool_worker *workers;
+    tbus mutex; /* protects everything below */
+    tbus work_sem; /* one count per worker that should look for jobs */
+    tbus done_sem; /* one count per worker that is idle again */
+    int terminate;
+    thread_pool_job job;
+    void *arg;
+    int next_job;
+    int num_jobs;
+};
+
+/*****************************************************************************/
+/* takes jobs until there are none left */
+static void
+run_jobs(struct thread_pool *self, int worker)
+{
+    int index;
+
+    tc_mutex_lock(self->mutex);
+    while (self->next_job < self->num_jobs)
+    {
+        index = self->next_job++;
+        tc_mutex_unlock(self->mutex);
+        self->job(self->arg, index, worker);
+        tc_mutex_lock(self->mutex);
+    }
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+worker_main(void *arg)
+{
+    struct thread_pool_worker *worker;
+    struct thread_pool *self;
+    int terminate;
+
+    worker = (struct thread_pool_worker *) arg;
+    self = worker->pool;
+    for (;;)
+    {
+        tc_sem_dec(self->work_sem);
+        tc_mutex_lock(self->mutex);
+        terminate = self->terminate;
+        tc_mutex_unlock(self->mutex);
+        if (terminate)
+        {
+            break;
+        }
+        run_jobs(self, worker->index);
+        tc_sem_inc(self->done_sem);
+    }
+    tc_sem_inc(self->done_sem);
+    return 0;
+}
+
+/*****************************************************************************/
+struct thread_pool *
+thread_pool_create(int num_workers)
+{
+    struct thread_pool *self;
+    int index;
+
+    self = g_new0(struct thread_pool, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->mutex = tc_mutex_create();
+    self->work_sem = tc_sem_create(0);
+    self->done_sem = tc_sem_create(0);
+    if (num_workers > 0)
+    {
+        self->workers = g_new0(struct thread_pool_worker, num_workers);
+        if (self->workers == NULL)
+        {
+            num_workers = 0;
+        }
+    }
+    for (index = 0; index < num_workers; index++)
+    {
+        self->workers[index].pool = self;
+        self->workers[index].index = self->num_workers + 1;
+        if (tc_thread_create(worker_main, self->workers + index) != 0)
+        {
+            break;
+        }
+        self->num_workers++;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+thread_pool_delete(struct thread_pool *self)
+{
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    self->terminate = 1;
+    tc_mutex_unlock(self->mutex);
+    for (index = 0; index < self->num_workers; index++)
+    {
+        tc_sem_inc(self->work_sem);
+    }
+    /* wait for the workers to exit */
+    for (index = 0; index < self->num_workers; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+    tc_sem_delete(self->work_sem);
+    tc_sem_delete(self->done_sem);
+    tc_mutex_delete(self->mutex);
+    g_free(self->workers);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+thread_pool_get_num_workers(struct thread_pool *self)
+{
+    return (self == NULL) ? 0 : self->num_workers;
+}
+
+/*****************************************************************************/
+void
+thread_pool_run(struct thread_pool *self, int num_jobs,
+                thread_pool_job job, void *arg)
+{
+    int index;
+    int wake;
+
+    if (num_jobs < 1)
+    {
+        return;
+    }
+    if ((self == NULL) || (self->num_workers < 1) || (num_jobs == 1))
+    {
+        for (index = 0; index < num_jobs; index++)
+        {
+            job(arg, index, 0);
+        }
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    self->job = job;
+    self->arg = arg;
+    self->next_job = 0;
+    self->num_jobs = num_jobs;
+    tc_mutex_unlock(self->mutex);
+    /* the calling thread takes jobs too */
+    wake = MIN(self->num_workers, num_jobs - 1);
+    for (index = 0; index < wake; index++)
+    {
+        tc_sem_inc(self->work_sem);
+    }
+    run_jobs(self, 0);
+    for (index = 0; index < wake; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/thread_pool.h
+ * @brief   Fixed size pool of worker threads
+ *
+ * Runs a batch of independent jobs across the workers and the calling
+ * thread and returns when they have all finished.
+ */
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+struct thread_pool;
+
+/**
+ * Function run for each job of a batch
+ *
+ * @param arg Argument passed to thread_pool_run()
+ * @param index Job index, 0 to num_jobs - 1
+ * @param worker Index of the thread running the job, 0 to
+ *               thread_pool_get_num_workers(), 0 is the calling thread.
+ *               Use this to select per thread state, two jobs with the
+ *               same worker never run at the same time.
+ */
+typedef void (*thread_pool_job)(void *arg, int index, int worker);
+
+/**
+ * Create new thread pool
+ *
+ * @param num_workers Number of worker threads to start, 0 to run
+ *                    everything on the calling thread
+ * @return pool, or NULL if no memory
+ */
+struct thread_pool *
+thread_pool_create(int num_workers);
+
+/**
+ * Stop the worker threads and delete the pool
+ *
+ * Must not be called while thread_pool_run() is in progress.
+ *
+ * @param self pool to delete (may be NULL)
+ */
+void
+thread_pool_delete(struct thread_pool *self);
+
+/**
+ * Number of worker threads in the pool
+ *
+ * @param self pool (may be NULL)
+ * @return worker threads, not counting the calling thread
+ */
+int
+thread_pool_get_num_workers(struct thread_pool *self);
+
+/**
+ * Run a batch of jobs and wait for all of them
+ *
+ * Only one thread may call this at a time for a pool.
+ *
+ * @param self pool, or NULL to run the jobs on the calling thread
+ * @param num_jobs Number of jobs
+ * @param job Function to run for each job
+ * @param arg Argument passed to job
+ */
+void
+thread_pool_run(struct thread_pool *self, int num_jobs,
+                thread_pool_job job, void *arg);
+
+#endif
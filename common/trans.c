@@ -27,6 +27,7 @@
 #include "trans.h"
 #include "arch.h"
 #include "parse.h"
+#include "reactor.h"
 #include "ssl_calls.h"
 #include "log.h"
 
@@ -137,6 +138,7 @@ trans_delete(struct trans *self)
 
     if (self->sck >= 0)
     {
+        reactor_remove_obj(self->reactor, self->sck);
         g_tcp_close(self->sck);
     }
 
@@ -150,6 +152,7 @@ trans_delete(struct trans *self)
 
     if (self->tls != 0)
     {
+        reactor_remove_obj(self->reactor, ssl_get_rwo(self->tls));
         ssl_tls_delete(self->tls);
     }
 
@@ -234,6 +237,65 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
     return 0;
 }
 
+/*****************************************************************************/
+static int
+trans_get_reactor_events(struct trans *self)
+{
+    int events;
+
+    events = (self->wait_s != 0) ? REACTOR_WRITE : 0;
+    if ((self->si == 0) || (self->si->source[self->my_source] <= MAX_SBYTES))
+    {
+        events |= REACTOR_READ;
+    }
+    return events;
+}
+
+/*****************************************************************************/
+/* wait for the socket to be writable only while there is data waiting */
+static int
+trans_update_reactor(struct trans *self)
+{
+    if (self->reactor == NULL)
+    {
+        return 0;
+    }
+    return reactor_set_obj_events(self->reactor, self->sck,
+                                  trans_get_reactor_events(self));
+}
+
+/*****************************************************************************/
+int
+trans_add_to_reactor(struct trans *self, struct reactor *reactor,
+                     reactor_callback callback)
+{
+    if (self == 0)
+    {
+        return 1;
+    }
+
+    if (self->status != TRANS_STATUS_UP)
+    {
+        return 1;
+    }
+
+    if (reactor_add_obj(reactor, self->sck, trans_get_reactor_events(self),
+                        callback, self) != 0)
+    {
+        return 1;
+    }
+    if ((self->tls != NULL) &&
+            reactor_add_obj(reactor, ssl_get_rwo(self->tls), REACTOR_READ,
+                            callback, self) != 0)
+    {
+        reactor_remove_obj(reactor, self->sck);
+        return 1;
+    }
+    self->reactor = reactor;
+    self->reactor_callback = callback;
+    return 0;
+}
+
 /*****************************************************************************/
 int
 trans_send_waiting(struct trans *self, int block)
@@ -457,6 +519,10 @@ trans_check_wait_objs(struct trans *self)
             self->status = TRANS_STATUS_DOWN;
             return 1;
         }
+        if (trans_update_reactor(self) != 0)
+        {
+            return 1;
+        }
     }
 
     return rv;
@@ -672,7 +738,7 @@ trans_write_copy_s(struct trans *self, struct stream *out_s)
         }
         temp_s->next = wait_s;
     }
-    return 0;
+    return trans_update_reactor(self);
 }
 
 /*****************************************************************************/
@@ -786,6 +852,7 @@ trans_connect(struct trans *self, const char *server, const char *port,
         /* Allocate a new socket */
         if (self->sck >= 0)
         {
+            reactor_remove_obj(self->reactor, self->sck);
             g_tcp_close(self->sck);
         }
         self->sck = f_alloc_socket();
@@ -848,6 +915,7 @@ trans_connect(struct trans *self, const char *server, const char *port,
     {
         if (self->sck >= 0)
         {
+            reactor_remove_obj(self->reactor, self->sck);
             g_tcp_close(self->sck);
             self->sck = -1;
         }
@@ -886,6 +954,12 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
 
+        if (self->reuse_port && (g_sck_set_reuseport(self->sck) != 0))
+        {
+            g_tcp_close(self->sck);
+            self->sck = -1;
+            return 1;
+        }
         if (g_tcp_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -954,6 +1028,12 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         }
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
+        if (self->reuse_port && (g_sck_set_reuseport(self->sck) != 0))
+        {
+            g_tcp_close(self->sck);
+            self->sck = -1;
+            return 1;
+        }
         if (g_tcp4_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -973,6 +1053,12 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         }
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
+        if (self->reuse_port && (g_sck_set_reuseport(self->sck) != 0))
+        {
+            g_tcp_close(self->sck);
+            self->sck = -1;
+            return 1;
+        }
         if (g_tcp6_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -1057,6 +1143,13 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
     self->ssl_protocol = ssl_get_version(self->tls);
     self->cipher_name = ssl_get_cipher_name(self->tls);
 
+    if ((self->reactor != NULL) &&
+            reactor_add_obj(self->reactor, ssl_get_rwo(self->tls),
+                            REACTOR_READ, self->reactor_callback, self) != 0)
+    {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -23,6 +23,7 @@
 
 #include "arch.h"
 #include "parse.h"
+#include "reactor.h"
 
 #define TRANS_MODE_TCP 1 /* tcp6 if defined, else tcp4 */
 #define TRANS_MODE_UNIX 2
@@ -117,6 +118,9 @@ struct trans
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
+    struct reactor *reactor; /* set by trans_add_to_reactor() */
+    reactor_callback reactor_callback;
+    int reuse_port; /* tcp listener shares its address, set before listening */
 };
 
 struct trans *
@@ -133,6 +137,22 @@ trans_get_wait_objs_rw(struct trans *self,
                        tbus *wobjs, int *wcount, int *timeout);
 int
 trans_check_wait_objs(struct trans *self);
+/**
+ * Add the transport's objects to a reactor
+ *
+ * The callback is passed the transport as its argument, and is expected
+ * to call trans_check_wait_objs(). The transport waits to write only
+ * while it has data waiting to be sent. trans_delete() removes the
+ * objects from the reactor.
+ *
+ * @param self transport
+ * @param reactor reactor to wait with
+ * @param callback called when the transport is ready
+ * @return 0 for success
+ */
+int
+trans_add_to_reactor(struct trans *self, struct reactor *reactor,
+                     reactor_callback callback);
 int
 trans_force_read_s(struct trans *self, struct stream *in_s, int size);
 int
@@ -175,6 +175,9 @@ struct xrdp_client_info
     char variant[16];
     char options[256];
 
+    /* XRDP_PAINT_HINTS_* the encoder accepts from the module */
+    int paint_hints_flags;
+
     /* ==================================================================== */
     /* Private to xrdp below this line */
     /* ==================================================================== */
@@ -186,6 +189,11 @@ struct xrdp_client_info
 
     int use_frame_acks;
     int max_unacknowledged_frame_count;
+    int max_frames_in_flight; /* xrdp.ini cap on the above, 0 = no cap */
+    int max_frames_in_encoder; /* xrdp.ini, 0 = no Xorg/encoder overlap */
+    int jpeg_encoder_threads; /* xrdp.ini, 0 = one per CPU up to a limit */
+    int bitmap_compress_threads; /* xrdp.ini, 0 or 1 = no bitmap workers */
+    int order_peephole; /* xrdp.ini, optimise batches of drawing orders */
 
     long ssl_protocols;
     char *tls_ciphers;
@@ -198,6 +206,8 @@ struct xrdp_client_info
 
     int no_orders_supported;
     int use_cache_glyph_v2;
+    int frag_cache_entries; /* glyph fragment cache, 0 if not supported */
+    int frag_cache_cell_size;
     int rail_enable;
     int suppress_output;
 
@@ -219,6 +229,6 @@ struct xrdp_client_info
 
 /* yyyymmdd of last incompatible change to xrdp_client_info */
 /* also used for changes to all the xrdp installed headers */
-#define CLIENT_INFO_CURRENT_VERSION 20230425
+#define CLIENT_INFO_CURRENT_VERSION 20261019
 
 #endif
@@ -76,6 +76,25 @@
 #define XRDP_ENCODER_HINT_QUALITY_HIGHEST 0x00f0
 #define XRDP_ENCODER_HINT_QUALITY_AUTO    0x0100
 
+/**
+ * Per rectangle content hints sent with server_paint_rect_shmem_hints
+ */
+#define XRDP_ENCODER_CONTENT_DEFAULT 0
+#define XRDP_ENCODER_CONTENT_TEXT    1
+#define XRDP_ENCODER_CONTENT_VIDEO   2
+
+/**
+ * xrdp_client_info.paint_hints_flags, what the encoder can act on
+ */
+#define XRDP_PAINT_HINTS_CONTENT 0x0001
+#define XRDP_PAINT_HINTS_SCROLL  0x0002
+
+/**
+ * libxrdp_codec_jpeg_compress_ex() flags
+ */
+#define XRDP_JPEG_FLAGS_FAST_DCT 0x0001 /* faster, less accurate DCT */
+#define XRDP_JPEG_FLAGS_OPTIMIZE 0x0002 /* optimal Huffman tables, slower */
+
 #define XR_MIN_KEY_CODE 8
 #define XR_MAX_KEY_CODE 256
 
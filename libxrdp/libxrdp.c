@@ -55,6 +55,13 @@ libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini)
     return session;
 }
 
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_preload_config(const char *xrdp_ini)
+{
+    return xrdp_rdp_preload_config(xrdp_ini);
+}
+
 /******************************************************************************/
 int EXPORT_CC
 libxrdp_exit(struct xrdp_session *session)
@@ -406,6 +413,223 @@ libxrdp_send_bell(struct xrdp_session *session)
     return 0;
 }
 
+/*****************************************************************************/
+/* TS_BITMAP_DATA header for lines_sending lines from line i of the
+   update, returns the bytes written */
+static int
+libxrdp_out_bitmap_data(struct xrdp_session *session, struct stream *s,
+                        int x, int y, int cx, int i, int lines_sending,
+                        int width, int bpp, int bufsize)
+{
+    int line_size;
+
+    out_uint16_le(s, x); /* left */
+    out_uint16_le(s, y + i); /* top */
+    out_uint16_le(s, (x + cx) - 1); /* right */
+    out_uint16_le(s, (y + i + lines_sending) - 1); /* bottom */
+    out_uint16_le(s, width); /* width */
+    out_uint16_le(s, lines_sending); /* height */
+    out_uint16_le(s, bpp); /* bpp */
+
+    if (session->client_info->op1)
+    {
+        out_uint16_le(s, 0x401); /* compress */
+        out_uint16_le(s, bufsize); /* compressed size */
+        return 18;
+    }
+    out_uint16_le(s, 0x1); /* compress */
+    out_uint16_le(s, bufsize + 8);
+    out_uint8s(s, 2); /* pad */
+    out_uint16_le(s, bufsize); /* compressed size */
+    line_size = width * ((bpp + 7) / 8);
+    out_uint16_le(s, line_size); /* line size */
+    out_uint16_le(s, line_size * lines_sending); /* final size */
+    return 26;
+}
+
+/*****************************************************************************/
+/* Compresses horizontal bands of the bitmap on the bitmap workers and
+   sends them from the bottom up, as libxrdp_send_bitmap() does.  A band
+   is as many lines as the compressor takes in one go, if it stops early
+   the rest of the band is compressed here.
+   Returns non zero if there are no workers or only one band, nothing is
+   sent then. */
+static int
+libxrdp_send_bitmap_bands(struct xrdp_session *session, int width,
+                          int height, int bpp, char *data,
+                          int x, int y, int cx, int cy)
+{
+    struct xrdp_bitmap_job *jobs;
+    struct xrdp_bitmap_job *job;
+    struct stream *s;
+    struct stream *band_s;
+    struct stream *temp_s;
+    char *p_num_updates;
+    char *comp;
+    int e;
+    int stride;
+    int band_lines;
+    int num_bands;
+    int band;
+    int bottom;
+    int top;
+    int i;
+    int lines;
+    int bytes;
+    int header;
+    int byte_limit;
+    int total_bufsize;
+    int num_updates;
+
+    if (cy > height || width < 1)
+    {
+        return 1;
+    }
+    e = (4 - width) & 3;
+    if (bpp > 24)
+    {
+        /* planes of 64 * 64 */
+        band_lines = 4096 / (width + e);
+        stride = width * 4;
+    }
+    else
+    {
+        /* 16K of pixels */
+        band_lines = 16384 / ((width + e) * ((bpp + 7) / 8));
+        stride = (bpp == 8) ? width : (bpp == 24) ? width * 4 : width * 2;
+    }
+    if (band_lines < 1 || band_lines >= cy)
+    {
+        return 1;
+    }
+    num_bands = (cy + band_lines - 1) / band_lines;
+    jobs = g_new0(struct xrdp_bitmap_job, num_bands);
+    if (jobs == NULL)
+    {
+        return 1;
+    }
+    header = session->client_info->op1 ? 18 : 26;
+    byte_limit = (MAX_BITMAP_BUF_SIZE - 100) - header;
+    for (band = 0; band < num_bands; band++)
+    {
+        bottom = cy - band * band_lines;
+        top = MAX(bottom - band_lines, 0);
+        job = jobs + band;
+        job->data = data + top * stride;
+        job->width = width;
+        job->height = bottom - top;
+        job->bpp = (bpp > 24) ? 32 : bpp;
+        job->start_line = job->height - 1;
+        job->byte_limit = byte_limit;
+    }
+    if (xrdp_orders_compress_bitmaps((struct xrdp_orders *)session->orders,
+                                     jobs, num_bands) != 0)
+    {
+        g_free(jobs);
+        return 1;
+    }
+
+    make_stream(s);
+    init_stream(s, MAX_BITMAP_BUF_SIZE);
+    make_stream(band_s);
+    init_stream(band_s, 16384 * 2);
+    make_stream(temp_s);
+    init_stream(temp_s, 16384 * 2);
+    p_num_updates = NULL;
+    total_bufsize = 0;
+    num_updates = 0;
+    band = 0;
+    i = cy;
+    while (i > 0)
+    {
+        job = jobs + band;
+        bottom = cy - band * band_lines;
+        top = bottom - job->height;
+        if (i == bottom && job->lines > 0)
+        {
+            comp = job->comp;
+            bytes = job->bytes;
+            lines = job->lines;
+        }
+        else
+        {
+            /* what did not fit in the compressed band */
+            init_stream(band_s, 16384 * 2);
+            if (bpp > 24)
+            {
+                lines = xrdp_bitmap32_compress(job->data, width, job->height,
+                                               band_s, 32, byte_limit,
+                                               i - top - 1, temp_s, e, 0x10);
+            }
+            else
+            {
+                lines = xrdp_bitmap_compress(job->data, width, job->height,
+                                             band_s, bpp, byte_limit,
+                                             i - top - 1, temp_s, e);
+            }
+            if (lines == 0)
+            {
+                break;
+            }
+            comp = band_s->data;
+            bytes = (int)(band_s->p - band_s->data);
+        }
+
+        if (num_updates > 0 &&
+                total_bufsize + header + bytes > MAX_BITMAP_BUF_SIZE - 100)
+        {
+            p_num_updates[0] = num_updates;
+            p_num_updates[1] = num_updates >> 8;
+            s_mark_end(s);
+            xrdp_rdp_send_data((struct xrdp_rdp *)session->rdp, s,
+                               RDP_DATA_PDU_UPDATE);
+            num_updates = 0;
+        }
+        if (num_updates == 0)
+        {
+            xrdp_rdp_init_data((struct xrdp_rdp *)session->rdp, s);
+            out_uint16_le(s, RDP_UPDATE_BITMAP); /* updateType */
+            p_num_updates = s->p;
+            out_uint8s(s, 2); /* num_updates set later */
+            total_bufsize = 0;
+        }
+
+        i -= lines;
+        total_bufsize += libxrdp_out_bitmap_data(session, s, x, y, cx,
+                                                 i, lines, width + e, bpp,
+                                                 bytes);
+        out_uint8a(s, comp, bytes);
+        total_bufsize += bytes;
+        num_updates++;
+        if (i <= top)
+        {
+            band++;
+        }
+    }
+    if (num_updates > 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] TS_UPDATE_BITMAP_DATA "
+                  "updateType %d (UPDATETYPE_BITMAP), numberRectangles %d, "
+                  "rectangles <omitted from log>",
+                  RDP_UPDATE_BITMAP, num_updates);
+        p_num_updates[0] = num_updates;
+        p_num_updates[1] = num_updates >> 8;
+        s_mark_end(s);
+        xrdp_rdp_send_data((struct xrdp_rdp *)session->rdp, s,
+                           RDP_DATA_PDU_UPDATE);
+    }
+
+    for (band = 0; band < num_bands; band++)
+    {
+        g_free(jobs[band].comp);
+    }
+    g_free(jobs);
+    free_stream(s);
+    free_stream(band_s);
+    free_stream(temp_s);
+    return 0;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
@@ -453,6 +677,13 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: bpp %d Bpp %d line_bytes %d "
               "server_line_bytes %d", bpp, Bpp, line_bytes, server_line_bytes);
+    if (session->client_info->use_bitmap_comp &&
+            libxrdp_send_bitmap_bands(session, width, height, bpp, data,
+                                      x, y, cx, cy) == 0)
+    {
+        return 0;
+    }
+
     make_stream(s);
     init_stream(s, MAX_BITMAP_BUF_SIZE);
 
@@ -523,34 +754,12 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
                 i = i - lines_sending;
                 s_mark_end(s);
                 s_pop_layer(s, channel_hdr);
-                out_uint16_le(s, x); /* left */
-                out_uint16_le(s, y + i); /* top */
-                out_uint16_le(s, (x + cx) - 1); /* right */
-                out_uint16_le(s, (y + i + lines_sending) - 1); /* bottom */
-                out_uint16_le(s, width + e); /* width */
-                out_uint16_le(s, lines_sending); /* height */
-                out_uint16_le(s, bpp); /* bpp */
-
-                if (session->client_info->op1)
-                {
-                    out_uint16_le(s, 0x401); /* compress */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    j = j * lines_sending;
-                    total_bufsize += 18; /* bytes since pop layer */
-                }
-                else
-                {
-                    out_uint16_le(s, 0x1); /* compress */
-                    out_uint16_le(s, bufsize + 8);
-                    out_uint8s(s, 2); /* pad */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    out_uint16_le(s, j); /* line size */
-                    j = j * lines_sending;
-                    out_uint16_le(s, j); /* final size */
-                    total_bufsize += 26; /* bytes since pop layer */
-                }
+                /* bytes since pop layer */
+                total_bufsize += libxrdp_out_bitmap_data(session, s, x, y, cx,
+                                                         i, lines_sending,
+                                                         width + e, bpp,
+                                                         bufsize);
+                j = (width + e) * Bpp * lines_sending;
 
                 LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: decompressed pixels %d "
                           "decompressed bytes %d compressed bytes %d",
@@ -709,11 +918,12 @@ libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
                      int width, int height)
 {
     struct stream *s;
-    char *p;
+#if !defined(L_ENDIAN)
     tui16 *p16;
     tui32 *p32;
     int i;
     int j;
+#endif
     int data_bytes;
     int mask_bytes;
 
@@ -801,7 +1011,11 @@ libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
     out_uint16_le(s, mask_bytes); /* lengthAndMask */
     out_uint16_le(s, data_bytes); /* lengthXorMask */
 
-    /* xorMaskData */
+    /* xorMaskData, 24 bpp and little endian pixels are already in wire
+       order so large pointers are copied in one go */
+#if defined(L_ENDIAN)
+    out_uint8a(s, data, data_bytes);
+#else
     switch (bpp)
     {
         case 15:
@@ -818,19 +1032,7 @@ libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
             }
             break;
         case 24:
-            p = data;
-            for (i = 0; i < height; i++)
-            {
-                for (j = 0; j < width; j++)
-                {
-                    out_uint8(s, *p);
-                    p++;
-                    out_uint8(s, *p);
-                    p++;
-                    out_uint8(s, *p);
-                    p++;
-                }
-            }
+            out_uint8a(s, data, data_bytes);
             break;
         case 32:
             p32 = (tui32 *) data;
@@ -844,6 +1046,7 @@ libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
             }
             break;
     }
+#endif
 
     out_uint8a(s, mask, mask_bytes); /* andMaskData */
     out_uint8(s, 0); /* pad */
@@ -1239,6 +1442,23 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                                     cache_id, cache_idx, hints);
 }
 
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_orders_precompress_tiles(struct xrdp_session *session,
+                                 const struct xrdp_bitmap_tile *tiles,
+                                 int num_tiles)
+{
+    return xrdp_orders_precompress_tiles((struct xrdp_orders *)session->orders,
+                                         tiles, num_tiles);
+}
+
+/*****************************************************************************/
+void EXPORT_CC
+libxrdp_orders_clear_tiles(struct xrdp_session *session)
+{
+    xrdp_orders_clear_tiles((struct xrdp_orders *)session->orders);
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_get_channel_count(const struct xrdp_session *session)
@@ -1635,7 +1855,36 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
     jpeg_han = orders->jpeg_han;
     return xrdp_codec_jpeg_compress(jpeg_han, format, inp_data,
                                     width, height, stride, x, y,
-                                    cx, cy, quality, out_data, io_len);
+                                    cx, cy, quality, 0, out_data, io_len);
+}
+
+/*****************************************************************************/
+/* a compressor not tied to a session, for use by one thread at a time */
+void *EXPORT_CC
+libxrdp_codec_jpeg_create(void)
+{
+    return xrdp_jpeg_init();
+}
+
+/*****************************************************************************/
+void EXPORT_CC
+libxrdp_codec_jpeg_delete(void *handle)
+{
+    xrdp_jpeg_deinit(handle);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_codec_jpeg_compress_ex(void *handle,
+                               int format, char *inp_data,
+                               int width, int height,
+                               int stride, int x, int y,
+                               int cx, int cy, int quality, int flags,
+                               char *out_data, int *io_len)
+{
+    return xrdp_codec_jpeg_compress(handle, format, inp_data,
+                                    width, height, stride, x, y,
+                                    cx, cy, quality, flags, out_data, io_len);
 }
 
 /*****************************************************************************/
@@ -1771,6 +2020,20 @@ libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
     return 0;
 }
 
+/*****************************************************************************/
+void EXPORT_CC
+libxrdp_fastpath_pack_begin(struct xrdp_session *session)
+{
+    xrdp_rdp_fastpath_pack_begin((struct xrdp_rdp *)session->rdp);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_fastpath_pack_end(struct xrdp_session *session)
+{
+    return xrdp_rdp_fastpath_pack_end((struct xrdp_rdp *)session->rdp);
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_session_info(struct xrdp_session *session, const char *data,
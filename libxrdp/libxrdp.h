@@ -168,6 +168,15 @@ struct xrdp_rdp
     struct xrdp_client_info client_info;
     struct xrdp_mppc_enc *mppc_enc;
     void *rfx_enc;
+    int fastpath_frag_size; /* set on the first fastpath send */
+    /* fastpath updates packed into one PDU, see
+       xrdp_rdp_fastpath_pack_begin() */
+    int fp_pack_level;
+    struct stream *fp_pack_s;
+    int fp_pack_count;
+    int fp_pack_bytes;
+    int fp_updates_packed;
+    int fp_pdus_packed;
 };
 
 /* state */
@@ -272,6 +281,82 @@ struct xrdp_orders_state
 };
 
 /* orders */
+struct thread_pool;
+
+/* one bitmap compressed on the bitmap workers, the bitmap is read from
+   start_line up as xrdp_bitmap_compress() does */
+struct xrdp_bitmap_job
+{
+    char *data;
+    int width;
+    int height;
+    int bpp;
+    int start_line;
+    int byte_limit;
+    /* result */
+    int lines; /* lines compressed, 0 if none */
+    int bytes;
+    char *comp; /* g_malloc'd */
+};
+
+/* a drawing order held back until the end of the batch so it can be
+   dropped, merged or moved, see xrdp_orders_peephole.c */
+struct xrdp_order_item
+{
+    int type; /* RDP_ORDER_RECT, PATBLT, SCREENBLT or MEMBLT */
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int rop;
+    int color; /* rect colour, pat blt background */
+    int fg_color;
+    int srcx;
+    int srcy;
+    int cache_id;
+    int cache_idx;
+    int color_table;
+    int has_brush;
+    struct xrdp_brush brush;
+    int has_clip;
+    struct xrdp_rect clip;
+};
+
+#define XRDP_MAX_PENDING_ORDERS 64
+
+struct xrdp_orders_peephole_stats
+{
+    int orders_in;
+    int dropped; /* drawn over later in the batch */
+    int merged; /* into a rect next to it */
+    int moved; /* next to an order of the same type */
+    int orders_out;
+    int bytes_out; /* of orders_out */
+};
+
+/* glyph runs in the client's fragment cache, see
+   xrdp_orders_text_fragment() */
+#define XRDP_MAX_TEXT_FRAGMENTS 256
+
+struct xrdp_text_fragment
+{
+    int stamp; /* 0 if free */
+    unsigned int hash;
+    int bytes;
+    char data[255];
+};
+
+struct xrdp_text_frags
+{
+    int entries; /* the client's cache size */
+    int max_bytes; /* the client's largest fragment */
+    int off; /* a module uses the cache itself */
+    int stamp;
+    int hits;
+    int adds;
+    struct xrdp_text_fragment items[XRDP_MAX_TEXT_FRAGMENTS];
+};
+
 struct xrdp_orders
 {
     struct stream *out_s;
@@ -288,6 +373,22 @@ struct xrdp_orders
     /* shared */
     struct stream *s;
     struct stream *temp_s;
+    /* bitmap workers, created on first use, see
+       xrdp_orders_compress_bitmaps() */
+    struct thread_pool *bitmap_pool;
+    int num_bitmap_threads; /* including the calling thread */
+    struct stream **bitmap_s; /* one per thread */
+    struct stream **bitmap_temp_s;
+    /* tiles compressed ahead of the cache orders that send them */
+    struct xrdp_bitmap_job *tile_jobs;
+    int num_tile_jobs;
+    int next_tile_job;
+    /* orders of the current batch, NULL if the peephole is off */
+    struct xrdp_order_item *pending;
+    int num_pending;
+    struct xrdp_orders_peephole_stats peephole_stats;
+    /* created on the first text order if the client has a fragment cache */
+    struct xrdp_text_frags *text_frags;
 };
 
 #define PROTO_RDP_40 1
@@ -403,6 +504,8 @@ int
 xrdp_sec_process_mcs_data_monitors(struct xrdp_sec *self, struct stream *s);
 
 /* xrdp_rdp.c */
+int
+xrdp_rdp_preload_config(const char *xrdp_ini);
 struct xrdp_rdp *
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans);
 void
@@ -425,6 +528,10 @@ xrdp_rdp_send_data(struct xrdp_rdp *self, struct stream *s,
 int
 xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
                        int data_pdu_type);
+void
+xrdp_rdp_fastpath_pack_begin(struct xrdp_rdp *self);
+int
+xrdp_rdp_fastpath_pack_end(struct xrdp_rdp *self);
 int
 xrdp_rdp_send_data_update_sync(struct xrdp_rdp *self);
 int
@@ -502,6 +609,9 @@ xrdp_orders_text(struct xrdp_orders *self,
                  int x, int y, char *data, int data_len,
                  struct xrdp_rect *rect);
 int
+xrdp_orders_text_fragment(struct xrdp_text_frags *frags, int flags,
+                          const char *data, int data_len, char *out);
+int
 xrdp_orders_send_palette(struct xrdp_orders *self, int *palette,
                          int cache_id);
 int
@@ -529,6 +639,15 @@ xrdp_orders_send_bitmap3(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
                          int cache_id, int cache_idx, int hints);
 int
+xrdp_orders_compress_bitmaps(struct xrdp_orders *self,
+                             struct xrdp_bitmap_job *jobs, int num_jobs);
+int
+xrdp_orders_precompress_tiles(struct xrdp_orders *self,
+                              const struct xrdp_bitmap_tile *tiles,
+                              int num_tiles);
+void
+xrdp_orders_clear_tiles(struct xrdp_orders *self);
+int
 xrdp_orders_send_brush(struct xrdp_orders *self, int width, int height,
                        int bpp, int type, int size, char *data, int cache_id);
 int
@@ -538,6 +657,11 @@ xrdp_orders_send_create_os_surface(struct xrdp_orders *self, int id,
 int
 xrdp_orders_send_switch_os_surface(struct xrdp_orders *self, int id);
 
+/* xrdp_orders_peephole.c */
+int
+xrdp_orders_peephole(struct xrdp_order_item *items, int count,
+                     struct xrdp_orders_peephole_stats *stats);
+
 /* xrdp_bitmap_compress.c */
 int
 xrdp_bitmap_compress(char *in_data, int width, int height,
@@ -549,6 +673,30 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
                        struct stream *s, int bpp, int byte_limit,
                        int start_line, struct stream *temp_s,
                        int e, int flags);
+
+/* xrdp_bitmap32_simd.c */
+#define XRDP_PLANAR_SIMD_NONE   0
+#define XRDP_PLANAR_SIMD_SSE2   1
+#define XRDP_PLANAR_SIMD_AVX2   2
+#define XRDP_PLANAR_SIMD_NEON   3
+
+struct xrdp_planar_funcs
+{
+    const char *name;
+    void (*split3)(const char *src, int width,
+                   char *r_data, char *g_data, char *b_data);
+    void (*split4)(const char *src, int width, char *a_data,
+                   char *r_data, char *g_data, char *b_data);
+    void (*delta)(const char *prev, const char *cur, char *out, int bytes);
+    int (*count_run)(const char *ptr8, const char *lend, int same);
+};
+
+const struct xrdp_planar_funcs *
+xrdp_planar_get_funcs(void);
+int
+xrdp_planar_simd_supported(int simd);
+int
+xrdp_planar_simd_select(int simd);
 int
 xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    struct stream *s, int bpp, int byte_limit,
@@ -567,6 +715,7 @@ xrdp_codec_jpeg_compress(void *handle,
                          int   cx,       /* width of area to compress */
                          int   cy,       /* height of area to compress */
                          int   quality,  /* higher numbers compress less */
+                         int   flags,    /* XRDP_JPEG_FLAGS_* */
                          char *out_data, /* dest for jpg image */
                          int  *io_len    /* length of out_data and on return
                                             len of compressed data */
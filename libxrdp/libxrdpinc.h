@@ -91,6 +91,15 @@ struct xrdp_drdynvc_procs
 /* Defined in xrdp_client_info.h */
 struct display_size_description;
 
+/* see libxrdp_orders_precompress_tiles() */
+struct xrdp_bitmap_tile
+{
+    char *data;
+    int width;
+    int height;
+    int bpp;
+};
+
 /***
  * Initialise the XRDP library
  *
@@ -101,6 +110,18 @@ struct display_size_description;
  */
 struct xrdp_session *
 libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini);
+/**
+ * Read the xrdp.ini settings for the next libxrdp_init() ahead of time
+ *
+ * For a process forked before its connection comes in. The next session
+ * created with the same xrdp.ini takes the settings instead of reading
+ * the file.
+ *
+ * @param xrdp_ini Path to xrdp.ini config file
+ * @return 0 for success
+ */
+int
+libxrdp_preload_config(const char *xrdp_ini);
 int
 libxrdp_exit(struct xrdp_session *session);
 int
@@ -209,6 +230,34 @@ int
 libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
                             int cache_id, int cache_idx, int hints);
+
+/**
+ * Compress bitmap cache tiles ahead of sending them
+ *
+ * The tiles are compressed in parallel when bitmap_compress_threads is
+ * more than 1 in xrdp.ini.  libxrdp_orders_send_bitmap() and
+ * libxrdp_orders_send_bitmap2() then use the results for the same data,
+ * in the same order, instead of compressing again.
+ *
+ * @param session Session
+ * @param tiles Tiles, 64x64 at most
+ * @param num_tiles Number of tiles
+ * @return 0 if the tiles were compressed, non zero if there are no
+ *         workers and nothing was done
+ */
+int
+libxrdp_orders_precompress_tiles(struct xrdp_session *session,
+                                 const struct xrdp_bitmap_tile *tiles,
+                                 int num_tiles);
+/**
+ * Drop tiles from libxrdp_orders_precompress_tiles() not sent yet
+ *
+ * Must be called before the tile data is freed
+ *
+ * @param session Session
+ */
+void
+libxrdp_orders_clear_tiles(struct xrdp_session *session);
 /**
  * Returns the number of channels in the session
  *
@@ -296,6 +345,17 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
                             int stride, int x, int y,
                             int cx, int cy, int quality,
                             char *out_data, int *io_len);
+void *EXPORT_CC
+libxrdp_codec_jpeg_create(void);
+void EXPORT_CC
+libxrdp_codec_jpeg_delete(void *handle);
+int EXPORT_CC
+libxrdp_codec_jpeg_compress_ex(void *handle,
+                               int format, char *inp_data,
+                               int width, int height,
+                               int stride, int x, int y,
+                               int cx, int cy, int quality, int flags,
+                               char *out_data, int *io_len);
 int
 libxrdp_fastpath_send_surface(struct xrdp_session *session,
                               char *data_pad, int pad_bytes,
@@ -306,6 +366,23 @@ libxrdp_fastpath_send_surface(struct xrdp_session *session,
 int EXPORT_CC
 libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
                                    int frame_action, int frame_id);
+/**
+ * Packs the fastpath updates sent from here until
+ * libxrdp_fastpath_pack_end() into as few PDUs as they fit in. Calls
+ * nest, nothing is packed for clients without fastpath output.
+ *
+ * @param session Session
+ */
+void EXPORT_CC
+libxrdp_fastpath_pack_begin(struct xrdp_session *session);
+/**
+ * Sends what was packed since libxrdp_fastpath_pack_begin()
+ *
+ * @param session Session
+ * @return 0 for success
+ */
+int EXPORT_CC
+libxrdp_fastpath_pack_end(struct xrdp_session *session);
 int EXPORT_CC
 libxrdp_send_session_info(struct xrdp_session *session, const char *data,
                           int data_bytes);
@@ -38,66 +38,22 @@ http://msdn.microsoft.com/en-us/library/cc241877.aspx
 /*****************************************************************************/
 /* split RGB */
 static int
-fsplit3(char *in_data, int start_line, int width, int e,
+fsplit3(const struct xrdp_planar_funcs *funcs,
+        char *in_data, int start_line, int width, int e,
         char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
-    int rp;
-    int gp;
-    int bp;
-#endif
     int index;
     int out_index;
-    int pixel;
     int cy;
-    int *ptr32;
 
     cy = 0;
     out_index = 0;
     while (start_line >= 0)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
-        while (index < width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
-        }
+        funcs->split3(in_data + start_line * width * 4, width,
+                      r_data + out_index, g_data + out_index,
+                      b_data + out_index);
+        out_index += width;
         for (index = 0; index < e; index++)
         {
             r_data[out_index] = r_data[out_index - 1];
@@ -118,73 +74,22 @@ fsplit3(char *in_data, int start_line, int width, int e,
 /*****************************************************************************/
 /* split ARGB */
 static int
-fsplit4(char *in_data, int start_line, int width, int e,
+fsplit4(const struct xrdp_planar_funcs *funcs,
+        char *in_data, int start_line, int width, int e,
         char *a_data, char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
-    int ap;
-    int rp;
-    int gp;
-    int bp;
-#endif
     int index;
     int out_index;
-    int pixel;
     int cy;
-    int *ptr32;
 
     cy = 0;
     out_index = 0;
     while (start_line >= 0)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            ap  = (pixel >> 24) & 0x000000ff;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            ap |= (pixel >> 16) & 0x0000ff00;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel >>  8) & 0x00ff0000;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel <<  0) & 0xff000000;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(a_data + out_index)) = ap;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
-        while (index < width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            a_data[out_index] = pixel >> 24;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
-        }
+        funcs->split4(in_data + start_line * width * 4, width,
+                      a_data + out_index, r_data + out_index,
+                      g_data + out_index, b_data + out_index);
+        out_index += width;
         for (index = 0; index < e; index++)
         {
             a_data[out_index] = a_data[out_index - 1];
@@ -203,45 +108,13 @@ fsplit4(char *in_data, int start_line, int width, int e,
     return cy;
 }
 
-/*****************************************************************************/
-#define DELTA_ONE \
-    do { \
-        delta = src8[cx] - src8[0]; \
-        is_neg = (delta >> 7) & 1; \
-        dst8[cx] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg; \
-        src8++; \
-        dst8++; \
-    } while (0)
-
 /*****************************************************************************/
 static int
-fdelta(char *in_plane, char *out_plane, int cx, int cy)
+fdelta(const struct xrdp_planar_funcs *funcs,
+       char *in_plane, char *out_plane, int cx, int cy)
 {
-    char delta;
-    char is_neg;
-    char *src8;
-    char *dst8;
-    char *src8_end;
-
     g_memcpy(out_plane, in_plane, cx);
-    src8 = in_plane;
-    dst8 = out_plane;
-    src8_end = src8 + (cx * cy - cx);
-    while (src8 + 8 <= src8_end)
-    {
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-    }
-    while (src8 < src8_end)
-    {
-        DELTA_ONE;
-    }
+    funcs->delta(in_plane, in_plane + cx, out_plane + cx, cx * cy - cx);
     return 0;
 }
 
@@ -312,7 +185,8 @@ fout(int collen, int replen, char *colptr, struct stream *s)
 
 /*****************************************************************************/
 static int
-fpack(char *plane, int cx, int cy, struct stream *s)
+fpack(const struct xrdp_planar_funcs *funcs,
+      char *plane, int cx, int cy, struct stream *s)
 {
     char *ptr8;
     char *colptr;
@@ -321,6 +195,7 @@ fpack(char *plane, int cx, int cy, struct stream *s)
     int jndex;
     int collen;
     int replen;
+    int count;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "fpack:");
     holdp = s->p;
@@ -343,33 +218,39 @@ fpack(char *plane, int cx, int cy, struct stream *s)
         }
         while (ptr8 < lend)
         {
-            if (ptr8[0] == ptr8[1])
+            /* bytes equal to the next one extend the run */
+            count = funcs->count_run(ptr8, lend, 1);
+            replen += count;
+            ptr8 += count;
+            if (ptr8 >= lend)
             {
-                replen++;
+                break;
             }
-            else
+            /* ptr8[0] != ptr8[1] */
+            if (replen > 0)
             {
-                if (replen > 0)
+                if (replen < 3)
                 {
-                    if (replen < 3)
-                    {
-                        collen += replen + 1;
-                        replen = 0;
-                    }
-                    else
-                    {
-                        fout(collen, replen, colptr, s);
-                        colptr = ptr8 + 1;
-                        replen = 0;
-                        collen = 1;
-                    }
+                    collen += replen + 1;
+                    replen = 0;
                 }
                 else
                 {
-                    collen++;
+                    fout(collen, replen, colptr, s);
+                    colptr = ptr8 + 1;
+                    replen = 0;
+                    collen = 1;
                 }
             }
+            else
+            {
+                collen++;
+            }
             ptr8++;
+            /* replen is 0 now, differing bytes just add to the colours */
+            count = funcs->count_run(ptr8, lend, 0);
+            collen += count;
+            ptr8 += count;
         }
         /* end of line */
         fout(collen, replen, colptr, s);
@@ -423,6 +304,7 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     char *sg_data;
     char *sb_data;
     char *hold_p;
+    const struct xrdp_planar_funcs *funcs;
     int a_bytes;
     int r_bytes;
     int g_bytes;
@@ -440,6 +322,7 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     {
         return 0;
     }
+    funcs = xrdp_planar_get_funcs();
     header = flags & 0xFF;
     cx = width + e;
     sa_data = temp_s->data;
@@ -454,20 +337,20 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
 
     if (header & FLAGS_NOALPHA)
     {
-        cy = fsplit3(in_data, start_line, width, e,
+        cy = fsplit3(funcs, in_data, start_line, width, e,
                      sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
+            fdelta(funcs, sr_data, r_data, cx, cy);
+            fdelta(funcs, sg_data, g_data, cx, cy);
+            fdelta(funcs, sb_data, b_data, cx, cy);
             while (cy > 0)
             {
                 s->p = hold_p;
                 out_uint8(s, header);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
+                r_bytes = fpack(funcs, r_data, cx, cy, s);
+                g_bytes = fpack(funcs, g_data, cx, cy, s);
+                b_bytes = fpack(funcs, b_data, cx, cy, s);
                 max_bytes = cx * cy * 3;
                 total_bytes = r_bytes + g_bytes + b_bytes;
                 if (total_bytes > max_bytes)
@@ -503,22 +386,22 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     else
     {
-        cy = fsplit4(in_data, start_line, width, e,
+        cy = fsplit4(funcs, in_data, start_line, width, e,
                      sa_data, sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
-            fdelta(sa_data, a_data, cx, cy);
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
+            fdelta(funcs, sa_data, a_data, cx, cy);
+            fdelta(funcs, sr_data, r_data, cx, cy);
+            fdelta(funcs, sg_data, g_data, cx, cy);
+            fdelta(funcs, sb_data, b_data, cx, cy);
             while (cy > 0)
             {
                 s->p = hold_p;
                 out_uint8(s, header);
-                a_bytes = fpack(a_data, cx, cy, s);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
+                a_bytes = fpack(funcs, a_data, cx, cy, s);
+                r_bytes = fpack(funcs, r_data, cx, cy, s);
+                g_bytes = fpack(funcs, g_data, cx, cy, s);
+                b_bytes = fpack(funcs, b_data, cx, cy, s);
                 max_bytes = cx * cy * 4;
                 total_bytes = a_bytes + r_bytes + g_bytes + b_bytes;
                 if (total_bytes > max_bytes)
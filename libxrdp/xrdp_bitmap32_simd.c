@@ -0,0 +1,673 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * planar bitmap compressor
+ * plane split, delta and run scan kernels, picked at runtime
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+
+/* SSE2 and AVX2 kernels are built with target attributes so the rest of
+   the library does not need special compiler flags, NEON is only used
+   where it is part of the base instruction set */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLANAR_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define PLANAR_NEON
+#include <arm_neon.h>
+#endif
+
+/*****************************************************************************/
+/* split one line of XRGB into 3 planes */
+static void
+split3_c(const char *src, int width, char *r_data, char *g_data,
+         char *b_data)
+{
+#if defined(L_ENDIAN)
+    int rp;
+    int gp;
+    int bp;
+#endif
+    int index;
+    int pixel;
+    const int *ptr32;
+
+    ptr32 = (const int *) src;
+    index = 0;
+#if defined(L_ENDIAN)
+    while (index + 4 <= width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *ptr32;
+        ptr32++;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *ptr32;
+        ptr32++;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *ptr32;
+        ptr32++;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#endif
+    while (index < width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        r_data[index] = pixel >> 16;
+        g_data[index] = pixel >> 8;
+        b_data[index] = pixel >> 0;
+        index++;
+    }
+}
+
+/*****************************************************************************/
+/* split one line of ARGB into 4 planes */
+static void
+split4_c(const char *src, int width, char *a_data, char *r_data,
+         char *g_data, char *b_data)
+{
+#if defined(L_ENDIAN)
+    int ap;
+    int rp;
+    int gp;
+    int bp;
+#endif
+    int index;
+    int pixel;
+    const int *ptr32;
+
+    ptr32 = (const int *) src;
+    index = 0;
+#if defined(L_ENDIAN)
+    while (index + 4 <= width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        ap  = (pixel >> 24) & 0x000000ff;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *ptr32;
+        ptr32++;
+        ap |= (pixel >> 16) & 0x0000ff00;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *ptr32;
+        ptr32++;
+        ap |= (pixel >>  8) & 0x00ff0000;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *ptr32;
+        ptr32++;
+        ap |= (pixel <<  0) & 0xff000000;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(a_data + index)) = ap;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#endif
+    while (index < width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        a_data[index] = pixel >> 24;
+        r_data[index] = pixel >> 16;
+        g_data[index] = pixel >> 8;
+        b_data[index] = pixel >> 0;
+        index++;
+    }
+}
+
+/*****************************************************************************/
+#define DELTA_ONE \
+    do { \
+        delta = cur[index] - prev[index]; \
+        is_neg = (delta >> 7) & 1; \
+        out[index] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg; \
+        index++; \
+    } while (0)
+
+/*****************************************************************************/
+/* out = sign magnitude of cur - prev, with the sign in the low bit */
+static void
+delta_c(const char *prev, const char *cur, char *out, int bytes)
+{
+    char delta;
+    char is_neg;
+    int index;
+
+    index = 0;
+    while (index + 8 <= bytes)
+    {
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+    }
+    while (index < bytes)
+    {
+        DELTA_ONE;
+    }
+}
+
+/*****************************************************************************/
+/* number of bytes from ptr8, up to lend, that are (same != 0) or are not
+   (same == 0) equal to the byte after them */
+static int
+count_run_c(const char *ptr8, const char *lend, int same)
+{
+    const char *start;
+
+    start = ptr8;
+    same = same != 0;
+    while ((ptr8 < lend) && ((ptr8[0] == ptr8[1]) == same))
+    {
+        ptr8++;
+    }
+    return (int) (ptr8 - start);
+}
+
+#if defined(PLANAR_X86)
+
+/*****************************************************************************/
+/* one plane out of 16 pixels, shift selects the channel */
+#define SSE2_PLANE(_p0, _p1, _p2, _p3, _shift, _mask) \
+    _mm_packus_epi16( \
+        _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(_p0, _shift), _mask), \
+                        _mm_and_si128(_mm_srli_epi32(_p1, _shift), _mask)), \
+        _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(_p2, _shift), _mask), \
+                        _mm_and_si128(_mm_srli_epi32(_p3, _shift), _mask)))
+
+/*****************************************************************************/
+static TARGET_SSE2 void
+split3_sse2(const char *src, int width, char *r_data, char *g_data,
+            char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i mask;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (src + index * 4));
+        p1 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 16));
+        p2 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 32));
+        p3 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 48));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 16, mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 8, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 0, mask));
+        index += 16;
+    }
+    split3_c(src + index * 4, width - index,
+             r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static TARGET_SSE2 void
+split4_sse2(const char *src, int width, char *a_data, char *r_data,
+            char *g_data, char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i mask;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (src + index * 4));
+        p1 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 16));
+        p2 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 32));
+        p3 = _mm_loadu_si128((const __m128i *) (src + index * 4 + 48));
+        _mm_storeu_si128((__m128i *) (a_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 24, mask));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 16, mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 8, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         SSE2_PLANE(p0, p1, p2, p3, 0, mask));
+        index += 16;
+    }
+    split4_c(src + index * 4, width - index, a_data + index,
+             r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static TARGET_SSE2 void
+delta_sse2(const char *prev, const char *cur, char *out, int bytes)
+{
+    __m128i delta;
+    __m128i is_neg;
+    __m128i zero;
+    int index;
+
+    zero = _mm_setzero_si128();
+    index = 0;
+    while (index + 16 <= bytes)
+    {
+        delta = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (cur + index)),
+                             _mm_loadu_si128((const __m128i *) (prev + index)));
+        is_neg = _mm_cmpgt_epi8(zero, delta);
+        _mm_storeu_si128((__m128i *) (out + index),
+                         _mm_xor_si128(_mm_add_epi8(delta, delta), is_neg));
+        index += 16;
+    }
+    delta_c(prev + index, cur + index, out + index, bytes - index);
+}
+
+/*****************************************************************************/
+static TARGET_SSE2 int
+count_run_sse2(const char *ptr8, const char *lend, int same)
+{
+    const char *start;
+    unsigned int bits;
+    unsigned int flip;
+
+    start = ptr8;
+    flip = same ? 0xffff : 0;
+    /* reads ptr8[0..16], so ptr8 + 16 must not be past lend */
+    while (ptr8 + 16 <= lend)
+    {
+        bits = _mm_movemask_epi8(
+                   _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) ptr8),
+                                  _mm_loadu_si128((const __m128i *) (ptr8 + 1))));
+        bits = (bits ^ flip) & 0xffff;
+        if (bits != 0)
+        {
+            return (int) (ptr8 - start) + __builtin_ctz(bits);
+        }
+        ptr8 += 16;
+    }
+    return (int) (ptr8 - start) + count_run_c(ptr8, lend, same);
+}
+
+/*****************************************************************************/
+/* the AVX2 functions clear the upper halves of the ymm registers before
+   falling back to SSE2 code for the tail, mixing them is slow otherwise */
+
+/*****************************************************************************/
+/* one plane out of 32 pixels, the packs work per 128 bit lane so the
+   dwords come out as pixels 0, 8, 16, 24, 4, 12, 20, 28 */
+#define AVX2_PLANE(_p0, _p1, _p2, _p3, _shift, _mask, _order) \
+    _mm256_permutevar8x32_epi32(_mm256_packus_epi16( \
+        _mm256_packs_epi32( \
+            _mm256_and_si256(_mm256_srli_epi32(_p0, _shift), _mask), \
+            _mm256_and_si256(_mm256_srli_epi32(_p1, _shift), _mask)), \
+        _mm256_packs_epi32( \
+            _mm256_and_si256(_mm256_srli_epi32(_p2, _shift), _mask), \
+            _mm256_and_si256(_mm256_srli_epi32(_p3, _shift), _mask))), \
+        _order)
+
+/*****************************************************************************/
+static TARGET_AVX2 void
+split3_avx2(const char *src, int width, char *r_data, char *g_data,
+            char *b_data)
+{
+    __m256i p0;
+    __m256i p1;
+    __m256i p2;
+    __m256i p3;
+    __m256i mask;
+    __m256i order;
+    int index;
+
+    mask = _mm256_set1_epi32(0xff);
+    order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    index = 0;
+    while (index + 32 <= width)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *) (src + index * 4));
+        p1 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 32));
+        p2 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 64));
+        p3 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 96));
+        _mm256_storeu_si256((__m256i *) (r_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 16, mask, order));
+        _mm256_storeu_si256((__m256i *) (g_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 8, mask, order));
+        _mm256_storeu_si256((__m256i *) (b_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 0, mask, order));
+        index += 32;
+    }
+    _mm256_zeroupper();
+    split3_sse2(src + index * 4, width - index,
+                r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static TARGET_AVX2 void
+split4_avx2(const char *src, int width, char *a_data, char *r_data,
+            char *g_data, char *b_data)
+{
+    __m256i p0;
+    __m256i p1;
+    __m256i p2;
+    __m256i p3;
+    __m256i mask;
+    __m256i order;
+    int index;
+
+    mask = _mm256_set1_epi32(0xff);
+    order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    index = 0;
+    while (index + 32 <= width)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *) (src + index * 4));
+        p1 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 32));
+        p2 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 64));
+        p3 = _mm256_loadu_si256((const __m256i *) (src + index * 4 + 96));
+        _mm256_storeu_si256((__m256i *) (a_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 24, mask, order));
+        _mm256_storeu_si256((__m256i *) (r_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 16, mask, order));
+        _mm256_storeu_si256((__m256i *) (g_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 8, mask, order));
+        _mm256_storeu_si256((__m256i *) (b_data + index),
+                            AVX2_PLANE(p0, p1, p2, p3, 0, mask, order));
+        index += 32;
+    }
+    _mm256_zeroupper();
+    split4_sse2(src + index * 4, width - index, a_data + index,
+                r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static TARGET_AVX2 void
+delta_avx2(const char *prev, const char *cur, char *out, int bytes)
+{
+    __m256i delta;
+    __m256i is_neg;
+    __m256i zero;
+    int index;
+
+    zero = _mm256_setzero_si256();
+    index = 0;
+    while (index + 32 <= bytes)
+    {
+        delta = _mm256_sub_epi8(
+                    _mm256_loadu_si256((const __m256i *) (cur + index)),
+                    _mm256_loadu_si256((const __m256i *) (prev + index)));
+        is_neg = _mm256_cmpgt_epi8(zero, delta);
+        _mm256_storeu_si256((__m256i *) (out + index),
+                            _mm256_xor_si256(_mm256_add_epi8(delta, delta),
+                                             is_neg));
+        index += 32;
+    }
+    _mm256_zeroupper();
+    delta_sse2(prev + index, cur + index, out + index, bytes - index);
+}
+
+#endif /* PLANAR_X86 */
+
+#if defined(PLANAR_NEON)
+
+/*****************************************************************************/
+static void
+split3_neon(const char *src, int width, char *r_data, char *g_data,
+            char *b_data)
+{
+    uint8x16x4_t p;
+    int index;
+
+    index = 0;
+    while (index + 16 <= width)
+    {
+        /* BGRA in memory */
+        p = vld4q_u8((const uint8_t *) (src + index * 4));
+        vst1q_u8((uint8_t *) (r_data + index), p.val[2]);
+        vst1q_u8((uint8_t *) (g_data + index), p.val[1]);
+        vst1q_u8((uint8_t *) (b_data + index), p.val[0]);
+        index += 16;
+    }
+    split3_c(src + index * 4, width - index,
+             r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static void
+split4_neon(const char *src, int width, char *a_data, char *r_data,
+            char *g_data, char *b_data)
+{
+    uint8x16x4_t p;
+    int index;
+
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p = vld4q_u8((const uint8_t *) (src + index * 4));
+        vst1q_u8((uint8_t *) (a_data + index), p.val[3]);
+        vst1q_u8((uint8_t *) (r_data + index), p.val[2]);
+        vst1q_u8((uint8_t *) (g_data + index), p.val[1]);
+        vst1q_u8((uint8_t *) (b_data + index), p.val[0]);
+        index += 16;
+    }
+    split4_c(src + index * 4, width - index, a_data + index,
+             r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static void
+delta_neon(const char *prev, const char *cur, char *out, int bytes)
+{
+    int8x16_t delta;
+    int8x16_t is_neg;
+    int index;
+
+    index = 0;
+    while (index + 16 <= bytes)
+    {
+        delta = vsubq_s8(vld1q_s8((const int8_t *) (cur + index)),
+                         vld1q_s8((const int8_t *) (prev + index)));
+        is_neg = vshrq_n_s8(delta, 7);
+        vst1q_s8((int8_t *) (out + index),
+                 veorq_s8(vshlq_n_s8(delta, 1), is_neg));
+        index += 16;
+    }
+    delta_c(prev + index, cur + index, out + index, bytes - index);
+}
+
+/*****************************************************************************/
+static int
+count_run_neon(const char *ptr8, const char *lend, int same)
+{
+    const char *start;
+    uint8x16_t eq;
+    uint64_t bits;
+
+    start = ptr8;
+    while (ptr8 + 16 <= lend)
+    {
+        eq = vceqq_u8(vld1q_u8((const uint8_t *) ptr8),
+                      vld1q_u8((const uint8_t *) (ptr8 + 1)));
+        /* one nibble per byte */
+        bits = vget_lane_u64(vreinterpret_u64_u8(
+                                 vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (same)
+        {
+            bits = ~bits;
+        }
+        if (bits != 0)
+        {
+            return (int) (ptr8 - start) + (__builtin_ctzll(bits) >> 2);
+        }
+        ptr8 += 16;
+    }
+    return (int) (ptr8 - start) + count_run_c(ptr8, lend, same);
+}
+
+#endif /* PLANAR_NEON */
+
+static const struct xrdp_planar_funcs g_planar_funcs_c =
+{
+    "none", split3_c, split4_c, delta_c, count_run_c
+};
+
+#if defined(PLANAR_X86)
+static const struct xrdp_planar_funcs g_planar_funcs_sse2 =
+{
+    "sse2", split3_sse2, split4_sse2, delta_sse2, count_run_sse2
+};
+
+/* planar lines are at most 64 bytes and runs are mostly short, the wider
+   run scan was slower than the SSE2 one */
+static const struct xrdp_planar_funcs g_planar_funcs_avx2 =
+{
+    "avx2", split3_avx2, split4_avx2, delta_avx2, count_run_sse2
+};
+#endif
+
+#if defined(PLANAR_NEON)
+static const struct xrdp_planar_funcs g_planar_funcs_neon =
+{
+    "neon", split3_neon, split4_neon, delta_neon, count_run_neon
+};
+#endif
+
+static const struct xrdp_planar_funcs *g_planar_funcs = NULL;
+
+/*****************************************************************************/
+/* returns the kernels for simd or NULL if the cpu can not run them */
+static const struct xrdp_planar_funcs *
+xrdp_planar_lookup(int simd)
+{
+    switch (simd)
+    {
+        case XRDP_PLANAR_SIMD_NONE:
+            return &g_planar_funcs_c;
+#if defined(PLANAR_X86)
+        case XRDP_PLANAR_SIMD_SSE2:
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse2"))
+            {
+                return &g_planar_funcs_sse2;
+            }
+            break;
+        case XRDP_PLANAR_SIMD_AVX2:
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return &g_planar_funcs_avx2;
+            }
+            break;
+#endif
+#if defined(PLANAR_NEON)
+        case XRDP_PLANAR_SIMD_NEON:
+            return &g_planar_funcs_neon;
+#endif
+        default:
+            break;
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+int
+xrdp_planar_simd_supported(int simd)
+{
+    return xrdp_planar_lookup(simd) != NULL;
+}
+
+/*****************************************************************************/
+/* force a kernel set, for testing, returns 0 if it can be used */
+int
+xrdp_planar_simd_select(int simd)
+{
+    const struct xrdp_planar_funcs *funcs;
+
+    funcs = xrdp_planar_lookup(simd);
+    if (funcs == NULL)
+    {
+        return 1;
+    }
+    g_planar_funcs = funcs;
+    return 0;
+}
+
+/*****************************************************************************/
+/* the best kernels this cpu can run, picked on first use, all the kernel
+   sets give the same output so a racing first call is harmless */
+const struct xrdp_planar_funcs *
+xrdp_planar_get_funcs(void)
+{
+    const struct xrdp_planar_funcs *funcs;
+
+    funcs = g_planar_funcs;
+    if (funcs == NULL)
+    {
+        funcs = xrdp_planar_lookup(XRDP_PLANAR_SIMD_AVX2);
+        if (funcs == NULL)
+        {
+            funcs = xrdp_planar_lookup(XRDP_PLANAR_SIMD_SSE2);
+        }
+        if (funcs == NULL)
+        {
+            funcs = xrdp_planar_lookup(XRDP_PLANAR_SIMD_NEON);
+        }
+        if (funcs == NULL)
+        {
+            funcs = &g_planar_funcs_c;
+        }
+        LOG(LOG_LEVEL_DEBUG, "xrdp_planar_get_funcs: using %s kernels",
+            funcs->name);
+        g_planar_funcs = funcs;
+    }
+    return funcs;
+}
@@ -26,1553 +26,803 @@
 
 #include "libxrdp.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define BC_MAX_BYTES (16 * 1024)
 
-/*****************************************************************************/
-#define IN_PIXEL8(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL8(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
+/* per pixel classification, worked out a row at a time before the
+   encoder walks the row */
+#define BC_FILL  0x01 /* same as the pixel above, 0 on the first line */
+#define BC_MIX   0x02 /* pixel above xor mix, mix on the first line */
+#define BC_COLOR 0x04 /* same as the pixel before */
+#define BC_ALT   0x08 /* differs from the pixel before but matches the
+                         one before that */
 
-/*****************************************************************************/
-#define IN_PIXEL16(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL16(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
+struct bc_state
+{
+    struct stream *s;
+    const char *wire; /* the current pixel as it goes on the wire, the
+                         count pixels before it are held back */
+    int bytes; /* bytes per pixel on the wire */
+    int count;
+    int color_count;
+    int bicolor_count;
+    int fill_count;
+    int mix_count;
+    int fom_count;
+    int fom_mask_len;
+    int bicolor_spin;
+    unsigned int bicolor1;
+    unsigned int bicolor2;
+    char *fom_mask;
+};
 
 /*****************************************************************************/
-#define IN_PIXEL32(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL32(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
+static void
+bc_out_pixel(struct stream *s, unsigned int pixel, int bytes)
+{
+    if (bytes == 1)
+    {
+        out_uint8(s, pixel);
+    }
+    else if (bytes == 2)
+    {
+        out_uint16_le(s, pixel);
+    }
+    else
+    {
+        out_uint8(s, pixel & 0xff);
+        out_uint8(s, (pixel >> 8) & 0xff);
+        out_uint8(s, (pixel >> 16) & 0xff);
+    }
+}
 
 /*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT1(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8(in_s, in_data); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* the order header for fill, mix, color and copy runs */
+static void
+bc_out_run(struct stream *s, int code, int mega_code, int count)
+{
+    if (count < 32)
+    {
+        out_uint8(s, (code << 5) | count);
+    }
+    else if (count < 256 + 32)
+    {
+        out_uint8(s, code << 5);
+        out_uint8(s, count - 32);
+    }
+    else
+    {
+        out_uint8(s, mega_code);
+        out_uint16_le(s, count);
+    }
+}
 
 /*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT2(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_data); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_data); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint16_le(in_s, in_data); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* copy, the first count of the pixels held back, the rest are sent by
+   the order that follows */
+static void
+bc_out_copy(struct bc_state *st, int count)
+{
+    if (count > 0)
+    {
+        bc_out_run(st->s, 0x4, 0xf4, count);
+        out_uint8a(st->s, st->wire - st->count * st->bytes,
+                   count * st->bytes);
+    }
+    st->count = 0;
+}
 
 /*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT3(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_out_color(struct bc_state *st, unsigned int pixel)
+{
+    if (st->color_count > 0)
+    {
+        bc_out_run(st->s, 0x3, 0xf3, st->color_count);
+        bc_out_pixel(st->s, pixel, st->bytes);
+    }
+    st->color_count = 0;
+}
 
 /*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT1(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+static void
+bc_out_bicolor(struct bc_state *st, unsigned int color1, unsigned int color2)
+{
+    int half;
 
-/*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT2(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+    if (st->bicolor_count > 0)
+    {
+        half = st->bicolor_count / 2;
+        if (half < 16)
+        {
+            out_uint8(st->s, (0xe << 4) | half);
+        }
+        else if (half < 256 + 16)
+        {
+            out_uint8(st->s, 0xe0);
+            out_uint8(st->s, half - 16);
+        }
+        else
+        {
+            out_uint8(st->s, 0xf8);
+            out_uint16_le(st->s, half);
+        }
+        bc_out_pixel(st->s, color1, st->bytes);
+        bc_out_pixel(st->s, color2, st->bytes);
+    }
+    st->bicolor_count = 0;
+}
 
 /*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT3(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+static void
+bc_out_fill(struct bc_state *st)
+{
+    if (st->fill_count > 0)
+    {
+        bc_out_run(st->s, 0x0, 0xf0, st->fill_count);
+    }
+    st->fill_count = 0;
+}
 
 /*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT1(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_out_mix(struct bc_state *st)
+{
+    if (st->mix_count > 0)
+    {
+        bc_out_run(st->s, 0x1, 0xf1, st->mix_count);
+    }
+    st->mix_count = 0;
+}
 
 /*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT2(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* fill or mix (fom) */
+static void
+bc_out_fom(struct bc_state *st)
+{
+    int count;
 
-/*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT3(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+    count = st->fom_count;
+    if (count > 0)
+    {
+        if ((count % 8) == 0 && count < 249)
+        {
+            out_uint8(st->s, (0x2 << 5) | (count / 8));
+        }
+        else if (count < 256)
+        {
+            out_uint8(st->s, 0x40);
+            out_uint8(st->s, count - 1);
+        }
+        else
+        {
+            out_uint8(st->s, 0xf2);
+            out_uint16_le(st->s, count);
+        }
+        out_uint8a(st->s, st->fom_mask, st->fom_mask_len);
+    }
+    st->fom_count = 0;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT1(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_reset_counts(struct bc_state *st)
+{
+    st->bicolor_count = 0;
+    st->fill_count = 0;
+    st->color_count = 0;
+    st->mix_count = 0;
+    st->fom_count = 0;
+    st->fom_mask_len = 0;
+    st->bicolor_spin = 0;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT2(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* a run is sent when it is longer than 3 and no other run is longer */
+static int
+bc_is_best(const struct bc_state *st, int run)
+{
+    return run > 3 &&
+           run >= st->fill_count &&
+           run >= st->mix_count &&
+           run >= st->color_count &&
+           run >= st->bicolor_count &&
+           run >= st->fom_count;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT3(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_flush_fill(struct bc_state *st)
+{
+    bc_out_copy(st, st->count - st->fill_count);
+    bc_out_fill(st);
+    bc_reset_counts(st);
+}
 
 /*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT1(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_flush_mix(struct bc_state *st)
+{
+    bc_out_copy(st, st->count - st->mix_count);
+    bc_out_mix(st);
+    bc_reset_counts(st);
+}
 
 /*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT2(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_flush_color(struct bc_state *st, unsigned int pixel)
+{
+    bc_out_copy(st, st->count - st->color_count);
+    bc_out_color(st, pixel);
+    bc_reset_counts(st);
+}
 
 /*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT3(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_flush_bicolor(struct bc_state *st)
+{
+    if ((st->bicolor_count % 2) == 0)
+    {
+        bc_out_copy(st, st->count - st->bicolor_count);
+        bc_out_bicolor(st, st->bicolor1, st->bicolor2);
+    }
+    else
+    {
+        st->bicolor_count--;
+        bc_out_copy(st, st->count - st->bicolor_count);
+        bc_out_bicolor(st, st->bicolor2, st->bicolor1);
+    }
+    bc_reset_counts(st);
+}
 
 /*****************************************************************************/
-/* fom */
-#define OUT_FOM_COUNT1(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+bc_flush_fom(struct bc_state *st)
+{
+    bc_out_copy(st, st->count - st->fom_count);
+    bc_out_fom(st);
+    bc_reset_counts(st);
+}
 
 /*****************************************************************************/
-/* fom */
-#define OUT_FOM_COUNT2(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static int
+bc_test_bicolor(const struct bc_state *st, unsigned int pixel,
+                unsigned int last_pixel)
+{
+    return (pixel != last_pixel) &&
+           ((!st->bicolor_spin && pixel == st->bicolor1 &&
+             last_pixel == st->bicolor2) ||
+            (st->bicolor_spin && pixel == st->bicolor2 &&
+             last_pixel == st->bicolor1));
+}
 
 /*****************************************************************************/
-/* fill or mix (fom) */
-#define OUT_FOM_COUNT3(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* add count pixels to the fom run, set is 1 for mix pixels */
+static void
+bc_add_fom(struct bc_state *st, int set, int count)
+{
+    int bytes;
 
-/*****************************************************************************/
-#define TEST_FILL \
-    ((last_line == 0 && pixel == 0) || \
-     (last_line != 0 && pixel == ypixel))
-#define TEST_MIX \
-    ((last_line == 0 && pixel == mix) || \
-     (last_line != 0 && pixel == (ypixel ^ mix)))
-#define TEST_FOM (TEST_FILL || TEST_MIX)
-#define TEST_COLOR (pixel == last_pixel)
-#define TEST_BICOLOR \
-    ( \
-      (pixel != last_pixel) && \
-      ( \
-        (!bicolor_spin && pixel == bicolor1 && last_pixel == bicolor2) || \
-        (bicolor_spin && pixel == bicolor2 && last_pixel == bicolor1) \
-      ) \
-    )
-#define RESET_COUNTS \
-    do { \
-        bicolor_count = 0; \
-        fill_count = 0; \
-        color_count = 0; \
-        mix_count = 0; \
-        fom_count = 0; \
-        fom_mask_len = 0; \
-        bicolor_spin = 0; \
-    } while (0)
+    while (count > 0 && (st->fom_count % 8) != 0)
+    {
+        if (set)
+        {
+            st->fom_mask[st->fom_mask_len - 1] |= 1 << (st->fom_count % 8);
+        }
+        st->fom_count++;
+        count--;
+    }
+    bytes = count / 8;
+    if (bytes > 0)
+    {
+        g_memset(st->fom_mask + st->fom_mask_len, set ? 0xff : 0, bytes);
+        st->fom_mask_len += bytes;
+        st->fom_count += bytes * 8;
+        count -= bytes * 8;
+    }
+    if (count > 0)
+    {
+        st->fom_mask[st->fom_mask_len] = set ? (1 << count) - 1 : 0;
+        st->fom_mask_len++;
+        st->fom_count += count;
+    }
+}
 
 /*****************************************************************************/
-int
-xrdp_bitmap_compress(char *in_data, int width, int height,
-                     struct stream *s, int bpp, int byte_limit,
-                     int start_line, struct stream *temp_s,
-                     int e)
+/* one pixel through the full state machine, pix[-1] is the pixel before */
+static void
+bc_pixel(struct bc_state *st, const unsigned int *pix, int flags,
+         const char *wire)
 {
-    char *line;
-    char *last_line;
-    char fom_mask[8192]; /* good for up to 64K bitmap */
-    int lines_sent;
-    int pixel;
-    int count;
-    int color_count;
-    int last_pixel;
-    int bicolor_count;
-    int bicolor1;
-    int bicolor2;
-    int bicolor_spin;
-    int end;
-    int i;
-    int out_count;
-    int ypixel;
-    int last_ypixel;
-    int fill_count;
-    int mix_count;
-    int mix;
-    int fom_count;
-    int fom_mask_len;
-    int temp; /* used in macros */
-
-    init_stream(temp_s, 0);
-    fom_mask_len = 0;
-    last_line = 0;
-    lines_sent = 0;
-    end = width + e;
-    count = 0;
-    color_count = 0;
-    last_pixel = 0;
-    last_ypixel = 0;
-    bicolor_count = 0;
-    bicolor1 = 0;
-    bicolor2 = 0;
-    bicolor_spin = 0;
-    fill_count = 0;
-    mix_count = 0;
-    fom_count = 0;
-
-    if (bpp == 8)
+    unsigned int pixel;
+    unsigned int last_pixel;
+    int bicolor;
+
+    pixel = pix[0];
+    last_pixel = pix[-1];
+    st->wire = wire;
+    if (!(flags & BC_FILL))
     {
-        mix = 0xff;
-        out_count = end;
-        line = in_data + width * start_line;
-
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+        if (bc_is_best(st, st->fill_count))
         {
-            i = (s->p - s->data) + count;
-
-            if (i - color_count >= byte_limit &&
-                    i - bicolor_count >= byte_limit &&
-                    i - fill_count >= byte_limit &&
-                    i - mix_count >= byte_limit &&
-                    i - fom_count >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL8(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL8(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_FILL_COUNT1(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_MIX_COUNT1(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_COLOR_COUNT1(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT1(count, s, temp_s);
-                            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT1(count, s, temp_s);
-                            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
-
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
-
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
-
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
-
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
-
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
-
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
-
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
-
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
-
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
-
-                    fom_count++;
-                }
-
-                out_uint8(temp_s, pixel);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
-
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
-            {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
-                {
-                    count -= fill_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_FILL_COUNT1(fill_count, s);
-                    RESET_COUNTS;
-                }
-
-                fill_count = 0;
-
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
-                {
-                    count -= mix_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_MIX_COUNT1(mix_count, s);
-                    RESET_COUNTS;
-                }
-
-                mix_count = 0;
-
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
-
-                fom_count = 0;
-                fom_mask_len = 0;
-            }
-
-            last_line = line;
-            line = line - width;
-            start_line--;
-            lines_sent++;
+            bc_flush_fill(st);
         }
-
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
+        st->fill_count = 0;
+    }
+    if (!(flags & BC_MIX))
+    {
+        if (bc_is_best(st, st->mix_count))
         {
-            count -= fill_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_FILL_COUNT1(fill_count, s);
+            bc_flush_mix(st);
         }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
+        st->mix_count = 0;
+    }
+    if (!(flags & BC_COLOR))
+    {
+        if (bc_is_best(st, st->color_count))
         {
-            count -= mix_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_MIX_COUNT1(mix_count, s);
+            bc_flush_color(st, last_pixel);
         }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
+        st->color_count = 0;
+    }
+    bicolor = bc_test_bicolor(st, pixel, last_pixel);
+    if (!bicolor)
+    {
+        if (bc_is_best(st, st->bicolor_count))
         {
-            count -= color_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_COLOR_COUNT1(color_count, s, last_pixel);
+            bc_flush_bicolor(st);
         }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
+        st->bicolor_count = 0;
+        st->bicolor1 = last_pixel;
+        st->bicolor2 = pixel;
+        st->bicolor_spin = 0;
+    }
+    if (!(flags & (BC_FILL | BC_MIX)))
+    {
+        if (bc_is_best(st, st->fom_count))
         {
-            if ((bicolor_count % 2) == 0)
-            {
-                count -= bicolor_count;
-                OUT_COPY_COUNT1(count, s, temp_s);
-                OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
-            }
-            else
-            {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT1(count, s, temp_s);
-                OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor2, bicolor1);
-            }
-
-            count -= bicolor_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
+            bc_flush_fom(st);
+            /* that put the bicolor spin back */
+            bicolor = bc_test_bicolor(st, pixel, last_pixel);
         }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
+        st->fom_count = 0;
+        st->fom_mask_len = 0;
+    }
+    if (flags & BC_FILL)
+    {
+        st->fill_count++;
+    }
+    if (flags & BC_MIX)
+    {
+        st->mix_count++;
+    }
+    if (flags & BC_COLOR)
+    {
+        st->color_count++;
+    }
+    if (bicolor)
+    {
+        st->bicolor_spin = !st->bicolor_spin;
+        st->bicolor_count++;
+    }
+    if (flags & (BC_FILL | BC_MIX))
+    {
+        if ((st->fom_count % 8) == 0)
         {
-            count -= fom_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
+            st->fom_mask[st->fom_mask_len] = 0;
+            st->fom_mask_len++;
         }
-        else
+        if (flags & BC_MIX)
         {
-            OUT_COPY_COUNT1(count, s, temp_s);
+            st->fom_mask[st->fom_mask_len - 1] |= 1 << (st->fom_count % 8);
         }
+        st->fom_count++;
     }
-    else if ((bpp == 15) || (bpp == 16))
-    {
-        mix = (bpp == 15) ? 0xba1f : 0xffff;
-        out_count = end * 2;
-        line = in_data + width * start_line * 2;
-
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
-        {
-            i = (s->p - s->data) + count * 2;
-
-            if (i - (color_count * 2) >= byte_limit &&
-                    i - (bicolor_count * 2) >= byte_limit &&
-                    i - (fill_count * 2) >= byte_limit &&
-                    i - (mix_count * 2) >= byte_limit &&
-                    i - (fom_count * 2) >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end * 2;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL16(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL16(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_FILL_COUNT2(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_MIX_COUNT2(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_COLOR_COUNT2(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT2(count, s, temp_s);
-                            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT2(count, s, temp_s);
-                            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
-
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
-
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
-
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
-
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
-
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
-
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
-
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
-
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
+    st->count++;
+}
 
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
+/*****************************************************************************/
+/* returns true if a run of pixels that all have these flags can skip the
+   state machine, the pixel before it has already been through it.
+   None of the runs that are broken by these pixels may be pending and the
+   bicolor state must be the one left by a pixel that did not extend it */
+static int
+bc_can_skip(const struct bc_state *st, int flags, const unsigned int *pix)
+{
+    if ((flags & BC_ALT) || st->bicolor_count != 0 || st->bicolor_spin)
+    {
+        return 0;
+    }
+    if (!(flags & BC_COLOR) &&
+            (st->color_count != 0 ||
+             st->bicolor1 != pix[-2] || st->bicolor2 != pix[-1]))
+    {
+        return 0;
+    }
+    if (!(flags & BC_FILL) && st->fill_count != 0)
+    {
+        return 0;
+    }
+    if (!(flags & BC_MIX) && st->mix_count != 0)
+    {
+        return 0;
+    }
+    if (!(flags & (BC_FILL | BC_MIX)) && st->fom_count != 0)
+    {
+        return 0;
+    }
+    return 1;
+}
 
-                    fom_count++;
-                }
+/*****************************************************************************/
+/* what bc_pixel would do for count pixels that all have the same flags
+   when bc_can_skip says so, nothing is sent */
+static void
+bc_skip(struct bc_state *st, const unsigned int *pix, int flags, int count)
+{
+    if (flags & BC_FILL)
+    {
+        st->fill_count += count;
+    }
+    if (flags & BC_MIX)
+    {
+        st->mix_count += count;
+    }
+    if (flags & BC_COLOR)
+    {
+        st->color_count += count;
+    }
+    if (flags & (BC_FILL | BC_MIX))
+    {
+        bc_add_fom(st, flags & BC_MIX, count);
+    }
+    st->bicolor1 = pix[count - 2];
+    st->bicolor2 = pix[count - 1];
+    st->count += count;
+}
 
-                out_uint16_le(temp_s, pixel);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
+/*****************************************************************************/
+/* flags for pix[0..count - 1], pix[-2] and pix[-1] must be valid */
+static void
+bc_classify(const unsigned int *pix, const unsigned int *ypix,
+            unsigned int mix, unsigned char *flags, int count)
+{
+    unsigned int pixel;
+    int index;
 
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
+    index = 0;
+#if defined(__SSE2__)
+    {
+        __m128i mix4;
+        __m128i bits[4];
+        __m128i p;
+        __m128i y;
+        __m128i c;
+        __m128i v[2];
+        int jndex;
+
+        mix4 = _mm_set1_epi32(mix);
+        bits[0] = _mm_set1_epi32(BC_FILL);
+        bits[1] = _mm_set1_epi32(BC_MIX);
+        bits[2] = _mm_set1_epi32(BC_COLOR);
+        bits[3] = _mm_set1_epi32(BC_ALT);
+        while (index + 8 <= count)
+        {
+            for (jndex = 0; jndex < 2; jndex++)
             {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
-                {
-                    count -= fill_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_FILL_COUNT2(fill_count, s);
-                    RESET_COUNTS;
-                }
-
-                fill_count = 0;
-
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
-                {
-                    count -= mix_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_MIX_COUNT2(mix_count, s);
-                    RESET_COUNTS;
-                }
-
-                mix_count = 0;
-
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
-
-                fom_count = 0;
-                fom_mask_len = 0;
+                p = _mm_loadu_si128((const __m128i *) (pix + index));
+                y = _mm_loadu_si128((const __m128i *) (ypix + index));
+                c = _mm_cmpeq_epi32(p, _mm_loadu_si128(
+                                        (const __m128i *) (pix + index - 1)));
+                v[jndex] = _mm_or_si128(
+                               _mm_or_si128(
+                                   _mm_and_si128(_mm_cmpeq_epi32(p, y), bits[0]),
+                                   _mm_and_si128(_mm_cmpeq_epi32(
+                                           p, _mm_xor_si128(y, mix4)), bits[1])),
+                               _mm_or_si128(
+                                   _mm_and_si128(c, bits[2]),
+                                   _mm_andnot_si128(c, _mm_and_si128(
+                                           _mm_cmpeq_epi32(p, _mm_loadu_si128(
+                                                   (const __m128i *) (pix + index - 2))),
+                                           bits[3]))));
+                index += 4;
             }
-
-            last_line = line;
-            line = line - width * 2;
-            start_line--;
-            lines_sent++;
+            p = _mm_packs_epi32(v[0], v[1]);
+            _mm_storel_epi64((__m128i *) (flags + index - 8),
+                             _mm_packus_epi16(p, p));
         }
-
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
+    }
+#elif defined(__ARM_NEON)
+    {
+        uint32x4_t mix4;
+        uint32x4_t p;
+        uint32x4_t y;
+        uint32x4_t c;
+        uint32x4_t v[2];
+        int jndex;
+
+        mix4 = vdupq_n_u32(mix);
+        while (index + 8 <= count)
         {
-            count -= fill_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_FILL_COUNT2(fill_count, s);
+            for (jndex = 0; jndex < 2; jndex++)
+            {
+                p = vld1q_u32(pix + index);
+                y = vld1q_u32(ypix + index);
+                c = vceqq_u32(p, vld1q_u32(pix + index - 1));
+                v[jndex] = vorrq_u32(
+                               vorrq_u32(
+                                   vandq_u32(vceqq_u32(p, y), vdupq_n_u32(BC_FILL)),
+                                   vandq_u32(vceqq_u32(p, veorq_u32(y, mix4)),
+                                             vdupq_n_u32(BC_MIX))),
+                               vorrq_u32(
+                                   vandq_u32(c, vdupq_n_u32(BC_COLOR)),
+                                   vbicq_u32(vandq_u32(vceqq_u32(
+                                           p, vld1q_u32(pix + index - 2)),
+                                                       vdupq_n_u32(BC_ALT)), c)));
+                index += 4;
+            }
+            vst1_u8(flags + index - 8,
+                    vmovn_u16(vcombine_u16(vmovn_u32(v[0]), vmovn_u32(v[1]))));
         }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
+    }
+#endif
+    while (index < count)
+    {
+        pixel = pix[index];
+        flags[index] = (pixel == ypix[index] ? BC_FILL : 0) |
+                       (pixel == (ypix[index] ^ mix) ? BC_MIX : 0);
+        if (pixel == pix[index - 1])
         {
-            count -= mix_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_MIX_COUNT2(mix_count, s);
+            flags[index] |= BC_COLOR;
         }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
+        else if (pixel == pix[index - 2])
         {
-            count -= color_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_COLOR_COUNT2(color_count, s, last_pixel);
+            flags[index] |= BC_ALT;
         }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
-        {
-            if ((bicolor_count % 2) == 0)
-            {
-                count -= bicolor_count;
-                OUT_COPY_COUNT2(count, s, temp_s);
-                OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-            }
-            else
-            {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT2(count, s, temp_s);
-                OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor2, bicolor1);
-            }
+        index++;
+    }
+}
 
-            count -= bicolor_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-        }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
+/*****************************************************************************/
+/* reads a source line into pix and its wire form into wire, the e pixels
+   past width repeat the last one */
+static void
+bc_read_line(const char *line, int bpp, int width, int end,
+             unsigned int *pix, char *wire)
+{
+    unsigned int pixel;
+    int bytes;
+    int index;
+
+    if (bpp == 8)
+    {
+        for (index = 0; index < width; index++)
         {
-            count -= fom_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
+            pix[index] = ((const unsigned char *) line)[index];
         }
-        else
+        g_memcpy(wire, line, width);
+        bytes = 1;
+    }
+    else if (bpp == 24)
+    {
+        for (index = 0; index < width; index++)
         {
-            OUT_COPY_COUNT2(count, s, temp_s);
+            pixel = ((const unsigned int *) line)[index];
+            pix[index] = pixel;
+            wire[index * 3 + 0] = pixel;
+            wire[index * 3 + 1] = pixel >> 8;
+            wire[index * 3 + 2] = pixel >> 16;
         }
+        bytes = 3;
     }
-    else if (bpp == 24)
+    else
     {
-        mix = 0xffffff;
-        out_count = end * 3;
-        line = in_data + width * start_line * 4;
-
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+        for (index = 0; index < width; index++)
         {
-            i = (s->p - s->data) + count * 3;
-
-            if (i - (color_count * 3) >= byte_limit &&
-                    i - (bicolor_count * 3) >= byte_limit &&
-                    i - (fill_count * 3) >= byte_limit &&
-                    i - (mix_count * 3) >= byte_limit &&
-                    i - (fom_count * 3) >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end * 3;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL32(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL32(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_FILL_COUNT3(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_MIX_COUNT3(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_COLOR_COUNT3(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT3(count, s, temp_s);
-                            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT3(count, s, temp_s);
-                            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
-
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
-
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
-
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
-
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
-
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
+            pixel = ((const unsigned short *) line)[index];
+            pix[index] = pixel;
+            wire[index * 2 + 0] = pixel;
+            wire[index * 2 + 1] = pixel >> 8;
+        }
+        bytes = 2;
+    }
+    for (index = width; index < end; index++)
+    {
+        pix[index] = pix[index - 1];
+        g_memcpy(wire + index * bytes, wire + (index - 1) * bytes, bytes);
+    }
+}
 
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
+/*****************************************************************************/
+/* Each line is classified first, then walked once.  Runs of pixels that
+   all have the same flags and can not end or start a run are added in
+   one step, everything else goes through the state machine a pixel at a
+   time, so the output is the same as sending every pixel through it. */
+int
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e)
+{
+    struct bc_state st;
+    char *line;
+    char *wire;
+    unsigned int *pix_buf;
+    unsigned int *pix;
+    unsigned int *ypix;
+    unsigned char *flags;
+    unsigned int mix;
+    unsigned int last_pixel;
+    unsigned int last_pixel2;
+    int first_line;
+    int lines_sent;
+    int stride;
+    int end;
+    int out_count;
+    int index;
+    int limit;
+    int bytes;
 
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
+    if (bpp == 8)
+    {
+        mix = 0xff;
+        bytes = 1;
+        stride = width;
+    }
+    else if ((bpp == 15) || (bpp == 16))
+    {
+        mix = (bpp == 15) ? 0xba1f : 0xffff;
+        bytes = 2;
+        stride = width * 2;
+    }
+    else if (bpp == 24)
+    {
+        mix = 0xffffff;
+        bytes = 3;
+        stride = width * 4;
+    }
+    else
+    {
+        return 0;
+    }
+    end = width + e;
+    out_count = end * bytes;
+    if (width < 1 || out_count > BC_MAX_BYTES)
+    {
+        return 0;
+    }
 
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
+    /* at most BC_MAX_BYTES / bytes pixels are taken so that is the
+       longest fill or mix run */
+    pix_buf = (unsigned int *) g_malloc(sizeof(unsigned int) * (end + 2) +
+                                        sizeof(unsigned int) * end +
+                                        end + BC_MAX_BYTES / 8 + 1, 0);
+    if (pix_buf == NULL)
+    {
+        return 0;
+    }
+    pix = pix_buf + 2;
+    ypix = pix + end;
+    flags = (unsigned char *) (ypix + end);
+    g_memset(&st, 0, sizeof(st));
+    st.s = s;
+    st.bytes = bytes;
+    st.fom_mask = (char *) (flags + end);
+    /* every line taken is kept in temp_s as it goes on the wire, copy
+       orders are sent from there, there are at most BC_MAX_BYTES */
+    init_stream(temp_s, BC_MAX_BYTES);
+    wire = temp_s->data;
+    g_memset(ypix, 0, sizeof(unsigned int) * end);
+    last_pixel = 0;
+    last_pixel2 = 0;
+    first_line = 1;
+    lines_sent = 0;
+    line = in_data + stride * start_line;
 
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
+    while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+    {
+        index = (s->p - s->data) + st.count * bytes;
+        if (index - st.color_count * bytes >= byte_limit &&
+                index - st.bicolor_count * bytes >= byte_limit &&
+                index - st.fill_count * bytes >= byte_limit &&
+                index - st.mix_count * bytes >= byte_limit &&
+                index - st.fom_count * bytes >= byte_limit)
+        {
+            break;
+        }
 
-                    fom_count++;
-                }
+        out_count += end * bytes;
 
-                out_uint8(temp_s, pixel & 0xff);
-                out_uint8(temp_s, (pixel >> 8) & 0xff);
-                out_uint8(temp_s, (pixel >> 16) & 0xff);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
+        pix[-2] = last_pixel2;
+        pix[-1] = last_pixel;
+        bc_read_line(line, bpp, width, end, pix, wire);
+        bc_classify(pix, ypix, mix, flags, end);
 
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
+        index = 0;
+        while (index < end)
+        {
+            bc_pixel(&st, pix + index, flags[index], wire + index * bytes);
+            index++;
+            /* the pixels after it that look the same */
+            if (index < end && flags[index] == flags[index - 1] &&
+                    bc_can_skip(&st, flags[index], pix + index))
             {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
-                {
-                    count -= fill_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_FILL_COUNT3(fill_count, s);
-                    RESET_COUNTS;
-                }
-
-                fill_count = 0;
-
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
+                limit = index + 1;
+                while (limit < end && flags[limit] == flags[index])
                 {
-                    count -= mix_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_MIX_COUNT3(mix_count, s);
-                    RESET_COUNTS;
+                    limit++;
                 }
-
-                mix_count = 0;
-
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
-
-                fom_count = 0;
-                fom_mask_len = 0;
+                bc_skip(&st, pix + index, flags[index], limit - index);
+                index = limit;
             }
-
-            last_line = line;
-            line = line - width * 4;
-            start_line--;
-            lines_sent++;
         }
+        st.wire = wire + end * bytes;
 
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
-        {
-            count -= fill_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_FILL_COUNT3(fill_count, s);
-        }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
-        {
-            count -= mix_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_MIX_COUNT3(mix_count, s);
-        }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
-        {
-            count -= color_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_COLOR_COUNT3(color_count, s, last_pixel);
-        }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
+        /* can't take fill, mix, or fom past first line */
+        if (first_line)
         {
-            if ((bicolor_count % 2) == 0)
+            if (bc_is_best(&st, st.fill_count))
             {
-                count -= bicolor_count;
-                OUT_COPY_COUNT3(count, s, temp_s);
-                OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
+                bc_flush_fill(&st);
             }
-            else
+            st.fill_count = 0;
+            if (bc_is_best(&st, st.mix_count))
             {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT3(count, s, temp_s);
-                OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor2, bicolor1);
+                bc_flush_mix(&st);
             }
-
-            count -= bicolor_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
-        }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
-        {
-            count -= fom_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-        }
-        else
-        {
-            OUT_COPY_COUNT3(count, s, temp_s);
+            st.mix_count = 0;
+            if (bc_is_best(&st, st.fom_count))
+            {
+                bc_flush_fom(&st);
+            }
+            st.fom_count = 0;
+            st.fom_mask_len = 0;
+            first_line = 0;
         }
+
+        last_pixel = pix[end - 1];
+        last_pixel2 = pix[end - 2];
+        /* this line is the one above the next */
+        g_memcpy(ypix, pix, sizeof(unsigned int) * end);
+        wire += end * bytes;
+        line -= stride;
+        start_line--;
+        lines_sent++;
     }
 
+    if (bc_is_best(&st, st.fill_count))
+    {
+        bc_out_copy(&st, st.count - st.fill_count);
+        bc_out_fill(&st);
+    }
+    else if (bc_is_best(&st, st.mix_count))
+    {
+        bc_out_copy(&st, st.count - st.mix_count);
+        bc_out_mix(&st);
+    }
+    else if (bc_is_best(&st, st.color_count))
+    {
+        bc_out_copy(&st, st.count - st.color_count);
+        bc_out_color(&st, last_pixel);
+    }
+    else if (bc_is_best(&st, st.bicolor_count))
+    {
+        bc_flush_bicolor(&st);
+    }
+    else if (bc_is_best(&st, st.fom_count))
+    {
+        bc_out_copy(&st, st.count - st.fom_count);
+        bc_out_fom(&st);
+    }
+    else
+    {
+        bc_out_copy(&st, st.count);
+    }
+    g_free(pix_buf);
     return lines_sent;
 }
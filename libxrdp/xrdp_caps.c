@@ -410,6 +410,8 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
                              int len)
 {
     int glyph_support_level;
+    int frag_cache_entries;
+    int frag_cache_cell_size;
 
     if (len < 40 + 4 + 2 + 2) /* MS-RDPBCGR 2.2.7.1.8 */
     {
@@ -418,7 +420,8 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
     }
 
     in_uint8s(s, 40);  /* glyph cache */
-    in_uint8s(s, 4);   /* frag cache */
+    in_uint16_le(s, frag_cache_entries); /* frag cache */
+    in_uint16_le(s, frag_cache_cell_size);
     in_uint16_le(s, glyph_support_level);
     in_uint8s(s, 2);   /* pad */
 
@@ -426,8 +429,14 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
     {
         self->client_info.use_cache_glyph_v2 = 1;
     }
-    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_process_glyphcache: support level %d ",
-              glyph_support_level);
+    if (glyph_support_level != GLYPH_SUPPORT_NONE)
+    {
+        self->client_info.frag_cache_entries = frag_cache_entries;
+        self->client_info.frag_cache_cell_size = frag_cache_cell_size;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_process_glyphcache: support level %d "
+              "fragment cache entries %d cell size %d", glyph_support_level,
+              frag_cache_entries, frag_cache_cell_size);
     return 0;
 }
 
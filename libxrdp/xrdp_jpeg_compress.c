@@ -130,6 +130,7 @@ xrdp_codec_jpeg_compress(void *handle,
                          int   cx,       /* width of area to compress */
                          int   cy,       /* height of area to compress */
                          int   quality,  /* higher numbers compress less */
+                         int   flags,    /* XRDP_JPEG_FLAGS_* */
                          char *out_data, /* dest for jpg image */
                          int  *io_len    /* length of out_data and on return */
                          /* len of compressed data */
@@ -138,6 +139,7 @@ xrdp_codec_jpeg_compress(void *handle,
     tjhandle       tj_han;
     int            error;
     int            bpp;
+    int            tj_flags;
     char          *src_ptr;
     unsigned long  lio_len;
 
@@ -160,6 +162,13 @@ xrdp_codec_jpeg_compress(void *handle,
     src_ptr = inp_data + (y * stride + x * bpp);
 
     lio_len = *io_len;
+    /* TurboJPEG never optimizes the Huffman tables so
+       XRDP_JPEG_FLAGS_OPTIMIZE does not apply */
+    tj_flags = 0;
+    if (flags & XRDP_JPEG_FLAGS_FAST_DCT)
+    {
+        tj_flags |= TJFLAG_FASTDCT;
+    }
     /* compress inner rect */
 
     /* notes
@@ -184,7 +193,7 @@ xrdp_codec_jpeg_compress(void *handle,
                        &lio_len,   /* inner_buf length & compressed_size */
                        TJSAMP_420, /* jpeg sub sample */
                        quality,    /* jpeg quality */
-                       0           /* flags */
+                       tj_flags    /* flags */
                       );
     if (error != 0)
     {
@@ -230,6 +239,7 @@ xrdp_jpeg_deinit(void *handle)
 #include <stdlib.h>
 #include <string.h>
 #include <jpeglib.h>
+#include "log.h"
 
 #define JP_QUALITY 75
 
@@ -241,6 +251,27 @@ struct mydata_comp
     int overwrite;
 };
 
+/* one compressor, reused for every image so the memory pools and
+   quantization tables are not rebuilt each time */
+struct jpeg_ctx
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dst_mgr;
+    struct mydata_comp md;
+    J_COLOR_SPACE color_space; /* settings of the last image */
+    int input_components;
+    int quality;
+    int flags;
+    JOCTET *row_buf; /* one line converted to RGB */
+    int row_buf_bytes;
+    /* optimize_coding overwrites the Huffman tables and
+       jpeg_set_defaults does not always put them back */
+    int have_std_tables;
+    JHUFF_TBL std_dc_tables[2];
+    JHUFF_TBL std_ac_tables[2];
+};
+
 /*****************************************************************************/
 /* called at beginning */
 static void
@@ -257,7 +288,7 @@ my_init_destination(j_compress_ptr cinfo)
 
 /*****************************************************************************/
 /* called when buffer is full and we need more space */
-static int
+static boolean
 my_empty_output_buffer(j_compress_ptr cinfo)
 {
     struct mydata_comp *md;
@@ -286,41 +317,83 @@ my_term_destination(j_compress_ptr cinfo)
 }
 
 /*****************************************************************************/
+/* sets up ctx for the next image, the compression parameters are only
+   rebuilt when they change */
+static void
+jp_start(struct jpeg_ctx *ctx, int width, int height,
+         J_COLOR_SPACE color_space, int input_components,
+         int quality, int flags, JOCTET *comp_data, int comp_data_bytes)
+{
+    struct jpeg_compress_struct *cinfo;
+    int index;
+
+    cinfo = &(ctx->cinfo);
+    ctx->md.cb = comp_data;
+    ctx->md.cb_bytes = comp_data_bytes;
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    if ((ctx->color_space != color_space) ||
+            (ctx->input_components != input_components) ||
+            (ctx->quality != quality) || (ctx->flags != flags))
+    {
+        cinfo->input_components = input_components;
+        cinfo->in_color_space = color_space;
+        jpeg_set_defaults(cinfo);
+        cinfo->num_components = 3;
+        cinfo->dct_method = (flags & XRDP_JPEG_FLAGS_FAST_DCT) ?
+                            JDCT_IFAST : JDCT_FLOAT;
+        cinfo->optimize_coding = (flags & XRDP_JPEG_FLAGS_OPTIMIZE) != 0;
+        jpeg_set_quality(cinfo, quality, 1);
+        if (!ctx->have_std_tables)
+        {
+            for (index = 0; index < 2; index++)
+            {
+                ctx->std_dc_tables[index] = *(cinfo->dc_huff_tbl_ptrs[index]);
+                ctx->std_ac_tables[index] = *(cinfo->ac_huff_tbl_ptrs[index]);
+            }
+            ctx->have_std_tables = 1;
+        }
+        ctx->color_space = color_space;
+        ctx->input_components = input_components;
+        ctx->quality = quality;
+        ctx->flags = flags;
+    }
+    jpeg_start_compress(cinfo, 1);
+}
+
+/*****************************************************************************/
+/* returns 1 if comp_data was too small */
 static int
-jp_do_compress(JOCTET *data, int width, int height, int bpp, int quality,
-               JOCTET *comp_data, int *comp_data_bytes)
+jp_finish(struct jpeg_ctx *ctx, int *comp_data_bytes)
+{
+    int index;
+
+    jpeg_finish_compress(&(ctx->cinfo));
+    if (ctx->cinfo.optimize_coding && ctx->have_std_tables)
+    {
+        for (index = 0; index < 2; index++)
+        {
+            *(ctx->cinfo.dc_huff_tbl_ptrs[index]) = ctx->std_dc_tables[index];
+            *(ctx->cinfo.ac_huff_tbl_ptrs[index]) = ctx->std_ac_tables[index];
+        }
+    }
+    *comp_data_bytes = ctx->md.total_done;
+    return ctx->md.overwrite;
+}
+
+/*****************************************************************************/
+static int
+jp_do_compress(struct jpeg_ctx *ctx, JOCTET *data, int width, int height,
+               int bpp, int quality, JOCTET *comp_data, int *comp_data_bytes)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    struct jpeg_destination_mgr dst_mgr;
-    struct mydata_comp md;
     JSAMPROW row_pointer[4];
     int Bpp;
 
     Bpp = (bpp + 7) / 8;
-    memset(&cinfo, 0, sizeof(cinfo));
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    memset(&md, 0, sizeof(md));
-    md.cb = comp_data,
-    md.cb_bytes = *comp_data_bytes;
-    cinfo.client_data = &md;
-    memset(&dst_mgr, 0, sizeof(dst_mgr));
-    dst_mgr.init_destination = my_init_destination;
-    dst_mgr.empty_output_buffer = my_empty_output_buffer;
-    dst_mgr.term_destination = my_term_destination;
-    cinfo.dest = &dst_mgr;
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = Bpp;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    cinfo.num_components = 3;
-    cinfo.dct_method = JDCT_FLOAT;
-    jpeg_set_quality(&cinfo, quality, 1);
-    jpeg_start_compress(&cinfo, 1);
-
-    while (cinfo.next_scanline + 3 < cinfo.image_height)
+    jp_start(ctx, width, height, JCS_RGB, Bpp, quality, 0,
+             comp_data, *comp_data_bytes);
+
+    while (ctx->cinfo.next_scanline + 3 < ctx->cinfo.image_height)
     {
         row_pointer[0] = data;
         data += width * Bpp;
@@ -330,31 +403,22 @@ jp_do_compress(JOCTET *data, int width, int height, int bpp, int quality,
         data += width * Bpp;
         row_pointer[3] = data;
         data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 4);
+        jpeg_write_scanlines(&(ctx->cinfo), row_pointer, 4);
     }
 
-    while (cinfo.next_scanline < cinfo.image_height)
+    while (ctx->cinfo.next_scanline < ctx->cinfo.image_height)
     {
         row_pointer[0] = data;
         data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        jpeg_write_scanlines(&(ctx->cinfo), row_pointer, 1);
     }
 
-    jpeg_finish_compress(&cinfo);
-    *comp_data_bytes = md.total_done;
-    jpeg_destroy_compress(&cinfo);
-
-    if (md.overwrite)
-    {
-        return 1;
-    }
-
-    return 0;
+    return jp_finish(ctx, comp_data_bytes);
 }
 
 /*****************************************************************************/
 static int
-jpeg_compress(char *in_data, int width, int height,
+jpeg_compress(struct jpeg_ctx *ctx, char *in_data, int width, int height,
               struct stream *s, struct stream *temp_s, int bpp,
               int byte_limit, int e, int quality)
 {
@@ -404,8 +468,8 @@ jpeg_compress(char *in_data, int width, int height,
     }
 
     cdata_bytes = byte_limit;
-    jp_do_compress(data, width + e, height, 24, quality, (JOCTET *) s->p,
-                   &cdata_bytes);
+    jp_do_compress(ctx, data, width + e, height, 24, quality,
+                   (JOCTET *) s->p, &cdata_bytes);
     s->p += cdata_bytes;
     return cdata_bytes;
 }
@@ -417,31 +481,136 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    int start_line, struct stream *temp_s,
                    int e, int quality)
 {
-    jpeg_compress(in_data, width, height, s, temp_s, bpp, byte_limit,
-                  e, quality);
+    if (handle == 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_jpeg_compress: handle is nil");
+        return height;
+    }
+    jpeg_compress((struct jpeg_ctx *) handle, in_data, width, height,
+                  s, temp_s, bpp, byte_limit, e, quality);
     return height;
 }
 
-/*****************************************************************************/
+/**
+ * Compress a rectangular area (aka inner rectangle) inside our
+ * frame buffer (inp_data), same pixel layout as TJPF_XBGR
+ *****************************************************************************/
 int
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
-                         int quality, char *out_data, int *io_len)
+                         int quality, int flags, char *out_data, int *io_len)
 {
-    return 0;
+    struct jpeg_ctx *ctx;
+    JSAMPROW row_pointer[16];
+    JOCTET *src;
+#if defined(JCS_EXTENSIONS)
+    int lines;
+    int index;
+#else
+    JOCTET *dst;
+    int i;
+#endif
+
+    if (handle == 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_codec_jpeg_compress: handle is nil");
+        *io_len = 0;
+        return height;
+    }
+    ctx = (struct jpeg_ctx *) handle;
+    src = (JOCTET *) (inp_data + y * stride + x * 4);
+#if defined(JCS_EXTENSIONS)
+    /* libjpeg-turbo reads the frame buffer directly */
+    jp_start(ctx, cx, cy, JCS_EXT_XBGR, 4, quality, flags,
+             (JOCTET *) out_data, *io_len);
+    while (ctx->cinfo.next_scanline < ctx->cinfo.image_height)
+    {
+        lines = MIN(16, (int) (ctx->cinfo.image_height -
+                               ctx->cinfo.next_scanline));
+        for (index = 0; index < lines; index++)
+        {
+            row_pointer[index] = src;
+            src += stride;
+        }
+        jpeg_write_scanlines(&(ctx->cinfo), row_pointer, lines);
+    }
+#else
+    if (ctx->row_buf_bytes < cx * 3)
+    {
+        g_free(ctx->row_buf);
+        ctx->row_buf_bytes = cx * 3;
+        ctx->row_buf = (JOCTET *) g_malloc(ctx->row_buf_bytes, 0);
+        if (ctx->row_buf == 0)
+        {
+            ctx->row_buf_bytes = 0;
+            *io_len = 0;
+            return -1;
+        }
+    }
+    jp_start(ctx, cx, cy, JCS_RGB, 3, quality, flags,
+             (JOCTET *) out_data, *io_len);
+    row_pointer[0] = ctx->row_buf;
+    while (ctx->cinfo.next_scanline < ctx->cinfo.image_height)
+    {
+        dst = ctx->row_buf;
+        for (i = 0; i < cx; i++)
+        {
+            /* X, B, G, R in memory */
+            *(dst++) = src[i * 4 + 3];
+            *(dst++) = src[i * 4 + 2];
+            *(dst++) = src[i * 4 + 1];
+        }
+        src += stride;
+        jpeg_write_scanlines(&(ctx->cinfo), row_pointer, 1);
+    }
+#endif
+    if (jp_finish(ctx, io_len) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_codec_jpeg_compress: output buffer "
+            "too small");
+        *io_len = 0;
+        return -1;
+    }
+    return height;
 }
 
 /*****************************************************************************/
 void *
 xrdp_jpeg_init(void)
 {
-    return 0;
+    struct jpeg_ctx *ctx;
+
+    ctx = g_new0(struct jpeg_ctx, 1);
+    if (ctx == 0)
+    {
+        return 0;
+    }
+    ctx->cinfo.err = jpeg_std_error(&(ctx->jerr));
+    jpeg_create_compress(&(ctx->cinfo));
+    ctx->cinfo.client_data = &(ctx->md);
+    ctx->dst_mgr.init_destination = my_init_destination;
+    ctx->dst_mgr.empty_output_buffer = my_empty_output_buffer;
+    ctx->dst_mgr.term_destination = my_term_destination;
+    ctx->cinfo.dest = &(ctx->dst_mgr);
+    /* force jp_start to set the parameters the first time */
+    ctx->quality = -1;
+    return ctx;
 }
 
 /*****************************************************************************/
 int
 xrdp_jpeg_deinit(void *handle)
 {
+    struct jpeg_ctx *ctx;
+
+    if (handle == 0)
+    {
+        return 0;
+    }
+    ctx = (struct jpeg_ctx *) handle;
+    jpeg_destroy_compress(&(ctx->cinfo));
+    g_free(ctx->row_buf);
+    g_free(ctx);
     return 0;
 }
 
@@ -461,8 +630,9 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
 int
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
-                         int quality, char *out_data, int *io_len)
+                         int quality, int flags, char *out_data, int *io_len)
 {
+    *io_len = 0;
     return 0;
 }
 
@@ -25,6 +25,7 @@
 #include "libxrdp.h"
 #include "ms-rdpbcgr.h"
 #include "ms-rdpegdi.h"
+#include "thread_pool.h"
 
 #if defined(XRDP_NEUTRINORDP)
 #include <freerdp/codec/rfx.h>
@@ -35,6 +36,13 @@
 #define MAX_ORDERS_SIZE(_client_info) \
     (MAX((_client_info)->max_fastpath_frag_bytes, 16 * 1024) - 256);
 
+/* shorter glyph runs cost more to add to the fragment cache than a
+   USE_FRAGMENT saves */
+#define TEXT_FRAGMENT_MIN_BYTES 4
+
+static int
+xrdp_orders_flush_pending(struct xrdp_orders *self);
+
 /*****************************************************************************/
 struct xrdp_orders *
 xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
@@ -56,6 +64,10 @@ xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
     }
     make_stream(self->s);
     make_stream(self->temp_s);
+    if (rdp_layer->client_info.order_peephole)
+    {
+        self->pending = g_new(struct xrdp_order_item, XRDP_MAX_PENDING_ORDERS);
+    }
     return self;
 }
 
@@ -63,14 +75,45 @@ xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
 void
 xrdp_orders_delete(struct xrdp_orders *self)
 {
+    int index;
+    struct xrdp_orders_peephole_stats *stats;
+
     if (self == 0)
     {
         return;
     }
+    stats = &(self->peephole_stats);
+    if (stats->orders_in > 0)
+    {
+        /* what the orders not sent would have taken is a guess */
+        LOG(LOG_LEVEL_INFO, "xrdp_orders_delete: peephole sent %d of %d "
+            "orders, %d drawn over, %d merged, %d moved, about %d bytes "
+            "saved", stats->orders_out, stats->orders_in, stats->dropped,
+            stats->merged, stats->moved,
+            (stats->dropped + stats->merged) *
+            (stats->bytes_out / MAX(stats->orders_out, 1)));
+    }
     xrdp_jpeg_deinit(self->jpeg_han);
     free_stream(self->out_s);
     free_stream(self->s);
     free_stream(self->temp_s);
+    xrdp_orders_clear_tiles(self);
+    thread_pool_delete(self->bitmap_pool);
+    for (index = 0; index < self->num_bitmap_threads; index++)
+    {
+        free_stream(self->bitmap_s[index]);
+        free_stream(self->bitmap_temp_s[index]);
+    }
+    g_free(self->bitmap_s);
+    g_free(self->bitmap_temp_s);
+    if (self->text_frags != 0)
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_orders_delete: %d glyph runs sent from "
+            "the fragment cache, %d added to it", self->text_frags->hits,
+            self->text_frags->adds);
+    }
+    g_free(self->pending);
+    g_free(self->text_frags);
     g_free(self->orders_state.text_data);
     g_free(self);
 }
@@ -88,6 +131,9 @@ xrdp_orders_reset(struct xrdp_orders *self)
     }
     g_free(self->orders_state.text_data);
     g_memset(&(self->orders_state), 0, sizeof(self->orders_state));
+    /* the client starts with an empty fragment cache */
+    g_free(self->text_frags);
+    self->text_frags = 0;
     self->order_count_ptr = 0;
     self->order_count = 0;
     self->order_level = 0;
@@ -148,6 +194,10 @@ xrdp_orders_send(struct xrdp_orders *self)
     rv = 0;
     if (self->order_level > 0)
     {
+        if ((self->order_level == 1) && (xrdp_orders_flush_pending(self) != 0))
+        {
+            rv = 1;
+        }
         self->order_level--;
         if ((self->order_level == 0) && (self->order_count > 0))
         {
@@ -190,6 +240,10 @@ xrdp_orders_force_send(struct xrdp_orders *self)
     {
         return 1;
     }
+    if (xrdp_orders_flush_pending(self) != 0)
+    {
+        return 1;
+    }
     if ((self->order_level > 0) && (self->order_count > 0))
     {
         s_mark_end(self->out_s);
@@ -232,6 +286,12 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size)
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
+    /* orders held back go before this one */
+    if (xrdp_orders_flush_pending(self) != 0)
+    {
+        return 1;
+    }
+
     if (self->order_level < 1)
     {
         if (max_size > max_order_size)
@@ -495,13 +555,42 @@ xrdp_order_pack_small_or_tiny(struct xrdp_orders *self,
     return 0;
 }
 
+/*****************************************************************************/
+/* holds back an order until the end of the batch */
+/* returns NULL if it has to be sent now */
+static struct xrdp_order_item *
+xrdp_orders_queue(struct xrdp_orders *self, int type, struct xrdp_rect *rect)
+{
+    struct xrdp_order_item *item;
+
+    if ((self->pending == NULL) || (self->order_level < 1))
+    {
+        return NULL;
+    }
+    if ((self->num_pending >= XRDP_MAX_PENDING_ORDERS) &&
+            (xrdp_orders_flush_pending(self) != 0))
+    {
+        return NULL;
+    }
+    item = self->pending + self->num_pending;
+    self->num_pending++;
+    g_memset(item, 0, sizeof(struct xrdp_order_item));
+    item->type = type;
+    if (rect != NULL)
+    {
+        item->has_clip = 1;
+        item->clip = *rect;
+    }
+    return item;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* send a solid rect to client */
 /* max size 23 */
-int
-xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
-                 int color, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect)
 {
     int order_flags;
     int vals[8];
@@ -665,14 +754,35 @@ xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                 int color, struct xrdp_rect *rect)
+{
+    struct xrdp_order_item *item;
+
+    item = xrdp_orders_queue(self, RDP_ORDER_RECT, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_rect(self, x, y, cx, cy, color, rect);
+    }
+    item->x = x;
+    item->y = y;
+    item->cx = cx;
+    item->cy = cy;
+    item->color = color;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* send a screen blt order */
 /* max size 25 */
-int
-xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
-                       int cx, int cy, int srcx, int srcy,
-                       int rop, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_screen_blt(struct xrdp_orders *self, int x, int y,
+                           int cx, int cy, int srcx, int srcy,
+                           int rop, struct xrdp_rect *rect)
 {
     int order_flags = 0;
     int vals[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -855,15 +965,40 @@ xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
+                       int cx, int cy, int srcx, int srcy,
+                       int rop, struct xrdp_rect *rect)
+{
+    struct xrdp_order_item *item;
+
+    item = xrdp_orders_queue(self, RDP_ORDER_SCREENBLT, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_screen_blt(self, x, y, cx, cy, srcx, srcy,
+                                          rop, rect);
+    }
+    item->x = x;
+    item->y = y;
+    item->cx = cx;
+    item->cy = cy;
+    item->srcx = srcx;
+    item->srcy = srcy;
+    item->rop = rop;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* send a pat blt order */
 /* max size 39 */
-int
-xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
-                    int cx, int cy, int rop, int bg_color,
-                    int fg_color, struct xrdp_brush *brush,
-                    struct xrdp_rect *rect)
+static int
+xrdp_orders_out_pat_blt(struct xrdp_orders *self, int x, int y,
+                        int cx, int cy, int rop, int bg_color,
+                        int fg_color, struct xrdp_brush *brush,
+                        struct xrdp_rect *rect)
 {
     int order_flags;
     int present;
@@ -1074,6 +1209,37 @@ xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
+                    int cx, int cy, int rop, int bg_color,
+                    int fg_color, struct xrdp_brush *brush,
+                    struct xrdp_rect *rect)
+{
+    struct xrdp_order_item *item;
+
+    item = xrdp_orders_queue(self, RDP_ORDER_PATBLT, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_pat_blt(self, x, y, cx, cy, rop, bg_color,
+                                       fg_color, brush, rect);
+    }
+    item->x = x;
+    item->y = y;
+    item->cx = cx;
+    item->cy = cy;
+    item->rop = rop;
+    item->color = bg_color;
+    item->fg_color = fg_color;
+    if (brush != NULL)
+    {
+        item->has_brush = 1;
+        item->brush = *brush;
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* send a dest blt order */
@@ -1450,11 +1616,11 @@ xrdp_orders_line(struct xrdp_orders *self, int mix_mode,
 /* returns error */
 /* send a mem blt order */
 /* max size  30 */
-int
-xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
-                    int color_table, int x, int y, int cx, int cy,
-                    int rop, int srcx, int srcy,
-                    int cache_idx, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int rop, int srcx, int srcy,
+                        int cache_idx, struct xrdp_rect *rect)
 {
     int order_flags = 0;
     int vals[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -1654,6 +1820,106 @@ xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
+                    int color_table, int x, int y, int cx, int cy,
+                    int rop, int srcx, int srcy,
+                    int cache_idx, struct xrdp_rect *rect)
+{
+    struct xrdp_order_item *item;
+
+    item = xrdp_orders_queue(self, RDP_ORDER_MEMBLT, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_mem_blt(self, cache_id, color_table, x, y,
+                                       cx, cy, rop, srcx, srcy, cache_idx,
+                                       rect);
+    }
+    item->x = x;
+    item->y = y;
+    item->cx = cx;
+    item->cy = cy;
+    item->rop = rop;
+    item->srcx = srcx;
+    item->srcy = srcy;
+    item->cache_id = cache_id;
+    item->cache_idx = cache_idx;
+    item->color_table = color_table;
+    return 0;
+}
+
+/*****************************************************************************/
+/* optimises and sends the orders held back */
+/* returns error */
+static int
+xrdp_orders_flush_pending(struct xrdp_orders *self)
+{
+    struct xrdp_order_item *item;
+    struct xrdp_rect *rect;
+    struct xrdp_brush *brush;
+    char *order_count_ptr;
+    char *p;
+    int count;
+    int index;
+    int rv;
+
+    count = self->num_pending;
+    if (count < 1)
+    {
+        return 0;
+    }
+    /* the senders below call xrdp_orders_check() */
+    self->num_pending = 0;
+    count = xrdp_orders_peephole(self->pending, count,
+                                 &(self->peephole_stats));
+    rv = 0;
+    for (index = 0; (index < count) && (rv == 0); index++)
+    {
+        item = self->pending + index;
+        rect = item->has_clip ? &(item->clip) : NULL;
+        order_count_ptr = self->order_count_ptr;
+        p = self->out_s->p;
+        switch (item->type)
+        {
+            case RDP_ORDER_RECT:
+                rv = xrdp_orders_out_rect(self, item->x, item->y,
+                                          item->cx, item->cy,
+                                          item->color, rect);
+                break;
+            case RDP_ORDER_SCREENBLT:
+                rv = xrdp_orders_out_screen_blt(self, item->x, item->y,
+                                                item->cx, item->cy,
+                                                item->srcx, item->srcy,
+                                                item->rop, rect);
+                break;
+            case RDP_ORDER_PATBLT:
+                brush = item->has_brush ? &(item->brush) : NULL;
+                rv = xrdp_orders_out_pat_blt(self, item->x, item->y,
+                                             item->cx, item->cy, item->rop,
+                                             item->color, item->fg_color,
+                                             brush, rect);
+                break;
+            default:
+                rv = xrdp_orders_out_mem_blt(self, item->cache_id,
+                                             item->color_table,
+                                             item->x, item->y,
+                                             item->cx, item->cy, item->rop,
+                                             item->srcx, item->srcy,
+                                             item->cache_idx, rect);
+                break;
+        }
+        self->peephole_stats.orders_out++;
+        if (self->order_count_ptr == order_count_ptr)
+        {
+            /* not when a full packet was sent first */
+            self->peephole_stats.bytes_out += (int)(self->out_s->p - p);
+        }
+    }
+    return rv;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -1983,6 +2249,86 @@ xrdp_orders_composite_blt(struct xrdp_orders *self, int srcidx, int srcformat,
     return 0;
 }
 
+/*****************************************************************************/
+/* replaces a glyph run sent before with a USE_FRAGMENT of it, or adds the
+   run to the client's fragment cache with an ADD_FRAGMENT after it
+   ([MS-RDPEGDI] 2.2.2.2.1.1.2.13), out must hold data_len + 3 bytes
+   returns the bytes in out, 0 to send data as it is */
+int
+xrdp_orders_text_fragment(struct xrdp_text_frags *frags, int flags,
+                          const char *data, int data_len, char *out)
+{
+    struct xrdp_text_fragment *item;
+    unsigned int hash;
+    int oldest;
+    int index;
+    int id;
+
+    if (frags->off || (data_len < TEXT_FRAGMENT_MIN_BYTES) ||
+            (data_len > frags->max_bytes))
+    {
+        return 0;
+    }
+    /* the run is only used whole so a USE_FRAGMENT is always the last
+       thing in the data and needs no delta after it */
+    hash = 2166136261u;
+    index = 0;
+    while (index < data_len)
+    {
+        if ((data[index] == (char) GLYPH_FRAGMENT_USE) ||
+                (data[index] == (char) GLYPH_FRAGMENT_ADD))
+        {
+            /* fragment ids are not ours to pick */
+            LOG(LOG_LEVEL_INFO, "xrdp_orders_text_fragment: module uses "
+                "the fragment cache, not caching glyph runs");
+            frags->off = 1;
+            return 0;
+        }
+        hash = (hash ^ (unsigned char) data[index++]) * 16777619u;
+        if (!(flags & SO_CHAR_INC_EQUAL_BM_BASE) && (index < data_len))
+        {
+            /* delta, 0x80 then 2 bytes if it does not fit in one */
+            id = (data[index] == (char) 0x80) ? 3 : 1;
+            while ((id-- > 0) && (index < data_len))
+            {
+                hash = (hash ^ (unsigned char) data[index++]) * 16777619u;
+            }
+        }
+    }
+
+    oldest = 0;
+    for (index = 0; index < frags->entries; index++)
+    {
+        item = frags->items + index;
+        if ((item->stamp != 0) && (item->hash == hash) &&
+                (item->bytes == data_len) &&
+                (g_memcmp(item->data, data, data_len) == 0))
+        {
+            item->stamp = ++(frags->stamp);
+            frags->hits++;
+            out[0] = (char) GLYPH_FRAGMENT_USE;
+            out[1] = index;
+            return 2;
+        }
+        if (item->stamp < frags->items[oldest].stamp)
+        {
+            oldest = index;
+        }
+    }
+
+    item = frags->items + oldest;
+    item->stamp = ++(frags->stamp);
+    item->hash = hash;
+    item->bytes = data_len;
+    g_memcpy(item->data, data, data_len);
+    frags->adds++;
+    g_memcpy(out, data, data_len);
+    out[data_len] = (char) GLYPH_FRAGMENT_ADD;
+    out[data_len + 1] = oldest;
+    out[data_len + 2] = data_len;
+    return data_len + 3;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -2000,6 +2346,28 @@ xrdp_orders_text(struct xrdp_orders *self,
     int present = 0;
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
+    struct xrdp_client_info *ci;
+    char frag_data[255 + 3];
+    int frag_bytes;
+
+    ci = &(self->rdp_layer->client_info);
+    if ((self->text_frags == 0) && (ci->frag_cache_entries > 0))
+    {
+        self->text_frags = g_new0(struct xrdp_text_frags, 1);
+        self->text_frags->entries = MIN(ci->frag_cache_entries,
+                                        XRDP_MAX_TEXT_FRAGMENTS);
+        self->text_frags->max_bytes = MIN(ci->frag_cache_cell_size, 255);
+    }
+    if (self->text_frags != 0)
+    {
+        frag_bytes = xrdp_orders_text_fragment(self->text_frags, flags,
+                                               data, data_len, frag_data);
+        if (frag_bytes > 0)
+        {
+            data = frag_data;
+            data_len = frag_bytes;
+        }
+    }
 
     if (xrdp_orders_check(self, 44 + data_len) != 0)
     {
@@ -2349,6 +2717,236 @@ xrdp_orders_send_raw_bitmap(struct xrdp_orders *self,
     return 0;
 }
 
+/*****************************************************************************/
+/* starts the bitmap workers the first time, returns error if there are
+   none */
+static int
+xrdp_orders_bitmap_init(struct xrdp_orders *self)
+{
+    int threads;
+    int index;
+
+    if (self->bitmap_pool != NULL)
+    {
+        return 0;
+    }
+    threads = self->rdp_layer->client_info.bitmap_compress_threads;
+    if (threads < 2)
+    {
+        return 1;
+    }
+    self->bitmap_pool = thread_pool_create(threads - 1);
+    threads = thread_pool_get_num_workers(self->bitmap_pool) + 1;
+    self->bitmap_s = g_new0(struct stream *, threads);
+    self->bitmap_temp_s = g_new0(struct stream *, threads);
+    if (self->bitmap_pool == NULL || self->bitmap_s == NULL ||
+            self->bitmap_temp_s == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_orders_bitmap_init: out of memory");
+        thread_pool_delete(self->bitmap_pool);
+        self->bitmap_pool = NULL;
+        g_free(self->bitmap_s);
+        g_free(self->bitmap_temp_s);
+        self->bitmap_s = NULL;
+        self->bitmap_temp_s = NULL;
+        return 1;
+    }
+    for (index = 0; index < threads; index++)
+    {
+        make_stream(self->bitmap_s[index]);
+        init_stream(self->bitmap_s[index], 16384 * 2);
+        make_stream(self->bitmap_temp_s[index]);
+        init_stream(self->bitmap_temp_s[index], 16384 * 2);
+    }
+    self->num_bitmap_threads = threads;
+    LOG(LOG_LEVEL_INFO, "xrdp_orders_bitmap_init: %d bitmap compression "
+        "threads", threads);
+    return 0;
+}
+
+struct xrdp_bitmap_batch
+{
+    struct xrdp_orders *self;
+    struct xrdp_bitmap_job *jobs;
+};
+
+/*****************************************************************************/
+/* runs on the bitmap workers, the streams of a worker are its own */
+static void
+xrdp_orders_bitmap_job(void *arg, int index, int worker)
+{
+    struct xrdp_bitmap_batch *batch = (struct xrdp_bitmap_batch *)arg;
+    struct xrdp_bitmap_job *job;
+    struct stream *s;
+    struct stream *temp_s;
+    int e;
+
+    job = batch->jobs + index;
+    s = batch->self->bitmap_s[worker];
+    temp_s = batch->self->bitmap_temp_s[worker];
+    e = (4 - job->width) & 3;
+    init_stream(s, 16384 * 2);
+    init_stream(temp_s, 16384 * 2);
+    if (job->bpp > 24)
+    {
+        job->lines = xrdp_bitmap32_compress(job->data, job->width,
+                                            job->height, s, job->bpp,
+                                            job->byte_limit, job->start_line,
+                                            temp_s, e, 0x10);
+    }
+    else
+    {
+        job->lines = xrdp_bitmap_compress(job->data, job->width, job->height,
+                                          s, job->bpp, job->byte_limit,
+                                          job->start_line, temp_s, e);
+    }
+    job->bytes = (int)(s->p - s->data);
+    job->comp = NULL;
+    if (job->lines > 0)
+    {
+        job->comp = (char *)g_malloc(job->bytes, 0);
+        if (job->comp == NULL)
+        {
+            job->lines = 0;
+            return;
+        }
+        g_memcpy(job->comp, s->data, job->bytes);
+    }
+}
+
+/*****************************************************************************/
+/* compresses the bitmaps in parallel, the results must be freed by the
+   caller, returns error if there are no bitmap workers */
+int
+xrdp_orders_compress_bitmaps(struct xrdp_orders *self,
+                             struct xrdp_bitmap_job *jobs, int num_jobs)
+{
+    struct xrdp_bitmap_batch batch;
+
+    if (xrdp_orders_bitmap_init(self) != 0)
+    {
+        return 1;
+    }
+    batch.self = self;
+    batch.jobs = jobs;
+    thread_pool_run(self->bitmap_pool, num_jobs, xrdp_orders_bitmap_job,
+                    &batch);
+    return 0;
+}
+
+/*****************************************************************************/
+/* compresses cache tiles before the orders for them are sent, returns
+   error if there are no bitmap workers */
+int
+xrdp_orders_precompress_tiles(struct xrdp_orders *self,
+                              const struct xrdp_bitmap_tile *tiles,
+                              int num_tiles)
+{
+    struct xrdp_bitmap_job *jobs;
+    struct xrdp_client_info *ci;
+    int max_order_size;
+    int index;
+
+    xrdp_orders_clear_tiles(self);
+    if (num_tiles < 1 || xrdp_orders_bitmap_init(self) != 0)
+    {
+        return 1;
+    }
+    jobs = g_new0(struct xrdp_bitmap_job, num_tiles);
+    if (jobs == NULL)
+    {
+        return 1;
+    }
+    ci = &(self->rdp_layer->client_info);
+    max_order_size = MAX_ORDERS_SIZE(ci);
+    for (index = 0; index < num_tiles; index++)
+    {
+        jobs[index].data = tiles[index].data;
+        jobs[index].width = tiles[index].width;
+        jobs[index].height = tiles[index].height;
+        jobs[index].bpp = tiles[index].bpp;
+        jobs[index].start_line = tiles[index].height - 1;
+        jobs[index].byte_limit = max_order_size;
+    }
+    xrdp_orders_compress_bitmaps(self, jobs, num_tiles);
+    self->tile_jobs = jobs;
+    self->num_tile_jobs = num_tiles;
+    self->next_tile_job = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+xrdp_orders_clear_tiles(struct xrdp_orders *self)
+{
+    int index;
+
+    for (index = 0; index < self->num_tile_jobs; index++)
+    {
+        g_free(self->tile_jobs[index].comp);
+    }
+    g_free(self->tile_jobs);
+    self->tile_jobs = NULL;
+    self->num_tile_jobs = 0;
+    self->next_tile_job = 0;
+}
+
+/*****************************************************************************/
+/* compresses a tile for a cache order, or takes it from the tiles
+   compressed ahead, returns the lines compressed */
+static int
+xrdp_orders_compress_tile(struct xrdp_orders *self,
+                          int width, int height, int bpp, char *data,
+                          char **comp, int *bytes)
+{
+    struct xrdp_bitmap_job *job;
+    struct xrdp_client_info *ci;
+    struct stream *s;
+    struct stream *temp_s;
+    int max_order_size;
+    int lines;
+    int index;
+    int e;
+
+    /* the tiles are sent in the order they were compressed but the ones
+       found in the cache are skipped */
+    for (index = self->next_tile_job; index < self->num_tile_jobs; index++)
+    {
+        job = self->tile_jobs + index;
+        if (job->data == data && job->width == width &&
+                job->height == height && job->bpp == bpp && job->lines > 0)
+        {
+            self->next_tile_job = index + 1;
+            *comp = job->comp;
+            *bytes = job->bytes;
+            return job->lines;
+        }
+    }
+
+    ci = &(self->rdp_layer->client_info);
+    max_order_size = MAX_ORDERS_SIZE(ci);
+    e = (4 - width) & 3;
+    s = self->s;
+    init_stream(s, 16384 * 2);
+    temp_s = self->temp_s;
+    init_stream(temp_s, 16384 * 2);
+    if (bpp > 24)
+    {
+        lines = xrdp_bitmap32_compress(data, width, height, s,
+                                       bpp, max_order_size,
+                                       height - 1, temp_s, e, 0x10);
+    }
+    else
+    {
+        lines = xrdp_bitmap_compress(data, width, height, s,
+                                     bpp, max_order_size,
+                                     height - 1, temp_s, e);
+    }
+    *comp = s->data;
+    *bytes = (int)(s->p - s->data);
+    return lines;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* max size width * height * Bpp + 16 */
@@ -2361,14 +2959,9 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
     int len = 0;
     int bufsize = 0;
     int Bpp = 0;
-    int i = 0;
     int lines_sending = 0;
     int e = 0;
-    struct stream *s = NULL;
-    struct stream *temp_s = NULL;
-    char *p = NULL;
-    int max_order_size;
-    struct xrdp_client_info *ci;
+    char *comp = NULL;
 
     if (width > 64)
     {
@@ -2382,9 +2975,6 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
         return 1;
     }
 
-    ci = &(self->rdp_layer->client_info);
-    max_order_size = MAX_ORDERS_SIZE(ci);
-
     e = width % 4;
 
     if (e != 0)
@@ -2392,31 +2982,14 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
         e = 4 - e;
     }
 
-    s = self->s;
-    init_stream(s, 16384 * 2);
-    temp_s = self->temp_s;
-    init_stream(temp_s, 16384 * 2);
-    p = s->p;
-    i = height;
-    if (bpp > 24)
-    {
-        lines_sending = xrdp_bitmap32_compress(data, width, height, s,
-                                               bpp, max_order_size,
-                                               i - 1, temp_s, e, 0x10);
-    }
-    else
-    {
-        lines_sending = xrdp_bitmap_compress(data, width, height, s,
-                                             bpp, max_order_size,
-                                             i - 1, temp_s, e);
-    }
+    lines_sending = xrdp_orders_compress_tile(self, width, height, bpp, data,
+                                              &comp, &bufsize);
 
     if (lines_sending != height)
     {
         height = lines_sending;
     }
 
-    bufsize = (int)(s->p - p);
     Bpp = (bpp + 7) / 8;
     if (xrdp_orders_check(self, bufsize + 16) != 0)
     {
@@ -2457,7 +3030,7 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
                       Bpp * height); /* final size */
     }
 
-    out_uint8a(self->out_s, s->data, bufsize);
+    out_uint8a(self->out_s, comp, bufsize);
     return 0;
 }
 
@@ -2792,11 +3365,7 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
     int i = 0;
     int lines_sending = 0;
     int e = 0;
-    struct stream *s = NULL;
-    struct stream *temp_s = NULL;
-    char *p = NULL;
-    int max_order_size;
-    struct xrdp_client_info *ci;
+    char *comp = NULL;
 
     if (width > 64)
     {
@@ -2810,9 +3379,6 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
         return 1;
     }
 
-    ci = &(self->rdp_layer->client_info);
-    max_order_size = MAX_ORDERS_SIZE(ci);
-
     e = width % 4;
 
     if (e != 0)
@@ -2820,31 +3386,14 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
         e = 4 - e;
     }
 
-    s = self->s;
-    init_stream(s, 16384 * 2);
-    temp_s = self->temp_s;
-    init_stream(temp_s, 16384 * 2);
-    p = s->p;
-    i = height;
-    if (bpp > 24)
-    {
-        lines_sending = xrdp_bitmap32_compress(data, width, height, s,
-                                               bpp, max_order_size,
-                                               i - 1, temp_s, e, 0x10);
-    }
-    else
-    {
-        lines_sending = xrdp_bitmap_compress(data, width, height, s,
-                                             bpp, max_order_size,
-                                             i - 1, temp_s, e);
-    }
+    lines_sending = xrdp_orders_compress_tile(self, width, height, bpp, data,
+                                              &comp, &bufsize);
 
     if (lines_sending != height)
     {
         height = lines_sending;
     }
 
-    bufsize = (int)(s->p - p);
     Bpp = (bpp + 7) / 8;
     if (xrdp_orders_check(self, bufsize + 14) != 0)
     {
@@ -2866,7 +3415,7 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
     out_uint8(self->out_s, i);
     i = cache_idx & 0xff;
     out_uint8(self->out_s, i);
-    out_uint8a(self->out_s, s->data, bufsize);
+    out_uint8a(self->out_s, comp, bufsize);
     return 0;
 }
 
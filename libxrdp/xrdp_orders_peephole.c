@@ -0,0 +1,289 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * peephole optimiser for a batch of drawing orders
+ *
+ * Orders that are drawn over later in the batch before anything reads
+ * them are dropped, solid rects of the same colour that make a rect
+ * together are merged and orders are moved next to the last order of
+ * the same type when nothing in between draws on or reads from the same
+ * part of the screen.  The order type is then not sent again and the
+ * bounds of the last order are more likely to be reused.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+
+/* rops that do not read the destination */
+#define ROP_BLACKNESS 0x00
+#define ROP_SRCCOPY   0xcc
+#define ROP_PATCOPY   0xf0
+#define ROP_WHITENESS 0xff
+
+/* mem blt cache id of an off screen bitmap */
+#define CACHE_ID_OFFSCREEN 255
+
+/*****************************************************************************/
+/* the part of the screen an order draws on */
+/* returns boolean, the area is not empty */
+static int
+order_area(const struct xrdp_order_item *item, struct xrdp_rect *area)
+{
+    area->left = item->x;
+    area->top = item->y;
+    area->right = item->x + item->cx;
+    area->bottom = item->y + item->cy;
+    if (item->has_clip)
+    {
+        area->left = MAX(area->left, item->clip.left);
+        area->top = MAX(area->top, item->clip.top);
+        area->right = MIN(area->right, item->clip.right);
+        area->bottom = MIN(area->bottom, item->clip.bottom);
+    }
+    return (area->left < area->right) && (area->top < area->bottom);
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+rects_overlap(const struct xrdp_rect *a, const struct xrdp_rect *b)
+{
+    return (a->left < b->right) && (b->left < a->right) &&
+           (a->top < b->bottom) && (b->top < a->bottom);
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+rect_contains(const struct xrdp_rect *outer, const struct xrdp_rect *inner)
+{
+    return (outer->left <= inner->left) && (outer->top <= inner->top) &&
+           (outer->right >= inner->right) && (outer->bottom >= inner->bottom);
+}
+
+/*****************************************************************************/
+/* returns boolean, the order draws without looking at what is there */
+static int
+order_is_opaque(const struct xrdp_order_item *item)
+{
+    switch (item->type)
+    {
+        case RDP_ORDER_RECT:
+            return 1;
+        case RDP_ORDER_PATBLT:
+            return (item->rop == ROP_PATCOPY) || (item->rop == ROP_BLACKNESS) ||
+                   (item->rop == ROP_WHITENESS);
+        default:
+            return item->rop == ROP_SRCCOPY;
+    }
+}
+
+/*****************************************************************************/
+/* returns boolean, the order reads some of area from the screen */
+static int
+order_reads(const struct xrdp_order_item *item, const struct xrdp_rect *area)
+{
+    struct xrdp_rect src;
+
+    if ((item->type == RDP_ORDER_MEMBLT) &&
+            (item->cache_id == CACHE_ID_OFFSCREEN))
+    {
+        /* could be the bitmap being drawn on */
+        return 1;
+    }
+    if (!order_is_opaque(item) && order_area(item, &src) &&
+            rects_overlap(&src, area))
+    {
+        return 1;
+    }
+    if (item->type == RDP_ORDER_SCREENBLT)
+    {
+        src.left = item->srcx;
+        src.top = item->srcy;
+        src.right = item->srcx + item->cx;
+        src.bottom = item->srcy + item->cy;
+        return rects_overlap(&src, area);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns boolean, the result is the same in either order */
+static int
+orders_commute(const struct xrdp_order_item *a,
+               const struct xrdp_order_item *b)
+{
+    struct xrdp_rect a_area;
+    struct xrdp_rect b_area;
+    int a_draws;
+    int b_draws;
+
+    a_draws = order_area(a, &a_area);
+    b_draws = order_area(b, &b_area);
+    if (a_draws && b_draws && rects_overlap(&a_area, &b_area))
+    {
+        return 0;
+    }
+    if (a_draws && order_reads(b, &a_area))
+    {
+        return 0;
+    }
+    if (b_draws && order_reads(a, &b_area))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* merges b, drawn right after a, into a */
+/* returns boolean, b was merged */
+static int
+order_merge(struct xrdp_order_item *a, const struct xrdp_order_item *b)
+{
+    int start;
+    int end;
+
+    if ((a->type != RDP_ORDER_RECT) || (b->type != RDP_ORDER_RECT) ||
+            (a->color != b->color) || (a->has_clip != b->has_clip))
+    {
+        return 0;
+    }
+    if (a->has_clip && ((a->clip.left != b->clip.left) ||
+                        (a->clip.top != b->clip.top) ||
+                        (a->clip.right != b->clip.right) ||
+                        (a->clip.bottom != b->clip.bottom)))
+    {
+        return 0;
+    }
+    if ((a->x == b->x) && (a->cx == b->cx) &&
+            (b->y <= a->y + a->cy) && (a->y <= b->y + b->cy))
+    {
+        /* one above the other */
+        start = MIN(a->y, b->y);
+        end = MAX(a->y + a->cy, b->y + b->cy);
+        a->y = start;
+        a->cy = end - start;
+        return 1;
+    }
+    if ((a->y == b->y) && (a->cy == b->cy) &&
+            (b->x <= a->x + a->cx) && (a->x <= b->x + b->cx))
+    {
+        /* side by side */
+        start = MIN(a->x, b->x);
+        end = MAX(a->x + a->cx, b->x + b->cx);
+        a->x = start;
+        a->cx = end - start;
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* optimises count orders, at most XRDP_MAX_PENDING_ORDERS, in place */
+/* returns the number of orders left */
+int
+xrdp_orders_peephole(struct xrdp_order_item *items, int count,
+                     struct xrdp_orders_peephole_stats *stats)
+{
+    struct xrdp_order_item sorted[XRDP_MAX_PENDING_ORDERS];
+    struct xrdp_rect area;
+    struct xrdp_rect later_area;
+    struct xrdp_order_item *item;
+    struct xrdp_order_item *other;
+    int keep[XRDP_MAX_PENDING_ORDERS];
+    int out[XRDP_MAX_PENDING_ORDERS];
+    int num_out;
+    int index;
+    int jndex;
+    int pos;
+
+    count = MIN(count, XRDP_MAX_PENDING_ORDERS);
+    stats->orders_in += count;
+
+    /* drop what draws nothing or is drawn over before it is read */
+    for (index = 0; index < count; index++)
+    {
+        keep[index] = order_area(items + index, &area);
+        for (jndex = index + 1; keep[index] && (jndex < count); jndex++)
+        {
+            other = items + jndex;
+            if (order_reads(other, &area))
+            {
+                break;
+            }
+            if (order_is_opaque(other) && order_area(other, &later_area) &&
+                    rect_contains(&later_area, &area))
+            {
+                keep[index] = 0;
+            }
+        }
+        if (!keep[index])
+        {
+            stats->dropped++;
+        }
+    }
+
+    /* move each order up to the last one of the same type if it can get
+       past everything in between, then try to merge them */
+    num_out = 0;
+    for (index = 0; index < count; index++)
+    {
+        if (!keep[index])
+        {
+            continue;
+        }
+        item = items + index;
+        pos = num_out;
+        for (jndex = num_out - 1; jndex >= 0; jndex--)
+        {
+            other = items + out[jndex];
+            if (other->type == item->type)
+            {
+                pos = jndex + 1;
+                break;
+            }
+            if (!orders_commute(other, item))
+            {
+                break;
+            }
+        }
+        if ((pos > 0) && order_merge(items + out[pos - 1], item))
+        {
+            stats->merged++;
+            continue;
+        }
+        if (pos < num_out)
+        {
+            g_memmove(out + pos + 1, out + pos, (num_out - pos) * sizeof(int));
+            stats->moved++;
+        }
+        out[pos] = index;
+        num_out++;
+    }
+
+    for (index = 0; index < num_out; index++)
+    {
+        sorted[index] = items[out[index]];
+    }
+    g_memcpy(items, sorted, num_out * sizeof(struct xrdp_order_item));
+    return num_out;
+}
@@ -36,6 +36,12 @@
 
 
 #define FASTPATH_FRAG_SIZE (16 * 1024 - 128)
+/* the PDU length is 15 bits, less room for the FIPS pad */
+#define FASTPATH_MAX_PDU_SIZE (0x7fff - 8)
+/* the most plain text in a TLS record */
+#define TLS_MAX_RECORD_SIZE (16 * 1024)
+/* record header, explicit nonce and tag of a TLS 1.2 AES-GCM record */
+#define TLS_RECORD_OVERHEAD 29
 
 /*****************************************************************************/
 static int
@@ -80,6 +86,10 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->use_bulk_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "order_peephole") == 0)
+        {
+            client_info->order_peephole = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "crypt_level") == 0)
         {
             if (g_strcasecmp(value, "none") == 0)
@@ -137,6 +147,22 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->pointer_flags = g_text2bool(value) == 0 ? 2 : 0;
         }
+        else if (g_strcasecmp(item, "max_frames_in_flight") == 0)
+        {
+            client_info->max_frames_in_flight = MAX(g_atoi(value), 0);
+        }
+        else if (g_strcasecmp(item, "max_frames_in_encoder") == 0)
+        {
+            client_info->max_frames_in_encoder = MAX(g_atoi(value), 0);
+        }
+        else if (g_strcasecmp(item, "jpeg_encoder_threads") == 0)
+        {
+            client_info->jpeg_encoder_threads = MAX(g_atoi(value), 0);
+        }
+        else if (g_strcasecmp(item, "bitmap_compress_threads") == 0)
+        {
+            client_info->bitmap_compress_threads = MAX(g_atoi(value), 0);
+        }
         else if (g_strcasecmp(item, "require_credentials") == 0)
         {
             client_info->require_credentials = g_text2bool(value);
@@ -355,6 +381,73 @@ xrdp_rdp_detect_cpu(void)
 }
 #endif
 
+/* xrdp.ini settings read ahead of a connection by a pre-forked process,
+   see xrdp_rdp_preload_config() */
+static struct xrdp_client_info *g_preloaded_client_info = NULL;
+static char *g_preloaded_xrdp_ini = NULL;
+/* the file as it was when read, it is read again if it has changed */
+static long g_preloaded_xrdp_ini_mtime = -1;
+static int g_preloaded_xrdp_ini_size = -1;
+static int g_preloaded_xrdp_ini_inode = -1;
+
+/*****************************************************************************/
+/* read the xrdp.ini settings for the next xrdp_rdp_create(), which takes
+   them instead of reading the file */
+int
+xrdp_rdp_preload_config(const char *xrdp_ini)
+{
+    if (g_preloaded_client_info != NULL)
+    {
+        return 0;
+    }
+    g_preloaded_client_info = g_new0(struct xrdp_client_info, 1);
+    if (g_preloaded_client_info == NULL)
+    {
+        return 1;
+    }
+    g_preloaded_xrdp_ini = g_strdup(xrdp_ini);
+    g_preloaded_xrdp_ini_mtime = g_file_get_mtime(xrdp_ini);
+    g_preloaded_xrdp_ini_size = g_file_get_size(xrdp_ini);
+    g_preloaded_xrdp_ini_inode = g_file_get_inode_num(xrdp_ini);
+    return xrdp_rdp_read_config(xrdp_ini, g_preloaded_client_info);
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the preloaded settings are from this xrdp.ini
+   as it is now */
+static int
+xrdp_rdp_preloaded_config_is_current(const char *xrdp_ini)
+{
+    if ((g_preloaded_client_info == NULL) ||
+            (g_strcmp(g_preloaded_xrdp_ini, xrdp_ini) != 0))
+    {
+        return 0;
+    }
+    if ((g_file_get_mtime(xrdp_ini) != g_preloaded_xrdp_ini_mtime) ||
+            (g_file_get_size(xrdp_ini) != g_preloaded_xrdp_ini_size) ||
+            (g_file_get_inode_num(xrdp_ini) != g_preloaded_xrdp_ini_inode))
+    {
+        LOG(LOG_LEVEL_INFO, "%s has changed since it was preloaded, "
+            "reading it again", xrdp_ini);
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+xrdp_rdp_free_preloaded_config(void)
+{
+    if (g_preloaded_client_info != NULL)
+    {
+        g_free(g_preloaded_client_info->tls_ciphers);
+        g_free(g_preloaded_client_info);
+        g_preloaded_client_info = NULL;
+    }
+    g_free(g_preloaded_xrdp_ini);
+    g_preloaded_xrdp_ini = NULL;
+}
+
 /*****************************************************************************/
 struct xrdp_rdp *
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
@@ -366,7 +459,19 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     self->session = session;
     self->share_id = 66538;
     /* read ini settings */
-    xrdp_rdp_read_config(session->xrdp_ini, &self->client_info);
+    if (xrdp_rdp_preloaded_config_is_current(session->xrdp_ini))
+    {
+        /* the strings it holds are handed over too */
+        g_memcpy(&self->client_info, g_preloaded_client_info,
+                 sizeof(self->client_info));
+        g_free(g_preloaded_client_info);
+        g_preloaded_client_info = NULL;
+    }
+    else
+    {
+        xrdp_rdp_read_config(session->xrdp_ini, &self->client_info);
+    }
+    xrdp_rdp_free_preloaded_config();
     /* create sec layer */
     self->sec_layer = xrdp_sec_create(self, trans);
     /* default 8 bit v1 color bitmap cache entries and size */
@@ -404,6 +509,12 @@ xrdp_rdp_delete(struct xrdp_rdp *self)
         return;
     }
 
+    if (self->fp_updates_packed > 0)
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_rdp_delete: %d fastpath updates sent in "
+            "%d PDUs", self->fp_updates_packed, self->fp_pdus_packed);
+    }
+    free_stream(self->fp_pack_s);
     xrdp_sec_delete(self->sec_layer);
     mppc_enc_free(self->mppc_enc);
 #if defined(XRDP_NEUTRINORDP)
@@ -554,6 +665,152 @@ xrdp_rdp_recv(struct xrdp_rdp *self, struct stream *s, int *code)
     }
 }
 
+/*****************************************************************************/
+/* sends the fastpath updates packed so far */
+/* returns error */
+static int
+xrdp_rdp_fastpath_pack_flush(struct xrdp_rdp *self)
+{
+    int count;
+
+    count = self->fp_pack_count;
+    if (count < 1)
+    {
+        return 0;
+    }
+    self->fp_pack_count = 0;
+    self->fp_pack_bytes = 0;
+    self->fp_updates_packed += count;
+    self->fp_pdus_packed++;
+    s_mark_end(self->fp_pack_s);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_rdp_fastpath_pack_flush: %d updates in "
+              "one TS_FP_UPDATE_PDU", count);
+    if (xrdp_sec_send_fastpath(self->sec_layer, self->fp_pack_s) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_rdp_fastpath_pack_flush: "
+            "xrdp_sec_send_fastpath failed");
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* adds a whole TS_FP_UPDATE to the PDU being packed, frag_size is the
+   most update data one PDU carries */
+/* returns error */
+static int
+xrdp_rdp_fastpath_pack_add(struct xrdp_rdp *self, const char *data,
+                           int bytes, int frag_size)
+{
+    if ((self->fp_pack_count > 0) &&
+            (self->fp_pack_bytes + bytes > frag_size))
+    {
+        if (xrdp_rdp_fastpath_pack_flush(self) != 0)
+        {
+            return 1;
+        }
+    }
+    if (self->fp_pack_count == 0)
+    {
+        if (self->fp_pack_s == NULL)
+        {
+            make_stream(self->fp_pack_s);
+        }
+        if (xrdp_sec_init_fastpath(self->sec_layer, self->fp_pack_s) != 0)
+        {
+            return 1;
+        }
+    }
+    out_uint8a(self->fp_pack_s, data, bytes);
+    self->fp_pack_count++;
+    self->fp_pack_bytes += bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+/* From here until xrdp_rdp_fastpath_pack_end() whole fastpath updates
+   are packed into as few TS_FP_UPDATE_PDUs as they fit in.  Updates that
+   need fragmenting and anything sent on the slow path send what is
+   packed first so the order on the wire does not change. */
+void
+xrdp_rdp_fastpath_pack_begin(struct xrdp_rdp *self)
+{
+    if (self->client_info.use_fast_path & 1)
+    {
+        self->fp_pack_level++;
+    }
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_rdp_fastpath_pack_end(struct xrdp_rdp *self)
+{
+    if (self->fp_pack_level < 1)
+    {
+        return 0;
+    }
+    self->fp_pack_level--;
+    if (self->fp_pack_level > 0)
+    {
+        return 0;
+    }
+    return xrdp_rdp_fastpath_pack_flush(self);
+}
+
+/*****************************************************************************/
+/* the most update data, headers included, sent in one fastpath PDU
+   With TLS the PDU fills one TLS record, without it the PDU can be as
+   big as its length field allows, up to what the client reassembles.
+   When the MSS of the connection is known the PDU is cut down to a
+   whole number of TCP segments so no small segment trails each PDU, but
+   never below the fixed size used before so a full orders PDU still
+   goes in one piece. */
+static int
+xrdp_rdp_get_fastpath_frag_size(struct xrdp_rdp *self)
+{
+    struct trans *trans;
+    int sec_bytes;
+    int pdu_size;
+    int record_bytes;
+    int wire_bytes;
+    int mss;
+
+    if (self->fastpath_frag_size > 0)
+    {
+        return self->fastpath_frag_size;
+    }
+    trans = self->sec_layer->mcs_layer->iso_layer->trans;
+    sec_bytes = xrdp_sec_get_fastpath_bytes(self->sec_layer);
+    if (trans->tls != NULL)
+    {
+        pdu_size = TLS_MAX_RECORD_SIZE;
+        record_bytes = TLS_RECORD_OVERHEAD;
+    }
+    else
+    {
+        pdu_size = MIN(FASTPATH_MAX_PDU_SIZE,
+                       MAX(self->client_info.max_fastpath_frag_bytes,
+                           FASTPATH_FRAG_SIZE));
+        record_bytes = 0;
+    }
+    /* not a TCP connection if this fails */
+    mss = 0;
+    if ((g_tcp_get_mss(trans->sck, &mss) == 0) && (mss > 0))
+    {
+        wire_bytes = ((pdu_size + record_bytes) / mss) * mss;
+        if (wire_bytes - record_bytes - sec_bytes >= FASTPATH_FRAG_SIZE)
+        {
+            pdu_size = wire_bytes - record_bytes;
+        }
+    }
+    self->fastpath_frag_size = pdu_size - sec_bytes;
+    LOG(LOG_LEVEL_INFO, "xrdp_rdp_get_fastpath_frag_size: %d bytes, "
+        "mss %d, %s", self->fastpath_frag_size, mss,
+        trans->tls != NULL ? "tls" : "no tls");
+    return self->fastpath_frag_size;
+}
+
 /*****************************************************************************/
 /* Send a [MS-RDPBCGR] Control PDU with for the given pduType with the headers
    added */
@@ -562,6 +819,10 @@ xrdp_rdp_send(struct xrdp_rdp *self, struct stream *s, int pdu_type)
 {
     int len = 0;
 
+    if (xrdp_rdp_fastpath_pack_flush(self) != 0)
+    {
+        return 1;
+    }
     s_pop_layer(s, rdp_hdr);
     len = s->end - s->p;
 
@@ -605,6 +866,10 @@ xrdp_rdp_send_data(struct xrdp_rdp *self, struct stream *s,
     struct stream ls;
     struct xrdp_mppc_enc *mppc_enc;
 
+    if (xrdp_rdp_fastpath_pack_flush(self) != 0)
+    {
+        return 1;
+    }
     s_pop_layer(s, rdp_hdr);
     len = (int)(s->end - s->p);
     pdutype = 0x10 | PDUTYPE_DATAPDU;
@@ -734,6 +999,8 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
     int to_comp_len;
     int sec_offset;
     int rdp_offset;
+    int frag_size;
+    char *update;
     struct stream frag_s;
     struct stream comp_s;
     struct stream send_s;
@@ -754,6 +1021,15 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         header_bytes = 3;
     }
     sec_bytes = xrdp_sec_get_fastpath_bytes(self->sec_layer);
+    frag_size = xrdp_rdp_get_fastpath_frag_size(self);
+    if ((int)(s->end - s->p) > frag_size)
+    {
+        /* the fragments go on their own */
+        if (xrdp_rdp_fastpath_pack_flush(self) != 0)
+        {
+            return 1;
+        }
+    }
     fragmentation = 0;
     frag_s = *s;
     sec_offset = (int)(frag_s.sec_hdr - frag_s.data);
@@ -764,9 +1040,9 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         comp_type = 0;
         send_s = frag_s;
         no_comp_len = (int)(frag_s.end - frag_s.p);
-        if (no_comp_len > FASTPATH_FRAG_SIZE)
+        if (no_comp_len > frag_size)
         {
-            no_comp_len = FASTPATH_FRAG_SIZE;
+            no_comp_len = frag_size;
             if (fragmentation == 0)
             {
                 fragmentation = 2; /* FASTPATH_FRAGMENT_FIRST */
@@ -821,6 +1097,7 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
 
         send_s.end = send_s.p + send_len;
         send_s.size = send_s.end - send_s.data;
+        update = send_s.p;
         out_uint8(&send_s, updateHeader);
         if (compression != 0)
         {
@@ -833,7 +1110,18 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
                   "updateCode %d, fragmentation %d, compression %d, compressionFlags %s, size %d",
                   updateCode, fragmentation, compression,
                   (compression ? comp_type_str : "(not present)"), send_len);
-        if (xrdp_sec_send_fastpath(self->sec_layer, &send_s) != 0)
+        if ((self->fp_pack_level > 0) && (fragmentation == 0))
+        {
+            if (xrdp_rdp_fastpath_pack_add(self, update,
+                                           header_bytes + send_len,
+                                           frag_size) != 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "xrdp_rdp_send_fastpath: "
+                    "xrdp_rdp_fastpath_pack_add failed");
+                return 1;
+            }
+        }
+        else if (xrdp_sec_send_fastpath(self->sec_layer, &send_s) != 0)
         {
             LOG(LOG_LEVEL_ERROR, "xrdp_rdp_send_fastpath: xrdp_sec_send_fastpath failed");
             return 1;
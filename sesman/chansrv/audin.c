@@ -33,6 +33,11 @@
 #include "xrdp_constants.h"
 #include "fifo.h"
 
+#if defined(XRDP_OPUS)
+#include <opus/opus.h>
+static OpusDecoder *g_opus_decoder = NULL;
+#endif
+
 #define MSG_SNDIN_VERSION       1
 #define MSG_SNDIN_FORMATS       2
 #define MSG_SNDIN_OPEN          3
@@ -46,8 +51,24 @@
 #define AUDIN_NAME "AUDIO_INPUT"
 #define AUDIN_FLAGS  1 /* WTS_CHANNEL_OPTION_DYNAMIC */
 
+#define AUDIN_FRAMES_PER_PACKET 2048
+#define AUDIN_OPUS_FRAMES_PER_PACKET 960 /* 20 ms at 48 kHz */
+#define AUDIN_OPUS_MAX_FRAMES 5760 /* 120 ms at 48 kHz, the most in a packet */
+
+/* Opus is decoded at 48 kHz and resampled to the 44.1 kHz of g_pcm_44100,
+   see audin_resample() */
+#define AUDIN_RS_IN  480
+#define AUDIN_RS_OUT 441
+
+/* decoded sound is held until there is this much, then played until the
+   fifo runs dry, and the oldest is dropped when there is more than the
+   max, see sound_sndsrvr_source_data_in() */
+#define AUDIN_JITTER_MS 60
+#define AUDIN_JITTER_MAX_MS 300
+
 extern struct fifo *g_in_fifo; /* in sound.c */
 extern int g_bytes_in_fifo; /* in sound.c */
+extern int g_in_fifo_prefill_bytes; /* in sound.c */
 
 struct xr_wave_format_ex
 {
@@ -74,12 +95,30 @@ static struct xr_wave_format_ex g_pcm_44100 =
     g_pcm_44100_data /* data */
 };
 
+#if defined(XRDP_OPUS)
+static uint8_t g_opus_48000_data[] = { 0 };
+static struct xr_wave_format_ex g_opus_48000 =
+{
+    WAVE_FORMAT_OPUS, /* wFormatTag */
+    2,                /* num of channels */
+    48000,            /* samples per sec */
+    192000,           /* avg bytes per sec */
+    4,                /* block align */
+    16,               /* bits per sample */
+    0,                /* data size */
+    g_opus_48000_data /* data */
+};
+#endif
+
 static struct chansrv_drdynvc_procs g_audin_info;
 static int g_audin_chanid;
 static struct stream *g_in_s;
 
 static struct xr_wave_format_ex *g_server_formats[] =
 {
+#if defined(XRDP_OPUS)
+    &g_opus_48000,
+#endif
     &g_pcm_44100,
     NULL
 };
@@ -87,6 +126,14 @@ static struct xr_wave_format_ex *g_server_formats[] =
 static struct xr_wave_format_ex **g_client_formats = NULL;
 
 static int g_current_format = 0; /* index in g_client_formats */
+static int g_num_client_formats = 0;
+
+#if defined(XRDP_OPUS)
+static int g_rs_pos = 0; /* in 1/AUDIN_RS_OUT of an input frame */
+static int g_rs_prev[2]; /* last input frame */
+static tsi16 g_rs_in[AUDIN_OPUS_MAX_FRAMES * 2];
+static tsi16 g_rs_out[AUDIN_OPUS_MAX_FRAMES * 2];
+#endif
 
 /*****************************************************************************/
 
@@ -128,9 +175,48 @@ cleanup_client_formats(void)
     }
     g_free(g_client_formats);
     g_client_formats = NULL;
+    g_num_client_formats = 0;
     return 0;
 }
 
+/*****************************************************************************/
+/* wFormatTag of the client format in use, or -1 if there isn't one */
+static int
+audin_current_format_tag(void)
+{
+    if ((g_current_format < 0) || (g_current_format >= g_num_client_formats))
+    {
+        return -1;
+    }
+    return g_client_formats[g_current_format]->wFormatTag;
+}
+
+/*****************************************************************************/
+static void
+audin_set_format(int aindex)
+{
+    g_current_format = aindex;
+#if defined(XRDP_OPUS)
+    g_rs_pos = 0;
+    g_rs_prev[0] = 0;
+    g_rs_prev[1] = 0;
+    /* don't carry decoder state over from an earlier Opus stream */
+    if (g_opus_decoder != NULL)
+    {
+        opus_decoder_ctl(g_opus_decoder, OPUS_RESET_STATE);
+    }
+#endif
+    if (audin_current_format_tag() == WAVE_FORMAT_OPUS)
+    {
+        g_in_fifo_prefill_bytes = (AUDIN_JITTER_MS *
+                                   g_pcm_44100.nAvgBytesPerSec / 1000) & ~3;
+    }
+    else
+    {
+        g_in_fifo_prefill_bytes = 0;
+    }
+}
+
 /*****************************************************************************/
 static int
 audin_send_version(int chan_id)
@@ -210,7 +296,9 @@ audin_send_open(int chan_id)
     init_stream(s, wf->cbSize + 64);
 
     out_uint8(s, MSG_SNDIN_OPEN);
-    out_uint32_le(s, 2048); /* FramesPerPacket */
+    out_uint32_le(s, (wf->wFormatTag == WAVE_FORMAT_OPUS) ?
+                  AUDIN_OPUS_FRAMES_PER_PACKET :
+                  AUDIN_FRAMES_PER_PACKET); /* FramesPerPacket */
     out_uint32_le(s, g_current_format); /* initialFormat */
     out_uint16_le(s, wf->wFormatTag);
     out_uint16_le(s, wf->nChannels);
@@ -275,6 +363,7 @@ audin_process_formats(int chan_id, struct stream *s)
         }
         wf = g_new0(struct xr_wave_format_ex, 1);
         g_client_formats[index] = wf;
+        g_num_client_formats = index + 1;
         in_uint16_le(s, wf->wFormatTag);
         in_uint16_le(s, wf->nChannels);
         in_uint32_le(s, wf->nSamplesPerSec);
@@ -304,6 +393,22 @@ audin_process_formats(int chan_id, struct stream *s)
             in_uint8a(s, wf->data, wf->cbSize);
         }
     }
+    if (g_num_client_formats < 1)
+    {
+        LOG(LOG_LEVEL_WARNING, "audin_process_formats: no formats in common "
+            "with the client");
+        return 0;
+    }
+    /* the client lists the server formats it supports, prefer Opus */
+    audin_set_format(0);
+    for (index = 0; index < g_num_client_formats; index++)
+    {
+        if (g_client_formats[index]->wFormatTag == WAVE_FORMAT_OPUS)
+        {
+            audin_set_format(index);
+            break;
+        }
+    }
     audin_send_open(chan_id);
     return 0;
 }
@@ -333,17 +438,33 @@ audin_process_incoming_data(int chan_id, struct stream *s)
 }
 
 /*****************************************************************************/
+/* PCM for the sound server source */
 static int
-audin_process_data(int chan_id, struct stream *s)
+audin_add_pcm(const char *data, int data_bytes)
 {
-    int data_bytes;
+    int max_bytes;
     struct stream *ls;
 
-    data_bytes = (int) (s->end - s->p);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "audin_process_data: data_bytes %d", data_bytes);
+    if (g_in_fifo_prefill_bytes > 0)
+    {
+        /* keep the latency down if the client sends faster than it's read */
+        max_bytes = AUDIN_JITTER_MAX_MS * g_pcm_44100.nAvgBytesPerSec / 1000;
+        while (g_bytes_in_fifo + data_bytes > max_bytes)
+        {
+            ls = (struct stream *) fifo_remove_item(g_in_fifo);
+            if (ls == NULL)
+            {
+                break;
+            }
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "audin_add_pcm: dropped %d bytes",
+                      ls->size);
+            g_bytes_in_fifo -= ls->size;
+            xstream_free(ls);
+        }
+    }
 
     xstream_new(ls, data_bytes);
-    g_memcpy(ls->data, s->p, data_bytes);
+    g_memcpy(ls->data, data, data_bytes);
     ls->p += data_bytes;
     s_mark_end(ls);
     fifo_add_item(g_in_fifo, (void *) ls);
@@ -352,19 +473,120 @@ audin_process_data(int chan_id, struct stream *s)
     return 0;
 }
 
+#if defined(XRDP_OPUS)
+
+/*****************************************************************************/
+/* linear interpolation from 48 kHz to 44.1 kHz stereo, carried over from
+   one call to the next
+   returns output frames */
+static int
+audin_resample(const tsi16 *in, int frames, tsi16 *out)
+{
+    int count;
+    int index;
+    int frac;
+    int ch;
+    int a;
+    int b;
+
+    /* g_rs_pos 0 is g_rs_prev, 1 is in[0] and so on */
+    count = 0;
+    while ((index = g_rs_pos / AUDIN_RS_OUT) < frames)
+    {
+        frac = g_rs_pos % AUDIN_RS_OUT;
+        for (ch = 0; ch < 2; ch++)
+        {
+            a = (index == 0) ? g_rs_prev[ch] : in[(index - 1) * 2 + ch];
+            b = in[index * 2 + ch];
+            out[count * 2 + ch] = a + (b - a) * frac / AUDIN_RS_OUT;
+        }
+        count++;
+        g_rs_pos += AUDIN_RS_IN;
+    }
+    g_rs_pos -= frames * AUDIN_RS_OUT;
+    if (frames > 0)
+    {
+        g_rs_prev[0] = in[(frames - 1) * 2];
+        g_rs_prev[1] = in[(frames - 1) * 2 + 1];
+    }
+    return count;
+}
+
+/*****************************************************************************/
+static int
+audin_process_opus_data(const char *data, int data_bytes)
+{
+    int error;
+    int frames;
+
+    if (g_opus_decoder == NULL)
+    {
+        g_opus_decoder = opus_decoder_create(48000, 2, &error);
+        if (g_opus_decoder == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "audin_process_opus_data: "
+                "opus_decoder_create failed: %s", opus_strerror(error));
+            return 0;
+        }
+    }
+    frames = opus_decode(g_opus_decoder, (const unsigned char *) data,
+                         data_bytes, g_rs_in, AUDIN_OPUS_MAX_FRAMES, 0);
+    if (frames < 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "audin_process_opus_data: opus_decode "
+                  "failed: %s", opus_strerror(frames));
+        return 0;
+    }
+    frames = audin_resample(g_rs_in, frames, g_rs_out);
+    return audin_add_pcm((const char *) g_rs_out, frames * 4);
+}
+
+/*****************************************************************************/
+static void
+audin_opus_destroy(void)
+{
+    if (g_opus_decoder != NULL)
+    {
+        opus_decoder_destroy(g_opus_decoder);
+        g_opus_decoder = NULL;
+    }
+}
+
+#endif
+
+/*****************************************************************************/
+static int
+audin_process_data(int chan_id, struct stream *s)
+{
+    int data_bytes;
+
+    data_bytes = (int) (s->end - s->p);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "audin_process_data: data_bytes %d", data_bytes);
+
+#if defined(XRDP_OPUS)
+    if (audin_current_format_tag() == WAVE_FORMAT_OPUS)
+    {
+        return audin_process_opus_data(s->p, data_bytes);
+    }
+#endif
+    return audin_add_pcm(s->p, data_bytes);
+}
+
 /*****************************************************************************/
 static int
 audin_process_format_change(int chan_id, struct stream *s)
 {
+    int format;
+
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_process_format_change:");
     if (!s_check_rem(s, 4))
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "audin_process_format_change: parse error");
         return 1;
     }
-    in_uint32_le(s, g_current_format);
-    LOG_DEVEL(LOG_LEVEL_INFO, "audin_process_format_change: g_current_format %d",
-              g_current_format);
+    in_uint32_le(s, format);
+    LOG_DEVEL(LOG_LEVEL_INFO, "audin_process_format_change: format %d", format);
+    audin_set_format(format);
     return 0;
 }
 
@@ -424,6 +646,10 @@ audin_close_response(int chan_id)
     cleanup_client_formats();
     free_stream(g_in_s);
     g_in_s = NULL;
+    g_in_fifo_prefill_bytes = 0;
+#if defined(XRDP_OPUS)
+    audin_opus_destroy();
+#endif
     return 0;
 }
 
@@ -506,6 +732,9 @@ int
 audin_deinit(void)
 {
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_deinit:");
+#if defined(XRDP_OPUS)
+    audin_opus_destroy();
+#endif
     return 0;
 }
 
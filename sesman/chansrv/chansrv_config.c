@@ -41,9 +41,22 @@
 #define DEFAULT_ENABLE_FUSE_MOUNT           1
 #define DEFAULT_FUSE_MOUNT_NAME             "xrdp-client"
 #define DEFAULT_FILE_UMASK                  077
+#define DEFAULT_FUSE_READ_AHEAD_KB          1024
+#define DEFAULT_FUSE_WRITE_BACK_KB          0
+#define MAX_FUSE_WRITE_BACK_KB              (64 * 1024)
+#define DEFAULT_FUSE_ATTR_CACHE_MS          2000
+#define DEFAULT_FUSE_NEGATIVE_CACHE_MS      1000
+#define DEFAULT_FUSE_CLIPBOARD_REQUESTS     4
 #define DEFAULT_USE_NAUTILUS3_FLIST_FORMAT  0
 #define DEFAULT_NUM_SILENT_FRAMES_AAC       4
 #define DEFAULT_NUM_SILENT_FRAMES_MP3       2
+#define DEFAULT_SOUND_LOW_LATENCY           0
+#define DEFAULT_SOUND_OPUS_FRAME_MS         20
+#define DEFAULT_SOUND_OPUS_BITRATE          0
+#define DEFAULT_SOUND_OPUS_COMPLEXITY       -1
+#define DEFAULT_SOUND_MAX_LATENCY_MS        100
+#define DEFAULT_SOUND_DYNAMIC_CHANNEL       0
+#define DEFAULT_SOUND_LOSSY_CHANNEL         0
 #define DEFAULT_MSEC_DO_NOT_SEND            1000
 /**
  * Type used for passing a logging function about
@@ -167,6 +180,38 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->file_umask = strtol(value, NULL, 0);
         }
+        else if (g_strcasecmp(name, "FuseReadAheadKB") == 0)
+        {
+            cfg->fuse_read_ahead_kb = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseWriteBackKB") == 0)
+        {
+            cfg->fuse_write_back_kb = strtoul(value, NULL, 0);
+            if (cfg->fuse_write_back_kb > MAX_FUSE_WRITE_BACK_KB)
+            {
+                /* the buffer goes to the client in one IRP_MJ_WRITE,
+                 * and its length must fit the int passed for that */
+                logmsg(LOG_LEVEL_WARNING, "FuseWriteBackKB is too big,"
+                       " using %d", MAX_FUSE_WRITE_BACK_KB);
+                cfg->fuse_write_back_kb = MAX_FUSE_WRITE_BACK_KB;
+            }
+        }
+        else if (g_strcasecmp(name, "FuseAttrCacheMs") == 0)
+        {
+            cfg->fuse_attr_cache_ms = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseNegativeCacheMs") == 0)
+        {
+            cfg->fuse_negative_cache_ms = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseClipboardRequests") == 0)
+        {
+            cfg->fuse_clipboard_requests = strtoul(value, NULL, 0);
+            if (cfg->fuse_clipboard_requests < 1)
+            {
+                cfg->fuse_clipboard_requests = 1;
+            }
+        }
         else if (g_strcasecmp(name, "UseNautilus3FlistFormat") == 0)
         {
             cfg->use_nautilus3_flist_format = g_text2bool(value);
@@ -183,6 +228,44 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->msec_do_not_send = strtoul(value, NULL, 0);
         }
+        else if (g_strcasecmp(name, "SoundLowLatency") == 0)
+        {
+            cfg->sound_low_latency = g_text2bool(value);
+        }
+        else if (g_strcasecmp(name, "SoundOpusFrameMs") == 0)
+        {
+            cfg->sound_opus_frame_ms = strtoul(value, NULL, 0);
+            if (cfg->sound_opus_frame_ms != 10 && cfg->sound_opus_frame_ms != 20)
+            {
+                logmsg(LOG_LEVEL_WARNING, "SoundOpusFrameMs must be 10 or 20,"
+                       " using %d", DEFAULT_SOUND_OPUS_FRAME_MS);
+                cfg->sound_opus_frame_ms = DEFAULT_SOUND_OPUS_FRAME_MS;
+            }
+        }
+        else if (g_strcasecmp(name, "SoundOpusBitrate") == 0)
+        {
+            cfg->sound_opus_bitrate = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "SoundOpusComplexity") == 0)
+        {
+            cfg->sound_opus_complexity = strtol(value, NULL, 0);
+            if (cfg->sound_opus_complexity > 10)
+            {
+                cfg->sound_opus_complexity = 10;
+            }
+        }
+        else if (g_strcasecmp(name, "SoundMaxLatencyMs") == 0)
+        {
+            cfg->sound_max_latency_ms = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "SoundDynamicChannel") == 0)
+        {
+            cfg->sound_dynamic_channel = g_text2bool(value);
+        }
+        else if (g_strcasecmp(name, "SoundLossyChannel") == 0)
+        {
+            cfg->sound_lossy_channel = g_text2bool(value);
+        }
     }
 
     return error;
@@ -213,10 +296,22 @@ new_config(void)
         cfg->restrict_inbound_clipboard = DEFAULT_RESTRICT_INBOUND_CLIPBOARD;
         cfg->fuse_mount_name = fuse_mount_name;
         cfg->file_umask = DEFAULT_FILE_UMASK;
+        cfg->fuse_read_ahead_kb = DEFAULT_FUSE_READ_AHEAD_KB;
+        cfg->fuse_write_back_kb = DEFAULT_FUSE_WRITE_BACK_KB;
+        cfg->fuse_attr_cache_ms = DEFAULT_FUSE_ATTR_CACHE_MS;
+        cfg->fuse_negative_cache_ms = DEFAULT_FUSE_NEGATIVE_CACHE_MS;
+        cfg->fuse_clipboard_requests = DEFAULT_FUSE_CLIPBOARD_REQUESTS;
         cfg->use_nautilus3_flist_format = DEFAULT_USE_NAUTILUS3_FLIST_FORMAT;
         cfg->num_silent_frames_aac = DEFAULT_NUM_SILENT_FRAMES_AAC;
         cfg->num_silent_frames_mp3 = DEFAULT_NUM_SILENT_FRAMES_MP3;
         cfg->msec_do_not_send = DEFAULT_MSEC_DO_NOT_SEND;
+        cfg->sound_low_latency = DEFAULT_SOUND_LOW_LATENCY;
+        cfg->sound_opus_frame_ms = DEFAULT_SOUND_OPUS_FRAME_MS;
+        cfg->sound_opus_bitrate = DEFAULT_SOUND_OPUS_BITRATE;
+        cfg->sound_opus_complexity = DEFAULT_SOUND_OPUS_COMPLEXITY;
+        cfg->sound_max_latency_ms = DEFAULT_SOUND_MAX_LATENCY_MS;
+        cfg->sound_dynamic_channel = DEFAULT_SOUND_DYNAMIC_CHANNEL;
+        cfg->sound_lossy_channel = DEFAULT_SOUND_LOSSY_CHANNEL;
     }
 
     return cfg;
@@ -301,6 +396,13 @@ config_dump(struct config_chansrv *config)
               g_bool2text(config->enable_fuse_mount));
     g_writeln("    FuseMountName:             %s", config->fuse_mount_name);
     g_writeln("    FileMask:                  0%o", config->file_umask);
+    g_writeln("    FuseReadAheadKB:           %u", config->fuse_read_ahead_kb);
+    g_writeln("    FuseWriteBackKB:           %u", config->fuse_write_back_kb);
+    g_writeln("    FuseAttrCacheMs:           %u", config->fuse_attr_cache_ms);
+    g_writeln("    FuseNegativeCacheMs:       %u",
+              config->fuse_negative_cache_ms);
+    g_writeln("    FuseClipboardRequests:     %u",
+              config->fuse_clipboard_requests);
     g_writeln("    Nautilus 3 Flist Format:   %s",
               g_bool2text(config->use_nautilus3_flist_format));
 }
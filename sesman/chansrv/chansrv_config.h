@@ -35,6 +35,16 @@ struct config_chansrv
     char *fuse_mount_name;
     /** FileUmask from sesman.ini */
     mode_t file_umask;
+    /** FuseReadAheadKB from sesman.ini, 0 to read only what is asked for */
+    unsigned int fuse_read_ahead_kb;
+    /** FuseWriteBackKB from sesman.ini, 0 to write through */
+    unsigned int fuse_write_back_kb;
+    /** FuseAttrCacheMs from sesman.ini, 0 to always ask the client */
+    unsigned int fuse_attr_cache_ms;
+    /** FuseNegativeCacheMs from sesman.ini, 0 to always ask the client */
+    unsigned int fuse_negative_cache_ms;
+    /** FuseClipboardRequests from sesman.ini, at least 1 */
+    unsigned int fuse_clipboard_requests;
 
     /** Whether to use nautilus3-compatible file lists for the clipboard */
     int use_nautilus3_flist_format;
@@ -44,6 +54,24 @@ struct config_chansrv
     unsigned int num_silent_frames_mp3;
     /** Do net send sound data afer SNDC_CLOSE is sent. unit is millisecond, setting from sesman.ini */
     unsigned int msec_do_not_send;
+
+    /** SoundLowLatency from sesman.ini, Opus in short frames when the
+        client can take it */
+    int sound_low_latency;
+    /** SoundOpusFrameMs from sesman.ini, 10 or 20 */
+    unsigned int sound_opus_frame_ms;
+    /** SoundOpusBitrate from sesman.ini in bits/s, 0 for the default */
+    unsigned int sound_opus_bitrate;
+    /** SoundOpusComplexity from sesman.ini, 0 to 10, -1 for the default */
+    int sound_opus_complexity;
+    /** SoundMaxLatencyMs from sesman.ini, aimed for in low latency mode */
+    unsigned int sound_max_latency_ms;
+    /** SoundDynamicChannel from sesman.ini, sound out over a dynamic
+        channel if the client has one */
+    int sound_dynamic_channel;
+    /** SoundLossyChannel from sesman.ini, try AUDIO_PLAYBACK_LOSSY_DVC
+        first */
+    int sound_lossy_channel;
 };
 
 
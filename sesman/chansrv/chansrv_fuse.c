@@ -176,6 +176,16 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #define XFUSE_ATTR_TIMEOUT      5.0
 #define XFUSE_ENTRY_TIMEOUT     5.0
 
+/* read-ahead of files on redirected drives, see xfuse_ra_read() */
+#define XFUSE_RA_BLOCK_SIZE     (64 * 1024)
+/* sequential reads in a row before reading ahead */
+#define XFUSE_RA_SEQ_THRESHOLD  2
+
+/* write-back of files on redirected drives, see xfuse_wb_write() */
+#define XFUSE_WB_TIMEOUT_MS     500
+/* IRP_MJ_WRITEs in flight before a write waits for one to complete */
+#define XFUSE_WB_MAX_IN_FLIGHT  4
+
 
 /* Type of buffer used for fuse_add_direntry() calls */
 struct dirbuf1
@@ -252,6 +262,8 @@ struct state_create
 struct state_read
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
+    struct xfuse_read_ahead *ra;  /* Read-ahead this is for, or NULL    */
+    struct xfuse_ra_block *block; /* Block of ra being read             */
 };
 
 /*
@@ -261,6 +273,7 @@ struct state_write
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
     fuse_ino_t        inum;       /* inum of file we're writing         */
+    struct xfuse_write_back *wb;  /* Write-back this is for, or NULL    */
 };
 
 /*
@@ -307,22 +320,128 @@ struct xfuse_handle
      *       fields of this structure contain invalid values.
      */
     struct xfs_dir_handle *dir_handle;
+
+    /* read-ahead for a file on a redirected drive, NULL until it's read */
+    struct xfuse_read_ahead *ra;
+
+    /* write-back for a file on a redirected drive, NULL to write through */
+    struct xfuse_write_back *wb;
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
+enum xfuse_ra_block_state
+{
+    RA_BLOCK_EMPTY = 0,
+    RA_BLOCK_PENDING,             /* IRP_MJ_READ sent to the client     */
+    RA_BLOCK_VALID,
+    RA_BLOCK_FAILED
+};
+
+/*
+ * A block of a file read ahead of the reader
+ */
+struct xfuse_ra_block
+{
+    off_t             off;        /* Multiple of XFUSE_RA_BLOCK_SIZE    */
+    enum xfuse_ra_block_state state;
+    int               stale;      /* Written to while pending           */
+    size_t            len;        /* Less than the block size at EOF    */
+    unsigned int      last_used;  /* For finding the LRU block          */
+    char             *data;
+};
+
+/*
+ * A FUSE read waiting for read-ahead blocks to come in
+ */
+struct xfuse_ra_wait
+{
+    fuse_req_t        req;
+    off_t             off;
+    size_t            size;
+};
+
+/*
+ * Read-ahead state of a file open on a redirected drive. Once the file is
+ * read sequentially, blocks ahead of the reader are requested with
+ * several IRP_MJ_READs in flight, and the window grows while the reading
+ * stays sequential. Reads are answered from the blocks where possible.
+ *
+ * Files in the .clipboard dir are read ahead in the same way, with
+ * CLIPRDR_FILECONTENTS_REQUESTs in place of the IRP_MJ_READs.
+ *
+ * The handle can be released with blocks still in flight, so this is
+ * freed when both have happened.
+ */
+struct xfuse_read_ahead
+{
+    fuse_ino_t        inum;
+    tui32             DeviceId;
+    tui32             FileId;
+    int               is_loc_resource; /* File in .clipboard dir       */
+    int               lindex;     /* Of a file in .clipboard dir        */
+    int               released;   /* The handle has gone                */
+    int               in_flight;  /* Blocks not back from the client    */
+    off_t             next_off;   /* Where a sequential read starts     */
+    int               seq_count;  /* Sequential reads in a row          */
+    int               window;     /* Blocks to keep ahead of the reader */
+    unsigned int      clock;      /* For last_used                      */
+    int               num_blocks;
+    struct xfuse_ra_block *blocks;
+    struct list      *waits;      /* struct xfuse_ra_wait *             */
+};
+
+/*
+ * Write-back state of a file open for writing on a redirected drive.
+ * Contiguous writes are collected in a buffer and answered at once. The
+ * buffer is sent as one IRP_MJ_WRITE when it's full, when a write isn't
+ * contiguous, after XFUSE_WB_TIMEOUT_MS, or on a flush, fsync or release.
+ * A failed IRP_MJ_WRITE is reported to the next flush or fsync.
+ *
+ * On release, the close is held back until the writes in flight are
+ * complete, and this is freed with it.
+ */
+struct xfuse_wb_blocked
+{
+    fuse_req_t        req;
+    size_t            size;
+};
+
+struct xfuse_write_back
+{
+    fuse_ino_t        inum;
+    tui32             DeviceId;
+    tui32             FileId;
+    char             *buf;
+    size_t            size;       /* Size of buf                        */
+    off_t             off;        /* File offset of buf                 */
+    size_t            len;        /* Bytes in buf                       */
+    unsigned int      deadline;   /* g_time3() when buf is sent         */
+    int               in_flight;  /* IRP_MJ_WRITEs not complete         */
+    int               error;      /* errno to report, or 0              */
+    struct list      *blocked;    /* struct xfuse_wb_blocked * of writes
+                                     waiting for in_flight to drop      */
+    struct list      *waits;      /* fuse_req_t of flushes and fsyncs   */
+    struct state_close *close;    /* Held back close, or NULL           */
+    int               orphaned;   /* FUSE has gone, free when complete  */
+};
+
 /* used for file data request sent to client */
 struct req_list_item
 {
-    fuse_req_t req;
+    struct state_read *fip;
     int stream_id;
     int lindex;
     int off;
     int size;
+    int sent; /* CLIPRDR_FILECONTENTS_REQUEST sent to the client */
 };
 
 extern struct config_chansrv *g_cfg; /* in chansrv.c */
 
 static struct list *g_req_list = 0;
+static int g_clip_stream_id = 0;             /* last streamId sent          */
+static struct list *g_ra_list = 0;           /* struct xfuse_read_ahead *   */
+static struct list *g_wb_list = 0;           /* struct xfuse_write_back *   */
 static struct xfs_fs *g_xfs;                 /* an inst of xrdp file system */
 static ino_t g_clipboard_inum;               /* inode of clipboard dir      */
 static char *g_mount_point = 0;              /* our FUSE mount point        */
@@ -386,10 +505,11 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
                             const char *name, mode_t mode,
                             struct fuse_file_info *fi);
 
-#if 0
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi);
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi);
-#endif
 
 static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                              int to_set, struct fuse_file_info *fi);
@@ -400,6 +520,19 @@ static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
 static void xfuse_cb_releasedir(fuse_req_t req, fuse_ino_t ino,
                                 struct fuse_file_info *fi);
 
+/* reads of files in the .clipboard dir */
+static void xfuse_clip_send_requests(void);
+
+/* read-ahead */
+static void xfuse_ra_release(struct xfuse_read_ahead *ra);
+
+/* write-back */
+static struct xfuse_write_back *xfuse_wb_create(XFUSE_HANDLE *fh,
+        fuse_ino_t inum, int flags);
+static void xfuse_wb_delete(struct xfuse_write_back *wb);
+static void xfuse_wb_send(struct xfuse_write_back *wb);
+static void xfuse_wb_send_inode(fuse_ino_t inum);
+
 /* miscellaneous functions */
 static void xfs_inode_to_fuse_entry_param(const XFS_INODE *xinode,
         struct fuse_entry_param *e);
@@ -437,7 +570,7 @@ xfuse_handle_delete(XFUSE_HANDLE *self)
 
     if (self->dir_handle != NULL)
     {
-        free(self->dir_handle);
+        xfs_closedir(g_xfs, self->dir_handle);
     }
     free(self);
 }
@@ -599,7 +732,8 @@ xfuse_init(void)
     g_xfuse_ops.read        = xfuse_cb_read;
     g_xfuse_ops.write       = xfuse_cb_write;
     g_xfuse_ops.create      = xfuse_cb_create;
-    //g_xfuse_ops.fsync     = xfuse_cb_fsync; /* LK_TODO delete this */
+    g_xfuse_ops.flush       = xfuse_cb_flush;
+    g_xfuse_ops.fsync       = xfuse_cb_fsync;
     g_xfuse_ops.getattr     = xfuse_cb_getattr;
     g_xfuse_ops.setattr     = xfuse_cb_setattr;
     g_xfuse_ops.opendir     = xfuse_cb_opendir;
@@ -654,6 +788,40 @@ xfuse_deinit(void)
         g_req_list = 0;
     }
 
+    if (g_ra_list != 0)
+    {
+        /* anything still in flight is freed when it comes back */
+        while (g_ra_list->count > 0)
+        {
+            xfuse_ra_release((struct xfuse_read_ahead *)
+                             list_get_item(g_ra_list, 0));
+        }
+        list_delete(g_ra_list);
+        g_ra_list = 0;
+    }
+
+    if (g_wb_list != 0)
+    {
+        /* anything buffered can't be sent now, and anything still in
+         * flight is freed when it comes back */
+        while (g_wb_list->count > 0)
+        {
+            struct xfuse_write_back *wb;
+            wb = (struct xfuse_write_back *) list_get_item(g_wb_list, 0);
+            list_remove_item(g_wb_list, 0);
+            if (wb->in_flight == 0)
+            {
+                xfuse_wb_delete(wb);
+            }
+            else
+            {
+                wb->orphaned = 1;
+            }
+        }
+        list_delete(g_wb_list);
+        g_wb_list = 0;
+    }
+
     xfuse_deinit_xrdp_fs();
 
     g_xfuse_inited = 0;
@@ -668,13 +836,27 @@ xfuse_deinit(void)
 int xfuse_check_wait_objs(void)
 {
     struct fuse_chan *tmpch;
+    struct xfuse_write_back *wb;
+    unsigned int      now;
     int               rval;
+    int               index;
 
     if (g_ch == 0)
     {
         return 0;
     }
 
+    /* send write-back buffers which have waited long enough */
+    now = g_time3();
+    for (index = 0; index < g_wb_list->count; index++)
+    {
+        wb = (struct xfuse_write_back *) list_get_item(g_wb_list, index);
+        if (wb->len > 0 && (int) (wb->deadline - now) <= 0)
+        {
+            xfuse_wb_send(wb);
+        }
+    }
+
     if (g_sck_can_recv(g_fd, 0))
     {
         tmpch = g_ch;
@@ -709,7 +891,11 @@ int xfuse_check_wait_objs(void)
 
 int xfuse_get_wait_objs(tbus *objs, int *count, int *timeout)
 {
+    struct xfuse_write_back *wb;
+    unsigned int now;
     int lcount;
+    int index;
+    int left;
 
     if (g_ch == 0)
     {
@@ -721,6 +907,21 @@ int xfuse_get_wait_objs(tbus *objs, int *count, int *timeout)
     lcount++;
     *count = lcount;
 
+    /* wake up to send write-back buffers */
+    now = g_time3();
+    for (index = 0; index < g_wb_list->count; index++)
+    {
+        wb = (struct xfuse_write_back *) list_get_item(g_wb_list, index);
+        if (wb->len > 0)
+        {
+            left = MAX((int) (wb->deadline - now), 1);
+            if (*timeout < 1 || left < *timeout)
+            {
+                *timeout = left;
+            }
+        }
+    }
+
     return 0;
 }
 
@@ -790,6 +991,8 @@ int xfuse_clear_clip_dir(void)
 /**
  * Return clipboard data to fuse
  *
+ * data_bytes is -1 if the client failed the request
+ *
  * @return 0 on success, -1 on failure
  *****************************************************************************/
 
@@ -799,36 +1002,58 @@ xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: stream_id=%d data_bytes=%d", stream_id, data_bytes);
 
     struct req_list_item *rli;
+    struct req_list_item *oldest;
+    int index;
+    int found;
 
-    if ((rli = (struct req_list_item *) list_get_item(g_req_list, 0)) == NULL)
+    if (g_req_list == NULL)
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
         return -1;
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "lindex=%d off=%d size=%d", rli->lindex, rli->off, rli->size);
-
-    fuse_reply_buf(rli->req, data, data_bytes);
-
-    list_remove_item(g_req_list, 0);
-    if (g_req_list->count <= 0)
+    /* the request with this streamId, or the oldest one sent if the
+       client didn't send it back */
+    found = -1;
+    oldest = NULL;
+    for (index = 0; index < g_req_list->count; index++)
     {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "completed all requests");
-        return 0;
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        if (!rli->sent)
+        {
+            continue;
+        }
+        if (oldest == NULL)
+        {
+            oldest = rli;
+            found = index;
+        }
+        if (rli->stream_id == stream_id)
+        {
+            found = index;
+            break;
+        }
     }
-
-    /* send next request */
-    rli = (struct req_list_item *) list_get_item(g_req_list, 0);
-    if (rli == NULL)
+    if (found < 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
         return -1;
     }
+    rli = (struct req_list_item *) list_get_item(g_req_list, found);
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "lindex=%d off=%d size=%d", rli->lindex, rli->off, rli->size);
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data");
+    if (data_bytes < 0)
+    {
+        xfuse_devredir_cb_read_file(rli->fip, STATUS_UNSUCCESSFUL, NULL, 0);
+    }
+    else
+    {
+        xfuse_devredir_cb_read_file(rli->fip, STATUS_SUCCESS, data,
+                                    MIN(data_bytes, rli->size));
+    }
+    list_remove_item(g_req_list, found);
 
-    clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                rli->off, rli->size);
+    xfuse_clip_send_requests();
 
     return 0;
 }
@@ -938,6 +1163,9 @@ static int xfuse_init_lib(struct fuse_args *args)
     g_req_list = list_create();
     g_req_list->auto_free = 1;
 
+    g_ra_list = list_create();
+    g_wb_list = list_create();
+
     return 0;
 }
 
@@ -1056,6 +1284,9 @@ void xfuse_devredir_cb_enum_dir_add_entry(
                 xinode->ctime = fattr->mtime;
 
                 /* device_id is inherited from parent */
+
+                /* a lookup of this can use what we've got */
+                xfs_set_attr_fresh(g_xfs, xinode->inum);
             }
         }
     }
@@ -1105,6 +1336,7 @@ void xfuse_devredir_cb_enum_dir_done(struct state_dirscan *fip,
         }
         else
         {
+            xfs_set_listing_fresh(g_xfs, fip->pinum);
             fi->fh = xfuse_handle_to_fuse_handle(xhandle);
             fuse_reply_open(fip->req, &fip->fi);
         }
@@ -1149,6 +1381,7 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
                 {
                     xfs_remove_entry(g_xfs, fip->existing_inum);
                 }
+                xfs_add_negative(g_xfs, fip->pinum, fip->name);
                 fuse_reply_err(fip->req, ENOENT);
                 break;
 
@@ -1229,6 +1462,7 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
         }
         if (xinode != NULL)
         {
+            xfs_set_attr_fresh(g_xfs, xinode->inum);
             make_fuse_entry_reply(fip->req, xinode);
         }
         else
@@ -1367,6 +1601,7 @@ void xfuse_devredir_cb_create_file(struct state_create *fip,
             else
             {
 
+                xfs_set_attr_fresh(g_xfs, xinode->inum);
                 if ((fip->mode & S_IFDIR) != 0)
                 {
                     make_fuse_entry_reply(fip->req, xinode);
@@ -1374,6 +1609,7 @@ void xfuse_devredir_cb_create_file(struct state_create *fip,
                 else
                 {
                     struct fuse_entry_param  e;
+                    fh->wb = xfuse_wb_create(fh, xinode->inum, fip->fi.flags);
                     xfs_inode_to_fuse_entry_param(xinode, &e);
                     fuse_reply_create(fip->req, &e, &fip->fi);
                     xfs_increment_file_open_count(g_xfs, xinode->inum);
@@ -1426,6 +1662,7 @@ void xfuse_devredir_cb_open_file(struct state_open *fip,
             /* save file handle for later use */
             fh->DeviceId = DeviceId;
             fh->FileId = FileId;
+            fh->wb = xfuse_wb_create(fh, fip->inum, fip->fi.flags);
 
             fip->fi.fh = xfuse_handle_to_fuse_handle(fh);
 
@@ -1443,166 +1680,1036 @@ void xfuse_devredir_cb_open_file(struct state_open *fip,
     free(fip);
 }
 
-void xfuse_devredir_cb_read_file(struct state_read *fip,
-                                 enum NTSTATUS IoStatus,
-                                 const char *buf, size_t length)
-{
-    if (IoStatus != STATUS_SUCCESS)
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
-        fuse_reply_err(fip->req, EIO);
-    }
-    else
-    {
-        fuse_reply_buf(fip->req, buf, length);
-    }
-    free(fip);
-}
+/******************************************************************************
+**                                                                           **
+**                  write-back of files on redirected drives                 **
+**                                                                           **
+******************************************************************************/
 
-void xfuse_devredir_cb_write_file(
-    struct state_write *fip,
-    enum NTSTATUS IoStatus,
-    off_t offset,
-    size_t length)
+/**
+ * Creates the write-back state of a file being opened
+ *
+ * @return NULL if the file is to be written through
+ *****************************************************************************/
+
+static struct xfuse_write_back *
+xfuse_wb_create(XFUSE_HANDLE *fh, fuse_ino_t inum, int flags)
 {
-    XFS_INODE   *xinode;
+    struct xfuse_write_back *wb;
+    int sync_flags;
 
-    if (IoStatus != STATUS_SUCCESS)
+    sync_flags = O_SYNC;
+#ifdef O_DSYNC
+    sync_flags |= O_DSYNC;
+#endif
+#ifdef O_DIRECT
+    sync_flags |= O_DIRECT;
+#endif
+    if (g_cfg->fuse_write_back_kb == 0 || g_wb_list == NULL ||
+            (flags & O_ACCMODE) == O_RDONLY || (flags & sync_flags) != 0)
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
-        fuse_reply_err(fip->req, EIO);
+        return NULL;
     }
-    else
+    wb = g_new0(struct xfuse_write_back, 1);
+    if (wb != NULL)
     {
-        off_t new_size = offset + length;
-        fuse_reply_write(fip->req, length);
-
-        /* update file size */
-        if ((xinode = xfs_get(g_xfs, fip->inum)) != NULL)
-        {
-            if (new_size > xinode->size)
-            {
-                xinode->size = new_size;
-            }
-        }
-        else
+        wb->size = (size_t) g_cfg->fuse_write_back_kb * 1024;
+        wb->buf = g_new(char, wb->size);
+        wb->waits = list_create();
+        wb->blocked = list_create();
+        if (wb->buf == NULL || wb->waits == NULL || wb->blocked == NULL)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is invalid", fip->inum);
+            free(wb->buf);
+            list_delete(wb->waits);
+            list_delete(wb->blocked);
+            free(wb);
+            return NULL;
         }
+        wb->blocked->auto_free = 1;
+        wb->inum = inum;
+        wb->DeviceId = fh->DeviceId;
+        wb->FileId = fh->FileId;
+        list_add_item(g_wb_list, (tintptr) wb);
     }
-
-    free(fip);
+    return wb;
 }
 
-void xfuse_devredir_cb_rmdir_or_file(struct state_remove *fip,
-                                     enum NTSTATUS IoStatus)
+/*****************************************************************************/
+static void
+xfuse_wb_delete(struct xfuse_write_back *wb)
 {
-    XFS_INODE   *xinode = xfs_get(g_xfs, fip->inum);
+    int index;
 
-    switch (IoStatus)
+    if (g_wb_list != NULL &&
+            (index = list_index_of(g_wb_list, (tintptr) wb)) >= 0)
     {
-        case STATUS_SUCCESS:
-        case STATUS_NO_SUCH_FILE:
-            xfs_remove_entry(g_xfs, xinode->inum); /* Remove local copy */
-            fuse_reply_err(fip->req, 0);
-            break;
+        list_remove_item(g_wb_list, index);
+    }
+    list_delete(wb->waits);
+    list_delete(wb->blocked);
+    free(wb->buf);
+    free(wb);
+}
 
-        case STATUS_SHARING_VIOLATION:
-        case STATUS_ACCESS_DENIED:
-            fuse_reply_err(fip->req, EACCES);
-            break;
+/**
+ * Sends what is in the buffer to the client
+ *****************************************************************************/
 
-        default:
-            LOG_DEVEL(LOG_LEVEL_INFO, "Error code %08x - fallthrough", (int) IoStatus);
-            fuse_reply_err(fip->req, EBADF);
-            break;
+static void
+xfuse_wb_send(struct xfuse_write_back *wb)
+{
+    struct state_write *fusep;
+    size_t len;
+
+    if (wb->len == 0)
+    {
+        return;
     }
-    free(fip);
+    len = wb->len;
+    wb->len = 0;
+    if ((fusep = g_new0(struct state_write, 1)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        wb->error = (wb->error != 0) ? wb->error : ENOMEM;
+        return;
+    }
+    fusep->inum = wb->inum;
+    fusep->wb = wb;
+    wb->in_flight++;
+
+    /*
+     * The buffer is copied before this returns. Further processing
+     * happens in xfuse_devredir_cb_write_file()
+     */
+    devredir_file_write(fusep, wb->DeviceId, wb->FileId, wb->buf,
+                        len, wb->off);
 }
 
-void xfuse_devredir_cb_rename_file(struct state_rename *fip,
-                                   enum NTSTATUS IoStatus)
+/**
+ * Sends the write-back buffers of a file so that the client sees them
+ * before another request for the file
+ *****************************************************************************/
+
+static void
+xfuse_wb_send_inode(fuse_ino_t inum)
 {
-    int status;
+    struct xfuse_write_back *wb;
+    int index;
 
-    if (IoStatus != STATUS_SUCCESS)
+    if (g_wb_list == NULL)
     {
-        status =
-            (IoStatus == STATUS_SHARING_VIOLATION) ? EBUSY  :
-            (IoStatus == STATUS_ACCESS_DENIED)     ? EACCES :
-            /* default */                        EEXIST ;
+        return;
     }
-    else
+    for (index = 0; index < g_wb_list->count; index++)
     {
-        status = xfs_move_entry(g_xfs, fip->pinum,
-                                fip->new_pinum, fip->name);
+        wb = (struct xfuse_write_back *) list_get_item(g_wb_list, index);
+        if (wb->inum == inum)
+        {
+            xfuse_wb_send(wb);
+        }
     }
-
-    fuse_reply_err(fip->req, status);
-    free(fip);
 }
 
-void xfuse_devredir_cb_file_close(struct state_close *fip)
+/**
+ * Sends the close held back by xfuse_wb_release() and frees wb
+ *****************************************************************************/
+
+static void
+xfuse_wb_close(struct xfuse_write_back *wb)
 {
-    fuse_reply_err(fip->req, 0);
-    xfs_decrement_file_open_count(g_xfs, fip->inum);
+    struct state_close *fip = wb->close;
 
-    free(fip);
+    /*
+     * If this call succeeds, further request processing happens in
+     * xfuse_devredir_cb_file_close()
+     */
+    if (devredir_file_close(fip, wb->DeviceId, wb->FileId))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
+        fuse_reply_err(fip->req, EREMOTEIO);
+        free(fip);
+    }
+    xfuse_wb_delete(wb);
 }
 
-/*
- * Determine is a file is in the FUSE filesystem
- *
- * The whole purpose of this function is to avoid deadlocks. If we try
- * to determine the size (or any other attribute) of a file in the FUSE
- * filesystem, the kernel will block the calling thread and send a message
- * to libfuse. Since we're single-threaded, this will result in deadlock.
- *
- * Ideally we'd use a stat() of the file to compare with a stat() of
- * the mountpoint. This won't work however, for the reasons outline above.
+/**
+ * Buffers a write to a file on a redirected drive
  *
- * A simple implementation might be to compare the start of the filename
- * with the FUSE mount point. This will work, but can easily be defeated,
- * (perhaps unintentionally) by symlinks in the path.
+ * The write is answered straight away, unless XFUSE_WB_MAX_IN_FLIGHT
+ * writes are in flight, when it's answered as one of them completes.
  *
- * The approach taken here is to record the basename of the FUSE mount
- * point directory (e.g. 'thinclient_drives') and look for that in the
- * passed-in filename as a directory element. If we find it, we look
- * at the device name and inode number of the parent directory of the
- * FUSE mount point. If these match we consider the filename to be in
- * the FUSE filesystem.
- */
-int xfuse_path_in_xfuse_fs(const char *path)
+ * @return 0 if the write has been taken, or nonzero if it's bigger
+ *         than the buffer and must be written through
+ *****************************************************************************/
+
+static int
+xfuse_wb_write(struct xfuse_write_back *wb, fuse_req_t req,
+               const char *buf, size_t size, off_t off)
 {
-    char *wpath = NULL; /* Writeable copy of path */
-    char *p;
-    int blen = g_strlen(g_fuse_root_path_basename);
-    int rv = 0;
+    XFS_INODE *xinode;
+    struct xfuse_wb_blocked *blocked;
 
-    if ((wpath = g_strdup(path)) == NULL)
+    if (wb->len > 0 &&
+            (off != wb->off + (off_t) wb->len || wb->len + size > wb->size))
     {
-        LOG(LOG_LEVEL_ERROR, "system out of memory");
+        xfuse_wb_send(wb);
     }
-    else
+    if (size > wb->size)
     {
-        /* Look ahead in the string for the basename of the FUSE mount point */
-        for (p = wpath;
-                (p = g_strstr(p, g_fuse_root_path_basename)) != NULL ;
-                p = p + 1)
-        {
-            /* Is this string preceded by a '/' ? */
-            if (p == wpath || *(p - 1) != '/')
-            {
-                continue;
-            }
+        return 1;
+    }
+    if (wb->len == 0)
+    {
+        wb->off = off;
+        wb->deadline = g_time3() + XFUSE_WB_TIMEOUT_MS;
+    }
+    g_memcpy(wb->buf + wb->len, buf, size);
+    wb->len += size;
 
-            /* Is the string followed by a '/' or '\0' ? We know it's
-             * valid to look ahead this far in the string, as g_strstr()
-             * tells us it is */
-            if (*(p + blen) != '/' && *(p + blen) != '\0')
-            {
-                continue;
-            }
+    /* the file grows now, as far as FUSE is concerned */
+    if ((xinode = xfs_get(g_xfs, wb->inum)) != NULL &&
+            off + (off_t) size > xinode->size)
+    {
+        xinode->size = off + size;
+    }
+
+    if (wb->len == wb->size)
+    {
+        xfuse_wb_send(wb);
+    }
+    if (wb->in_flight >= XFUSE_WB_MAX_IN_FLIGHT || wb->blocked->count > 0)
+    {
+        /* several writes on a handle can be waiting, from threads or
+         * processes sharing it, or mmap writeback */
+        blocked = g_new0(struct xfuse_wb_blocked, 1);
+        if (blocked == NULL)
+        {
+            /* it's in the buffer, so it can only go ahead */
+            fuse_reply_write(req, size);
+            return 0;
+        }
+        blocked->req = req;
+        blocked->size = size;
+        list_add_item(wb->blocked, (tintptr) blocked);
+    }
+    else
+    {
+        fuse_reply_write(req, size);
+    }
+    return 0;
+}
+
+/**
+ * Answers a flush or fsync once everything written has completed
+ *****************************************************************************/
+
+static void
+xfuse_wb_sync(struct xfuse_write_back *wb, fuse_req_t req)
+{
+    xfuse_wb_send(wb);
+    if (wb->in_flight > 0)
+    {
+        list_add_item(wb->waits, (tintptr) req);
+    }
+    else
+    {
+        fuse_reply_err(req, wb->error);
+        wb->error = 0;
+    }
+}
+
+/**
+ * The handle of a file with write-back state is going
+ *
+ * @param fip Close to send once the writes in flight are complete
+ *****************************************************************************/
+
+static void
+xfuse_wb_release(struct xfuse_write_back *wb, struct state_close *fip)
+{
+    xfuse_wb_send(wb);
+    wb->close = fip;
+    if (wb->in_flight == 0)
+    {
+        xfuse_wb_close(wb);
+    }
+}
+
+/**
+ * A write-back IRP_MJ_WRITE is complete
+ *****************************************************************************/
+
+static void
+xfuse_wb_write_done(struct xfuse_write_back *wb, enum NTSTATUS IoStatus)
+{
+    int index;
+    struct xfuse_wb_blocked *blocked;
+
+    wb->in_flight--;
+    if (wb->orphaned)
+    {
+        if (wb->in_flight == 0)
+        {
+            xfuse_wb_delete(wb);
+        }
+        return;
+    }
+    if (IoStatus != STATUS_SUCCESS)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
+        if (wb->error == 0)
+        {
+            wb->error = EIO;
+        }
+    }
+    if (wb->in_flight < XFUSE_WB_MAX_IN_FLIGHT)
+    {
+        /* the data of these is in the buffer already, answer them in
+         * the order they came */
+        for (index = 0; index < wb->blocked->count; index++)
+        {
+            blocked = (struct xfuse_wb_blocked *)
+                      list_get_item(wb->blocked, index);
+            fuse_reply_write(blocked->req, blocked->size);
+        }
+        list_clear(wb->blocked);
+    }
+    if (wb->in_flight > 0)
+    {
+        return;
+    }
+    if (wb->waits->count > 0)
+    {
+        for (index = 0; index < wb->waits->count; index++)
+        {
+            fuse_reply_err((fuse_req_t) list_get_item(wb->waits, index),
+                           wb->error);
+        }
+        list_clear(wb->waits);
+        wb->error = 0;
+    }
+    if (wb->close != NULL)
+    {
+        xfuse_wb_close(wb);
+    }
+}
+
+/*****************************************************************************/
+/******************************************************************************
+**                                                                           **
+**                   reads of files in the .clipboard dir                    **
+**                                                                           **
+******************************************************************************/
+
+/**
+ * Sends the queued requests for clipboard file data, keeping up to
+ * FuseClipboardRequests of them in flight
+ *****************************************************************************/
+
+static void
+xfuse_clip_send_requests(void)
+{
+    struct req_list_item *rli;
+    unsigned int sent;
+    int index;
+
+    sent = 0;
+    for (index = 0; index < g_req_list->count; index++)
+    {
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        if (rli->sent)
+        {
+            sent++;
+        }
+    }
+    for (index = 0; index < g_req_list->count; index++)
+    {
+        if (sent >= g_cfg->fuse_clipboard_requests)
+        {
+            break;
+        }
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        if (rli->sent)
+        {
+            continue;
+        }
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data stream_id = %d "
+                  "lindex = %d off = %d size = %d",
+                  rli->stream_id, rli->lindex, rli->off, rli->size);
+        rli->sent = 1;
+        sent++;
+        clipboard_request_file_data(rli->stream_id, rli->lindex,
+                                    rli->off, rli->size);
+    }
+}
+
+/**
+ * Reads part of a file in the .clipboard dir from the client
+ *
+ * The reply is made by xfuse_devredir_cb_read_file() when the data is in,
+ * as for a file on a redirected drive.
+ *****************************************************************************/
+
+static void
+xfuse_clip_read(struct state_read *fip, int lindex, size_t size, off_t off)
+{
+    struct req_list_item *rli;
+
+    if ((rli = g_new0(struct req_list_item, 1)) == NULL)
+    {
+        xfuse_devredir_cb_read_file(fip, STATUS_UNSUCCESSFUL, NULL, 0);
+        return;
+    }
+    /* a streamId for each request, so the responses can be told apart */
+    g_clip_stream_id = (g_clip_stream_id % 0x7fffffff) + 1;
+    rli->fip = fip;
+    rli->stream_id = g_clip_stream_id;
+    rli->lindex = lindex;
+    rli->off = (int) off;
+    rli->size = (int) size;
+    list_add_item(g_req_list, (tbus) rli);
+    xfuse_clip_send_requests();
+}
+
+/*****************************************************************************/
+/******************************************************************************
+**                                                                           **
+**                  read-ahead of files on redirected drives                 **
+**                                                                           **
+******************************************************************************/
+
+/**
+ * Creates the read-ahead state of an open file
+ *
+ * @return NULL if read-ahead is off or there's no memory
+ *****************************************************************************/
+
+static struct xfuse_read_ahead *
+xfuse_ra_create(XFUSE_HANDLE *fh, fuse_ino_t inum)
+{
+    struct xfuse_read_ahead *ra;
+    XFS_INODE *xinode;
+    int num_blocks;
+
+    num_blocks = g_cfg->fuse_read_ahead_kb / (XFUSE_RA_BLOCK_SIZE / 1024);
+    if (num_blocks < 2 || g_ra_list == NULL)
+    {
+        return NULL;
+    }
+    ra = g_new0(struct xfuse_read_ahead, 1);
+    if (ra != NULL)
+    {
+        ra->blocks = g_new0(struct xfuse_ra_block, num_blocks);
+        ra->waits = list_create();
+        if (ra->blocks == NULL || ra->waits == NULL)
+        {
+            free(ra->blocks);
+            list_delete(ra->waits);
+            free(ra);
+            return NULL;
+        }
+        ra->waits->auto_free = 1;
+        ra->inum = inum;
+        ra->DeviceId = fh->DeviceId;
+        ra->FileId = fh->FileId;
+        if (fh->is_loc_resource)
+        {
+            xinode = xfs_get(g_xfs, inum);
+            ra->is_loc_resource = 1;
+            ra->lindex = (xinode != NULL) ? xinode->lindex : 0;
+        }
+        ra->num_blocks = num_blocks;
+        list_add_item(g_ra_list, (tintptr) ra);
+    }
+    return ra;
+}
+
+/*****************************************************************************/
+static void
+xfuse_ra_delete(struct xfuse_read_ahead *ra)
+{
+    int index;
+
+    for (index = 0; index < ra->num_blocks; index++)
+    {
+        free(ra->blocks[index].data);
+    }
+    free(ra->blocks);
+    list_delete(ra->waits);
+    free(ra);
+}
+
+/**
+ * The handle of a file with read-ahead state is going
+ *****************************************************************************/
+
+static void
+xfuse_ra_release(struct xfuse_read_ahead *ra)
+{
+    struct xfuse_ra_wait *wait;
+    int index;
+
+    if (ra == NULL)
+    {
+        return;
+    }
+    /* FUSE doesn't release a file while reads are running, but be sure */
+    for (index = 0; index < ra->waits->count; index++)
+    {
+        wait = (struct xfuse_ra_wait *) list_get_item(ra->waits, index);
+        fuse_reply_err(wait->req, EIO);
+    }
+    list_clear(ra->waits);
+    ra->released = 1;
+    if (g_ra_list != NULL)
+    {
+        index = list_index_of(g_ra_list, (tintptr) ra);
+        list_remove_item(g_ra_list, index);
+    }
+    if (ra->in_flight == 0)
+    {
+        xfuse_ra_delete(ra);
+    }
+}
+
+/**
+ * Drops what has been read ahead of a file that has been written to
+ *****************************************************************************/
+
+static void
+xfuse_ra_invalidate(fuse_ino_t inum)
+{
+    struct xfuse_read_ahead *ra;
+    struct xfuse_ra_block *block;
+    int index;
+    int bindex;
+
+    if (g_ra_list == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < g_ra_list->count; index++)
+    {
+        ra = (struct xfuse_read_ahead *) list_get_item(g_ra_list, index);
+        if (ra->inum != inum)
+        {
+            continue;
+        }
+        for (bindex = 0; bindex < ra->num_blocks; bindex++)
+        {
+            block = ra->blocks + bindex;
+            if (block->state == RA_BLOCK_PENDING)
+            {
+                block->stale = 1;
+            }
+            else
+            {
+                block->state = RA_BLOCK_EMPTY;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+static struct xfuse_ra_block *
+xfuse_ra_find_block(struct xfuse_read_ahead *ra, off_t off)
+{
+    struct xfuse_ra_block *block;
+    int index;
+
+    for (index = 0; index < ra->num_blocks; index++)
+    {
+        block = ra->blocks + index;
+        if (block->state != RA_BLOCK_EMPTY && !block->stale &&
+                block->off == off)
+        {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Asks the client for part of the file, a block or a read that the
+ * blocks can't answer
+ *****************************************************************************/
+
+static void
+xfuse_ra_send(struct xfuse_read_ahead *ra, struct state_read *fusep,
+              size_t size, off_t off)
+{
+    if (ra->is_loc_resource)
+    {
+        xfuse_clip_read(fusep, ra->lindex, size, off);
+    }
+    else
+    {
+        devredir_file_read(fusep, ra->DeviceId, ra->FileId, size, off);
+    }
+}
+
+/**
+ * Sends an IRP_MJ_READ for a block, unless it's read already or there is
+ * no room for it
+ *****************************************************************************/
+
+static void
+xfuse_ra_request_block(struct xfuse_read_ahead *ra, off_t off)
+{
+    struct xfuse_ra_block *block;
+    struct xfuse_ra_block *lru;
+    struct state_read *fusep;
+    int index;
+
+    if (xfuse_ra_find_block(ra, off) != NULL)
+    {
+        return;
+    }
+    /* an empty block, or the least recently used one not in flight */
+    lru = NULL;
+    for (index = 0; index < ra->num_blocks; index++)
+    {
+        block = ra->blocks + index;
+        if (block->state == RA_BLOCK_EMPTY && !block->stale)
+        {
+            lru = block;
+            break;
+        }
+        if (block->state != RA_BLOCK_PENDING &&
+                (lru == NULL || block->last_used < lru->last_used))
+        {
+            lru = block;
+        }
+    }
+    if (lru == NULL)
+    {
+        return;
+    }
+    block = lru;
+    if (block->data == NULL &&
+            (block->data = g_new(char, XFUSE_RA_BLOCK_SIZE)) == NULL)
+    {
+        return;
+    }
+    if ((fusep = g_new0(struct state_read, 1)) == NULL)
+    {
+        return;
+    }
+    block->off = off;
+    block->state = RA_BLOCK_PENDING;
+    block->stale = 0;
+    block->len = 0;
+    block->last_used = ++ra->clock;
+    fusep->ra = ra;
+    fusep->block = block;
+    ra->in_flight++;
+
+    /*
+     * Further processing happens in xfuse_devredir_cb_read_file(), which
+     * may be called before this returns
+     */
+    xfuse_ra_send(ra, fusep, XFUSE_RA_BLOCK_SIZE, off);
+}
+
+/**
+ * Reads from the client what the read-ahead can't answer
+ *****************************************************************************/
+
+static void
+xfuse_ra_read_direct(struct xfuse_read_ahead *ra, fuse_req_t req,
+                     size_t size, off_t off)
+{
+    struct state_read *fusep;
+
+    if ((fusep = g_new0(struct state_read, 1)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
+    else
+    {
+        fusep->req = req;
+        xfuse_ra_send(ra, fusep, size, off);
+    }
+}
+
+/**
+ * Answers a FUSE read from the blocks read ahead
+ *
+ * @return 0 if answered, 1 if a block it needs is still in flight, or
+ *         2 if the blocks can't answer it
+ *****************************************************************************/
+
+static int
+xfuse_ra_reply(struct xfuse_read_ahead *ra, fuse_req_t req,
+               size_t size, off_t off)
+{
+    struct xfuse_ra_block *block;
+    off_t block_off;
+    off_t end;
+    off_t from;
+    off_t to;
+    char *buf;
+    int pending;
+
+    end = off + size;
+    pending = 0;
+    for (block_off = off - off % XFUSE_RA_BLOCK_SIZE; block_off < end;
+            block_off += XFUSE_RA_BLOCK_SIZE)
+    {
+        block = xfuse_ra_find_block(ra, block_off);
+        if (block == NULL || block->state == RA_BLOCK_FAILED)
+        {
+            return 2;
+        }
+        if (block->state == RA_BLOCK_PENDING)
+        {
+            pending = 1;
+        }
+        else if (block->len < XFUSE_RA_BLOCK_SIZE)
+        {
+            /* end of file */
+            end = MIN(end, block_off + (off_t) block->len);
+            break;
+        }
+    }
+    if (pending)
+    {
+        return 1;
+    }
+    if (end <= off)
+    {
+        fuse_reply_buf(req, NULL, 0);
+        return 0;
+    }
+    if ((buf = g_new(char, end - off)) == NULL)
+    {
+        return 2;
+    }
+    for (from = off; from < end; from = to)
+    {
+        block = xfuse_ra_find_block(ra, from - from % XFUSE_RA_BLOCK_SIZE);
+        to = MIN(end, block->off + XFUSE_RA_BLOCK_SIZE);
+        g_memcpy(buf + (from - off), block->data + (from - block->off),
+                 to - from);
+        block->last_used = ++ra->clock;
+    }
+    fuse_reply_buf(req, buf, end - off);
+    free(buf);
+    return 0;
+}
+
+/**
+ * Answers the FUSE reads waiting on blocks which have come in
+ *****************************************************************************/
+
+static void
+xfuse_ra_reply_waits(struct xfuse_read_ahead *ra)
+{
+    struct xfuse_ra_wait *wait;
+    int index;
+    int rv;
+
+    index = 0;
+    while (index < ra->waits->count)
+    {
+        wait = (struct xfuse_ra_wait *) list_get_item(ra->waits, index);
+        rv = xfuse_ra_reply(ra, wait->req, wait->size, wait->off);
+        if (rv == 1)
+        {
+            ++index;
+            continue;
+        }
+        if (rv == 2)
+        {
+            xfuse_ra_read_direct(ra, wait->req, wait->size, wait->off);
+        }
+        list_remove_item(ra->waits, index);
+    }
+}
+
+/**
+ * A read-ahead block is back from the client
+ *****************************************************************************/
+
+static void
+xfuse_ra_block_done(struct xfuse_read_ahead *ra, struct xfuse_ra_block *block,
+                    enum NTSTATUS IoStatus, const char *buf, size_t length)
+{
+    ra->in_flight--;
+    if (ra->released)
+    {
+        if (ra->in_flight == 0)
+        {
+            xfuse_ra_delete(ra);
+        }
+        return;
+    }
+    if (block->stale)
+    {
+        block->state = RA_BLOCK_EMPTY;
+        block->stale = 0;
+    }
+    else if (IoStatus != STATUS_SUCCESS)
+    {
+        block->state = RA_BLOCK_FAILED;
+    }
+    else
+    {
+        block->len = MIN(length, XFUSE_RA_BLOCK_SIZE);
+        g_memcpy(block->data, buf, block->len);
+        block->state = RA_BLOCK_VALID;
+    }
+    xfuse_ra_reply_waits(ra);
+}
+
+/**
+ * Reads from a file on a redirected drive, reading ahead if the reads
+ * are sequential
+ *****************************************************************************/
+
+static void
+xfuse_ra_read(struct xfuse_read_ahead *ra, fuse_req_t req,
+              size_t size, off_t off)
+{
+    struct xfuse_ra_wait *wait;
+    XFS_INODE *xinode;
+    off_t block_off;
+    off_t end;
+    int max_window;
+    int rv;
+
+    if (off == ra->next_off)
+    {
+        ra->seq_count++;
+    }
+    else
+    {
+        ra->seq_count = 0;
+        ra->window = 0;
+    }
+    ra->next_off = off + size;
+
+    rv = xfuse_ra_reply(ra, req, size, off);
+    if (ra->seq_count < XFUSE_RA_SEQ_THRESHOLD)
+    {
+        if (rv != 0)
+        {
+            xfuse_ra_read_direct(ra, req, size, off);
+        }
+        return;
+    }
+
+    /* start with two blocks ahead, doubling up to half the cache */
+    max_window = ra->num_blocks / 2;
+    ra->window = (ra->window == 0) ? 2 : MIN(ra->window * 2, max_window);
+
+    /* what this read needs, then the window past it, but not past EOF */
+    end = off + size;
+    for (block_off = off - off % XFUSE_RA_BLOCK_SIZE; block_off < end;
+            block_off += XFUSE_RA_BLOCK_SIZE)
+    {
+        xfuse_ra_request_block(ra, block_off);
+    }
+    xinode = xfs_get(g_xfs, ra->inum);
+    end = block_off + (off_t) ra->window * XFUSE_RA_BLOCK_SIZE;
+    for (; block_off < end; block_off += XFUSE_RA_BLOCK_SIZE)
+    {
+        if (xinode != NULL && block_off >= xinode->size)
+        {
+            break;
+        }
+        xfuse_ra_request_block(ra, block_off);
+    }
+
+    if (rv == 0)
+    {
+        return;
+    }
+    rv = xfuse_ra_reply(ra, req, size, off);
+    if (rv == 1 && (wait = g_new0(struct xfuse_ra_wait, 1)) != NULL)
+    {
+        wait->req = req;
+        wait->off = off;
+        wait->size = size;
+        list_add_item(ra->waits, (tintptr) wait);
+    }
+    else if (rv != 0)
+    {
+        xfuse_ra_read_direct(ra, req, size, off);
+    }
+}
+
+/*****************************************************************************/
+void xfuse_devredir_cb_read_file(struct state_read *fip,
+                                 enum NTSTATUS IoStatus,
+                                 const char *buf, size_t length)
+{
+    if (fip->ra != NULL)
+    {
+        xfuse_ra_block_done(fip->ra, fip->block, IoStatus, buf, length);
+    }
+    else if (IoStatus != STATUS_SUCCESS)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
+        fuse_reply_err(fip->req, EIO);
+    }
+    else
+    {
+        fuse_reply_buf(fip->req, buf, length);
+    }
+    free(fip);
+}
+
+void xfuse_devredir_cb_write_file(
+    struct state_write *fip,
+    enum NTSTATUS IoStatus,
+    off_t offset,
+    size_t length)
+{
+    XFS_INODE   *xinode;
+
+    if (fip->wb != NULL)
+    {
+        /* the write has been answered, the file size is already set */
+        xfuse_wb_write_done(fip->wb, IoStatus);
+    }
+    else if (IoStatus != STATUS_SUCCESS)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
+        fuse_reply_err(fip->req, EIO);
+    }
+    else
+    {
+        off_t new_size = offset + length;
+        fuse_reply_write(fip->req, length);
+
+        /* update file size */
+        if ((xinode = xfs_get(g_xfs, fip->inum)) != NULL)
+        {
+            if (new_size > xinode->size)
+            {
+                xinode->size = new_size;
+            }
+        }
+        else
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is invalid", fip->inum);
+        }
+    }
+
+    free(fip);
+}
+
+void xfuse_devredir_cb_rmdir_or_file(struct state_remove *fip,
+                                     enum NTSTATUS IoStatus)
+{
+    XFS_INODE   *xinode = xfs_get(g_xfs, fip->inum);
+
+    switch (IoStatus)
+    {
+        case STATUS_SUCCESS:
+        case STATUS_NO_SUCH_FILE:
+            xfs_remove_entry(g_xfs, xinode->inum); /* Remove local copy */
+            fuse_reply_err(fip->req, 0);
+            break;
+
+        case STATUS_SHARING_VIOLATION:
+        case STATUS_ACCESS_DENIED:
+            fuse_reply_err(fip->req, EACCES);
+            break;
+
+        default:
+            LOG_DEVEL(LOG_LEVEL_INFO, "Error code %08x - fallthrough", (int) IoStatus);
+            fuse_reply_err(fip->req, EBADF);
+            break;
+    }
+    free(fip);
+}
+
+void xfuse_devredir_cb_rename_file(struct state_rename *fip,
+                                   enum NTSTATUS IoStatus)
+{
+    int status;
+
+    if (IoStatus != STATUS_SUCCESS)
+    {
+        status =
+            (IoStatus == STATUS_SHARING_VIOLATION) ? EBUSY  :
+            (IoStatus == STATUS_ACCESS_DENIED)     ? EACCES :
+            /* default */                        EEXIST ;
+    }
+    else
+    {
+        status = xfs_move_entry(g_xfs, fip->pinum,
+                                fip->new_pinum, fip->name);
+    }
+
+    fuse_reply_err(fip->req, status);
+    free(fip);
+}
+
+void xfuse_devredir_cb_file_close(struct state_close *fip)
+{
+    fuse_reply_err(fip->req, 0);
+    xfs_decrement_file_open_count(g_xfs, fip->inum);
+
+    free(fip);
+}
+
+/*
+ * Determine is a file is in the FUSE filesystem
+ *
+ * The whole purpose of this function is to avoid deadlocks. If we try
+ * to determine the size (or any other attribute) of a file in the FUSE
+ * filesystem, the kernel will block the calling thread and send a message
+ * to libfuse. Since we're single-threaded, this will result in deadlock.
+ *
+ * Ideally we'd use a stat() of the file to compare with a stat() of
+ * the mountpoint. This won't work however, for the reasons outline above.
+ *
+ * A simple implementation might be to compare the start of the filename
+ * with the FUSE mount point. This will work, but can easily be defeated,
+ * (perhaps unintentionally) by symlinks in the path.
+ *
+ * The approach taken here is to record the basename of the FUSE mount
+ * point directory (e.g. 'thinclient_drives') and look for that in the
+ * passed-in filename as a directory element. If we find it, we look
+ * at the device name and inode number of the parent directory of the
+ * FUSE mount point. If these match we consider the filename to be in
+ * the FUSE filesystem.
+ */
+int xfuse_path_in_xfuse_fs(const char *path)
+{
+    char *wpath = NULL; /* Writeable copy of path */
+    char *p;
+    int blen = g_strlen(g_fuse_root_path_basename);
+    int rv = 0;
+
+    if ((wpath = g_strdup(path)) == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "system out of memory");
+    }
+    else
+    {
+        /* Look ahead in the string for the basename of the FUSE mount point */
+        for (p = wpath;
+                (p = g_strstr(p, g_fuse_root_path_basename)) != NULL ;
+                p = p + 1)
+        {
+            /* Is this string preceded by a '/' ? */
+            if (p == wpath || *(p - 1) != '/')
+            {
+                continue;
+            }
+
+            /* Is the string followed by a '/' or '\0' ? We know it's
+             * valid to look ahead this far in the string, as g_strstr()
+             * tells us it is */
+            if (*(p + blen) != '/' && *(p + blen) != '\0')
+            {
+                continue;
+            }
 
             /* Temporarily terminate the string early, and check the
              * file system characteristics of the preceding directory */
@@ -1663,12 +2770,31 @@ static void xfuse_cb_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
                 fuse_reply_err(req, ENOENT);
             }
         }
+        else if ((xinode = xfs_lookup_in_dir(g_xfs, parent, name)) != NULL &&
+                 xfs_is_attr_fresh(g_xfs, xinode->inum,
+                                   g_cfg->fuse_attr_cache_ms))
+        {
+            /* specified file resides on redirected share, and we've
+             * looked it up (or listed it) recently */
+            make_fuse_entry_reply(req, xinode);
+        }
+        else if (xinode == NULL &&
+                 (xfs_is_negative(g_xfs, parent, name,
+                                  g_cfg->fuse_negative_cache_ms) ||
+                  (xfs_is_listing_fresh(g_xfs, parent,
+                                        g_cfg->fuse_negative_cache_ms) &&
+                   xfs_lookup_in_dir_nocase(g_xfs, parent, name) == NULL)))
+        {
+            /* ...and it wasn't there recently. A name listed with other
+             * case goes to the client, which usually ignores case */
+            fuse_reply_err(req, ENOENT);
+        }
         else
         {
             /* specified file resides on redirected share
              *
-             * We always look these up, and relying on libfuse to do sane
-             * caching */
+             * We look these up when the cache is out of date, and rely on
+             * libfuse to do sane caching */
             struct state_lookup *fip = g_new0(struct state_lookup, 1);
             char *full_path = get_name_for_entry_in_parent(parent, name);
 
@@ -1911,6 +3037,7 @@ static void xfuse_cb_unlink(fuse_req_t req, fuse_ino_t parent,
 
             fip->req = req;
             fip->inum = xinode->inum;
+            xfs_invalidate(g_xfs, parent);
 
             /* we want path minus 'root node of the share' */
             cptr = filename_on_device(full_path);
@@ -2005,6 +3132,9 @@ static void xfuse_cb_rename(fuse_req_t req,
             fip->pinum = old_xinode->inum;
             fip->new_pinum = new_parent;
             strcpy(fip->name, new_name);
+            xfs_invalidate(g_xfs, old_parent);
+            xfs_invalidate(g_xfs, new_parent);
+            xfs_invalidate(g_xfs, old_xinode->inum);
 
             /* we want path minus 'root node of the share' */
             cptr = filename_on_device(old_full_path);
@@ -2111,6 +3241,7 @@ static void xfuse_create_dir_or_file(fuse_req_t req, fuse_ino_t parent,
                 fip->pinum = parent;
                 strcpy(fip->name, name);
                 fip->mode = mode;
+                xfs_invalidate(g_xfs, parent);
 
                 /* we want path minus 'root node of the share' */
                 cptr = filename_on_device(full_path);
@@ -2246,6 +3377,12 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
     else if (!xinode->is_redirected)
     {
         /* specified file is a local resource */
+        if (handle != NULL)
+        {
+            fi->fh = xfuse_handle_to_fuse_handle(NULL);
+            xfuse_ra_release(handle->ra);
+            xfuse_handle_delete(handle);
+        }
         fuse_reply_err(req, 0);
     }
     else
@@ -2266,17 +3403,23 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
 
         fi->fh = xfuse_handle_to_fuse_handle(NULL);
 
+        if (handle->wb != NULL)
+        {
+            /* closes once the writes are complete */
+            xfuse_wb_release(handle->wb, fip);
+        }
         /*
          * If this call succeeds, further request processing happens in
          * xfuse_devredir_cb_file_close()
          */
-        if (devredir_file_close(fip, xinode->device_id, handle->FileId))
+        else if (devredir_file_close(fip, xinode->device_id, handle->FileId))
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
             fuse_reply_err(req, EREMOTEIO);
             free(fip);
         }
 
+        xfuse_ra_release(handle->ra);
         xfuse_handle_delete(handle);
     }
 }
@@ -2293,7 +3436,6 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
     XFUSE_HANDLE          *fh;
     struct state_read *fusep;
     XFS_INODE            *xinode;
-    struct req_list_item  *rli;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "want_bytes %zd bytes at off %lld", size, (long long) off);
 
@@ -2314,30 +3456,43 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
             return;
         }
 
-        rli = g_new0(struct req_list_item, 1);
-
-        rli->stream_id = 0;
-        rli->req = req;
-        rli->lindex = xinode->lindex;
-        rli->off = off;
-        rli->size = size;
-        list_add_item(g_req_list, (tbus) rli);
-
-        if (g_req_list->count == 1)
+        if (fh->ra == NULL)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data lindex = %d off = %lld size = %zd",
-                      rli->lindex, (long long) off, size);
+            fh->ra = xfuse_ra_create(fh, ino);
+        }
 
-            clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                        (int) off, (int) size);
+        if (fh->ra != NULL)
+        {
+            /* replies when the data is in */
+            xfuse_ra_read(fh->ra, req, size, off);
+        }
+        else if ((fusep = g_new0(struct state_read, 1)) == NULL)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+            fuse_reply_err(req, ENOMEM);
+        }
+        else
+        {
+            fusep->req = req;
+            xfuse_clip_read(fusep, xinode->lindex, size, off);
         }
     }
     else
     {
         /* target file is on a remote device */
 
-        fusep = g_new0(struct state_read, 1);
-        if (fusep == NULL)
+        xfuse_wb_send_inode(ino);
+        if (fh->ra == NULL)
+        {
+            fh->ra = xfuse_ra_create(fh, ino);
+        }
+
+        if (fh->ra != NULL)
+        {
+            /* replies when the data is in */
+            xfuse_ra_read(fh->ra, req, size, off);
+        }
+        else if ((fusep = g_new0(struct state_read, 1)) == NULL)
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
             fuse_reply_err(req, ENOMEM);
@@ -2385,8 +3540,13 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
     {
         /* target file is on a remote device */
 
-        fusep = g_new0(struct state_write, 1);
-        if (fusep == NULL)
+        xfuse_ra_invalidate(ino);
+        xfs_invalidate(g_xfs, ino);
+        if (fh->wb != NULL && xfuse_wb_write(fh->wb, req, buf, size, off) == 0)
+        {
+            /* buffered */
+        }
+        else if ((fusep = g_new0(struct state_write, 1)) == NULL)
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
             fuse_reply_err(req, ENOMEM);
@@ -2427,15 +3587,39 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
 /**
  *****************************************************************************/
 
-#if 0
+/**
+ * Called on every close() of a file. Answers once the writes buffered
+ * for the handle are complete, with any error from them
+ *****************************************************************************/
+
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi)
+{
+    XFUSE_HANDLE *fh = xfuse_handle_from_fuse_handle(fi->fh);
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld", ino);
+
+    if (fh != NULL && fh->wb != NULL)
+    {
+        xfuse_wb_sync(fh->wb, req);
+    }
+    else
+    {
+        fuse_reply_err(req, 0);
+    }
+}
+
+/**
+ *****************************************************************************/
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi)
 {
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "#################### entered: ino=%ld datasync=%d", ino, datasync);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "function not required");
-    fuse_reply_err(req, EINVAL);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld datasync=%d", ino, datasync);
+
+    /* writes which aren't buffered are complete when they're answered */
+    xfuse_cb_flush(req, ino, fi);
 }
-#endif
 
 /**
  * Sets attributes for a directory entry.
@@ -2490,6 +3674,8 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         {
             attrs.size = attr->st_size;
             change_mask |= TO_SET_SIZE;
+            xfuse_ra_invalidate(ino);
+            xfuse_wb_send_inode(ino);
         }
 
         if ((to_set & FUSE_SET_ATTR_ATIME) && xinode->atime != attr->st_atime)
@@ -2531,6 +3717,7 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                 const char *cptr;
                 fip->req = req;
                 fip->inum = ino;
+                xfs_invalidate(g_xfs, ino);
                 /* Save the important stuff so we can update our node if the
                  * remote update is successful */
                 fip->fattr = attrs;
@@ -2576,8 +3763,10 @@ static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
         LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is not valid", ino);
         fuse_reply_err(req, ENOENT);
     }
-    else if (!xinode->is_redirected)
+    else if (!xinode->is_redirected ||
+             xfs_is_listing_fresh(g_xfs, ino, g_cfg->fuse_attr_cache_ms))
     {
+        /* local, or listed from the device recently */
         if ((xhandle = xfuse_handle_create()) == NULL)
         {
             fuse_reply_err(req, ENOMEM);
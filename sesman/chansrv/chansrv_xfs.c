@@ -27,6 +27,7 @@
 #endif
 
 #include "os_calls.h"
+#include "string_calls.h"
 #include "log.h"
 
 #include "chansrv_xfs.h"
@@ -44,6 +45,23 @@
 /* inum of the delete pending directory */
 #define DELETE_PENDING_ID 2
 
+/* most names remembered as missing from a directory */
+#define MAX_NEGATIVES_PER_DIR 32
+
+/* Directories with fewer entries than this are searched without a hash */
+#define DIR_HASH_MIN_ENTRIES  16
+#define DIR_HASH_INITIAL_SIZE 64
+
+/*
+ * A name a redirected device said was not in a directory
+ */
+struct xfs_negative
+{
+    struct xfs_negative *next;         /* Newest first                     */
+    tui32          time;               /* From g_time3()                   */
+    char           name[XFS_MAXFILENAMELEN + 1];
+};
+
 /*
  * A double-linked list of inodes, sorted by inum
  *
@@ -75,10 +93,29 @@ typedef struct xfs_inode_all
     struct xfs_inode_all *next;        /* Next entry in parent             */
     struct xfs_inode_all *previous;    /* Previous entry in parent         */
     XFS_LIST             dir;          /* Directory only - children        */
+    struct xfs_inode_all *hash_next;   /* Next entry in parent's bucket    */
+    /*
+     * Directory only - the children hashed by name, once there are
+     * DIR_HASH_MIN_ENTRIES of them. hash_size is a power of two.
+     */
+    struct xfs_inode_all **hash;
+    unsigned int         hash_size;
+    unsigned int         entry_count;
+    struct xfs_dir_handle *handles;    /* Directory only - open handles    */
     /*
      * Other private elements
      */
     unsigned int         open_count;   /* Regular files only               */
+    /*
+     * What is known about a redirected entry, and when it was read
+     * from the device (g_time3() values)
+     */
+    char                 attr_fresh;   /* attr_time is set                 */
+    char                 listing_fresh; /* Directory only - listing_time is set */
+    tui32                attr_time;    /* Attributes read                  */
+    tui32                listing_time; /* Directory only - contents listed */
+    struct xfs_negative *negatives;    /* Directory only - names not there */
+    unsigned int         negative_count;
 } XFS_INODE_ALL;
 
 
@@ -107,11 +144,19 @@ struct xfs_fs
  *
  * inum           inum of the directory being scanned
  * generation     Generation of the inum we opened
+ * off_inum       Offset last passed back by xfs_readdir(), or 0
+ * cursor         inum of the entry to carry on from at off_inum, or 0 at
+ *                the end. If that entry leaves the directory, the cursor
+ *                moves on to the entry after it, so carrying on is O(1).
+ * next           Next open handle on the same directory
  */
 struct xfs_dir_handle
 {
     fuse_ino_t  inum;
     tui32       generation;
+    fuse_ino_t  off_inum;
+    fuse_ino_t  cursor;
+    struct xfs_dir_handle *next;
 };
 
 
@@ -238,25 +283,197 @@ remove_inode_from_list(XFS_LIST *list, XFS_INODE_ALL *xino)
 
 }
 
+/*  ------------------------------------------------------------------------ */
+/*
+ * Hash of a name for a directory bucket
+ *
+ * The client filesystem is usually case-insensitive, so ASCII letters
+ * are folded. Names which differ only in case then share a bucket, and a
+ * case-insensitive search costs no more than an exact one.
+ */
+static unsigned int
+name_hash(const char *name)
+{
+    unsigned int hash = 2166136261U;
+    unsigned int c;
+
+    while ((c = (unsigned char) *name++) != '\0')
+    {
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619U;
+    }
+    return hash;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+add_inode_to_hash(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **bucket;
+
+    bucket = &dinode->hash[name_hash(xino->pub.name) & (dinode->hash_size - 1)];
+    xino->hash_next = *bucket;
+    *bucket = xino;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+remove_inode_from_hash(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **pp;
+
+    pp = &dinode->hash[name_hash(xino->pub.name) & (dinode->hash_size - 1)];
+    while (*pp != NULL)
+    {
+        if (*pp == xino)
+        {
+            *pp = xino->hash_next;
+            break;
+        }
+        pp = &(*pp)->hash_next;
+    }
+    xino->hash_next = NULL;
+}
+
+/*  ------------------------------------------------------------------------ */
+/*
+ * (Re)builds the hash of a directory, if it's big enough to need one
+ *
+ * If there's no memory, the existing hash (if any) is kept
+ */
+static void
+grow_dir_hash(XFS_INODE_ALL *dinode)
+{
+    XFS_INODE_ALL **new_hash;
+    XFS_INODE_ALL *p;
+    unsigned int new_size;
+
+    if (dinode->entry_count < DIR_HASH_MIN_ENTRIES ||
+            dinode->entry_count <= dinode->hash_size)
+    {
+        return;
+    }
+
+    new_size = (dinode->hash_size == 0) ? DIR_HASH_INITIAL_SIZE :
+               dinode->hash_size * 2;
+    if ((new_hash = g_new0(XFS_INODE_ALL *, new_size)) != NULL)
+    {
+        free(dinode->hash);
+        dinode->hash = new_hash;
+        dinode->hash_size = new_size;
+        for (p = dinode->dir.begin; p != NULL; p = p->next)
+        {
+            add_inode_to_hash(dinode, p);
+        }
+    }
+}
+
 /*  ------------------------------------------------------------------------ */
 static void
 link_inode_into_directory_node(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
 {
     xino->parent = dinode;
     add_inode_to_list(&dinode->dir, xino);
+    ++dinode->entry_count;
+    if (dinode->hash != NULL)
+    {
+        add_inode_to_hash(dinode, xino);
+    }
+    grow_dir_hash(dinode);
 }
 
 /*  ------------------------------------------------------------------------ */
 static void
 unlink_inode_from_parent(XFS_INODE_ALL *xino)
 {
-    remove_inode_from_list(&xino->parent->dir, xino);
+    XFS_INODE_ALL *dinode = xino->parent;
+    struct xfs_dir_handle *handle;
+
+    /* Move on readdir cursors pointing at this entry */
+    for (handle = dinode->handles; handle != NULL; handle = handle->next)
+    {
+        if (handle->cursor == xino->pub.inum)
+        {
+            handle->cursor = (xino->next != NULL) ? xino->next->pub.inum : 0;
+        }
+    }
+
+    if (dinode->hash != NULL)
+    {
+        remove_inode_from_hash(dinode, xino);
+    }
+    --dinode->entry_count;
+    remove_inode_from_list(&dinode->dir, xino);
 
     xino->next = NULL;
     xino->previous = NULL;
     xino->parent = NULL;
 }
 
+/*  ------------------------------------------------------------------------ */
+static int
+is_fresh(int is_set, tui32 time, unsigned int ttl)
+{
+    return is_set && (tui32) (g_time3() - time) < ttl;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+free_negatives(XFS_INODE_ALL *dinode)
+{
+    struct xfs_negative *p;
+
+    while ((p = dinode->negatives) != NULL)
+    {
+        dinode->negatives = p->next;
+        free(p);
+    }
+    dinode->negative_count = 0;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+remove_negative(XFS_INODE_ALL *dinode, const char *name)
+{
+    struct xfs_negative **pp;
+    struct xfs_negative *p;
+
+    for (pp = &dinode->negatives; (p = *pp) != NULL; pp = &p->next)
+    {
+        if (g_strcasecmp(p->name, name) == 0)
+        {
+            *pp = p->next;
+            free(p);
+            --dinode->negative_count;
+            break;
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+/*
+ * Frees an inode which is not in a directory
+ */
+static void
+free_inode(XFS_INODE_ALL *xino)
+{
+    struct xfs_dir_handle *handle;
+
+    /* Handles still open on the directory are found to be invalid
+     * by the generation, but mustn't point back here */
+    while ((handle = xino->handles) != NULL)
+    {
+        xino->handles = handle->next;
+        handle->next = NULL;
+    }
+    free_negatives(xino);
+    free(xino->hash);
+    free(xino);
+}
+
 /*  ------------------------------------------------------------------------ */
 struct xfs_fs *
 xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
@@ -363,7 +580,10 @@ xfs_delete_xfs_fs(struct xfs_fs *xfs)
         size_t i;
         for (i = 0 ; i < xfs->inode_count; ++i)
         {
-            free(xfs->inode_table[i]);
+            if (xfs->inode_table[i] != NULL)
+            {
+                free_inode(xfs->inode_table[i]);
+            }
         }
     }
     free(xfs->inode_table);
@@ -443,6 +663,7 @@ xfs_add_entry(struct xfs_fs *xfs, fuse_ino_t parent_inum,
                 xino->next = NULL;
                 xino->previous = NULL;
                 link_inode_into_directory_node(parent, xino);
+                remove_negative(parent, name);
                 result = &xino->pub;
             }
         }
@@ -498,7 +719,7 @@ xfs_remove_entry(struct xfs_fs *xfs, fuse_ino_t inum)
              * so that the caller can distinguish re-uses of the same inum.
              */
             ++xfs->generation;
-            free(xino);
+            free_inode(xino);
         }
     }
 }
@@ -560,8 +781,9 @@ xfs_get_full_path(struct xfs_fs *xfs, fuse_ino_t inum)
 }
 
 /*  ------------------------------------------------------------------------ */
-XFS_INODE *
-xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
+static XFS_INODE *
+lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name,
+              int nocase)
 {
     XFS_INODE_ALL *xino;
     XFS_INODE *result = NULL;
@@ -570,12 +792,29 @@ xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
             (xino->pub.mode & S_IFDIR) != 0)
     {
         XFS_INODE_ALL *p;
-        for (p = xino->dir.begin ; p != NULL; p = p->next)
+        if (xino->hash != NULL)
         {
-            if (strcmp(p->pub.name, name) == 0)
+            p = xino->hash[name_hash(name) & (xino->hash_size - 1)];
+            for (; p != NULL; p = p->hash_next)
             {
-                result = &p->pub;
-                break;
+                if ((nocase ? g_strcasecmp(p->pub.name, name) :
+                        strcmp(p->pub.name, name)) == 0)
+                {
+                    result = &p->pub;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            for (p = xino->dir.begin ; p != NULL; p = p->next)
+            {
+                if ((nocase ? g_strcasecmp(p->pub.name, name) :
+                        strcmp(p->pub.name, name)) == 0)
+                {
+                    result = &p->pub;
+                    break;
+                }
             }
         }
     }
@@ -583,6 +822,21 @@ xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
     return result;
 }
 
+/*  ------------------------------------------------------------------------ */
+XFS_INODE *
+xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
+{
+    return lookup_in_dir(xfs, inum, name, 0);
+}
+
+/*  ------------------------------------------------------------------------ */
+XFS_INODE *
+xfs_lookup_in_dir_nocase(struct xfs_fs *xfs, fuse_ino_t inum,
+                         const char *name)
+{
+    return lookup_in_dir(xfs, inum, name, 1);
+}
+
 /*  ------------------------------------------------------------------------ */
 int
 xfs_is_dir_empty(struct xfs_fs *xfs, fuse_ino_t inum)
@@ -648,6 +902,8 @@ xfs_opendir(struct xfs_fs *xfs, fuse_ino_t dir)
         {
             result->inum = xino->pub.inum;
             result->generation = xino->pub.generation;
+            result->next = xino->handles;
+            xino->handles = result;
         }
     }
 
@@ -679,6 +935,13 @@ xfs_readdir(struct xfs_fs *xfs, struct xfs_dir_handle *handle, off_t *off)
             /* First call */
             result = dxino->dir.begin;
         }
+        else if (inum == handle->off_inum)
+        {
+            /* Carrying on from the last call. If the entry has gone,
+             * the cursor has moved on to the next one */
+            result = (handle->cursor != 0) ?
+                     xfs->inode_table[handle->cursor] : NULL;
+        }
         else if (inum < xfs->inode_count &&
                  (xino = xfs->inode_table[inum]) != 0 &&
                  xino->parent == dxino)
@@ -712,10 +975,13 @@ xfs_readdir(struct xfs_fs *xfs, struct xfs_dir_handle *handle, off_t *off)
     {
         /* We're done */
         *off = (off_t) -1;
+        handle->off_inum = 0;
     }
     else
     {
         *off = (off_t)result->next->pub.inum;
+        handle->off_inum = result->next->pub.inum;
+        handle->cursor = handle->off_inum;
     }
 
     /* Caller only sees public interface to the result */
@@ -726,6 +992,28 @@ xfs_readdir(struct xfs_fs *xfs, struct xfs_dir_handle *handle, off_t *off)
 void
 xfs_closedir(struct xfs_fs *xfs, struct xfs_dir_handle *handle)
 {
+    XFS_INODE_ALL *dxino;
+    struct xfs_dir_handle **pp;
+
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    /* Unlink from the directory, if it's still there */
+    if (xfs != NULL && handle->inum < xfs->inode_count &&
+            ((dxino = xfs->inode_table[handle->inum]) != NULL) &&
+            handle->generation == dxino->pub.generation)
+    {
+        for (pp = &dxino->handles; *pp != NULL; pp = &(*pp)->next)
+        {
+            if (*pp == handle)
+            {
+                *pp = handle->next;
+                break;
+            }
+        }
+    }
     free(handle);
 }
 
@@ -861,8 +1149,9 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
             }
 
             unlink_inode_from_parent(xino);
-            link_inode_into_directory_node(parent, xino);
             strcpy(xino->pub.name, name);
+            link_inode_into_directory_node(parent, xino);
+            remove_negative(parent, name);
         }
         else if (strcmp(xino->pub.name, name) != 0)
         {
@@ -871,11 +1160,148 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
             {
                 xfs_remove_entry(xfs, dest->inum);
             }
+            /* The name is the hash key */
+            if (parent->hash != NULL)
+            {
+                remove_inode_from_hash(parent, xino);
+            }
             strcpy(xino->pub.name, name);
+            if (parent->hash != NULL)
+            {
+                add_inode_to_hash(parent, xino);
+            }
+            remove_negative(parent, name);
         }
         result = 0;
     }
 
     return result;
 }
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_set_attr_fresh(struct xfs_fs *xfs, fuse_ino_t inum)
+{
+    XFS_INODE_ALL *xino;
+
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        xino->attr_fresh = 1;
+        xino->attr_time = g_time3();
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+int
+xfs_is_attr_fresh(struct xfs_fs *xfs, fuse_ino_t inum, unsigned int ttl)
+{
+    XFS_INODE_ALL *xino;
+
+    return (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL) &&
+            is_fresh(xino->attr_fresh, xino->attr_time, ttl));
+}
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_set_listing_fresh(struct xfs_fs *xfs, fuse_ino_t inum)
+{
+    XFS_INODE_ALL *xino;
+
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL) &&
+            (xino->pub.mode & S_IFDIR) != 0)
+    {
+        xino->listing_fresh = 1;
+        xino->listing_time = g_time3();
+        /* the listing says what isn't there */
+        free_negatives(xino);
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+int
+xfs_is_listing_fresh(struct xfs_fs *xfs, fuse_ino_t inum, unsigned int ttl)
+{
+    XFS_INODE_ALL *xino;
+
+    return (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL) &&
+            is_fresh(xino->listing_fresh, xino->listing_time, ttl));
+}
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_add_negative(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
+{
+    XFS_INODE_ALL *xino;
+    struct xfs_negative *p;
+    struct xfs_negative **pp;
+
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL) &&
+            (xino->pub.mode & S_IFDIR) != 0 &&
+            strlen(name) <= XFS_MAXFILENAMELEN)
+    {
+        remove_negative(xino, name);
+        if (xino->negative_count >= MAX_NEGATIVES_PER_DIR)
+        {
+            /* Forget the oldest */
+            pp = &xino->negatives;
+            while ((*pp)->next != NULL)
+            {
+                pp = &(*pp)->next;
+            }
+            free(*pp);
+            *pp = NULL;
+            --xino->negative_count;
+        }
+        if ((p = g_new(struct xfs_negative, 1)) != NULL)
+        {
+            p->time = g_time3();
+            strcpy(p->name, name);
+            p->next = xino->negatives;
+            xino->negatives = p;
+            ++xino->negative_count;
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+int
+xfs_is_negative(struct xfs_fs *xfs, fuse_ino_t inum, const char *name,
+                unsigned int ttl)
+{
+    XFS_INODE_ALL *xino;
+    struct xfs_negative *p;
+
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        for (p = xino->negatives; p != NULL; p = p->next)
+        {
+            if (g_strcasecmp(p->name, name) == 0)
+            {
+                return is_fresh(1, p->time, ttl);
+            }
+        }
+    }
+    return 0;
+}
+
+/*  ------------------------------------------------------------------------ */
+void
+xfs_invalidate(struct xfs_fs *xfs, fuse_ino_t inum)
+{
+    XFS_INODE_ALL *xino;
+
+    if (inum < xfs->inode_count &&
+            ((xino = xfs->inode_table[inum]) != NULL))
+    {
+        xino->attr_fresh = 0;
+        xino->listing_fresh = 0;
+        free_negatives(xino);
+    }
+}
 #endif  /* XRDP_FUSE */
@@ -154,6 +154,9 @@ xfs_get_full_path(struct xfs_fs *xfs, fuse_ino_t inum);
 /*
  * Lookup a file in a directory
  *
+ * Large directories are hashed by name, so this doesn't depend on the
+ * size of the directory.
+ *
  * @param xfs  filesystem instance
  * @param inum Inumber of the directory
  * @param name Name of the file to lookup
@@ -162,6 +165,19 @@ xfs_get_full_path(struct xfs_fs *xfs, fuse_ino_t inum);
 XFS_INODE *
 xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name);
 
+/*
+ * Lookup a file in a directory, ignoring ASCII case as the client
+ * filesystem usually does
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of the directory
+ * @param name Name of the file to lookup
+ * @return Pointer to XFS_INODE if found
+ */
+XFS_INODE *
+xfs_lookup_in_dir_nocase(struct xfs_fs *xfs, fuse_ino_t inum,
+                         const char *name);
+
 /*
  * Inquires as to whether a directory is empty.
  *
@@ -212,6 +228,9 @@ xfs_opendir(struct xfs_fs *xfs, fuse_ino_t dir);
  * Whether files added or removed from the directory in question are
  * returned or not is unspecified by this interface.
  *
+ * Carrying on from the offset returned by the last call on the handle
+ * is O(1), even if the entry at that offset has since been removed.
+ *
  * @param xfs  filesystem instance
  * @param handle Handle from xfs_opendir
  * @param off    Offset (by reference). Pass in zero to get the first
@@ -314,5 +333,100 @@ int
 xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
                fuse_ino_t new_parent_inum, const char *name);
 
+/*
+ * Cache of what has been read from redirected devices
+ *
+ * Entries record when their attributes were last read from the device,
+ * and directories when they were last listed and which names the device
+ * said weren't in them. The caller decides how old each of these may be.
+ * Adding or moving an entry drops its name from the missing names of the
+ * directory.
+ */
+
+/*
+ * Record that the attributes of an entry have just been read
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ */
+void
+xfs_set_attr_fresh(struct xfs_fs *xfs, fuse_ino_t inum);
+
+/*
+ * Were the attributes of an entry read less than ttl ms ago?
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ * @param ttl  Most ms since the attributes were read
+ *
+ * @result != 0 if so
+ */
+int
+xfs_is_attr_fresh(struct xfs_fs *xfs, fuse_ino_t inum, unsigned int ttl);
+
+/*
+ * Record that a directory has just been listed in full
+ *
+ * Until the listing is out of date, a name not in the directory isn't
+ * on the device either.
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of directory
+ */
+void
+xfs_set_listing_fresh(struct xfs_fs *xfs, fuse_ino_t inum);
+
+/*
+ * Was a directory listed less than ttl ms ago?
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of directory
+ * @param ttl  Most ms since the directory was listed
+ *
+ * @result != 0 if so
+ */
+int
+xfs_is_listing_fresh(struct xfs_fs *xfs, fuse_ino_t inum, unsigned int ttl);
+
+/*
+ * Record that a name isn't in a directory on the device
+ *
+ * Only the most recent few names are kept for each directory.
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of directory
+ * @param name Name looked up
+ */
+void
+xfs_add_negative(struct xfs_fs *xfs, fuse_ino_t inum, const char *name);
+
+/*
+ * Was a name found not to be in a directory less than ttl ms ago?
+ *
+ * Names are compared ignoring ASCII case, as on the client.
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of directory
+ * @param name Name to look up
+ * @param ttl  Most ms since the name was looked up
+ *
+ * @result != 0 if so
+ */
+int
+xfs_is_negative(struct xfs_fs *xfs, fuse_ino_t inum, const char *name,
+                unsigned int ttl);
+
+/*
+ * Forget what has been read about an entry from the device
+ *
+ * For a directory, this is the listing and the missing names, but not
+ * what is known about the entries in it.
+ *
+ * @param xfs  filesystem instance
+ * @param inum Inumber of entry
+ */
+void
+xfs_invalidate(struct xfs_fs *xfs, fuse_ino_t inum);
+
 #endif /*  XRDP_FUSE   */
 #endif /* _CHANSRV_XFS */
@@ -473,6 +473,36 @@ clipboard_init(void)
     return rv;
 }
 
+/*****************************************************************************/
+static void
+clipboard_c2s_free_data(void)
+{
+    g_free(g_clip_c2s.data);
+    g_clip_c2s.data = 0;
+    free_stream(g_clip_c2s.image_s);
+    g_clip_c2s.image_s = 0;
+}
+
+/*****************************************************************************/
+/* points data at the bytes of g_clip_c2s from offset up to end, returns
+   how many of them are in one piece, an image is in two */
+static int
+clipboard_c2s_get_data(int offset, int end, char **data)
+{
+    if (g_clip_c2s.image_s == 0)
+    {
+        *data = g_clip_c2s.data + offset;
+        return end - offset;
+    }
+    if (offset < 14)
+    {
+        *data = g_bmp_image_header + offset;
+        return MIN(end, 14) - offset;
+    }
+    *data = g_clip_c2s.image_s->p + (offset - 14);
+    return end - offset;
+}
+
 /*****************************************************************************/
 int
 clipboard_deinit(void)
@@ -485,9 +515,9 @@ clipboard_deinit(void)
     }
 
     xfuse_deinit();
+    clipboard_file_deinit();
 
-    g_free(g_clip_c2s.data);
-    g_clip_c2s.data = 0;
+    clipboard_c2s_free_data();
     g_free(g_clip_s2c.data);
     g_clip_s2c.data = 0;
 
@@ -615,6 +645,107 @@ clipboard_in_unicode(struct stream *s, char *text, int *num_chars)
     return index * 2;
 }
 
+/* most UTF-8 bytes clipboard_c2s_utf16_to_utf8() writes for in_bytes */
+#define CLIP_UTF8_BOUND(in_bytes) (((in_bytes) + 1) / 2 * 3 + 4)
+
+/*****************************************************************************/
+static void
+clipboard_c2s_utf16_reset(void)
+{
+    g_clip_c2s.utf16_byte = -1;
+    g_clip_c2s.utf16_high = 0;
+    g_clip_c2s.utf16_end = 0;
+}
+
+/*****************************************************************************/
+/* returns number of bytes written */
+static int
+clipboard_out_utf8(char *out, unsigned int code_point)
+{
+    if (code_point < 0x80)
+    {
+        out[0] = (char) code_point;
+        return 1;
+    }
+    if (code_point < 0x800)
+    {
+        out[0] = (char) (0xc0 | (code_point >> 6));
+        out[1] = (char) (0x80 | (code_point & 0x3f));
+        return 2;
+    }
+    if (code_point < 0x10000)
+    {
+        out[0] = (char) (0xe0 | (code_point >> 12));
+        out[1] = (char) (0x80 | ((code_point >> 6) & 0x3f));
+        out[2] = (char) (0x80 | (code_point & 0x3f));
+        return 3;
+    }
+    out[0] = (char) (0xf0 | (code_point >> 18));
+    out[1] = (char) (0x80 | ((code_point >> 12) & 0x3f));
+    out[2] = (char) (0x80 | ((code_point >> 6) & 0x3f));
+    out[3] = (char) (0x80 | (code_point & 0x3f));
+    return 4;
+}
+
+/*****************************************************************************/
+/* converts a chunk of CF_UNICODETEXT straight to UTF-8, stopping at the
+   terminating NUL. State carried between chunks is in g_clip_c2s, call
+   clipboard_c2s_utf16_reset() first. out must have room for
+   CLIP_UTF8_BOUND(in_bytes) bytes.
+   returns number of bytes written */
+static int
+clipboard_c2s_utf16_to_utf8(const char *in, int in_bytes, char *out)
+{
+    unsigned int unit;
+    unsigned int code_point;
+    int index;
+    int out_bytes;
+
+    out_bytes = 0;
+    for (index = 0; index < in_bytes && !g_clip_c2s.utf16_end; index++)
+    {
+        if (g_clip_c2s.utf16_byte < 0)
+        {
+            g_clip_c2s.utf16_byte = (tui8) in[index];
+            continue;
+        }
+        unit = g_clip_c2s.utf16_byte | ((tui8) in[index] << 8);
+        g_clip_c2s.utf16_byte = -1;
+        if (unit >= 0xdc00 && unit <= 0xdfff && g_clip_c2s.utf16_high != 0)
+        {
+            code_point = 0x10000 + ((g_clip_c2s.utf16_high - 0xd800) << 10) +
+                         (unit - 0xdc00);
+            g_clip_c2s.utf16_high = 0;
+            out_bytes += clipboard_out_utf8(out + out_bytes, code_point);
+            continue;
+        }
+        if (g_clip_c2s.utf16_high != 0)
+        {
+            /* unpaired high surrogate */
+            out_bytes += clipboard_out_utf8(out + out_bytes, 0xfffd);
+            g_clip_c2s.utf16_high = 0;
+        }
+        if (unit == 0)
+        {
+            g_clip_c2s.utf16_end = 1;
+        }
+        else if (unit >= 0xd800 && unit <= 0xdbff)
+        {
+            g_clip_c2s.utf16_high = unit;
+        }
+        else if (unit >= 0xdc00 && unit <= 0xdfff)
+        {
+            /* unpaired low surrogate */
+            out_bytes += clipboard_out_utf8(out + out_bytes, 0xfffd);
+        }
+        else
+        {
+            out_bytes += clipboard_out_utf8(out + out_bytes, unit);
+        }
+    }
+    return out_bytes;
+}
+
 static char windows_native_format[] =
 {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -870,14 +1001,29 @@ clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
 {
     XEvent xev;
     long val1[2];
+    char *data;
+    int offset;
+    int bytes;
+    int mode;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_provide_selection_c2s: bytes %d",
               g_clip_c2s.total_bytes);
     if (g_clip_c2s.total_bytes < g_incr_max_req_size)
     {
-        XChangeProperty(g_display, req->requestor, req->property,
-                        type, 8, PropModeReplace,
-                        (tui8 *)g_clip_c2s.data, g_clip_c2s.total_bytes);
+        /* the requestor reads the property after SelectionNotify, so it
+           can be set in pieces */
+        mode = PropModeReplace;
+        offset = 0;
+        do
+        {
+            bytes = clipboard_c2s_get_data(offset, g_clip_c2s.total_bytes,
+                                           &data);
+            XChangeProperty(g_display, req->requestor, req->property,
+                            type, 8, mode, (tui8 *)data, bytes);
+            mode = PropModeAppend;
+            offset += bytes;
+        }
+        while (offset < g_clip_c2s.total_bytes);
         g_memset(&xev, 0, sizeof(xev));
         xev.xselection.type = SelectionNotify;
         xev.xselection.send_event = True;
@@ -1183,17 +1329,25 @@ clipboard_process_data_response_for_image(struct stream *s,
     {
         return 0;
     }
-    g_free(g_clip_c2s.data);
-    g_clip_c2s.data = (char *) g_malloc(len + 14, 0);
-    if (g_clip_c2s.data == 0)
+    clipboard_c2s_free_data();
+    if (s == g_ins)
     {
-        g_clip_c2s.total_bytes = 0;
-        return 0;
+        /* keep the stream the image was reassembled in rather than copy
+           the image out of it */
+        g_clip_c2s.image_s = g_ins;
+        make_stream(g_ins);
+        init_stream(g_ins, 8192);
     }
-    g_clip_c2s.total_bytes = len;
+    else
+    {
+        make_stream(g_clip_c2s.image_s);
+        init_stream(g_clip_c2s.image_s, len);
+        out_uint8a(g_clip_c2s.image_s, s->p, len);
+        s_mark_end(g_clip_c2s.image_s);
+        g_clip_c2s.image_s->p = g_clip_c2s.image_s->data;
+    }
+    g_clip_c2s.total_bytes = len + 14;
     g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
-    g_memcpy(g_clip_c2s.data, g_bmp_image_header, 14);
-    in_uint8a(s, g_clip_c2s.data + 14, len);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: calling "
               "clipboard_provide_selection_c2s");
     clipboard_provide_selection_c2s(lxev, lxev->target);
@@ -1221,7 +1375,7 @@ clipboard_process_data_response_for_file(struct stream *s,
     lxev = &g_saved_selection_req_event;
 
     const int flist_size = 1024 * 1024;
-    g_free(g_clip_c2s.data);
+    clipboard_c2s_free_data();
     g_clip_c2s.data = (char *)g_malloc(flist_size, 0);
     if (g_clip_c2s.data == NULL)
     {
@@ -1301,10 +1455,7 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
                                 int clip_msg_len)
 {
     XSelectionRequestEvent *lxev;
-    twchar *wtext;
-    twchar wchr;
     int len;
-    int index;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response:");
     lxev = &g_saved_selection_req_event;
@@ -1328,44 +1479,20 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
     {
         return 0;
     }
-    wtext = (twchar *) g_malloc(((len / 2) + 1) * sizeof(twchar), 0);
-    if (wtext == 0)
-    {
-        return 0;
-    }
-    index = 0;
-    while (s_check_rem(s, 2))
-    {
-        in_uint16_le(s, wchr);
-        wtext[index] = wchr;
-        if (wchr == 0)
-        {
-            break;
-        }
-        index++;
-    }
-    wtext[index] = 0;
-    g_free(g_clip_c2s.data);
-    g_clip_c2s.data = 0;
+    clipboard_c2s_free_data();
     g_clip_c2s.total_bytes = 0;
-    len = g_wcstombs(0, wtext, 0);
-    if (len >= 0)
-    {
-        g_clip_c2s.data = (char *) g_malloc(len + 16, 0);
-        if (g_clip_c2s.data == 0)
-        {
-            g_free(wtext);
-            return 0;
-        }
-        g_wcstombs(g_clip_c2s.data, wtext, len + 1);
-    }
-    if (g_clip_c2s.data != 0)
+    /* converted straight from the reassembled message */
+    g_clip_c2s.data = (char *) g_malloc(CLIP_UTF8_BOUND(len) + 1, 0);
+    if (g_clip_c2s.data == 0)
     {
-        g_clip_c2s.total_bytes = g_strlen(g_clip_c2s.data);
-        g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
-        clipboard_provide_selection_c2s(lxev, lxev->target);
+        return 0;
     }
-    g_free(wtext);
+    clipboard_c2s_utf16_reset();
+    len = clipboard_c2s_utf16_to_utf8(s->p, len, g_clip_c2s.data);
+    g_clip_c2s.data[len] = 0;
+    g_clip_c2s.total_bytes = len;
+    g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
+    clipboard_provide_selection_c2s(lxev, lxev->target);
     return 0;
 }
 
@@ -1418,35 +1545,77 @@ clipboard_process_clip_caps(struct stream *s, int clip_msg_status,
 }
 
 /*****************************************************************************/
+/* sends the next INCR chunk of g_clip_c2s to the requestor, or the empty
+   chunk that ends the transfer once all of it has been sent */
 static int
-ss_part(char *data, int data_bytes)
+clipboard_c2s_send_incr_chunk(void)
 {
-    int index;
-    char *text;
+    char *data;
+    int data_bytes;
 
+    /* an image starts with a chunk of just the BMP file header */
+    data_bytes = clipboard_c2s_get_data(g_clip_c2s.incr_bytes_done,
+                                        g_clip_c2s.read_bytes_done, &data);
+    if ((data_bytes < 1) && g_clip_c2s.doing_response_ss)
+    {
+        /* the rest is still coming from the client */
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_send_incr_chunk: waiting "
+                  "for data");
+        g_clip_c2s.incr_in_progress = 0;
+        return 0;
+    }
+    if (data_bytes > g_incr_max_req_size)
+    {
+        data_bytes = g_incr_max_req_size;
+    }
+    g_clip_c2s.incr_bytes_done += data_bytes;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_send_incr_chunk: data_bytes %d",
+              data_bytes);
+    XChangeProperty(g_display, g_clip_c2s.window,
+                    g_clip_c2s.property, g_clip_c2s.type, 8,
+                    PropModeReplace, (tui8 *)data, data_bytes);
+    if (data_bytes < 1)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_send_incr_chunk: INCR done");
+        g_clip_c2s.incr_in_progress = 0;
+        /* we no longer need property notify */
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+        g_clip_c2s.converted = 1;
+        return 0;
+    }
+    g_clip_c2s.incr_in_progress = 1;
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+ss_part(char *data, int data_bytes)
+{
     LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_part: data_bytes %d read_bytes_done %d "
               "incr_bytes_done %d", data_bytes,
               g_clip_c2s.read_bytes_done,
               g_clip_c2s.incr_bytes_done);
     /* copy to buffer */
-    if (g_clip_c2s.type == g_utf8_atom)
+    if (g_clip_c2s.xrdp_clip_type == XRDP_CB_TEXT)
     {
-        /* todo unicode */
-        text = (char *)g_malloc(data_bytes, 0);
-        index = 0;
-        data_bytes /= 2;
-        while (index < data_bytes)
+        if (g_clip_c2s.read_bytes_done + CLIP_UTF8_BOUND(data_bytes) >
+                g_clip_c2s.data_size)
         {
-            text[index] = data[index * 2];
-            index++;
+            LOG(LOG_LEVEL_ERROR, "ss_part: more data than announced");
+            return 1;
         }
-        text[index] = 0;
-        g_memcpy(g_clip_c2s.data + g_clip_c2s.read_bytes_done, text, data_bytes);
-        g_clip_c2s.read_bytes_done += data_bytes;
-        g_free(text);
+        g_clip_c2s.read_bytes_done +=
+            clipboard_c2s_utf16_to_utf8(data, data_bytes,
+                                        g_clip_c2s.data +
+                                        g_clip_c2s.read_bytes_done);
     }
     else
     {
+        if (g_clip_c2s.read_bytes_done + data_bytes > g_clip_c2s.data_size)
+        {
+            LOG(LOG_LEVEL_ERROR, "ss_part: more data than announced");
+            return 1;
+        }
         g_memcpy(g_clip_c2s.data + g_clip_c2s.read_bytes_done, data, data_bytes);
         g_clip_c2s.read_bytes_done += data_bytes;
     }
@@ -1460,53 +1629,26 @@ ss_part(char *data, int data_bytes)
         LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_part: read_bytes_done < incr_bytes_done");
         return 0;
     }
-    data = g_clip_c2s.data + g_clip_c2s.incr_bytes_done;
-    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-    if (data_bytes > g_incr_max_req_size)
-    {
-        data_bytes = g_incr_max_req_size;
-    }
-    g_clip_c2s.incr_bytes_done += data_bytes;
-    XChangeProperty(g_display, g_clip_c2s.window,
-                    g_clip_c2s.property, g_clip_c2s.type, 8,
-                    PropModeReplace, (tui8 *)data, data_bytes);
-    g_clip_c2s.incr_in_progress = 1;
-    return 0;
+    return clipboard_c2s_send_incr_chunk();
 }
 
 /*****************************************************************************/
 static int
 ss_end(void)
 {
-    char *data;
-    int data_bytes;
-
     LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_end:");
     g_clip_c2s.doing_response_ss = 0;
     g_clip_c2s.in_request = 0;
+    /* the size in the INCR property was a guess, this is what there is */
+    g_clip_c2s.total_bytes = g_clip_c2s.read_bytes_done;
 
     if (g_clip_c2s.incr_in_progress)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_end: incr_in_progress set");
         return 0;
     }
-    if (g_clip_c2s.read_bytes_done <= g_clip_c2s.incr_bytes_done)
-    {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_end: read_bytes_done < incr_bytes_done");
-        return 0;
-    }
-    data = g_clip_c2s.data + g_clip_c2s.incr_bytes_done;
-    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-    if (data_bytes > g_incr_max_req_size)
-    {
-        data_bytes = g_incr_max_req_size;
-    }
-    g_clip_c2s.incr_bytes_done += data_bytes;
-    XChangeProperty(g_display, g_clip_c2s.window,
-                    g_clip_c2s.property, g_clip_c2s.type, 8,
-                    PropModeReplace, (tui8 *)data, data_bytes);
-    g_clip_c2s.incr_in_progress = 1;
-    return 0;
+    /* the requestor is waiting for the rest, or for the end */
+    return clipboard_c2s_send_incr_chunk();
 }
 
 /*****************************************************************************/
@@ -1517,19 +1659,25 @@ ss_start(char *data, int data_bytes, int total_bytes)
     XSelectionRequestEvent *req;
     long val1[2];
     int incr_bytes;
+    int data_size;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "ss_start: data_bytes %d total_bytes %d",
               data_bytes, total_bytes);
     req = &g_saved_selection_req_event;
 
     incr_bytes = total_bytes;
+    data_size = total_bytes;
     if (req->target == g_image_bmp_atom)
     {
         incr_bytes += 14;
+        data_size += 14;
     }
-    else if (req->target == g_utf8_atom)
+    else if (g_clip_c2s.xrdp_clip_type == XRDP_CB_TEXT)
     {
+        /* UTF-16 is converted to UTF-8 as it comes in */
         incr_bytes /= 2;
+        data_size = CLIP_UTF8_BOUND(total_bytes);
+        clipboard_c2s_utf16_reset();
     }
     val1[0] = incr_bytes; /* a guess */
     val1[1] = 0;
@@ -1540,8 +1688,9 @@ ss_start(char *data, int data_bytes, int total_bytes)
     g_clip_c2s.type = req->target;
     g_clip_c2s.property = req->property;
     g_clip_c2s.window = req->requestor;
-    g_free(g_clip_c2s.data);
-    g_clip_c2s.data = (char *)g_malloc(incr_bytes + 64, 0);
+    clipboard_c2s_free_data();
+    g_clip_c2s.data = (char *)g_malloc(data_size + 64, 0);
+    g_clip_c2s.data_size = (g_clip_c2s.data == 0) ? 0 : data_size + 64;
     g_clip_c2s.total_bytes = incr_bytes;
 
     XChangeProperty(g_display, req->requestor, req->property,
@@ -1609,7 +1758,10 @@ clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
         return 0;
     }
 
-    if (g_clip_c2s.in_request)
+    /* large text and images go to the requestor as they come in, file
+       lists are read whole */
+    if (g_clip_c2s.in_request &&
+            (g_clip_c2s.xrdp_clip_type != XRDP_CB_FILE))
     {
         if (total_length > 32 * 1024)
         {
@@ -2561,7 +2713,6 @@ clipboard_event_property_notify(XEvent *xevent)
     int rv;
     int format_in_bytes;
     int new_data_len;
-    int data_bytes;
     char *cptr;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: PropertyNotify .window %ld "
@@ -2578,37 +2729,12 @@ clipboard_event_property_notify(XEvent *xevent)
         /* this is used for when copying a large clipboard to the other app,
            it will delete the property so we know to send the next one */
 
-        if ((g_clip_c2s.data == 0) || (g_clip_c2s.total_bytes < 1))
+        if (g_clip_c2s.data == 0)
         {
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR error");
             return 0;
         }
-        data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
-        data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-        if ((data_bytes < 1) &&
-                (g_clip_c2s.read_bytes_done < g_clip_c2s.total_bytes))
-        {
-            g_clip_c2s.incr_in_progress = 0;
-            return 0;
-        }
-        if (data_bytes > g_incr_max_req_size)
-        {
-            data_bytes = g_incr_max_req_size;
-        }
-        g_clip_c2s.incr_bytes_done += data_bytes;
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: data_bytes %d", data_bytes);
-        XChangeProperty(xevent->xproperty.display, xevent->xproperty.window,
-                        xevent->xproperty.atom, g_clip_c2s.type, 8,
-                        PropModeReplace, data, data_bytes);
-        if (data_bytes < 1)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
-            g_clip_c2s.incr_in_progress = 0;
-            /* we no longer need property notify */
-            XSelectInput(xevent->xproperty.display, xevent->xproperty.window,
-                         NoEventMask);
-            g_clip_c2s.converted = 1;
-        }
+        clipboard_c2s_send_incr_chunk();
     }
     if (g_clip_s2c.incr_in_progress &&
             (xevent->xproperty.window == g_wnd) &&
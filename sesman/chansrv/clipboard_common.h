@@ -59,13 +59,22 @@ struct clip_c2s /* client to server, pasting from mstsc to linux app */
     int read_bytes_done;
     int total_bytes;
     char *data;
+    int data_size; /* bytes allocated for data in a response short circuit */
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
     Window window; /* Window used in INCR transfer */
     int xrdp_clip_type; /* XRDP_CB_TEXT, XRDP_CB_BITMAP, XRDP_CB_FILE, ... */
+    /* an image read whole is sent as the BMP file header and then the
+       rest of the stream it was read into, from p, data is not used */
+    struct stream *image_s;
     int converted;
     int in_request; /* a data request has been sent to client */
     int doing_response_ss; /* doing response short circuit */
+    /* UTF-16 text is converted as it comes in, a code unit or a surrogate
+       pair can be split between chunks */
+    int utf16_byte; /* first byte of a split code unit, or -1 */
+    int utf16_high; /* high surrogate waiting for the low one, or 0 */
+    int utf16_end; /* the terminating NUL has been read */
     Time clip_time;
 };
 
@@ -57,12 +57,35 @@ struct cb_file_info
     int flags;
     int size;
     tui64 time;
+    int transfer_logged; /* audit line written for this file */
 };
 
 static struct list *g_files_list = 0;
 
+/* files kept open while they are sent to the client, so that each chunk
+   is a read carrying on from the last one rather than an open and seek */
+#define CB_MAX_OPEN_FILES 4
+
+struct cb_open_file
+{
+    int in_use;
+    int lindex; /* in g_files_list */
+    int fd;
+    int pos; /* where the next read from fd starts */
+    unsigned int last_used;
+};
+
+static struct cb_open_file g_open_files[CB_MAX_OPEN_FILES];
+static unsigned int g_open_files_clock = 0;
+
+/* reused for every chunk of file data sent to the client */
+static struct stream *g_file_data_s = 0;
+
 /* used when server is asking for file info from the client */
 static int g_file_request_sent_type = 0;
+/* CB_FILECONTENTS_RANGE requests not answered yet, several can be in
+   flight and the client answers them in turn */
+static int g_file_range_requests_sent = 0;
 
 /* number of seconds from 1 Jan. 1601 00:00 to 1 Jan 1970 00:00 UTC */
 #define CB_EPOCH_DIFF 11644473600LL
@@ -82,6 +105,72 @@ timeval2wintime(struct timeval *tv)
 }
 #endif
 
+/*****************************************************************************/
+static void
+clipboard_close_open_file(struct cb_open_file *of)
+{
+    if (of->in_use)
+    {
+        g_file_close(of->fd);
+        of->in_use = 0;
+    }
+}
+
+/*****************************************************************************/
+/* close the files open for sending, the file list is going */
+static void
+clipboard_close_open_files(void)
+{
+    int index;
+
+    for (index = 0; index < CB_MAX_OPEN_FILES; index++)
+    {
+        clipboard_close_open_file(g_open_files + index);
+    }
+}
+
+/*****************************************************************************/
+/* returns the open file for lindex in g_files_list, opening it in place
+   of the least recently used one if need be, or NULL on error */
+static struct cb_open_file *
+clipboard_get_open_file(int lindex, const char *full_fn)
+{
+    struct cb_open_file *of;
+    struct cb_open_file *lru;
+    int index;
+    int fd;
+
+    lru = g_open_files;
+    for (index = 0; index < CB_MAX_OPEN_FILES; index++)
+    {
+        of = g_open_files + index;
+        if (of->in_use && of->lindex == lindex)
+        {
+            of->last_used = ++g_open_files_clock;
+            return of;
+        }
+        if (lru->in_use &&
+                (!of->in_use || of->last_used < lru->last_used))
+        {
+            lru = of;
+        }
+    }
+    fd = g_file_open_ro(full_fn);
+    if (fd == -1)
+    {
+        LOG(LOG_LEVEL_ERROR, "clipboard_get_open_file: file open [%s] failed: %s",
+            full_fn, g_get_strerror());
+        return NULL;
+    }
+    clipboard_close_open_file(lru);
+    lru->in_use = 1;
+    lru->lindex = lindex;
+    lru->fd = fd;
+    lru->pos = 0;
+    lru->last_used = ++g_open_files_clock;
+    return lru;
+}
+
 /***
  * See MS-RDPECLIP 3.1.5.4.7
  *
@@ -304,6 +393,7 @@ clipboard_send_data_response_for_file(const char *data, int data_size)
         g_files_list = list_create();
         g_files_list->auto_free = 1;
     }
+    clipboard_close_open_files();
     list_clear(g_files_list);
     clipboard_get_files(data, data_size);
     cItems = g_files_list->count;
@@ -406,7 +496,7 @@ clipboard_request_file_size(int stream_id, int lindex)
     int rv;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_request_file_size:");
-    if (g_file_request_sent_type != 0)
+    if (g_file_request_sent_type != 0 || g_file_range_requests_sent != 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_request_file_size: warning, still waiting "
                   "for CB_FILECONTENTS_RESPONSE");
@@ -441,9 +531,9 @@ clipboard_send_file_data(int streamId, int lindex,
     struct stream *s;
     int size;
     int rv;
-    int fd;
     char full_fn[256];
     struct cb_file_info *cfi;
+    struct cb_open_file *of;
 
     if (g_files_list == 0)
     {
@@ -462,34 +552,41 @@ clipboard_send_file_data(int streamId, int lindex,
               "nPositionLow %d cbRequested %d", streamId, lindex,
               nPositionLow, cbRequested);
     g_snprintf(full_fn, 255, "%s/%s", cfi->pathname, cfi->filename);
-    fd = g_file_open_ro(full_fn);
-    if (fd == -1)
+    of = clipboard_get_open_file(lindex, full_fn);
+    if (of == NULL)
     {
-        LOG(LOG_LEVEL_ERROR, "clipboard_send_file_data: file open [%s] failed: %s",
-            full_fn, g_get_strerror());
         clipboard_send_filecontents_response_fail(streamId);
         return 1;
     }
-    if (g_file_seek(fd, nPositionLow) < 0)
+    /* the client usually asks for the chunks in order */
+    if (of->pos != nPositionLow)
     {
-        LOG(LOG_LEVEL_ERROR, "clipboard_send_file_data: seek error in file [%s]: %s",
-            full_fn, g_get_strerror());
-        g_file_close(fd);
-        clipboard_send_filecontents_response_fail(streamId);
-        return 1;
+        if (g_file_seek(of->fd, nPositionLow) < 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "clipboard_send_file_data: seek error in file [%s]: %s",
+                full_fn, g_get_strerror());
+            clipboard_close_open_file(of);
+            clipboard_send_filecontents_response_fail(streamId);
+            return 1;
+        }
+        of->pos = nPositionLow;
     }
-    make_stream(s);
+    if (g_file_data_s == 0)
+    {
+        make_stream(g_file_data_s);
+    }
+    s = g_file_data_s;
     init_stream(s, cbRequested + 64);
-    size = g_file_read(fd, s->data + 12, cbRequested);
+    size = g_file_read(of->fd, s->data + 12, cbRequested);
     if (size < 1)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_send_file_data: read error, want %d got %d",
                   cbRequested, size);
-        free_stream(s);
-        g_file_close(fd);
+        clipboard_close_open_file(of);
         clipboard_send_filecontents_response_fail(streamId);
         return 1;
     }
+    of->pos += size;
     out_uint16_le(s, CB_FILECONTENTS_RESPONSE); /* 9 */
     out_uint16_le(s, CB_RESPONSE_OK); /* 1 status */
     out_uint32_le(s, size + 4);
@@ -499,17 +596,21 @@ clipboard_send_file_data(int streamId, int lindex,
     s_mark_end(s);
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
-    free_stream(s);
-    g_file_close(fd);
 
-    /* Log who transferred which file via clipboard for the purpose of audit */
-    LOG(LOG_LEVEL_INFO, "S2C: Transferred a file: filename=%s, uid=%d", full_fn, g_getuid());
+    /* Log who transferred which file via clipboard for the purpose of audit,
+       once for each file rather than for each chunk */
+    if (!cfi->transfer_logged)
+    {
+        LOG(LOG_LEVEL_INFO, "S2C: Transferred a file: filename=%s, uid=%d",
+            full_fn, g_getuid());
+        cfi->transfer_logged = 1;
+    }
 
     return rv;
 }
 
 /*****************************************************************************/
-/* ask the client to send the file size */
+/* ask the client to send a range of the file */
 int
 clipboard_request_file_data(int stream_id, int lindex, int offset,
                             int request_bytes)
@@ -524,7 +625,7 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     if (g_file_request_sent_type != 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_request_file_data: warning, still waiting "
-                  "for CB_FILECONTENTS_RESPONSE");
+                  "for CB_FILECONTENTS_RESPONSE to a size request");
     }
     make_stream(s);
     init_stream(s, 8192);
@@ -543,11 +644,20 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_RANGE;
+    g_file_range_requests_sent++;
     return rv;
 }
 
 
+/*****************************************************************************/
+void
+clipboard_file_deinit(void)
+{
+    clipboard_close_open_files();
+    free_stream(g_file_data_s);
+    g_file_data_s = 0;
+}
+
 /*****************************************************************************/
 /* client is asking from info about a file */
 int
@@ -601,11 +711,23 @@ clipboard_process_file_response(struct stream *s, int clip_msg_status,
                   "file_size %d", streamId, file_size);
         xfuse_file_contents_size(streamId, file_size);
     }
-    else if (g_file_request_sent_type == CB_FILECONTENTS_RANGE)
+    else if (g_file_range_requests_sent > 0)
     {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
-        xfuse_file_contents_range(streamId, s->p, clip_msg_len - 4);
+        g_file_range_requests_sent--;
+        /* a failed response may not have the streamId */
+        streamId = -1;
+        if (s_check_rem(s, 4))
+        {
+            in_uint32_le(s, streamId);
+        }
+        if (clip_msg_status & CB_RESPONSE_FAIL)
+        {
+            xfuse_file_contents_range(streamId, NULL, -1);
+        }
+        else
+        {
+            xfuse_file_contents_range(streamId, s->p, clip_msg_len - 4);
+        }
     }
     else
     {
@@ -58,4 +58,11 @@ int
 clipboard_request_file_data(int stream_id, int lindex, int offset,
                             int request_bytes);
 
+/**
+ * Close the files kept open for sending to the client, and free the
+ * buffer used for them
+ */
+void
+clipboard_file_deinit(void);
+
 #endif
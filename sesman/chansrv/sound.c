@@ -76,6 +76,8 @@ static int    g_cBlockNo = 0;
 static int    g_bytes_in_stream = 0;
 struct fifo  *g_in_fifo;
 int    g_bytes_in_fifo = 0;
+int    g_in_fifo_prefill_bytes = 0; /* jitter buffer, set by audin.c */
+static int g_in_fifo_filling = 1;
 static int    g_time_diff = 0;
 static int    g_best_time_diff = 0;
 
@@ -92,6 +94,33 @@ static int g_bbuf_size = 1024 * 8; /* may change later */
 
 static struct list *g_ack_time_diff = 0;
 
+/* low latency mode, see sound_ll_drop_frame() */
+#define SOUND_OPUS_BYTES_PER_MS (48 * 4) /* 48 kHz stereo 16 bit */
+/* confirms older than this are not gone by */
+#define SOUND_LL_CONFIRM_TIMEOUT_MS 1000
+static int g_ll_delay = 0;           /* smoothed send to confirm time, ms */
+static int g_ll_jitter = 0;          /* smoothed deviation from it, ms */
+static int g_ll_min_delay = 0;       /* least send to confirm time, ms */
+static int g_ll_confirmed_block = 0; /* last cConfirmedBlockNo */
+static int g_ll_confirm_time = 0;    /* g_time3() of the last confirm, or 0 */
+static int g_ll_dropped = 0;         /* the last frame was dropped */
+
+/* sound out over a dynamic channel, see sound_send_output_pdu() */
+#define SOUND_DVC_NAME       "AUDIO_PLAYBACK_DVC"
+#define SOUND_LOSSY_DVC_NAME "AUDIO_PLAYBACK_LOSSY_DVC"
+#define SOUND_DVC_FLAGS      1 /* WTS_CHANNEL_OPTION_DYNAMIC */
+/* the static channel is used if the client says nothing by then */
+#define SOUND_DVC_OPEN_TIMEOUT_MS 5000
+/* versions from which Wave2 PDUs are understood */
+#define SOUND_WAVE2_VERSION  8
+static struct chansrv_drdynvc_procs g_dvc_procs;
+static int g_dvc_chan_id = 0;         /* chansrv chan_id, 0 if none */
+static int g_dvc_open = 0;            /* sound out goes over g_dvc_chan_id */
+static int g_dvc_lossy = 0;           /* g_dvc_chan_id is the lossy one */
+static int g_dvc_open_seq = 0;        /* for sound_dvc_open_timeout() */
+static struct stream *g_dvc_s = NULL; /* client PDU in fragments */
+static int g_client_version = 0;      /* wVersion of the client formats */
+
 struct xr_wave_format_ex
 {
     int wFormatTag;
@@ -208,6 +237,14 @@ static int g_current_client_format_index = 0;
 /* index into list from server */
 static int g_current_server_format_index = 0;
 
+/*****************************************************************************/
+/* Opus in short frames, in preference to any other codec */
+static int
+sound_low_latency(void)
+{
+    return g_cfg->sound_low_latency && g_client_does_opus;
+}
+
 /* input formats */
 
 static tui8 g_pcm_inp_22050_data[] = { 0 };
@@ -262,6 +299,19 @@ static int sound_sndsrvr_source_data_in(struct trans *trans);
 static int sound_start_source_listener(void);
 static int sound_start_sink_listener(void);
 
+/*****************************************************************************/
+/* send a PDU of sound out, over the dynamic channel if the client has
+   opened it */
+static int
+sound_send_output_pdu(const char *data, int bytes)
+{
+    if (g_dvc_open)
+    {
+        return chansrv_drdynvc_send_data(g_dvc_chan_id, data, bytes);
+    }
+    return send_channel_data(g_rdpsnd_chan_id, data, bytes);
+}
+
 /*****************************************************************************/
 static int
 sound_send_server_output_formats(void)
@@ -287,7 +337,8 @@ sound_send_server_output_formats(void)
     out_uint16_le(s, 0);                    /* wDGramPort */
     out_uint16_le(s, num_formats);          /* wNumberOfFormats */
     out_uint8(s, g_cBlockNo);               /* cLastBlockConfirmed */
-    out_uint16_le(s, 5);                    /* wVersion */
+    /* Wave2 PDUs are only sent over the dynamic channel */
+    out_uint16_le(s, g_dvc_open ? SOUND_WAVE2_VERSION : 5); /* wVersion */
     out_uint8(s, 0);                        /* bPad */
 
     /* sndFormats */
@@ -330,7 +381,7 @@ sound_send_server_output_formats(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_output_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -359,7 +410,7 @@ sound_send_training(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_output_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -460,7 +511,9 @@ sound_process_output_formats(struct stream *s, int size)
 
     in_uint8s(s, 14);
     in_uint16_le(s, num_formats);
-    in_uint8s(s, 4);
+    in_uint8s(s, 1);                        /* cLastBlockConfirmed */
+    in_uint16_le(s, g_client_version);      /* wVersion */
+    in_uint8s(s, 1);                        /* bPad */
 
     if (num_formats > 0)
     {
@@ -478,6 +531,11 @@ sound_process_output_formats(struct stream *s, int size)
                                         nAvgBytesPerSec, nBlockAlign, wBitsPerSample,
                                         cbSize, data);
         }
+        if (sound_low_latency())
+        {
+            /* so the first frame is the right size too */
+            g_bbuf_size = g_cfg->sound_opus_frame_ms * SOUND_OPUS_BYTES_PER_MS;
+        }
         sound_send_training();
     }
 
@@ -718,6 +776,8 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
            SWB (super-wideband) 24 kHz
            FB (fullband)        48 kHz */
         g_opus_encoder = opus_encoder_create(48000, 2,
+                                             sound_low_latency() ?
+                                             OPUS_APPLICATION_RESTRICTED_LOWDELAY :
                                              OPUS_APPLICATION_AUDIO,
                                              &error);
         if (g_opus_encoder == 0)
@@ -725,6 +785,16 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
             LOG_DEVEL(LOG_LEVEL_ERROR, "sound_wave_compress_opus: opus_encoder_create failed");
             return data_bytes;
         }
+        if (g_cfg->sound_opus_bitrate > 0)
+        {
+            opus_encoder_ctl(g_opus_encoder,
+                             OPUS_SET_BITRATE(g_cfg->sound_opus_bitrate));
+        }
+        if (g_cfg->sound_opus_complexity >= 0)
+        {
+            opus_encoder_ctl(g_opus_encoder,
+                             OPUS_SET_COMPLEXITY(g_cfg->sound_opus_complexity));
+        }
     }
     data_bytes_org = data_bytes;
     rv = data_bytes;
@@ -860,6 +930,11 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
 static int
 sound_wave_compress(char *data, int data_bytes, int *format_index)
 {
+    if (sound_low_latency())
+    {
+        g_bbuf_size = g_cfg->sound_opus_frame_ms * SOUND_OPUS_BYTES_PER_MS;
+        return sound_wave_compress_opus(data, data_bytes, format_index);
+    }
     if (g_client_does_fdk_aac)
     {
         g_bbuf_size = 4096;
@@ -878,6 +953,34 @@ sound_wave_compress(char *data, int data_bytes, int *format_index)
     return data_bytes;
 }
 
+/*****************************************************************************/
+/* send a Wave2 PDU to the client, the header and data in one */
+static int
+sound_send_wave2_data_chunk(char *data, int data_bytes, int format_index)
+{
+    struct stream *s;
+    int error;
+    int time;
+
+    make_stream(s);
+    init_stream(s, 16 + data_bytes);
+    out_uint16_le(s, SNDC_WAVE2);
+    out_uint16_le(s, 12 + data_bytes); /* BodySize */
+    time = g_time3();
+    out_uint16_le(s, time);
+    out_uint16_le(s, format_index); /* wFormatNo */
+    g_cBlockNo++;
+    out_uint8(s, g_cBlockNo);
+    g_sent_time[g_cBlockNo & 0xff] = time;
+    out_uint8s(s, 3);
+    out_uint32_le(s, time); /* dwAudioTimeStamp */
+    out_uint8a(s, data, data_bytes);
+    s_mark_end(s);
+    error = sound_send_output_pdu(s->data, (int)(s->end - s->data));
+    free_stream(s);
+    return error;
+}
+
 /*****************************************************************************/
 /* send wave message to client */
 static int
@@ -903,6 +1006,11 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
 
     LOG(LOG_LEVEL_TRACE, "sound_send_wave_data_chunk: wFormatNo %d", format_index);
 
+    if (g_dvc_open && (g_client_version >= SOUND_WAVE2_VERSION))
+    {
+        return sound_send_wave2_data_chunk(data, data_bytes, format_index);
+    }
+
     /* part one of 2 PDU wave info */
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: sending %d bytes", data_bytes);
@@ -931,7 +1039,7 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_output_pdu(s->data, bytes);
 
     /* part two of 2 PDU wave info
        even is zero, we have to send this */
@@ -940,12 +1048,50 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
     out_uint8a(s, data + 4, data_bytes - 4);
     s_mark_end(s);
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_output_pdu(s->data, bytes);
 
     free_stream(s);
     return 0;
 }
 
+/*****************************************************************************/
+/* In low latency mode, a frame is dropped when the sound sent but not yet
+   confirmed by the client is more than SoundMaxLatencyMs, or more than the
+   network needs if that's longer. Frames aren't dropped two in a row, or
+   when the client isn't confirming them.
+   returns boolean */
+static int
+sound_ll_drop_frame(void)
+{
+    int frame_ms;
+    int in_flight_ms;
+    int limit_ms;
+
+    if ((g_ll_confirm_time == 0) ||
+            (g_time3() - g_ll_confirm_time > SOUND_LL_CONFIRM_TIMEOUT_MS))
+    {
+        return 0;
+    }
+    if (g_ll_dropped)
+    {
+        g_ll_dropped = 0;
+        return 0;
+    }
+    frame_ms = g_cfg->sound_opus_frame_ms;
+    in_flight_ms = ((g_cBlockNo - g_ll_confirmed_block) & 0xff) * frame_ms;
+    limit_ms = MAX((int) g_cfg->sound_max_latency_ms,
+                   g_ll_min_delay + 2 * g_ll_jitter + frame_ms);
+    if (in_flight_ms <= limit_ms)
+    {
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_ll_drop_frame: in flight %d ms limit %d ms "
+              "delay %d ms jitter %d ms", in_flight_ms, limit_ms,
+              g_ll_delay, g_ll_jitter);
+    g_ll_dropped = 1;
+    return 1;
+}
+
 /*****************************************************************************/
 /* send wave message to client, buffer first */
 static int
@@ -958,7 +1104,7 @@ sound_send_wave_data(char *data, int data_bytes)
     int res;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: sending %d bytes", data_bytes);
-    if (g_time_diff > g_best_time_diff + 250)
+    if (!sound_low_latency() && (g_time_diff > g_best_time_diff + 250))
     {
         data_bytes = data_bytes / 4;
         data_bytes = data_bytes & ~3;
@@ -982,6 +1128,12 @@ sound_send_wave_data(char *data, int data_bytes)
         if (g_buf_index >= g_bbuf_size)
         {
             g_buf_index = 0;
+            if (sound_low_latency() && sound_ll_drop_frame())
+            {
+                data_bytes -= chunk_bytes;
+                data_index += chunk_bytes;
+                continue;
+            }
             res = sound_send_wave_data_chunk(g_buffer, g_bbuf_size);
             if (res == 2)
             {
@@ -1016,6 +1168,11 @@ sound_send_close(void)
 
     g_best_time_diff = 0;
     g_buf_index = 0;
+    g_ll_delay = 0;
+    g_ll_jitter = 0;
+    g_ll_min_delay = 0;
+    g_ll_confirm_time = 0;
+    g_ll_dropped = 0;
 
     /* send close msg */
     make_stream(s);
@@ -1028,7 +1185,7 @@ sound_send_close(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_output_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -1054,6 +1211,7 @@ sound_process_wave_confirm(struct stream *s, int size)
     int cConfirmedBlockNo;
     int time;
     int time_diff;
+    int deviation;
     int index;
     int acc;
 
@@ -1066,6 +1224,25 @@ sound_process_wave_confirm(struct stream *s, int size)
         "cConfirmedBlockNo %d time diff %d",
         wTimeStamp, cConfirmedBlockNo, time_diff);
 
+    /* for sound_ll_drop_frame(), smoothed as for a TCP round trip time */
+    g_ll_confirmed_block = cConfirmedBlockNo;
+    g_ll_confirm_time = time;
+    if (g_ll_delay == 0)
+    {
+        g_ll_delay = time_diff;
+        g_ll_jitter = time_diff / 2;
+    }
+    else
+    {
+        deviation = time_diff - g_ll_delay;
+        g_ll_jitter = (3 * g_ll_jitter + MAX(deviation, -deviation)) / 4;
+        g_ll_delay = (7 * g_ll_delay + time_diff) / 8;
+    }
+    if ((g_ll_min_delay < 1) || (g_ll_min_delay > time_diff))
+    {
+        g_ll_min_delay = time_diff;
+    }
+
     acc = 0;
     list_add_item(g_ack_time_diff, time_diff);
     if (g_ack_time_diff->count >= 50)
@@ -1099,7 +1276,8 @@ process_pcm_message(int id, int size, struct stream *s)
     switch (id)
     {
         case 0:
-            if ((g_client_does_fdk_aac || g_client_does_mp3lame) && sending_silence)
+            if ((g_client_does_fdk_aac || g_client_does_mp3lame) &&
+                    !sound_low_latency() && sending_silence)
             {
                 if ((g_time3() - silence_start_time) < (int)g_cfg->msec_do_not_send)
                 {
@@ -1111,7 +1289,8 @@ process_pcm_message(int id, int size, struct stream *s)
             return sound_send_wave_data(s->p, size);
             break;
         case 1:
-            if ((g_client_does_fdk_aac || g_client_does_mp3lame) && sending_silence == 0)
+            if ((g_client_does_fdk_aac || g_client_does_mp3lame) &&
+                    !sound_low_latency() && sending_silence == 0)
             {
                 /* workaround for mstsc.exe. send silence data before send close */
                 int send_silence_times = g_client_does_fdk_aac ? g_cfg->num_silent_frames_aac : g_cfg->num_silent_frames_mp3;  /* setting from sesman.ini */
@@ -1268,6 +1447,207 @@ in_fifo_item_destructor(void *item, void *closure)
     xstream_free((struct stream *)item);
 }
 
+/*****************************************************************************/
+/* PDUs of sound out from the client, over either channel */
+static int
+sound_process_output_pdu(struct stream *s, int code, int size)
+{
+    switch (code)
+    {
+        case SNDC_WAVECONFIRM:
+            sound_process_wave_confirm(s, size);
+            break;
+
+        case SNDC_TRAINING:
+            sound_process_training(s, size);
+            break;
+
+        case SNDC_FORMATS:
+            sound_process_output_formats(s, size);
+            break;
+
+        default:
+            LOG_DEVEL(LOG_LEVEL_ERROR, "sound_process_output_pdu: unknown code %d size %d", code, size);
+            break;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_process_pdu(struct stream *s)
+{
+    int code;
+    int size;
+
+    if (!s_check_rem(s, 4))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_dvc_process_pdu: short PDU");
+        return 0;
+    }
+    in_uint8(s, code);
+    in_uint8s(s, 1);
+    in_uint16_le(s, size);
+    return sound_process_output_pdu(s, code, size);
+}
+
+/*****************************************************************************/
+static void
+sound_dvc_open_timeout(void *data)
+{
+    if (((int) (tintptr) data != g_dvc_open_seq) ||
+            (g_dvc_chan_id == 0) || g_dvc_open)
+    {
+        return;
+    }
+    LOG(LOG_LEVEL_WARNING, "sound_dvc_open_timeout: no reply to open %s, "
+        "using the static channel",
+        g_dvc_lossy ? SOUND_LOSSY_DVC_NAME : SOUND_DVC_NAME);
+    /* a late reply is ignored */
+    g_dvc_chan_id = 0;
+    g_dvc_lossy = 0;
+    sound_send_server_output_formats();
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+sound_dvc_open(int lossy)
+{
+    int error;
+
+    g_dvc_lossy = lossy;
+    g_dvc_open_seq++;
+    error = chansrv_drdynvc_open(lossy ? SOUND_LOSSY_DVC_NAME : SOUND_DVC_NAME,
+                                 SOUND_DVC_FLAGS, &g_dvc_procs,
+                                 &g_dvc_chan_id);
+    if (error != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "sound_dvc_open: chansrv_drdynvc_open failed");
+        g_dvc_chan_id = 0;
+        return error;
+    }
+    add_timeout(SOUND_DVC_OPEN_TIMEOUT_MS, sound_dvc_open_timeout,
+                (void *) (tintptr) g_dvc_open_seq);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_open_response(int chan_id, int creation_status)
+{
+    LOG_DEVEL(LOG_LEVEL_INFO, "sound_dvc_open_response: creation_status 0x%8.8x",
+              creation_status);
+    if (chan_id != g_dvc_chan_id)
+    {
+        if (creation_status == 0)
+        {
+            /* timed out already */
+            chansrv_drdynvc_close(chan_id);
+        }
+        return 0;
+    }
+    if (creation_status == 0)
+    {
+        LOG(LOG_LEVEL_INFO, "sound_dvc_open_response: sound out over %s",
+            g_dvc_lossy ? SOUND_LOSSY_DVC_NAME : SOUND_DVC_NAME);
+        g_dvc_open = 1;
+        return sound_send_server_output_formats();
+    }
+    g_dvc_chan_id = 0;
+    if (g_dvc_lossy && (sound_dvc_open(0) == 0))
+    {
+        return 0;
+    }
+    LOG(LOG_LEVEL_INFO, "sound_dvc_open_response: client refused the "
+        "dynamic channel, using the static channel");
+    g_dvc_lossy = 0;
+    return sound_send_server_output_formats();
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_close_response(int chan_id)
+{
+    LOG_DEVEL(LOG_LEVEL_INFO, "sound_dvc_close_response:");
+    if (chan_id == g_dvc_chan_id)
+    {
+        g_dvc_chan_id = 0;
+        g_dvc_open = 0;
+        free_stream(g_dvc_s);
+        g_dvc_s = NULL;
+        /* the formats agreed over the dynamic channel are gone with it,
+           sound out carries on over the static channel once the client
+           has answered the formats sent there */
+        g_client_version = 0;
+        g_client_does_fdk_aac = 0;
+        g_client_fdk_aac_index = 0;
+        g_client_does_opus = 0;
+        g_client_opus_index = 0;
+        g_client_does_mp3lame = 0;
+        g_client_mp3lame_index = 0;
+        g_current_client_format_index = 0;
+        sound_send_server_output_formats();
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_data_fragment(int chan_id, char *data, int bytes)
+{
+    int rv;
+
+    if (!s_check_rem(g_dvc_s, bytes))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_dvc_data_fragment: error bytes %d left %d",
+                  bytes, (int) (g_dvc_s->end - g_dvc_s->p));
+        return 1;
+    }
+    out_uint8a(g_dvc_s, data, bytes);
+    if (g_dvc_s->p == g_dvc_s->end)
+    {
+        g_dvc_s->p = g_dvc_s->data;
+        rv = sound_dvc_process_pdu(g_dvc_s);
+        free_stream(g_dvc_s);
+        g_dvc_s = NULL;
+        return rv;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_data_first(int chan_id, char *data, int bytes, int total_bytes)
+{
+    if (g_dvc_s != NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_dvc_data_first: warning g_dvc_s is not nil");
+        free_stream(g_dvc_s);
+    }
+    make_stream(g_dvc_s);
+    init_stream(g_dvc_s, total_bytes);
+    g_dvc_s->end = g_dvc_s->data + total_bytes;
+    return sound_dvc_data_fragment(chan_id, data, bytes);
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_data(int chan_id, char *data, int bytes)
+{
+    struct stream ls;
+
+    if (g_dvc_s == NULL)
+    {
+        g_memset(&ls, 0, sizeof(ls));
+        ls.data = data;
+        ls.p = ls.data;
+        ls.end = ls.p + bytes;
+        return sound_dvc_process_pdu(&ls);
+    }
+    return sound_dvc_data_fragment(chan_id, data, bytes);
+}
+
 /*****************************************************************************/
 int
 sound_init(void)
@@ -1276,8 +1656,22 @@ sound_init(void)
 
     g_stream_incoming_packet = NULL;
 
-    /* init sound output */
-    sound_send_server_output_formats();
+    /* init sound output, the formats go over the dynamic channel when the
+       client opens it, or the static channel if it doesn't */
+    g_memset(&g_dvc_procs, 0, sizeof(g_dvc_procs));
+    g_dvc_procs.open_response = sound_dvc_open_response;
+    g_dvc_procs.close_response = sound_dvc_close_response;
+    g_dvc_procs.data_first = sound_dvc_data_first;
+    g_dvc_procs.data = sound_dvc_data;
+    g_dvc_chan_id = 0;
+    g_dvc_open = 0;
+    g_dvc_s = NULL;
+    g_client_version = 0;
+    if (!g_cfg->sound_dynamic_channel ||
+            (sound_dvc_open(g_cfg->sound_lossy_channel) != 0))
+    {
+        sound_send_server_output_formats();
+    }
     sound_start_sink_listener();
 
     /* init sound input */
@@ -1302,6 +1696,21 @@ sound_init(void)
     }
     list_clear(g_ack_time_diff);
 
+#if defined(XRDP_OPUS)
+    if (g_cfg->sound_low_latency)
+    {
+        LOG(LOG_LEVEL_INFO, "sound low latency: %d ms Opus frames, "
+            "max latency %d ms", g_cfg->sound_opus_frame_ms,
+            g_cfg->sound_max_latency_ms);
+    }
+#else
+    if (g_cfg->sound_low_latency)
+    {
+        LOG(LOG_LEVEL_WARNING, "SoundLowLatency needs xrdp built with Opus, "
+            "ignored");
+    }
+#endif
+
 #if defined(XRDP_FDK_AAC) || defined(XRDP_MP3LAME)
     LOG(LOG_LEVEL_INFO, "num_silent_frames_aac: %d", g_cfg->num_silent_frames_aac);
     LOG(LOG_LEVEL_INFO, "num_silent_frames_mp3: %d", g_cfg->num_silent_frames_mp3);
@@ -1349,8 +1758,21 @@ sound_deinit(void)
     }
 #endif
 
+#if defined(XRDP_OPUS)
+    if (g_opus_encoder != 0)
+    {
+        opus_encoder_destroy(g_opus_encoder);
+        g_opus_encoder = 0;
+    }
+#endif
+
     fifo_delete(g_in_fifo, NULL);
 
+    free_stream(g_dvc_s);
+    g_dvc_s = NULL;
+    g_dvc_chan_id = 0;
+    g_dvc_open = 0;
+
     return 0;
 }
 
@@ -1378,18 +1800,6 @@ sound_data_in(struct stream *s, int chan_id, int chan_flags, int length,
 
     switch (code)
     {
-        case SNDC_WAVECONFIRM:
-            sound_process_wave_confirm(g_stream_incoming_packet, size);
-            break;
-
-        case SNDC_TRAINING:
-            sound_process_training(g_stream_incoming_packet, size);
-            break;
-
-        case SNDC_FORMATS:
-            sound_process_output_formats(g_stream_incoming_packet, size);
-            break;
-
         case SNDC_REC_NEGOTIATE:
             sound_process_input_formats(g_stream_incoming_packet, size);
             break;
@@ -1400,7 +1810,7 @@ sound_data_in(struct stream *s, int chan_id, int chan_flags, int length,
             break;
 
         default:
-            LOG_DEVEL(LOG_LEVEL_ERROR, "sound_data_in: unknown code %d size %d", code, size);
+            sound_process_output_pdu(g_stream_incoming_packet, code, size);
             break;
     }
 
@@ -1806,6 +2216,16 @@ sound_sndsrvr_source_data_in(struct trans *trans)
         /* set real len later */
         out_uint16_le(s, 0);
 
+        if (g_in_fifo_filling && (g_bytes_in_fifo < g_in_fifo_prefill_bytes))
+        {
+            /* after running dry, nothing until the jitter buffer fills */
+            bytes_req = 0;
+        }
+        else
+        {
+            g_in_fifo_filling = 0;
+        }
+
         while (bytes_read < bytes_req)
         {
             if (g_stream_inp == NULL)
@@ -1821,6 +2241,7 @@ sound_sndsrvr_source_data_in(struct trans *trans)
             if (g_stream_inp == NULL)
             {
                 /* no more data, send what we have */
+                g_in_fifo_filling = 1;
                 break;
             }
             else
@@ -37,6 +37,7 @@
 #define SNDC_UDPWAVE        0x0A
 #define SNDC_UDPWAVELAST    0x0B
 #define SNDC_QUALITYMODE    0x0C
+#define SNDC_WAVE2          0x0D
 
 /* used for sound input (mic) */
 #define SNDC_REC_NEGOTIATE  39
@@ -33,6 +33,7 @@
 #include "list.h"
 #include "os_calls.h"
 #include "pre_session_list.h"
+#include "reactor.h"
 #include "trans.h"
 
 #define PRE_SESSION_IN_USE(si) \
@@ -153,108 +154,45 @@ pre_session_list_set_peername(struct pre_session_item *psi, const char *name)
 
 /******************************************************************************/
 int
-pre_session_list_get_wait_objs(tbus robjs[], int *robjs_count)
+pre_session_list_trans_ready(struct reactor *reactor, tintptr obj,
+                             int events, void *arg)
 {
-    int i = 0;
+    struct trans *trans = (struct trans *)arg;
+    struct pre_session_item *psi;
+    enum pre_session_dispatcher_action action;
+    int index;
 
-    while (i < g_pre_session_list->count)
+    psi = (struct pre_session_item *)trans->callback_data;
+    if (trans->status != TRANS_STATUS_UP)
     {
-        struct pre_session_item *psi;
-        psi = (struct pre_session_item *)list_get_item(g_pre_session_list, i);
-        int psi_in_use = 0;
-
-        if (psi != NULL)
-        {
-            if (psi->client_trans != NULL &&
-                    psi->client_trans->status == TRANS_STATUS_UP)
-            {
-                robjs[(*robjs_count)++] = psi->client_trans->sck;
-                psi_in_use = 1;
-            }
-
-            if (psi->sesexec_trans != NULL &&
-                    psi->sesexec_trans->status == TRANS_STATUS_UP)
-            {
-                robjs[(*robjs_count)++] = psi->sesexec_trans->sck;
-                psi_in_use = 1;
-            }
-        }
-
-        if (psi_in_use)
-        {
-            ++i;
-        }
-        else
-        {
-            free_pre_session_item(psi);
-            list_remove_item(g_pre_session_list, i);
-        }
+        /* Gone down on a write, the other transport may still be up */
+        reactor_remove_obj(reactor, obj);
     }
-
-    return 0;
-}
-
-/******************************************************************************/
-int
-pre_session_list_check_wait_objs(void)
-{
-    int i = 0;
-
-    while (i < g_pre_session_list->count)
+    else if (trans_check_wait_objs(trans) != 0)
     {
-        struct pre_session_item *psi;
-        enum pre_session_dispatcher_action action;
-
-        psi = (struct pre_session_item *)list_get_item(g_pre_session_list, i);
-        action = E_PSD_TERMINATE_PRE_SESSION;
-
-        if (PRE_SESSION_IN_USE(psi))
-        {
-            if (psi->client_trans != NULL &&
-                    psi->client_trans->status == TRANS_STATUS_UP)
-            {
-                if (trans_check_wait_objs(psi->client_trans) != 0)
-                {
-                    LOG(LOG_LEVEL_ERROR, "pre_session_list_check_wait_objs: "
-                        "trans_check_wait_objs(1) failed, removing trans");
-                    psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
-                }
-            }
+        LOG(LOG_LEVEL_ERROR, "pre_session_list_trans_ready: "
+            "trans_check_wait_objs failed, removing trans");
+        psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
+    }
 
-            if (psi->sesexec_trans != NULL &&
-                    psi->sesexec_trans->status == TRANS_STATUS_UP)
-            {
-                if (trans_check_wait_objs(psi->sesexec_trans) != 0)
-                {
-                    LOG(LOG_LEVEL_ERROR, "pre_session_list_check_wait_objs: "
-                        "trans_check_wait_objs(2) failed, removing trans");
-                    psi->dispatcher_action = E_PSD_TERMINATE_PRE_SESSION;
-                }
-            }
+    /* Get any action, and reset the requested one */
+    action = psi->dispatcher_action;
+    psi->dispatcher_action = E_PSD_NONE;
 
-            /* Get any action, and reset the requested one */
-            action = psi->dispatcher_action;
-            psi->dispatcher_action = E_PSD_NONE;
-        }
+    if (action == E_PSD_REMOVE_CLIENT_TRANS)
+    {
+        trans_delete(psi->client_trans);
+        psi->client_trans = NULL;
+    }
 
-        switch (action)
+    if (action == E_PSD_TERMINATE_PRE_SESSION || !PRE_SESSION_IN_USE(psi))
+    {
+        index = list_index_of(g_pre_session_list, (tintptr)psi);
+        if (index >= 0)
         {
-            case E_PSD_NONE:
-                /* On to the next item on the list */
-                ++i;
-                break;
-
-            case E_PSD_REMOVE_CLIENT_TRANS:
-                trans_delete(psi->client_trans);
-                psi->client_trans = NULL;
-                /* On to the next item on the list */
-                ++i;
-                break;
-            case E_PSD_TERMINATE_PRE_SESSION:
-                free_pre_session_item(psi);
-                list_remove_item(g_pre_session_list, i);
-                break;
+            list_remove_item(g_pre_session_list, index);
         }
+        free_pre_session_item(psi);
     }
 
     return 0;
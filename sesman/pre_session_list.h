@@ -33,8 +33,11 @@
 
 #include <sys/types.h>
 
+#include "arch.h"
 #include "xrdp_constants.h"
 
+struct reactor;
+
 /**
  * Type describing the login state of a pre-session item
  */
@@ -108,12 +111,12 @@ pre_session_list_get_count(void);
  *
  * @return pointer to new pre-session object or NULL for no memory
  *
- * After allocating the session, you must initialise the sesexec_trans field
- * with a valid transport.
+ * After allocating the session, you must initialise the client_trans field
+ * with a valid transport, added to the sesman reactor with
+ * pre_session_list_trans_ready().
  *
- * The session is removed by pre_session_list_get_wait_objs() or
- * pre_session_check_wait_objs() when the client
- * transport goes down (or wasn't allocated in the first place).
+ * The session is removed by pre_session_list_trans_ready() when its
+ * transports go down.
  */
 struct pre_session_item *
 pre_session_list_new(void);
@@ -129,20 +132,20 @@ int
 pre_session_list_set_peername(struct pre_session_item *psi, const char *name);
 
 /**
- * @brief Get the wait objs for the pre-session list module
- * @param @robjs Objects array to update
- * @param robjs_count Elements in robjs (by reference)
- * @return 0 for success
- */
-int
-pre_session_list_get_wait_objs(tbus robjs[], int *robjs_count);
-
-
-/**
- * @brief Check the wait objs for the pre-session list module
+ * @brief Reactor callback for a transport of a pre-session item
+ *
+ * Pass this to trans_add_to_reactor() for the client_trans and the
+ * sesexec_trans of an item. The item is the callback_data of the
+ * transport.
+ *
+ * @param reactor Reactor
+ * @param obj Ready object
+ * @param events Ready events
+ * @param arg Transport
  * @return 0 for success
  */
 int
-pre_session_list_check_wait_objs(void);
+pre_session_list_trans_ready(struct reactor *reactor, tintptr obj,
+                             int events, void *arg);
 
 #endif // PRE_SESSION_LIST_H
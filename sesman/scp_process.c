@@ -391,6 +391,7 @@ process_create_session_request(struct pre_session_item *psi)
                 LOG(LOG_LEVEL_ERROR,
                     "Can't start sesexec to authenticate user");
                 status = E_SCP_SCREATE_GENERAL_ERROR;
+                session_list_remove(s_item);
             }
             else
             {
@@ -408,6 +409,7 @@ process_create_session_request(struct pre_session_item *psi)
                     LOG(LOG_LEVEL_ERROR,
                         "Can't ask sesexec to authenticate user");
                     status = E_SCP_SCREATE_GENERAL_ERROR;
+                    session_list_remove(s_item);
                 }
                 else
                 {
@@ -427,6 +429,12 @@ process_create_session_request(struct pre_session_item *psi)
                     psi->sesexec_trans = NULL;
                     psi->sesexec_pid = 0;
 
+                    // The transport is already in the reactor, so this
+                    // only changes the callback
+                    (void)trans_add_to_reactor(s_item->sesexec_trans,
+                                               g_reactor,
+                                               session_list_trans_ready);
+
                     // Add the display to the session item so we don't try
                     // to allocate it to another session
                     s_item->display = display;
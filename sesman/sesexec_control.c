@@ -211,6 +211,12 @@ sesexec_start(struct pre_session_item *psi)
                         g_get_strerror());
                     g_file_close(sck[0]);
                 }
+                else if (trans_add_to_reactor(t, g_reactor,
+                                              pre_session_list_trans_ready) != 0)
+                {
+                    LOG(LOG_LEVEL_ERROR, "Can't wait for sesexec transport");
+                    trans_delete(t);
+                }
                 else
                 {
                     t->trans_data_in = sesman_eicp_data_in;
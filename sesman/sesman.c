@@ -43,6 +43,7 @@
 #include "session_list.h"
 #include "lock_uds.h"
 #include "os_calls.h"
+#include "reactor.h"
 #include "scp.h"
 #include "scp_process.h"
 #include "sesexec_control.h"
@@ -89,6 +90,9 @@ static struct lock_uds *g_list_trans_lock;
 static struct list *g_con_list = NULL;
 static int g_pid;
 
+/* Waits for everything in sesman_main_loop() */
+struct reactor *g_reactor = NULL;
+
 /*****************************************************************************/
 /**
  * @brief looks for a case-insensitive match of a string in a list
@@ -254,6 +258,10 @@ sesman_close_all(void)
 
     sesman_delete_listening_transport();
 
+    /* after the transports, they drop their sockets from it */
+    reactor_delete(g_reactor);
+    g_reactor = NULL;
+
     return 0;
 }
 
@@ -292,15 +300,21 @@ sesman_listen_conn_in(struct trans *self, struct trans *new_self)
             "connections, rejecting");
         trans_delete(new_self);
     }
-    else if ((psi = pre_session_list_new()) == NULL)
+    else if (scp_init_trans(new_self) != 0)
     {
-        LOG(LOG_LEVEL_ERROR, "sesman_data_in: No memory to allocate "
-            "new connection");
+        LOG(LOG_LEVEL_ERROR, "sesman_data_in: Can't init SCP connection");
         trans_delete(new_self);
     }
-    else if (scp_init_trans(new_self) != 0)
+    else if (trans_add_to_reactor(new_self, g_reactor,
+                                  pre_session_list_trans_ready) != 0)
     {
-        LOG(LOG_LEVEL_ERROR, "sesman_data_in: Can't init SCP connection");
+        LOG(LOG_LEVEL_ERROR, "sesman_data_in: Can't wait for SCP connection");
+        trans_delete(new_self);
+    }
+    else if ((psi = pre_session_list_new()) == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_data_in: No memory to allocate "
+            "new connection");
         trans_delete(new_self);
     }
     else
@@ -313,6 +327,21 @@ sesman_listen_conn_in(struct trans *self, struct trans *new_self)
     return 0;
 }
 
+/******************************************************************************/
+static int
+sesman_listen_ready(struct reactor *reactor, tintptr obj, int events,
+                    void *arg)
+{
+    if (trans_check_wait_objs((struct trans *)arg) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_listen_ready: "
+            "trans_check_wait_objs failed");
+        return 1;
+    }
+
+    return 0;
+}
+
 /******************************************************************************/
 int
 sesman_eicp_data_in(struct trans *self)
@@ -462,6 +491,12 @@ sesman_create_listening_transport(const struct config_sesman *cfg)
             LOG(LOG_LEVEL_ERROR, "%s: Can't set permissions on '%s' [%s]",
                 __func__, cfg->listen_port, g_get_strerror());
         }
+        else if (g_reactor != NULL &&
+                 (rv = trans_add_to_reactor(g_list_trans, g_reactor,
+                                            sesman_listen_ready)) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "%s: trans_add_to_reactor failed", __func__);
+        }
         else
         {
             g_list_trans->trans_conn_in = sesman_listen_conn_in;
@@ -484,6 +519,41 @@ sesman_is_term(void)
     return g_is_wait_obj_set(g_term_event);
 }
 
+/******************************************************************************/
+static int
+sesman_term_ready(struct reactor *reactor, tintptr obj, int events,
+                  void *arg)
+{
+    LOG(LOG_LEVEL_INFO, "sesman_main_loop: sesman asked to terminate");
+    *(int *)arg = 1;
+    return 0;
+}
+
+/******************************************************************************/
+static int
+sesman_sigchld_ready(struct reactor *reactor, tintptr obj, int events,
+                     void *arg)
+{
+    g_reset_wait_obj(obj);
+    // Prevent any zombies from hanging around
+    while (g_waitchild(NULL) > 0)
+    {
+        ;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static int
+sesman_reload_ready(struct reactor *reactor, tintptr obj, int events,
+                    void *arg)
+{
+    /* We're asked to reload */
+    g_reset_wait_obj(obj);
+    sig_sesman_reload_cfg();
+    return 0;
+}
+
 /******************************************************************************/
 /**
  *
@@ -494,8 +564,27 @@ static int
 sesman_main_loop(void)
 {
     int error;
-    int robjs_count;
-    intptr_t robjs[1024];
+    int terminate;
+
+    /* everything is added to the reactor once, and only the ready
+     * objects are looked at after a wait */
+    g_reactor = reactor_create();
+    if (g_reactor == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_main_loop: reactor_create failed");
+        return 1;
+    }
+    terminate = 0;
+    if (reactor_add_obj(g_reactor, g_term_event, REACTOR_READ,
+                        sesman_term_ready, &terminate) != 0 ||
+            reactor_add_obj(g_reactor, g_sigchld_event, REACTOR_READ,
+                            sesman_sigchld_ready, NULL) != 0 ||
+            reactor_add_obj(g_reactor, g_reload_event, REACTOR_READ,
+                            sesman_reload_ready, NULL) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_main_loop: reactor_add_obj failed");
+        return 1;
+    }
 
     g_con_list = list_create();
     if (g_con_list == NULL)
@@ -513,98 +602,12 @@ sesman_main_loop(void)
     LOG(LOG_LEVEL_INFO, "Sesman now listening on %s", g_cfg->listen_port);
 
     error = 0;
-    while (!error)
+    while (!error && !terminate)
     {
-        robjs_count = 0;
-        robjs[robjs_count++] = g_term_event;
-        robjs[robjs_count++] = g_sigchld_event;
-        robjs[robjs_count++] = g_reload_event;
-
-        if (g_list_trans != NULL)
-        {
-            /* g_list_trans might be NULL on a reconfigure if sesman
-             * is unable to listen again */
-            error = trans_get_wait_objs(g_list_trans, robjs, &robjs_count);
-            if (error != 0)
-            {
-                LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                    "trans_get_wait_objs failed");
-                break;
-            }
-        }
-
-        error = pre_session_list_get_wait_objs(robjs, &robjs_count);
+        error = reactor_wait(g_reactor, -1);
         if (error != 0)
         {
-            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "pre_session_list_get_wait_objs failed");
-            break;
-        }
-
-        error = session_list_get_wait_objs(robjs, &robjs_count);
-        if (error != 0)
-        {
-            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "session_list_get_wait_objs failed");
-            break;
-        }
-
-        if (g_obj_wait(robjs, robjs_count, NULL, 0, -1) != 0)
-        {
-            /* should not get here */
-            LOG(LOG_LEVEL_WARNING, "sesman_main_loop: "
-                "Unexpected error from g_obj_wait()");
-            g_sleep(100);
-        }
-
-        if (g_is_wait_obj_set(g_term_event)) /* term */
-        {
-            LOG(LOG_LEVEL_INFO, "sesman_main_loop: "
-                "sesman asked to terminate");
-            break;
-        }
-
-        if (g_is_wait_obj_set(g_sigchld_event)) /* term */
-        {
-            g_reset_wait_obj(g_sigchld_event);
-            // Prevent any zombies from hanging around
-            while (g_waitchild(NULL) > 0)
-            {
-                ;
-            }
-        }
-
-        if (g_is_wait_obj_set(g_reload_event)) /* We're asked to reload */
-        {
-            g_reset_wait_obj(g_reload_event);
-            sig_sesman_reload_cfg();
-        }
-
-        if (g_list_trans != NULL)
-        {
-            error = trans_check_wait_objs(g_list_trans);
-            if (error != 0)
-            {
-                LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                    "trans_check_wait_objs failed");
-                break;
-            }
-        }
-
-        error = pre_session_list_check_wait_objs();
-        if (error != 0)
-        {
-            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "pre_session_list_check_wait_objs failed");
-            break;
-        }
-
-        error = session_list_check_wait_objs();
-        if (error != 0)
-        {
-            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "session_list_check_wait_objs failed");
-            break;
+            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: reactor_wait failed");
         }
     }
 
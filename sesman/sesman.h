@@ -28,10 +28,12 @@
 #define SESMAN_H
 
 struct config_sesman;
+struct reactor;
 struct trans;
 
 /* Globals */
 extern struct config_sesman *g_cfg;
+extern struct reactor *g_reactor;
 
 /**
  * Close all file descriptors used by sesman.
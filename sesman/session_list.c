@@ -538,53 +538,38 @@ free_session_info_list(struct scp_session_info *sesslist, unsigned int cnt)
 }
 
 /******************************************************************************/
-int
-session_list_get_wait_objs(tbus robjs[], int *robjs_count)
+void
+session_list_remove(struct session_item *si)
 {
-    int i;
+    int index;
 
-    for (i = 0 ; i < g_session_list->count; ++i)
+    index = list_index_of(g_session_list, (tintptr)si);
+    if (index >= 0)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
-        if (SESSION_IN_USE(si))
-        {
-            robjs[(*robjs_count)++] = si->sesexec_trans->sck;
-        }
+        list_remove_item(g_session_list, index);
     }
-
-    return 0;
+    free_session(si);
 }
 
 /******************************************************************************/
 int
-session_list_check_wait_objs(void)
+session_list_trans_ready(struct reactor *reactor, tintptr obj,
+                         int events, void *arg)
 {
-    int i;
+    struct trans *trans = (struct trans *)arg;
+    struct session_item *si;
 
-    for (i = 0 ; i < g_session_list->count; ++i)
+    si = (struct session_item *)trans->callback_data;
+    if (SESSION_IN_USE(si) && trans_check_wait_objs(trans) != 0)
     {
-        struct session_item *si;
-        si = (struct session_item *)list_get_item(g_session_list, i);
-        if (SESSION_IN_USE(si))
-        {
-            if (trans_check_wait_objs(si->sesexec_trans) != 0)
-            {
-                LOG(LOG_LEVEL_ERROR, "sesman_check_wait_objs: "
-                    "trans_check_wait_objs failed, removing trans");
-                si->sesexec_trans->status = TRANS_STATUS_DOWN;
-            }
-        }
+        LOG(LOG_LEVEL_ERROR, "session_list_trans_ready: "
+            "trans_check_wait_objs failed, removing trans");
+        trans->status = TRANS_STATUS_DOWN;
+    }
 
-        if (SESSION_IN_USE(si))
-        {
-            ++i;
-        }
-        else
-        {
-            free_session(si);
-            list_remove_item(g_session_list, i);
-        }
+    if (!SESSION_IN_USE(si))
+    {
+        session_list_remove(si);
     }
 
     return 0;
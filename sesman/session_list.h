@@ -30,10 +30,13 @@
 
 #include <sys/types.h>
 
+#include "arch.h"
 #include "guid.h"
 #include "scp_application_types.h"
 #include "xrdp_constants.h"
 
+struct reactor;
+
 enum session_state
 {
     /**
@@ -99,10 +102,12 @@ session_list_get_count(void);
  * @return pointer to new session object or NULL for no memory
  *
  * After allocating the session, you must initialise the sesexec_trans field
- * with a valid transport.
+ * with a valid transport, added to the sesman reactor with
+ * session_list_trans_ready(), or remove the session with
+ * session_list_remove().
  *
- * The session is removed by session_check_wait_objs() when the transport
- * goes down (or wasn't allocated in the first place).
+ * The session is removed by session_list_trans_ready() when the transport
+ * goes down.
  */
 struct session_item *
 session_list_new(void);
@@ -153,20 +158,26 @@ void
 free_session_info_list(struct scp_session_info *sesslist, unsigned int cnt);
 
 /**
- * @brief Get the wait objs for the session list module
- * @param @robjs Objects array to update
- * @param robjs_count Elements in robjs (by reference)
- * @return 0 for success
+ * @brief Removes a session from the list and frees it
+ * @param si Session item, invalid after this call
  */
-int
-session_list_get_wait_objs(tbus robjs[], int *robjs_count);
-
+void
+session_list_remove(struct session_item *si);
 
 /**
- * @brief Check the wait objs for the session list module
+ * @brief Reactor callback for the sesexec_trans of a session item
+ *
+ * Pass this to trans_add_to_reactor(). The item is the callback_data of
+ * the transport.
+ *
+ * @param reactor Reactor
+ * @param obj Ready object
+ * @param events Ready events
+ * @param arg Transport
  * @return 0 for success
  */
 int
-session_list_check_wait_objs(void);
+session_list_trans_ready(struct reactor *reactor, tintptr obj,
+                         int events, void *arg);
 
 #endif // SESSION_LIST_H
@@ -487,6 +487,28 @@ START_TEST(test_g_sck_fd_overflow)
 }
 END_TEST
 
+/******************************************************************************/
+START_TEST(test_g_tcp_get_mss)
+{
+    int sck[2];
+    int tcp_sck;
+    int mss;
+
+    tcp_sck = g_tcp_socket();
+    ck_assert_int_ge(tcp_sck, 0);
+    mss = 0;
+    ck_assert_int_eq(g_tcp_get_mss(tcp_sck, &mss), 0);
+    ck_assert_int_gt(mss, 0);
+    g_sck_close(tcp_sck);
+
+    /* not TCP */
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    ck_assert_int_ne(g_tcp_get_mss(sck[0], &mss), 0);
+    g_file_close(sck[0]);
+    g_file_close(sck[1]);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_test_os_calls(void)
@@ -512,5 +534,6 @@ make_suite_test_os_calls(void)
     tcase_add_test(tc_os_calls, test_g_file_is_open);
     tcase_add_test(tc_os_calls, test_g_sck_fd_passing);
     tcase_add_test(tc_os_calls, test_g_sck_fd_overflow);
+    tcase_add_test(tc_os_calls, test_g_tcp_get_mss);
     return s;
 }
@@ -0,0 +1,233 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "reactor.h"
+
+#include "test_common.h"
+#include "os_calls.h"
+#include "trans.h"
+
+#define NUM_OBJS 300
+
+struct ready_count
+{
+    int count;
+    tintptr last_obj;
+    int last_events;
+    struct reactor *reactor;
+    tintptr remove_obj; /* removed by the callback if not 0 */
+};
+
+/******************************************************************************/
+static int
+count_ready(struct reactor *reactor, tintptr obj, int events, void *arg)
+{
+    struct ready_count *rc = (struct ready_count *)arg;
+
+    rc->count++;
+    rc->last_obj = obj;
+    rc->last_events = events;
+    if (rc->remove_obj != 0)
+    {
+        reactor_remove_obj(reactor, rc->remove_obj);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+START_TEST(test_reactor__wait_objs)
+{
+    struct reactor *reactor;
+    tintptr objs[NUM_OBJS];
+    struct ready_count rc[NUM_OBJS];
+    int index;
+
+    reactor = reactor_create();
+    ck_assert_ptr_ne(reactor, NULL);
+    g_memset(rc, 0, sizeof(rc));
+    /* more than g_obj_wait() can take */
+    for (index = 0; index < NUM_OBJS; index++)
+    {
+        objs[index] = g_create_wait_obj("reactor");
+        ck_assert_int_ne(objs[index], 0);
+        ck_assert_int_eq(reactor_add_obj(reactor, objs[index], REACTOR_READ,
+                                         count_ready, rc + index), 0);
+    }
+
+    /* only the ready objects are passed to their callbacks */
+    ck_assert_int_eq(reactor_wait(reactor, 1), 0);
+    g_set_wait_obj(objs[7]);
+    g_set_wait_obj(objs[NUM_OBJS - 1]);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    for (index = 0; index < NUM_OBJS; index++)
+    {
+        ck_assert_int_eq(rc[index].count,
+                         (index == 7) || (index == NUM_OBJS - 1));
+    }
+    ck_assert_int_eq(rc[7].last_obj, objs[7]);
+    ck_assert_int_eq(rc[7].last_events, REACTOR_READ);
+
+    /* objects stay added until they are removed */
+    g_reset_wait_obj(objs[NUM_OBJS - 1]);
+    ck_assert_int_eq(reactor_remove_obj(reactor, objs[7]), 0);
+    g_set_wait_obj(objs[0]);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(rc[0].count, 1);
+    ck_assert_int_eq(rc[7].count, 1);
+    ck_assert_int_eq(rc[NUM_OBJS - 1].count, 1);
+
+    /* waiting for nothing keeps the object, but it is not ready */
+    ck_assert_int_eq(reactor_set_obj_events(reactor, objs[0], 0), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1), 0);
+    ck_assert_int_eq(rc[0].count, 1);
+    ck_assert_int_eq(reactor_set_obj_events(reactor, objs[0], REACTOR_READ), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(rc[0].count, 2);
+    ck_assert_int_ne(reactor_set_obj_events(reactor, objs[7], REACTOR_READ), 0);
+
+    reactor_delete(reactor);
+    for (index = 0; index < NUM_OBJS; index++)
+    {
+        g_delete_wait_obj(objs[index]);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_reactor__removed_by_callback)
+{
+    struct reactor *reactor;
+    struct ready_count rc[2];
+    tintptr obj[2];
+
+    reactor = reactor_create();
+    ck_assert_ptr_ne(reactor, NULL);
+    g_memset(rc, 0, sizeof(rc));
+    obj[0] = g_create_wait_obj("reactor");
+    obj[1] = g_create_wait_obj("reactor");
+    g_set_wait_obj(obj[0]);
+    g_set_wait_obj(obj[1]);
+    /* whichever is called first removes the other */
+    rc[0].remove_obj = obj[1];
+    rc[1].remove_obj = obj[0];
+    ck_assert_int_eq(reactor_add_obj(reactor, obj[0], REACTOR_READ,
+                                     count_ready, rc), 0);
+    ck_assert_int_eq(reactor_add_obj(reactor, obj[1], REACTOR_READ,
+                                     count_ready, rc + 1), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(rc[0].count + rc[1].count, 1);
+
+    reactor_delete(reactor);
+    g_delete_wait_obj(obj[0]);
+    g_delete_wait_obj(obj[1]);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_reactor__reused_fd)
+{
+    struct reactor *reactor;
+    struct ready_count rc[2];
+    tintptr obj;
+    tintptr obj2;
+
+    reactor = reactor_create();
+    ck_assert_ptr_ne(reactor, NULL);
+    g_memset(rc, 0, sizeof(rc));
+    obj = g_create_wait_obj("reactor");
+    ck_assert_int_eq(reactor_add_obj(reactor, obj, REACTOR_READ,
+                                     count_ready, rc), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1), 0);
+
+    /* the same fd numbers come back for the next object */
+    reactor_remove_obj(reactor, obj);
+    g_delete_wait_obj(obj);
+    obj2 = g_create_wait_obj("reactor");
+    ck_assert_int_eq(obj2, obj);
+    g_set_wait_obj(obj2);
+    ck_assert_int_eq(reactor_add_obj(reactor, obj2, REACTOR_READ,
+                                     count_ready, rc + 1), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(rc[0].count, 0);
+    ck_assert_int_eq(rc[1].count, 1);
+
+    reactor_delete(reactor);
+    g_delete_wait_obj(obj2);
+}
+END_TEST
+
+/******************************************************************************/
+static int
+trans_ready(struct reactor *reactor, tintptr obj, int events, void *arg)
+{
+    return trans_check_wait_objs((struct trans *)arg);
+}
+
+/******************************************************************************/
+static int
+trans_data_in(struct trans *self)
+{
+    (*(int *)self->callback_data)++;
+    return 0;
+}
+
+/******************************************************************************/
+START_TEST(test_reactor__trans)
+{
+    struct reactor *reactor;
+    struct trans *trans;
+    int sck[2];
+    int data_in_count;
+
+    reactor = reactor_create();
+    ck_assert_ptr_ne(reactor, NULL);
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    trans = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    trans->sck = sck[0];
+    trans->type1 = TRANS_TYPE_SERVER;
+    trans->status = TRANS_STATUS_UP;
+    trans->header_size = 4;
+    trans->trans_data_in = trans_data_in;
+    data_in_count = 0;
+    trans->callback_data = &data_in_count;
+
+    /* not ready, and not waiting to write with nothing to send */
+    ck_assert_int_eq(trans_add_to_reactor(trans, reactor, trans_ready), 0);
+    ck_assert_int_eq(reactor_wait(reactor, 1), 0);
+    ck_assert_int_eq(data_in_count, 0);
+
+    ck_assert_int_eq(g_file_write(sck[1], "abcd", 4), 4);
+    ck_assert_int_eq(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(data_in_count, 1);
+
+    /* a hang up is found by the read */
+    g_file_close(sck[1]);
+    ck_assert_int_ne(reactor_wait(reactor, 1000), 0);
+    ck_assert_int_eq(trans->status, TRANS_STATUS_DOWN);
+
+    /* removes its socket from the reactor */
+    trans_delete(trans);
+    ck_assert_int_eq(reactor_wait(reactor, 1), 0);
+    reactor_delete(reactor);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_reactor(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Reactor");
+
+    tc = tcase_create("reactor");
+    tcase_add_test(tc, test_reactor__wait_objs);
+    tcase_add_test(tc, test_reactor__removed_by_callback);
+    tcase_add_test(tc, test_reactor__reused_fd);
+    tcase_add_test(tc, test_reactor__trans);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
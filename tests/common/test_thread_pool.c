@@ -0,0 +1,150 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "thread_pool.h"
+
+#include "test_common.h"
+#include "os_calls.h"
+#include "thread_calls.h"
+
+#define NUM_JOBS 1000
+
+struct job_state
+{
+    tbus mutex;
+    int runs[NUM_JOBS];
+    int worker_max;
+    int worker_bad;
+};
+
+/******************************************************************************/
+static void
+count_job(void *arg, int index, int worker)
+{
+    struct job_state *state = (struct job_state *)arg;
+
+    tc_mutex_lock(state->mutex);
+    state->runs[index]++;
+    if (worker > state->worker_max)
+    {
+        state->worker_max = worker;
+    }
+    if (worker < 0)
+    {
+        state->worker_bad = 1;
+    }
+    tc_mutex_unlock(state->mutex);
+}
+
+/******************************************************************************/
+static void
+check_runs(struct job_state *state, int num_jobs, int expected)
+{
+    int index;
+
+    for (index = 0; index < num_jobs; index++)
+    {
+        ck_assert_int_eq(state->runs[index], expected);
+    }
+    for (; index < NUM_JOBS; index++)
+    {
+        ck_assert_int_eq(state->runs[index], 0);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_thread_pool__null)
+{
+    struct job_state state;
+
+    g_memset(&state, 0, sizeof(state));
+    state.mutex = tc_mutex_create();
+
+    // A NULL pool runs everything on the calling thread
+    thread_pool_run(NULL, NUM_JOBS, count_job, &state);
+    check_runs(&state, NUM_JOBS, 1);
+    ck_assert_int_eq(state.worker_max, 0);
+    ck_assert_int_eq(thread_pool_get_num_workers(NULL), 0);
+    thread_pool_delete(NULL);
+
+    tc_mutex_delete(state.mutex);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_thread_pool__no_workers)
+{
+    struct thread_pool *pool;
+    struct job_state state;
+
+    g_memset(&state, 0, sizeof(state));
+    state.mutex = tc_mutex_create();
+
+    pool = thread_pool_create(0);
+    ck_assert_ptr_ne(pool, NULL);
+    ck_assert_int_eq(thread_pool_get_num_workers(pool), 0);
+    thread_pool_run(pool, 10, count_job, &state);
+    check_runs(&state, 10, 1);
+    ck_assert_int_eq(state.worker_max, 0);
+    thread_pool_delete(pool);
+
+    tc_mutex_delete(state.mutex);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_thread_pool__batches)
+{
+    struct thread_pool *pool;
+    struct job_state state;
+    int batch;
+
+    g_memset(&state, 0, sizeof(state));
+    state.mutex = tc_mutex_create();
+
+    pool = thread_pool_create(3);
+    ck_assert_ptr_ne(pool, NULL);
+    ck_assert_int_eq(thread_pool_get_num_workers(pool), 3);
+
+    // Every job runs exactly once per batch, whatever the batch size
+    for (batch = 0; batch < 20; batch++)
+    {
+        thread_pool_run(pool, NUM_JOBS, count_job, &state);
+    }
+    check_runs(&state, NUM_JOBS, 20);
+
+    g_memset(state.runs, 0, sizeof(state.runs));
+    thread_pool_run(pool, 2, count_job, &state);
+    thread_pool_run(pool, 0, count_job, &state);
+    thread_pool_run(pool, 1, count_job, &state);
+    ck_assert_int_eq(state.runs[0], 2);
+    ck_assert_int_eq(state.runs[1], 1);
+    ck_assert_int_eq(state.runs[2], 0);
+
+    ck_assert_int_le(state.worker_max, 3);
+    ck_assert_int_eq(state.worker_bad, 0);
+    thread_pool_delete(pool);
+
+    tc_mutex_delete(state.mutex);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_thread_pool(void)
+{
+    Suite *s;
+    TCase *tc_thread_pool;
+
+    s = suite_create("ThreadPool");
+
+    tc_thread_pool = tcase_create("ThreadPool");
+    tcase_add_test(tc_thread_pool, test_thread_pool__null);
+    tcase_add_test(tc_thread_pool, test_thread_pool__no_workers);
+    tcase_add_test(tc_thread_pool, test_thread_pool__batches);
+
+    suite_add_tcase(s, tc_thread_pool);
+
+    return s;
+}
@@ -5,5 +5,9 @@
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_bitmap32(void);
+Suite *make_suite_test_bitmap_compress(void);
+Suite *make_suite_test_orders_peephole(void);
+Suite *make_suite_test_text_fragment(void);
 
 #endif /* TEST_LIBXRDP_H */
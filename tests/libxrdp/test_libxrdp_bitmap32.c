@@ -0,0 +1,315 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for the planar (bitmap32) compressor
+ *
+ * The benchmark results are logged, run with TEST_LOG_LEVEL=INFO
+ * to see them.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define TILE 64
+/* RLE of noise is larger than raw, the limit is checked after packing */
+#define OUT_SIZE (TILE * TILE * 8)
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 704
+#define BENCH_FRAMES 8
+
+enum pattern
+{
+    PATTERN_FLAT,
+    PATTERN_TEXT,
+    PATTERN_GRADIENT,
+    PATTERN_NOISE,
+    PATTERN_ALPHA,
+    PATTERN_COUNT
+};
+
+static const int g_simd[] =
+{
+    XRDP_PLANAR_SIMD_SSE2,
+    XRDP_PLANAR_SIMD_AVX2,
+    XRDP_PLANAR_SIMD_NEON
+};
+
+static const char *g_simd_name[] = { "none", "sse2", "avx2", "neon" };
+
+static struct stream *g_temp_s;
+static struct stream *g_ref_s;
+static struct stream *g_out_s;
+static unsigned int *g_image;
+
+/******************************************************************************/
+static void
+draw(unsigned int *image, int width, int height, enum pattern pattern)
+{
+    unsigned int seed;
+    unsigned int pixel;
+    int x;
+    int y;
+
+    seed = 0x2545f491 + pattern;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            switch (pattern)
+            {
+                case PATTERN_FLAT:
+                    pixel = (y < height / 2) ? 0xff3a6ea5 : 0xffffffff;
+                    break;
+                case PATTERN_TEXT:
+                    pixel = (((x * 7) ^ (y * 13)) % 11 < 3) ?
+                            0xff000000 : 0xffffffff;
+                    break;
+                case PATTERN_GRADIENT:
+                    pixel = 0xff000000 | ((x * 4) << 16) | ((y * 4) << 8) |
+                            ((x + y) & 0xff);
+                    break;
+                case PATTERN_NOISE:
+                    pixel = seed;
+                    break;
+                default:
+                    /* runs of repeated bytes broken up by noise */
+                    pixel = ((seed >> 16) % 5 == 0) ? seed :
+                            (unsigned int) (x / 9) * 0x10203040;
+                    break;
+            }
+            image[y * width + x] = pixel;
+        }
+    }
+}
+
+/******************************************************************************/
+static int
+compress(struct stream *s, int width, int height, int e, int flags,
+         int byte_limit)
+{
+    int lines;
+
+    init_stream(s, OUT_SIZE);
+    lines = xrdp_bitmap32_compress((char *) g_image, width, height, s, 32,
+                                   byte_limit, height - 1, g_temp_s,
+                                   e, flags);
+    s_mark_end(s);
+    return lines;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    make_stream(g_temp_s);
+    init_stream(g_temp_s, 8 * 4096);
+    make_stream(g_ref_s);
+    init_stream(g_ref_s, OUT_SIZE);
+    make_stream(g_out_s);
+    init_stream(g_out_s, OUT_SIZE);
+    g_image = g_new(unsigned int, BENCH_WIDTH * BENCH_HEIGHT);
+    ck_assert_ptr_ne(g_image, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_planar_simd_select(XRDP_PLANAR_SIMD_NONE);
+    free_stream(g_temp_s);
+    free_stream(g_ref_s);
+    free_stream(g_out_s);
+    g_free(g_image);
+}
+
+/******************************************************************************/
+/* output from the code before the kernels were split out */
+START_TEST(test_bitmap32__reference_output)
+{
+    static const unsigned char expected[] =
+    {
+        0x10,                               /* header, RLE */
+        0x13, 0xff, 0x04,                   /* alpha */
+        0x40, 0x10, 0x10, 0x10, 0x00, 0x04, /* red */
+        0x40, 0x20, 0x20, 0x20, 0x00, 0x04, /* green */
+        0x40, 0x30, 0x30, 0x30, 0x00, 0x04  /* blue */
+    };
+    int lines;
+
+    g_image[0] = 0xff102030;
+    g_image[1] = 0xff102030;
+    g_image[2] = 0xff102030;
+    g_image[3] = 0xff000000;
+    g_image[4] = 0xff102030;
+    g_image[5] = 0xff102030;
+    g_image[6] = 0xff102030;
+    g_image[7] = 0xff000000;
+    lines = compress(g_out_s, 4, 2, 0, 0x10, OUT_SIZE);
+    ck_assert_int_eq(lines, 2);
+    ck_assert_int_eq(g_out_s->end - g_out_s->data, sizeof(expected));
+    ck_assert_int_eq(g_memcmp(g_out_s->data, expected, sizeof(expected)), 0);
+}
+END_TEST
+
+/******************************************************************************/
+/* every kernel set must produce exactly what the scalar code does */
+START_TEST(test_bitmap32__simd_matches_scalar)
+{
+    static const int widths[] = { 1, 3, 4, 15, 16, 17, 31, 32, 33, 48, 63, 64 };
+    static const int flags[] = { 0x10, 0x30, 0x00, 0x20 };
+    int simd;
+    int pattern;
+    int windex;
+    int findex;
+    int e;
+    int height;
+    int byte_limit;
+    int ref_lines;
+    int lines;
+    int checked;
+
+    checked = 0;
+    for (simd = 0; simd < (int) (sizeof(g_simd) / sizeof(g_simd[0])); simd++)
+    {
+        if (!xrdp_planar_simd_supported(g_simd[simd]))
+        {
+            continue;
+        }
+        for (pattern = 0; pattern < PATTERN_COUNT; pattern++)
+        {
+            for (windex = 0; windex < (int) (sizeof(widths) / sizeof(int));
+                    windex++)
+            {
+                /* the planes hold 64 * 64 bytes */
+                e = (4 - (widths[windex] & 3)) & 3;
+                height = (64 * 64) / (widths[windex] + e);
+                height = MIN(height, 64);
+                draw(g_image, widths[windex], height, pattern);
+                for (findex = 0; findex < 4; findex++)
+                {
+                    for (byte_limit = 256; byte_limit <= 64 * 64 * 4 * 4;
+                            byte_limit *= 4)
+                    {
+                        xrdp_planar_simd_select(XRDP_PLANAR_SIMD_NONE);
+                        ref_lines = compress(g_ref_s, widths[windex], height,
+                                             e, flags[findex], byte_limit);
+                        ck_assert_int_eq(xrdp_planar_simd_select(g_simd[simd]),
+                                         0);
+                        lines = compress(g_out_s, widths[windex], height,
+                                         e, flags[findex], byte_limit);
+                        ck_assert_msg(lines == ref_lines,
+                                      "%s: pattern %d width %d flags 0x%x",
+                                      g_simd_name[g_simd[simd]], pattern,
+                                      widths[windex], flags[findex]);
+                        ck_assert_int_eq(g_out_s->end - g_out_s->data,
+                                         g_ref_s->end - g_ref_s->data);
+                        ck_assert_msg(g_memcmp(g_out_s->data, g_ref_s->data,
+                                               g_ref_s->end - g_ref_s->data) == 0,
+                                      "%s: pattern %d width %d flags 0x%x",
+                                      g_simd_name[g_simd[simd]], pattern,
+                                      widths[windex], flags[findex]);
+                        checked++;
+                    }
+                }
+            }
+        }
+    }
+    LOG(LOG_LEVEL_INFO, "bitmap32: %d simd outputs checked", checked);
+}
+END_TEST
+
+/******************************************************************************/
+static int
+bench(int flags)
+{
+    int start;
+    int frame;
+    int x;
+    int y;
+    int lines;
+
+    start = g_time3();
+    for (frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        for (y = 0; y < BENCH_HEIGHT; y += TILE)
+        {
+            for (x = 0; x < BENCH_WIDTH; x += TILE)
+            {
+                /* g_image holds one tile, the frame is made of copies */
+                lines = compress(g_out_s, TILE, TILE, 0, flags, OUT_SIZE);
+                ck_assert_int_gt(lines, 0);
+            }
+        }
+    }
+    return g_time3() - start;
+}
+
+/******************************************************************************/
+START_TEST(test_bitmap32__benchmark)
+{
+    static const int patterns[] = { PATTERN_TEXT, PATTERN_NOISE };
+    int pindex;
+    int simd;
+    int ms;
+
+    for (pindex = 0; pindex < 2; pindex++)
+    {
+        draw(g_image, TILE, TILE, patterns[pindex]);
+        for (simd = XRDP_PLANAR_SIMD_NONE; simd <= XRDP_PLANAR_SIMD_NEON;
+                simd++)
+        {
+            if (xrdp_planar_simd_select(simd) != 0)
+            {
+                continue;
+            }
+            ms = bench(0x10);
+            LOG(LOG_LEVEL_INFO, "bitmap32 bench %s %s: %d ms for %d frames "
+                "%dx%d, %d MPixel/s", pindex == 0 ? "text" : "noise",
+                g_simd_name[simd], ms, BENCH_FRAMES, BENCH_WIDTH,
+                BENCH_HEIGHT, BENCH_FRAMES * BENCH_WIDTH * BENCH_HEIGHT /
+                MAX(ms, 1) / 1000);
+        }
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_bitmap32(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Bitmap32");
+
+    tc = tcase_create("xrdp_bitmap32_compress");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_bitmap32__reference_output);
+    tcase_add_test(tc, test_bitmap32__simd_matches_scalar);
+    tcase_add_test(tc, test_bitmap32__benchmark);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
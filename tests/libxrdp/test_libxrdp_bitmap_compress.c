@@ -0,0 +1,640 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for the interleaved RLE bitmap compressor
+ *
+ * The output is decoded again as described in [MS-RDPBCGR] 2.2.9.1.1.3.1.2.4
+ * and compared with the source.  The benchmark results are logged, run
+ * with TEST_LOG_LEVEL=INFO to see them.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define MAX_WIDTH 128
+#define MAX_HEIGHT 64
+#define OUT_SIZE (MAX_WIDTH * MAX_HEIGHT * 8)
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 704
+#define BENCH_FRAMES 4
+#define TILE 64
+
+enum pattern
+{
+    PATTERN_FLAT,
+    PATTERN_TEXT,
+    PATTERN_GRADIENT,
+    PATTERN_NOISE,
+    PATTERN_STRIPES,
+    PATTERN_INVERTED,
+    PATTERN_COUNT
+};
+
+static struct stream *g_temp_s;
+static struct stream *g_out_s;
+/* source pixels, one int each, and the same as the compressor reads them */
+static unsigned int *g_pixels;
+static char *g_image;
+static unsigned int *g_decoded;
+
+/******************************************************************************/
+static unsigned int
+bpp_mask(int bpp)
+{
+    return bpp == 8 ? 0xff : bpp == 24 ? 0xffffff : 0xffff;
+}
+
+/******************************************************************************/
+static void
+draw(int width, int height, int bpp, enum pattern pattern)
+{
+    unsigned int seed;
+    unsigned int pixel;
+    int x;
+    int y;
+
+    seed = 0x2545f491 + pattern;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            switch (pattern)
+            {
+                case PATTERN_FLAT:
+                    pixel = (y < height / 2) ? 0x3a6ea5 : 0xffffff;
+                    break;
+                case PATTERN_TEXT:
+                    pixel = (((x * 7) ^ (y * 13)) % 11 < 3) ?
+                            0x000000 : 0xffffff;
+                    break;
+                case PATTERN_GRADIENT:
+                    pixel = ((x * 4) << 16) | ((y * 4) << 8) | (x + y);
+                    break;
+                case PATTERN_NOISE:
+                    pixel = seed >> 8;
+                    break;
+                case PATTERN_STRIPES:
+                    /* two colours taking turns, broken up now and then */
+                    pixel = ((x / 2 + y) & 1) ? 0x102030 : 0x405060;
+                    if ((seed >> 16) % 13 == 0)
+                    {
+                        pixel = seed >> 8;
+                    }
+                    break;
+                default:
+                    /* the line above, some of it inverted */
+                    pixel = (y == 0) ? (seed >> 8) :
+                            g_pixels[(y - 1) * width + x] ^
+                            (((x / 3 + y) & 1) ? 0xffffff : 0);
+                    break;
+            }
+            pixel &= bpp_mask(bpp);
+            g_pixels[y * width + x] = pixel;
+            if (bpp == 8)
+            {
+                ((unsigned char *) g_image)[y * width + x] = pixel;
+            }
+            else if (bpp == 24)
+            {
+                ((unsigned int *) g_image)[y * width + x] = pixel;
+            }
+            else
+            {
+                ((unsigned short *) g_image)[y * width + x] = pixel;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+static unsigned int
+in_pixel(struct stream *s, int bytes)
+{
+    unsigned int pixel;
+
+    ck_assert_msg(s_check_rem(s, bytes), "pixel past the end");
+    if (bytes == 1)
+    {
+        in_uint8(s, pixel);
+    }
+    else if (bytes == 2)
+    {
+        in_uint16_le(s, pixel);
+    }
+    else
+    {
+        in_uint8(s, pixel);
+        pixel |= ((unsigned char) s->p[0]) << 8;
+        pixel |= ((unsigned char) s->p[1]) << 16;
+        in_uint8s(s, 2);
+    }
+    return pixel;
+}
+
+/******************************************************************************/
+/* decodes the orders the compressor sends into g_decoded, the first line
+   out is the bottom line of the bitmap, returns the pixel count */
+static int
+decode(struct stream *s, int bpp, int cx, int max_pixels)
+{
+    unsigned int *out;
+    unsigned int fg;
+    unsigned int color1;
+    unsigned int color2;
+    unsigned int above;
+    int bytes;
+    int code;
+    int count;
+    int index;
+    int mask;
+    int bit;
+    int insert_fg;
+    int last_bg;
+
+    bytes = (bpp + 7) / 8;
+    fg = bpp_mask(bpp);
+    out = g_decoded;
+    index = 0;
+    last_bg = 0;
+    while (s_check_rem(s, 1))
+    {
+        in_uint8(s, code);
+        if ((code & 0xf0) == 0xf0)
+        {
+            in_uint16_le(s, count);
+        }
+        else if ((code >> 4) == 0xe)
+        {
+            count = code & 0x0f;
+            if (count == 0)
+            {
+                in_uint8(s, count);
+                count += 16;
+            }
+        }
+        else if ((code >> 5) == 0x2)
+        {
+            count = (code & 0x1f) * 8;
+            if (count == 0)
+            {
+                in_uint8(s, count);
+                count += 1;
+            }
+        }
+        else
+        {
+            count = code & 0x1f;
+            if (count == 0)
+            {
+                in_uint8(s, count);
+                count += 32;
+            }
+        }
+        if ((code & 0xf0) == 0xf0)
+        {
+            code &= 0x0f;
+            code = (code == 8) ? 0xe : code;
+        }
+        else if ((code >> 4) == 0xe)
+        {
+            code = 0xe;
+        }
+        else
+        {
+            code >>= 5;
+        }
+        if (code == 0xe)
+        {
+            count *= 2;
+        }
+        ck_assert_msg(index + count <= max_pixels, "order past the end");
+        switch (code)
+        {
+            case 0x0: /* background run */
+                insert_fg = last_bg;
+                for (; count > 0; count--, index++)
+                {
+                    above = (index < cx) ? 0 : out[index - cx];
+                    out[index] = insert_fg ? above ^ fg : above;
+                    insert_fg = 0;
+                }
+                break;
+            case 0x1: /* foreground run */
+                for (; count > 0; count--, index++)
+                {
+                    above = (index < cx) ? 0 : out[index - cx];
+                    out[index] = above ^ fg;
+                }
+                break;
+            case 0x2: /* foreground / background image */
+                mask = 0;
+                for (bit = 0; bit < count; bit++, index++)
+                {
+                    if ((bit % 8) == 0)
+                    {
+                        in_uint8(s, mask);
+                    }
+                    above = (index < cx) ? 0 : out[index - cx];
+                    out[index] = (mask & (1 << (bit % 8))) ? above ^ fg : above;
+                }
+                break;
+            case 0x3: /* color run */
+                color1 = in_pixel(s, bytes);
+                for (; count > 0; count--, index++)
+                {
+                    out[index] = color1;
+                }
+                break;
+            case 0x4: /* color image */
+                for (; count > 0; count--, index++)
+                {
+                    out[index] = in_pixel(s, bytes);
+                }
+                break;
+            case 0xe: /* dithered run */
+                color1 = in_pixel(s, bytes);
+                color2 = in_pixel(s, bytes);
+                for (bit = 0; bit < count; bit++, index++)
+                {
+                    out[index] = (bit & 1) ? color2 : color1;
+                }
+                break;
+            default:
+                ck_abort_msg("order 0x%x is never sent", code);
+                break;
+        }
+        last_bg = (code == 0x0);
+    }
+    return index;
+}
+
+/******************************************************************************/
+/* compresses from the bottom line and checks what was sent decodes to the
+   same pixels, returns the line count */
+static int
+round_trip(int width, int height, int bpp, int e, int byte_limit)
+{
+    int lines;
+    int pixels;
+    int cx;
+    int x;
+    int y;
+    unsigned int expected;
+
+    init_stream(g_out_s, OUT_SIZE);
+    lines = xrdp_bitmap_compress(g_image, width, height, g_out_s, bpp,
+                                 byte_limit, height - 1, g_temp_s, e);
+    s_mark_end(g_out_s);
+    ck_assert_int_gt(lines, 0);
+    ck_assert_int_le(lines, height);
+
+    cx = width + e;
+    g_out_s->p = g_out_s->data;
+    pixels = decode(g_out_s, bpp, cx, MAX_WIDTH * MAX_HEIGHT * 2);
+    ck_assert_int_eq(pixels, cx * lines);
+    for (y = 0; y < lines; y++)
+    {
+        for (x = 0; x < cx; x++)
+        {
+            /* the e pixels past the width repeat the last one */
+            expected = g_pixels[(height - 1 - y) * width + MIN(x, width - 1)];
+            ck_assert_msg(g_decoded[y * cx + x] == expected,
+                          "bpp %d width %d e %d: pixel %d, %d is 0x%x "
+                          "not 0x%x", bpp, width, e, x, y,
+                          g_decoded[y * cx + x], expected);
+        }
+    }
+    return lines;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    make_stream(g_temp_s);
+    init_stream(g_temp_s, 16384 * 2);
+    make_stream(g_out_s);
+    init_stream(g_out_s, OUT_SIZE);
+    g_pixels = g_new(unsigned int, BENCH_WIDTH * BENCH_HEIGHT);
+    g_image = g_new(char, BENCH_WIDTH * BENCH_HEIGHT * 4);
+    g_decoded = g_new(unsigned int, MAX_WIDTH * MAX_HEIGHT * 2);
+    ck_assert_ptr_ne(g_pixels, NULL);
+    ck_assert_ptr_ne(g_image, NULL);
+    ck_assert_ptr_ne(g_decoded, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    free_stream(g_temp_s);
+    free_stream(g_out_s);
+    g_free(g_pixels);
+    g_free(g_image);
+    g_free(g_decoded);
+}
+
+/******************************************************************************/
+/* output from the code before the line classifier */
+START_TEST(test_bitmap_compress__reference_output)
+{
+    static const unsigned char expected[] =
+    {
+        0x24,                               /* mix 4, bottom line */
+        0x84,                               /* copy 4 */
+        0xa5, 0x6e, 0xa5, 0x6e, 0xa5, 0x6e, 0xa5, 0x6e
+    };
+    int lines;
+
+    draw(4, 2, 16, PATTERN_FLAT);
+    init_stream(g_out_s, OUT_SIZE);
+    lines = xrdp_bitmap_compress(g_image, 4, 2, g_out_s, 16, OUT_SIZE, 1,
+                                 g_temp_s, 0);
+    s_mark_end(g_out_s);
+    ck_assert_int_eq(lines, 2);
+    ck_assert_int_eq(g_out_s->end - g_out_s->data, sizeof(expected));
+    ck_assert_int_eq(g_memcmp(g_out_s->data, expected, sizeof(expected)), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_bitmap_compress__round_trip)
+{
+    static const int bpps[] = { 8, 16, 24 };
+    static const int widths[] = { 1, 2, 3, 7, 8, 9, 31, 32, 33, 64, 100, 128 };
+    int bindex;
+    int windex;
+    int pattern;
+    int width;
+    int height;
+    int e;
+
+    for (bindex = 0; bindex < 3; bindex++)
+    {
+        for (pattern = 0; pattern < PATTERN_COUNT; pattern++)
+        {
+            for (windex = 0; windex < (int) (sizeof(widths) / sizeof(int));
+                    windex++)
+            {
+                width = widths[windex];
+                e = (4 - (width & 3)) & 3;
+                height = MIN(MAX_HEIGHT, 16384 / ((width + e) * 4));
+                draw(width, height, bpps[bindex], pattern);
+                ck_assert_int_eq(round_trip(width, height, bpps[bindex], e,
+                                            OUT_SIZE), height);
+            }
+        }
+    }
+}
+END_TEST
+
+/******************************************************************************/
+/* lines that do not fit are left for the next call */
+START_TEST(test_bitmap_compress__byte_limit)
+{
+    int lines;
+
+    draw(64, 64, 16, PATTERN_NOISE);
+    lines = round_trip(64, 64, 16, 0, 1024);
+    ck_assert_int_lt(lines, 64);
+    ck_assert_int_ge(g_out_s->end - g_out_s->data, 1024);
+
+    /* 16 KB of source pixels at most */
+    draw(128, 64, 24, PATTERN_FLAT);
+    ck_assert_int_eq(round_trip(128, 64, 24, 0, OUT_SIZE), 42);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_bitmap_compress__unsupported_bpp)
+{
+    init_stream(g_out_s, OUT_SIZE);
+    ck_assert_int_eq(xrdp_bitmap_compress(g_image, 4, 4, g_out_s, 32,
+                                          OUT_SIZE, 3, g_temp_s, 0), 0);
+    ck_assert_ptr_eq(g_out_s->p, g_out_s->data);
+}
+END_TEST
+
+/******************************************************************************/
+/* desktop like frame, flat areas with text like detail and a gradient */
+static void
+draw_desktop(int bpp)
+{
+    unsigned int pixel;
+    int x;
+    int y;
+
+    for (y = 0; y < BENCH_HEIGHT; y++)
+    {
+        for (x = 0; x < BENCH_WIDTH; x++)
+        {
+            if (y < 32)
+            {
+                pixel = 0x303040 + (x * 64 / BENCH_WIDTH);
+            }
+            else if ((x > 100) && (x < 900) && (y > 100) && (y < 600))
+            {
+                pixel = (((x * 7) ^ (y * 13)) % 11 < 3) ? 0x000000 : 0xffffff;
+            }
+            else
+            {
+                pixel = 0x3a6ea5;
+            }
+            pixel &= bpp_mask(bpp);
+            if (bpp == 24)
+            {
+                ((unsigned int *) g_image)[y * BENCH_WIDTH + x] = pixel;
+            }
+            else
+            {
+                ((unsigned short *) g_image)[y * BENCH_WIDTH + x] = pixel;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_bitmap_compress__benchmark)
+{
+    static const int bpps[] = { 16, 24 };
+    struct stream *tile_s;
+    char *src;
+    int bindex;
+    int start;
+    int ms;
+    int frame;
+    int bytes;
+    int x;
+    int y;
+    int ly;
+    int lines;
+
+    make_stream(tile_s);
+    init_stream(tile_s, TILE * TILE * 4);
+    for (bindex = 0; bindex < 2; bindex++)
+    {
+        draw_desktop(bpps[bindex]);
+        bytes = (bpps[bindex] + 7) / 8;
+        bytes = (bytes == 3) ? 4 : bytes;
+        start = g_time3();
+        for (frame = 0; frame < BENCH_FRAMES; frame++)
+        {
+            for (y = 0; y < BENCH_HEIGHT; y += TILE)
+            {
+                for (x = 0; x < BENCH_WIDTH; x += TILE)
+                {
+                    /* tiles are sent as their own bitmaps */
+                    src = tile_s->data;
+                    for (ly = 0; ly < TILE; ly++)
+                    {
+                        g_memcpy(src + ly * TILE * bytes,
+                                 g_image + ((y + ly) * BENCH_WIDTH + x) *
+                                 bytes, TILE * bytes);
+                    }
+                    init_stream(g_out_s, OUT_SIZE);
+                    lines = xrdp_bitmap_compress(src, TILE, TILE, g_out_s,
+                                                 bpps[bindex], 16384,
+                                                 TILE - 1, g_temp_s, 0);
+                    ck_assert_int_gt(lines, 0);
+                }
+            }
+        }
+        ms = g_time3() - start;
+        LOG(LOG_LEVEL_INFO, "bitmap compress bench %d bpp: %d ms for %d "
+            "frames %dx%d, %d MPixel/s", bpps[bindex], ms, BENCH_FRAMES,
+            BENCH_WIDTH, BENCH_HEIGHT,
+            BENCH_FRAMES * BENCH_WIDTH * BENCH_HEIGHT / MAX(ms, 1) / 1000);
+    }
+    free_stream(tile_s);
+}
+END_TEST
+
+/******************************************************************************/
+/* the bitmap workers must produce what compressing one at a time does */
+START_TEST(test_bitmap_compress__workers_match_serial)
+{
+    static const int bpps[] = { 16, 24, 32 };
+    struct xrdp_bitmap_job jobs[(BENCH_WIDTH / TILE) * 2];
+    struct xrdp_rdp *rdp;
+    struct xrdp_orders *orders;
+    char *tiles;
+    int num_jobs;
+    int bindex;
+    int bytes;
+    int index;
+    int bpp;
+    int x;
+    int y;
+    int ly;
+    int lines;
+
+    rdp = g_new0(struct xrdp_rdp, 1);
+    ck_assert_ptr_ne(rdp, NULL);
+    orders = xrdp_orders_create(NULL, rdp);
+    /* no workers */
+    ck_assert_int_ne(xrdp_orders_compress_bitmaps(orders, jobs, 1), 0);
+    xrdp_orders_delete(orders);
+
+    rdp->client_info.bitmap_compress_threads = 4;
+    orders = xrdp_orders_create(NULL, rdp);
+    num_jobs = (int) (sizeof(jobs) / sizeof(jobs[0]));
+    tiles = g_new(char, num_jobs * TILE * TILE * 4);
+    ck_assert_ptr_ne(tiles, NULL);
+    for (bindex = 0; bindex < 3; bindex++)
+    {
+        bpp = bpps[bindex];
+        /* the desktop has no 32 bpp drawing, its 24 bpp pixels will do */
+        draw_desktop(bpp == 32 ? 24 : bpp);
+        bytes = (bpp == 16) ? 2 : 4;
+        /* two rows of tiles across the text and the title bar */
+        for (index = 0; index < num_jobs; index++)
+        {
+            x = (index % (BENCH_WIDTH / TILE)) * TILE;
+            y = (index / (BENCH_WIDTH / TILE)) * 96;
+            for (ly = 0; ly < TILE; ly++)
+            {
+                g_memcpy(tiles + (index * TILE + ly) * TILE * bytes,
+                         g_image + ((y + ly) * BENCH_WIDTH + x) * bytes,
+                         TILE * bytes);
+            }
+            jobs[index].data = tiles + index * TILE * TILE * bytes;
+            jobs[index].width = TILE;
+            jobs[index].height = TILE;
+            jobs[index].bpp = bpp;
+            jobs[index].start_line = TILE - 1;
+            jobs[index].byte_limit = 16384;
+        }
+        ck_assert_int_eq(xrdp_orders_compress_bitmaps(orders, jobs,
+                         num_jobs), 0);
+        for (index = 0; index < num_jobs; index++)
+        {
+            init_stream(g_out_s, OUT_SIZE);
+            if (bpp > 24)
+            {
+                lines = xrdp_bitmap32_compress(jobs[index].data, TILE, TILE,
+                                               g_out_s, bpp, 16384, TILE - 1,
+                                               g_temp_s, 0, 0x10);
+            }
+            else
+            {
+                lines = xrdp_bitmap_compress(jobs[index].data, TILE, TILE,
+                                             g_out_s, bpp, 16384, TILE - 1,
+                                             g_temp_s, 0);
+            }
+            ck_assert_int_eq(jobs[index].lines, lines);
+            ck_assert_int_eq(jobs[index].bytes, g_out_s->p - g_out_s->data);
+            ck_assert_msg(g_memcmp(jobs[index].comp, g_out_s->data,
+                                   jobs[index].bytes) == 0,
+                          "bpp %d tile %d differs", bpp, index);
+            g_free(jobs[index].comp);
+        }
+    }
+    g_free(tiles);
+    xrdp_orders_delete(orders);
+    g_free(rdp);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_bitmap_compress(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("BitmapCompress");
+
+    tc = tcase_create("xrdp_bitmap_compress");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_bitmap_compress__reference_output);
+    tcase_add_test(tc, test_bitmap_compress__round_trip);
+    tcase_add_test(tc, test_bitmap_compress__byte_limit);
+    tcase_add_test(tc, test_bitmap_compress__unsupported_bpp);
+    tcase_add_test(tc, test_bitmap_compress__workers_match_serial);
+    tcase_add_test(tc, test_bitmap_compress__benchmark);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
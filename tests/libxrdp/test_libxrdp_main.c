@@ -14,6 +14,10 @@ int main (void)
 
     sr = srunner_create(make_suite_test_xrdp_sec_process_mcs_data_monitors());
     srunner_add_suite(sr, make_suite_test_monitor_processing());
+    srunner_add_suite(sr, make_suite_test_bitmap32());
+    srunner_add_suite(sr, make_suite_test_bitmap_compress());
+    srunner_add_suite(sr, make_suite_test_orders_peephole());
+    srunner_add_suite(sr, make_suite_test_text_fragment());
 
     srunner_set_tap(sr, "-");
 
@@ -0,0 +1,304 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for the drawing order peephole optimiser
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define SCREEN 48
+
+static struct xrdp_orders_peephole_stats g_stats;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_memset(&g_stats, 0, sizeof(g_stats));
+}
+
+/******************************************************************************/
+static struct xrdp_order_item
+rect(int x, int y, int cx, int cy, int color)
+{
+    struct xrdp_order_item item;
+
+    g_memset(&item, 0, sizeof(item));
+    item.type = RDP_ORDER_RECT;
+    item.x = x;
+    item.y = y;
+    item.cx = cx;
+    item.cy = cy;
+    item.color = color;
+    return item;
+}
+
+/******************************************************************************/
+static struct xrdp_order_item
+screen_blt(int x, int y, int cx, int cy, int srcx, int srcy)
+{
+    struct xrdp_order_item item;
+
+    item = rect(x, y, cx, cy, 0);
+    item.type = RDP_ORDER_SCREENBLT;
+    item.srcx = srcx;
+    item.srcy = srcy;
+    item.rop = 0xcc;
+    return item;
+}
+
+/******************************************************************************/
+static struct xrdp_order_item
+mem_blt(int x, int y, int cx, int cy, int cache_idx)
+{
+    struct xrdp_order_item item;
+
+    item = rect(x, y, cx, cy, 0);
+    item.type = RDP_ORDER_MEMBLT;
+    item.cache_idx = cache_idx;
+    item.rop = 0xcc;
+    return item;
+}
+
+/******************************************************************************/
+/* what the client draws, pat blts are solid, 0x55 inverts */
+static void
+draw(unsigned int *screen, const struct xrdp_order_item *items, int count)
+{
+    unsigned int copy[SCREEN * SCREEN];
+    const struct xrdp_order_item *item;
+    unsigned int pixel;
+    int index;
+    int x;
+    int y;
+    int sx;
+    int sy;
+
+    for (index = 0; index < count; index++)
+    {
+        item = items + index;
+        g_memcpy(copy, screen, sizeof(copy));
+        for (y = item->y; y < item->y + item->cy; y++)
+        {
+            for (x = item->x; x < item->x + item->cx; x++)
+            {
+                if ((x < 0) || (y < 0) || (x >= SCREEN) || (y >= SCREEN))
+                {
+                    continue;
+                }
+                if (item->has_clip &&
+                        ((x < item->clip.left) || (y < item->clip.top) ||
+                         (x >= item->clip.right) || (y >= item->clip.bottom)))
+                {
+                    continue;
+                }
+                sx = item->srcx + x - item->x;
+                sy = item->srcy + y - item->y;
+                switch (item->type)
+                {
+                    case RDP_ORDER_RECT:
+                        pixel = item->color;
+                        break;
+                    case RDP_ORDER_PATBLT:
+                        pixel = (item->rop == 0x55) ? ~copy[y * SCREEN + x] :
+                                item->color;
+                        break;
+                    case RDP_ORDER_SCREENBLT:
+                        /* black from off the screen */
+                        pixel = ((sx < 0) || (sy < 0) || (sx >= SCREEN) ||
+                                 (sy >= SCREEN)) ? 0 : copy[sy * SCREEN + sx];
+                        break;
+                    default:
+                        pixel = item->cache_idx * 7919 + sy * 131 + sx;
+                        break;
+                }
+                screen[y * SCREEN + x] = pixel;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_orders_peephole__drops_overdrawn)
+{
+    struct xrdp_order_item items[3];
+
+    items[0] = rect(0, 0, 10, 10, 1);
+    items[1] = mem_blt(20, 20, 8, 8, 3);
+    items[2] = rect(0, 0, 16, 16, 2);
+    ck_assert_int_eq(xrdp_orders_peephole(items, 3, &g_stats), 2);
+    ck_assert_int_eq(g_stats.dropped, 1);
+    ck_assert_int_eq(items[0].type, RDP_ORDER_MEMBLT);
+    ck_assert_int_eq(items[1].color, 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_peephole__keeps_what_is_read)
+{
+    struct xrdp_order_item items[3];
+
+    /* the screen blt copies the first rect before it is drawn over */
+    items[0] = rect(0, 0, 10, 10, 1);
+    items[1] = screen_blt(30, 30, 10, 10, 0, 0);
+    items[2] = rect(0, 0, 16, 16, 2);
+    ck_assert_int_eq(xrdp_orders_peephole(items, 3, &g_stats), 3);
+    ck_assert_int_eq(g_stats.dropped, 0);
+    ck_assert_int_eq(g_stats.moved, 0);
+    ck_assert_int_eq(items[0].color, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_peephole__merges_rects)
+{
+    struct xrdp_order_item items[4];
+
+    items[0] = rect(0, 0, 10, 4, 5);
+    items[1] = rect(0, 4, 10, 4, 5);
+    items[2] = rect(10, 0, 6, 8, 5);
+    /* different colour */
+    items[3] = rect(16, 0, 6, 8, 6);
+    ck_assert_int_eq(xrdp_orders_peephole(items, 4, &g_stats), 2);
+    ck_assert_int_eq(g_stats.merged, 2);
+    ck_assert_int_eq(items[0].x, 0);
+    ck_assert_int_eq(items[0].y, 0);
+    ck_assert_int_eq(items[0].cx, 16);
+    ck_assert_int_eq(items[0].cy, 8);
+    ck_assert_int_eq(items[1].color, 6);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_peephole__groups_types)
+{
+    struct xrdp_order_item items[4];
+
+    items[0] = mem_blt(0, 0, 8, 8, 1);
+    items[1] = rect(10, 0, 4, 4, 1);
+    items[2] = mem_blt(20, 0, 8, 8, 2);
+    /* drawn over the mem blt before it, can not move up */
+    items[3] = rect(22, 2, 4, 4, 1);
+    ck_assert_int_eq(xrdp_orders_peephole(items, 4, &g_stats), 4);
+    ck_assert_int_eq(g_stats.moved, 1);
+    ck_assert_int_eq(items[0].type, RDP_ORDER_MEMBLT);
+    ck_assert_int_eq(items[1].type, RDP_ORDER_MEMBLT);
+    ck_assert_int_eq(items[2].type, RDP_ORDER_RECT);
+    ck_assert_int_eq(items[3].type, RDP_ORDER_RECT);
+    ck_assert_int_eq(items[3].x, 22);
+}
+END_TEST
+
+/******************************************************************************/
+/* random batches must draw the same with and without the optimiser */
+START_TEST(test_orders_peephole__same_pixels)
+{
+    struct xrdp_order_item items[XRDP_MAX_PENDING_ORDERS];
+    struct xrdp_order_item optimised[XRDP_MAX_PENDING_ORDERS];
+    unsigned int expected[SCREEN * SCREEN];
+    unsigned int actual[SCREEN * SCREEN];
+    unsigned int seed;
+    int batch;
+    int count;
+    int index;
+    int kind;
+
+    seed = 12345;
+    for (batch = 0; batch < 2000; batch++)
+    {
+        seed = seed * 1103515245 + 12345;
+        count = 1 + (seed >> 16) % XRDP_MAX_PENDING_ORDERS;
+        for (index = 0; index < count; index++)
+        {
+            seed = seed * 1103515245 + 12345;
+            kind = (seed >> 8) % 5;
+            /* few sizes and colours so orders line up and cover each other */
+            items[index] = rect(((seed >> 12) % 6) * 8, ((seed >> 15) % 6) * 8,
+                                ((seed >> 18) % 3 + 1) * 8,
+                                ((seed >> 20) % 3 + 1) * 8,
+                                (seed >> 22) % 3);
+            if (kind == 1)
+            {
+                items[index].type = RDP_ORDER_PATBLT;
+                items[index].rop = ((seed >> 24) & 1) ? 0x55 : 0xf0;
+            }
+            else if (kind == 2)
+            {
+                items[index].type = RDP_ORDER_SCREENBLT;
+                items[index].rop = 0xcc;
+                items[index].srcx = ((seed >> 25) % 6) * 8;
+                items[index].srcy = ((seed >> 27) % 6) * 8;
+            }
+            else if (kind == 3)
+            {
+                items[index].type = RDP_ORDER_MEMBLT;
+                items[index].rop = 0xcc;
+                items[index].cache_idx = (seed >> 24) % 4;
+                items[index].cache_id = ((seed >> 26) % 8 == 0) ? 255 : 0;
+            }
+            if ((seed >> 29) == 0)
+            {
+                items[index].has_clip = 1;
+                items[index].clip.left = 4;
+                items[index].clip.top = 4;
+                items[index].clip.right = 36;
+                items[index].clip.bottom = 36;
+            }
+        }
+        g_memset(expected, 0, sizeof(expected));
+        g_memset(actual, 0, sizeof(actual));
+        draw(expected, items, count);
+        g_memcpy(optimised, items, sizeof(items));
+        draw(actual, optimised,
+             xrdp_orders_peephole(optimised, count, &g_stats));
+        ck_assert_msg(g_memcmp(expected, actual, sizeof(actual)) == 0,
+                      "batch %d of %d orders", batch, count);
+    }
+    ck_assert_int_gt(g_stats.dropped, 0);
+    ck_assert_int_gt(g_stats.merged, 0);
+    ck_assert_int_gt(g_stats.moved, 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_orders_peephole(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("OrdersPeephole");
+
+    tc = tcase_create("xrdp_orders_peephole");
+    tcase_add_checked_fixture(tc, setup, NULL);
+    tcase_add_test(tc, test_orders_peephole__drops_overdrawn);
+    tcase_add_test(tc, test_orders_peephole__keeps_what_is_read);
+    tcase_add_test(tc, test_orders_peephole__merges_rects);
+    tcase_add_test(tc, test_orders_peephole__groups_types);
+    tcase_add_test(tc, test_orders_peephole__same_pixels);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,156 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for the glyph run fragment cache
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+/* glyph index, delta pairs as xrdp_painter_draw_text() makes them */
+static const char g_hello[] = { 10, 0, 11, 8, 12, 8, 12, 4, 13, 4 };
+static const char g_world[] = { 14, 0, 13, 9, 15, 8, 12, 5, 16, 4 };
+
+static struct xrdp_text_frags *g_frags;
+static char g_out[255 + 3];
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_frags = g_new0(struct xrdp_text_frags, 1);
+    g_frags->entries = 256;
+    g_frags->max_bytes = 255;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_free(g_frags);
+}
+
+/******************************************************************************/
+START_TEST(test_text_fragment__add_then_use)
+{
+    int bytes;
+
+    bytes = xrdp_orders_text_fragment(g_frags, 0, g_hello, sizeof(g_hello),
+                                      g_out);
+    ck_assert_int_eq(bytes, sizeof(g_hello) + 3);
+    ck_assert_int_eq(g_memcmp(g_out, g_hello, sizeof(g_hello)), 0);
+    ck_assert_int_eq((unsigned char) g_out[sizeof(g_hello)],
+                     GLYPH_FRAGMENT_ADD);
+    ck_assert_int_eq(g_out[sizeof(g_hello) + 1], 0);
+    ck_assert_int_eq(g_out[sizeof(g_hello) + 2], sizeof(g_hello));
+
+    bytes = xrdp_orders_text_fragment(g_frags, 0, g_world, sizeof(g_world),
+                                      g_out);
+    ck_assert_int_eq(bytes, sizeof(g_world) + 3);
+    ck_assert_int_eq(g_out[sizeof(g_world) + 1], 1);
+
+    bytes = xrdp_orders_text_fragment(g_frags, 0, g_hello, sizeof(g_hello),
+                                      g_out);
+    ck_assert_int_eq(bytes, 2);
+    ck_assert_int_eq((unsigned char) g_out[0], GLYPH_FRAGMENT_USE);
+    ck_assert_int_eq(g_out[1], 0);
+    ck_assert_int_eq(g_frags->hits, 1);
+    ck_assert_int_eq(g_frags->adds, 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_text_fragment__replaces_oldest)
+{
+    char run[4];
+    int index;
+
+    g_frags->entries = 2;
+    xrdp_orders_text_fragment(g_frags, 0, g_hello, sizeof(g_hello), g_out);
+    xrdp_orders_text_fragment(g_frags, 0, g_world, sizeof(g_world), g_out);
+    /* hello is used again so world is the oldest */
+    xrdp_orders_text_fragment(g_frags, 0, g_hello, sizeof(g_hello), g_out);
+    for (index = 0; index < 4; index++)
+    {
+        run[index] = 20 + index;
+    }
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, run, 4, g_out), 7);
+    ck_assert_int_eq(g_out[5], 1);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_hello,
+                     sizeof(g_hello), g_out), 2);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_world,
+                     sizeof(g_world), g_out), sizeof(g_world) + 3);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_text_fragment__leaves_short_and_long_runs)
+{
+    g_frags->max_bytes = 8;
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_hello, 2,
+                     g_out), 0);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_hello,
+                     sizeof(g_hello), g_out), 0);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_hello, 8,
+                     g_out), 8 + 3);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_text_fragment__off_for_module_fragments)
+{
+    /* a glyph, a 3 byte delta holding 0xff, then a USE_FRAGMENT */
+    static const char wide[] = { 10, 0, 11, (char) 0x80, (char) 0xff, 0 };
+    static const char used[] = { 10, 0, (char) GLYPH_FRAGMENT_USE, 3 };
+
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, wide,
+                     sizeof(wide), g_out), sizeof(wide) + 3);
+    ck_assert_int_eq(g_frags->off, 0);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, used,
+                     sizeof(used), g_out), 0);
+    ck_assert_int_eq(g_frags->off, 1);
+    ck_assert_int_eq(xrdp_orders_text_fragment(g_frags, 0, g_hello,
+                     sizeof(g_hello), g_out), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_text_fragment(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("TextFragment");
+
+    tc = tcase_create("xrdp_orders_text_fragment");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_text_fragment__add_then_use);
+    tcase_add_test(tc, test_text_fragment__replaces_oldest);
+    tcase_add_test(tc, test_text_fragment__leaves_short_and_long_runs);
+    tcase_add_test(tc, test_text_fragment__off_for_module_fragments);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -6,5 +6,7 @@
 Suite *make_suite_test_bitmap_load(void);
 Suite *make_suite_egfx_base_functions(void);
 Suite *make_suite_region(void);
+Suite *make_suite_tile_hash(void);
+Suite *make_suite_jpeg(void);
 
 #endif /* TEST_XRDP_H */
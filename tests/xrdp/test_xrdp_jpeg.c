@@ -0,0 +1,306 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ *
+ * The benchmark results are logged, run with TEST_LOG_LEVEL=INFO
+ * to see them.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "log.h"
+#include "os_calls.h"
+#include "thread_pool.h"
+#include "xrdp.h"
+#include "test_xrdp.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define BENCH_FRAMES 4
+#define BENCH_THREADS 4
+#define SLICE_LINES 192
+
+static char *frame;
+static char *out_data;
+static int out_data_bytes;
+
+struct slice_batch
+{
+    void *ctx[BENCH_THREADS];
+    int quality;
+    int flags;
+    int bytes[HEIGHT / SLICE_LINES + 1];
+};
+
+/******************************************************************************/
+/* desktop like frame, flat areas with text like detail and a gradient */
+static void
+draw_desktop(void)
+{
+    unsigned int *dst;
+    unsigned int pixel;
+    int x;
+    int y;
+
+    dst = (unsigned int *) frame;
+    for (y = 0; y < HEIGHT; y++)
+    {
+        for (x = 0; x < WIDTH; x++)
+        {
+            if (y < 32)
+            {
+                pixel = 0x303040 + (x * 64 / WIDTH);
+            }
+            else if ((x > 100) && (x < 900) && (y > 100) && (y < 600))
+            {
+                /* glyph like dots on white */
+                pixel = (((x * 7) ^ (y * 13)) % 11 < 3) ? 0x000000 : 0xffffff;
+            }
+            else
+            {
+                pixel = 0x3a6ea5;
+            }
+            *(dst++) = pixel;
+        }
+    }
+}
+
+/******************************************************************************/
+/* photo like frame, smooth colour with noise */
+static void
+draw_photo(void)
+{
+    unsigned int *dst;
+    unsigned int seed;
+    int x;
+    int y;
+    int r;
+    int g;
+    int b;
+
+    dst = (unsigned int *) frame;
+    seed = 12345;
+    for (y = 0; y < HEIGHT; y++)
+    {
+        for (x = 0; x < WIDTH; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            r = (x * 255 / WIDTH) + ((seed >> 16) & 15);
+            g = (y * 255 / HEIGHT) + ((seed >> 20) & 15);
+            b = ((x + y) * 255 / (WIDTH + HEIGHT)) + ((seed >> 24) & 15);
+            *(dst++) = (MIN(r, 255) << 16) | (MIN(g, 255) << 8) | MIN(b, 255);
+        }
+    }
+}
+
+/******************************************************************************/
+static int
+compress(void *ctx, int y, int cy, int quality, int flags, char *out)
+{
+    int bytes;
+
+    bytes = out_data_bytes;
+    ck_assert_int_ge(libxrdp_codec_jpeg_compress_ex(ctx, 0, frame,
+                     WIDTH, HEIGHT, WIDTH * 4,
+                     0, y, WIDTH, cy,
+                     quality, flags, out, &bytes), 0);
+    return bytes;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    out_data_bytes = WIDTH * HEIGHT * 4;
+    frame = g_new(char, WIDTH * HEIGHT * 4);
+    out_data = g_new(char, out_data_bytes);
+    ck_assert_ptr_ne(frame, NULL);
+    ck_assert_ptr_ne(out_data, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_free(frame);
+    g_free(out_data);
+}
+
+/******************************************************************************/
+START_TEST(test_jpeg__valid_output)
+{
+    void *ctx;
+    int bytes;
+    unsigned char *p;
+
+    ctx = libxrdp_codec_jpeg_create();
+    draw_desktop();
+    bytes = compress(ctx, 0, HEIGHT, 75, 0, out_data);
+    if (bytes == 0)
+    {
+        /* built without a jpeg library */
+        libxrdp_codec_jpeg_delete(ctx);
+        return;
+    }
+    p = (unsigned char *) out_data;
+    /* SOI and EOI markers */
+    ck_assert_int_ge(bytes, 4);
+    ck_assert_int_eq(p[0], 0xff);
+    ck_assert_int_eq(p[1], 0xd8);
+    ck_assert_int_eq(p[bytes - 2], 0xff);
+    ck_assert_int_eq(p[bytes - 1], 0xd9);
+    libxrdp_codec_jpeg_delete(ctx);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_jpeg__context_reuse)
+{
+    void *ctx;
+    char *first;
+    int first_bytes;
+    int bytes;
+
+    ctx = libxrdp_codec_jpeg_create();
+    first = g_new(char, out_data_bytes);
+    ck_assert_ptr_ne(first, NULL);
+    draw_photo();
+    first_bytes = compress(ctx, 0, HEIGHT, 75, XRDP_JPEG_FLAGS_FAST_DCT,
+                           first);
+    /* different settings in between must not leak into the next image */
+    compress(ctx, 16, 64, 95, XRDP_JPEG_FLAGS_OPTIMIZE, out_data);
+    bytes = compress(ctx, 0, HEIGHT, 75, XRDP_JPEG_FLAGS_FAST_DCT, out_data);
+    ck_assert_int_eq(bytes, first_bytes);
+    ck_assert_int_eq(g_memcmp(first, out_data, bytes), 0);
+    g_free(first);
+    libxrdp_codec_jpeg_delete(ctx);
+}
+END_TEST
+
+/******************************************************************************/
+static void
+slice_job(void *arg, int index, int worker)
+{
+    struct slice_batch *batch = (struct slice_batch *) arg;
+    int y;
+    int bytes;
+
+    y = index * SLICE_LINES;
+    bytes = out_data_bytes / BENCH_THREADS;
+    libxrdp_codec_jpeg_compress_ex(batch->ctx[worker], 0, frame,
+                                   WIDTH, HEIGHT, WIDTH * 4,
+                                   0, y, WIDTH, MIN(SLICE_LINES, HEIGHT - y),
+                                   batch->quality, batch->flags,
+                                   out_data + worker * bytes, &bytes);
+    batch->bytes[index] = bytes;
+}
+
+/******************************************************************************/
+static void
+bench(const char *name, int quality, int flags)
+{
+    struct thread_pool *pool;
+    struct slice_batch batch;
+    void *ctx;
+    int start;
+    int serial_ms;
+    int parallel_ms;
+    int bytes;
+    int slices;
+    int index;
+    int jndex;
+
+    ctx = libxrdp_codec_jpeg_create();
+    bytes = 0;
+    start = g_time3();
+    for (index = 0; index < BENCH_FRAMES; index++)
+    {
+        bytes = compress(ctx, 0, HEIGHT, quality, flags, out_data);
+    }
+    serial_ms = g_time3() - start;
+    libxrdp_codec_jpeg_delete(ctx);
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    pool = thread_pool_create(BENCH_THREADS - 1);
+    for (index = 0; index < BENCH_THREADS; index++)
+    {
+        batch.ctx[index] = libxrdp_codec_jpeg_create();
+    }
+    batch.quality = quality;
+    batch.flags = flags;
+    slices = (HEIGHT + SLICE_LINES - 1) / SLICE_LINES;
+    start = g_time3();
+    for (index = 0; index < BENCH_FRAMES; index++)
+    {
+        thread_pool_run(pool, slices, slice_job, &batch);
+    }
+    parallel_ms = g_time3() - start;
+    for (index = 0; index < BENCH_THREADS; index++)
+    {
+        libxrdp_codec_jpeg_delete(batch.ctx[index]);
+    }
+    thread_pool_delete(pool);
+    for (jndex = 0; jndex < slices; jndex++)
+    {
+        ck_assert_int_gt(batch.bytes[jndex], 0);
+    }
+
+    LOG(LOG_LEVEL_INFO, "jpeg bench %s q%d flags 0x%x: %d bytes, "
+        "serial %d ms, %d slices on %d threads %d ms (%d frames %dx%d)",
+        name, quality, flags, bytes, serial_ms, slices, BENCH_THREADS,
+        parallel_ms, BENCH_FRAMES, WIDTH, HEIGHT);
+}
+
+/******************************************************************************/
+START_TEST(test_jpeg__benchmark)
+{
+    draw_desktop();
+    bench("desktop", 75, 0);
+    bench("desktop", 75, XRDP_JPEG_FLAGS_FAST_DCT);
+    bench("desktop", 90, XRDP_JPEG_FLAGS_OPTIMIZE);
+    draw_photo();
+    bench("photo", 75, 0);
+    bench("photo", 75, XRDP_JPEG_FLAGS_FAST_DCT);
+    bench("photo", 50, XRDP_JPEG_FLAGS_FAST_DCT);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_jpeg(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Jpeg");
+
+    tc = tcase_create("xrdp_jpeg");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_jpeg__valid_output);
+    tcase_add_test(tc, test_jpeg__context_reuse);
+    tcase_add_test(tc, test_jpeg__benchmark);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
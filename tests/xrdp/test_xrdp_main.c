@@ -57,6 +57,8 @@ int main (void)
     sr = srunner_create (make_suite_test_bitmap_load());
     srunner_add_suite(sr, make_suite_egfx_base_functions());
     srunner_add_suite(sr, make_suite_region());
+    srunner_add_suite(sr, make_suite_tile_hash());
+    srunner_add_suite(sr, make_suite_jpeg());
 
     srunner_set_tap(sr, "-");
     srunner_run_all (sr, CK_ENV);
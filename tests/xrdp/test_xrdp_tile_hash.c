@@ -0,0 +1,261 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "xrdp_tile_hash.h"
+#include "test_xrdp.h"
+
+#define WIDTH 320
+#define HEIGHT 256
+
+static struct xrdp_tile_hash *th;
+static unsigned int *frame;
+static short full_crect[4] = { 0, 0, WIDTH, HEIGHT };
+
+/******************************************************************************/
+/* content of a document at document position (dx, dy) */
+static unsigned int
+pixel_at(int dx, int dy)
+{
+    unsigned int v;
+
+    v = (unsigned int) (dx * 7919 + dy * 104729 + 17);
+    v ^= v >> 7;
+    v *= 0x2545f491u;
+    return v ^ (v >> 11);
+}
+
+/******************************************************************************/
+/* draws the document scrolled to (sx, sy) */
+static void
+draw_frame(int sx, int sy)
+{
+    int x;
+    int y;
+
+    for (y = 0; y < HEIGHT; y++)
+    {
+        for (x = 0; x < WIDTH; x++)
+        {
+            frame[y * WIDTH + x] = pixel_at(x + sx, y + sy);
+        }
+    }
+}
+
+/******************************************************************************/
+static void
+send_frame(void)
+{
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    xrdp_tile_hash_end_frame(th);
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    th = xrdp_tile_hash_create(WIDTH, HEIGHT);
+    ck_assert_ptr_ne(th, NULL);
+    frame = g_new(unsigned int, WIDTH * HEIGHT);
+    ck_assert_ptr_ne(frame, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_tile_hash_delete(th);
+    g_free(frame);
+}
+
+/******************************************************************************/
+START_TEST(test_tile_hash__scroll_down)
+{
+    short scroll[6];
+
+    draw_frame(0, 0);
+    send_frame();
+    /* document moves up 40 lines on the screen */
+    draw_frame(0, 40);
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_find_scroll(th, full_crect, 1,
+                     scroll), 1);
+    xrdp_tile_hash_end_frame(th);
+    ck_assert_int_eq(scroll[0], 0);
+    ck_assert_int_eq(scroll[1], 40);
+    ck_assert_int_eq(scroll[2], WIDTH);
+    ck_assert_int_eq(scroll[3], HEIGHT - 40);
+    ck_assert_int_eq(scroll[4], 0);
+    ck_assert_int_eq(scroll[5], -40);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__scroll_right)
+{
+    short scroll[6];
+
+    draw_frame(100, 0);
+    send_frame();
+    /* document moves right 24 columns on the screen */
+    draw_frame(76, 0);
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_find_scroll(th, full_crect, 1,
+                     scroll), 1);
+    xrdp_tile_hash_end_frame(th);
+    ck_assert_int_eq(scroll[0], 0);
+    ck_assert_int_eq(scroll[1], 0);
+    ck_assert_int_eq(scroll[2], WIDTH - 24);
+    ck_assert_int_eq(scroll[3], HEIGHT);
+    ck_assert_int_eq(scroll[4], 24);
+    ck_assert_int_eq(scroll[5], 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__no_scroll)
+{
+    short scroll[6];
+
+    draw_frame(0, 0);
+    send_frame();
+    /* unrelated content */
+    draw_frame(5000, 7000);
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_find_scroll(th, full_crect, 1,
+                     scroll), 0);
+    xrdp_tile_hash_end_frame(th);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__unknown_content)
+{
+    short scroll[6];
+
+    draw_frame(0, 0);
+    send_frame();
+    /* the client content was changed by someone else */
+    xrdp_tile_hash_invalidate(th, 0, 0, WIDTH, HEIGHT);
+    draw_frame(0, 40);
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_find_scroll(th, full_crect, 1,
+                     scroll), 0);
+    xrdp_tile_hash_end_frame(th);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__damage_not_a_rect)
+{
+    short scroll[6];
+    short crects[8] = { 0, 0, WIDTH, 128, 0, 128, 64, 128 };
+
+    draw_frame(0, 0);
+    send_frame();
+    draw_frame(0, 40);
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, crects, 2), 0);
+    ck_assert_int_eq(xrdp_tile_hash_find_scroll(th, crects, 2, scroll), 0);
+    xrdp_tile_hash_end_frame(th);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__size_mismatch)
+{
+    ck_assert_int_ne(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH / 2, HEIGHT, full_crect, 1), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__unchanged_tiles)
+{
+    short crects[4] = { 0, 0, WIDTH, 150 };
+
+    draw_frame(0, 0);
+    send_frame();
+    /* same pixels again, one of them changed */
+    frame[70 * WIDTH + 130] ^= 0x00010000;
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, crects, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 0, 0), 1);
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 4, 0), 1);
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 1, 1), 1);
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 2, 1), 0);
+    /* only partly damaged */
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 0, 2), 0);
+    /* outside the screen */
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 5, 0), 0);
+    xrdp_tile_hash_end_frame(th);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_hash__alpha_ignored)
+{
+    int index;
+
+    draw_frame(0, 0);
+    send_frame();
+    for (index = 0; index < WIDTH * HEIGHT; index++)
+    {
+        frame[index] ^= 0xff000000;
+    }
+    ck_assert_int_eq(xrdp_tile_hash_begin_frame(th, (char *) frame,
+                     WIDTH, HEIGHT, full_crect, 1), 0);
+    ck_assert_int_eq(xrdp_tile_hash_tile_unchanged(th, 3, 3), 1);
+    xrdp_tile_hash_end_frame(th);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_tile_hash(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("TileHash");
+
+    tc = tcase_create("xrdp_tile_hash");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_tile_hash__scroll_down);
+    tcase_add_test(tc, test_tile_hash__scroll_right);
+    tcase_add_test(tc, test_tile_hash__no_scroll);
+    tcase_add_test(tc, test_tile_hash__unknown_content);
+    tcase_add_test(tc, test_tile_hash__damage_not_a_rect);
+    tcase_add_test(tc, test_tile_hash__size_mismatch);
+    tcase_add_test(tc, test_tile_hash__unchanged_tiles);
+    tcase_add_test(tc, test_tile_hash__alpha_ignored);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
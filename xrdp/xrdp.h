@@ -83,6 +83,11 @@ xrdp_cache_reset(struct xrdp_cache *self,
 int
 xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                       int hints);
+void
+xrdp_cache_prepare_bitmaps(struct xrdp_cache *self,
+                           struct xrdp_bitmap **bitmaps, int count);
+void
+xrdp_cache_prepare_done(struct xrdp_cache *self);
 int
 xrdp_cache_add_palette(struct xrdp_cache *self, int *palette);
 int
@@ -368,6 +373,8 @@ xrdp_painter_line(struct xrdp_painter *self,
                   int x1, int y1, int x2, int y2);
 
 /* xrdp_font.c */
+int
+xrdp_font_preload(const struct xrdp_cfg_globals *globals, unsigned int dpi);
 struct xrdp_font *
 xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi);
 void
@@ -508,6 +515,11 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
                    char *data, int width, int height,
                    int flags, int frame_id);
 int
+server_paint_rects_ex(struct xrdp_mod *mod, int num_drects, short *drects,
+                      int num_crects, short *crects, short *crect_hints,
+                      int num_scrolls, short *scrolls, char *data,
+                      int width, int height, int flags, int frame_id);
+int
 server_set_pointer(struct xrdp_mod *mod, int x, int y,
                    char *data, char *mask);
 int
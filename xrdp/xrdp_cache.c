@@ -283,6 +283,65 @@ xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
     return 0;
 }
 
+/*****************************************************************************/
+/* the bitmap cache for a bitmap, returns -1 if it is too big */
+static int
+xrdp_cache_get_bitmap_cache_id(struct xrdp_cache *self,
+                               struct xrdp_bitmap *bitmap,
+                               int *bmp_size, int *cache_entries)
+{
+    int e;
+    int Bpp;
+
+    e = (4 - (bitmap->width % 4)) & 3;
+
+    /* client Bpp, bmp_size */
+    Bpp = (bitmap->bpp + 7) / 8;
+    *bmp_size = (bitmap->width + e) * bitmap->height * Bpp;
+
+    if (*bmp_size <= self->cache1_size)
+    {
+        *cache_entries = self->cache1_entries;
+        return 0;
+    }
+    if (*bmp_size <= self->cache2_size)
+    {
+        *cache_entries = self->cache2_entries;
+        return 1;
+    }
+    if (*bmp_size <= self->cache3_size)
+    {
+        *cache_entries = self->cache3_entries;
+        return 2;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/* returns the index of a cached bitmap with the same pixels, or -1 */
+static int
+xrdp_cache_find_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
+                       int cache_id)
+{
+    int jndex;
+    int cache_idx;
+    struct list16 *ll;
+    struct xrdp_bitmap *lbm;
+
+    ll = &(self->crc16[cache_id][bitmap->crc16]);
+    for (jndex = 0; jndex < ll->count; jndex++)
+    {
+        cache_idx = list16_get_item(ll, jndex);
+        lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
+        if ((lbm != NULL) && COMPARE_WITH_CRC32(lbm, bitmap))
+        {
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_idx, jndex);
+            return cache_idx;
+        }
+    }
+    return -1;
+}
+
 /*****************************************************************************/
 /* returns cache id */
 int
@@ -290,15 +349,11 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                       int hints)
 {
     int index;
-    int jndex;
     int cache_id;
     int cache_idx;
     int bmp_size;
-    int e;
-    int Bpp;
     int crc16;
     int iig;
-    int found;
     int cache_entries;
     int lru_index;
     struct list16 *ll;
@@ -309,52 +364,19 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: crc16 0x%4.4x",
               bitmap->crc16);
 
-    e = (4 - (bitmap->width % 4)) & 3;
-    found = 0;
-    cache_id = 0;
     cache_entries = 0;
-
-    /* client Bpp, bmp_size */
-    Bpp = (bitmap->bpp + 7) / 8;
-    bmp_size = (bitmap->width + e) * bitmap->height * Bpp;
     self->bitmap_stamp++;
-
-    if (bmp_size <= self->cache1_size)
-    {
-        cache_id = 0;
-        cache_entries = self->cache1_entries;
-    }
-    else if (bmp_size <= self->cache2_size)
-    {
-        cache_id = 1;
-        cache_entries = self->cache2_entries;
-    }
-    else if (bmp_size <= self->cache3_size)
-    {
-        cache_id = 2;
-        cache_entries = self->cache3_entries;
-    }
-    else
+    cache_id = xrdp_cache_get_bitmap_cache_id(self, bitmap, &bmp_size,
+               &cache_entries);
+    if (cache_id < 0)
     {
         LOG(LOG_LEVEL_ERROR, "error in xrdp_cache_add_bitmap, "
             "too big(%d) bpp %d", bmp_size, bitmap->bpp);
         return 0;
     }
 
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    for (jndex = 0; jndex < ll->count; jndex++)
-    {
-        cache_idx = list16_get_item(ll, jndex);
-        lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
-        if ((lbm != NULL) && COMPARE_WITH_CRC32(lbm, bitmap))
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_idx, jndex);
-            found = 1;
-            break;
-        }
-    }
-    if (found)
+    cache_idx = xrdp_cache_find_bitmap(self, bitmap, cache_id);
+    if (cache_idx >= 0)
     {
         lru_index = self->bitmap_items[cache_id][cache_idx].lru_index;
         self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
@@ -472,6 +494,61 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     return MAKELONG(cache_idx, cache_id);
 }
 
+/*****************************************************************************/
+/* Compresses the bitmaps that are not in the cache together on the
+   bitmap workers, xrdp_cache_add_bitmap() then sends the results.
+   xrdp_cache_prepare_done() must be called before the bitmaps are freed */
+void
+xrdp_cache_prepare_bitmaps(struct xrdp_cache *self,
+                           struct xrdp_bitmap **bitmaps, int count)
+{
+    struct xrdp_bitmap_tile *tiles;
+    int index;
+    int num_tiles;
+    int cache_id;
+    int bmp_size;
+    int cache_entries;
+
+    if (!self->use_bitmap_comp || (self->bitmap_cache_version & 4) ||
+            (self->session->client_info->bitmap_compress_threads < 2) ||
+            (count < 2))
+    {
+        return;
+    }
+    tiles = g_new(struct xrdp_bitmap_tile, count);
+    if (tiles == NULL)
+    {
+        return;
+    }
+    num_tiles = 0;
+    for (index = 0; index < count; index++)
+    {
+        cache_id = xrdp_cache_get_bitmap_cache_id(self, bitmaps[index],
+                   &bmp_size, &cache_entries);
+        if ((cache_id >= 0) &&
+                (xrdp_cache_find_bitmap(self, bitmaps[index], cache_id) < 0))
+        {
+            tiles[num_tiles].data = bitmaps[index]->data;
+            tiles[num_tiles].width = bitmaps[index]->width;
+            tiles[num_tiles].height = bitmaps[index]->height;
+            tiles[num_tiles].bpp = bitmaps[index]->bpp;
+            num_tiles++;
+        }
+    }
+    if (num_tiles > 1)
+    {
+        libxrdp_orders_precompress_tiles(self->session, tiles, num_tiles);
+    }
+    g_free(tiles);
+}
+
+/*****************************************************************************/
+void
+xrdp_cache_prepare_done(struct xrdp_cache *self)
+{
+    libxrdp_orders_clear_tiles(self->session);
+}
+
 /*****************************************************************************/
 /* not used */
 /* not sure how to use a palette in rdp */
@@ -593,6 +670,71 @@ xrdp_cache_add_char(struct xrdp_cache *self,
     return MAKELONG(c, f);
 }
 
+/*****************************************************************************/
+/* the bytes of data and mask the pointer uses, the rest of the item
+   is not sent */
+static void
+xrdp_cache_pointer_bytes(const struct xrdp_pointer_item *pointer_item,
+                         int *data_bytes, int *mask_bytes)
+{
+    int bpp;
+    int pixels;
+
+    bpp = pointer_item->bpp == 0 ? 24 : pointer_item->bpp;
+    pixels = pointer_item->width * pointer_item->height;
+    if ((pixels <= 0) || (pixels > 96 * 96))
+    {
+        pixels = 32 * 32;
+    }
+    *data_bytes = MIN(pixels * ((bpp + 7) / 8), 96 * 96 * 4);
+    *mask_bytes = pixels / 8;
+}
+
+/*****************************************************************************/
+static unsigned int
+xrdp_cache_pointer_hash(const struct xrdp_pointer_item *pointer_item)
+{
+    const unsigned char *p;
+    unsigned int hash;
+    int data_bytes;
+    int mask_bytes;
+    int index;
+
+    xrdp_cache_pointer_bytes(pointer_item, &data_bytes, &mask_bytes);
+    /* FNV-1a */
+    hash = 2166136261u;
+    p = (const unsigned char *) pointer_item->data;
+    for (index = 0; index < data_bytes; index++)
+    {
+        hash = (hash ^ p[index]) * 16777619u;
+    }
+    p = (const unsigned char *) pointer_item->mask;
+    for (index = 0; index < mask_bytes; index++)
+    {
+        hash = (hash ^ p[index]) * 16777619u;
+    }
+    return hash;
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_cache_pointer_equal(const struct xrdp_pointer_item *a,
+                         const struct xrdp_pointer_item *b)
+{
+    int data_bytes;
+    int mask_bytes;
+
+    if ((a->x != b->x) || (a->y != b->y) || (a->bpp != b->bpp) ||
+            (a->width != b->width) || (a->height != b->height))
+    {
+        return 0;
+    }
+    xrdp_cache_pointer_bytes(a, &data_bytes, &mask_bytes);
+    return (g_memcmp(a->data, b->data, data_bytes) == 0) &&
+           (g_memcmp(a->mask, b->mask, mask_bytes) == 0);
+}
+
 /*****************************************************************************/
 /* added the pointer to the cache and send it to client, it also sets the
    client if it finds it
@@ -605,6 +747,7 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
     int i;
     int oldest;
     int index;
+    unsigned int hash;
 
     if (self == 0)
     {
@@ -613,22 +756,21 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
 
     self->pointer_stamp++;
 
-    /* look for match */
+    /* look for match, only the shapes with the same hash are compared */
+    hash = xrdp_cache_pointer_hash(pointer_item);
     for (i = 2; i < self->pointer_cache_entries; i++)
     {
-        if (self->pointer_items[i].x == pointer_item->x &&
-                self->pointer_items[i].y == pointer_item->y &&
-                g_memcmp(self->pointer_items[i].data,
-                         pointer_item->data, 96 * 96 * 4) == 0 &&
-                g_memcmp(self->pointer_items[i].mask,
-                         pointer_item->mask, 96 * 96 / 8) == 0 &&
-                self->pointer_items[i].bpp == pointer_item->bpp &&
-                self->pointer_items[i].width == pointer_item->width &&
-                self->pointer_items[i].height == pointer_item->height)
+        if (self->pointer_items[i].stamp != 0 &&
+                self->pointer_hashes[i] == hash &&
+                xrdp_cache_pointer_equal(self->pointer_items + i,
+                                         pointer_item))
         {
             self->pointer_items[i].stamp = self->pointer_stamp;
-            xrdp_wm_set_pointer(self->wm, i);
-            self->wm->current_pointer = i;
+            if (self->wm->current_pointer != i)
+            {
+                xrdp_wm_set_pointer(self->wm, i);
+                self->wm->current_pointer = i;
+            }
             LOG_DEVEL(LOG_LEVEL_TRACE, "found pointer at %d", i);
             return i;
         }
@@ -657,6 +799,7 @@ xrdp_cache_add_pointer(struct xrdp_cache *self,
     self->pointer_items[index].bpp = pointer_item->bpp;
     self->pointer_items[index].width = pointer_item->width;
     self->pointer_items[index].height = pointer_item->height;
+    self->pointer_hashes[index] = hash;
     xrdp_wm_send_pointer(self->wm, index,
                          self->pointer_items[index].data,
                          self->pointer_items[index].mask,
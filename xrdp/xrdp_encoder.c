@@ -27,6 +27,8 @@
 #include "ms-rdpbcgr.h"
 #include "thread_calls.h"
 #include "fifo.h"
+#include "thread_pool.h"
+#include "xrdp_tile_hash.h"
 
 #ifdef XRDP_RFXCODEC
 #include "rfxcodec_encode.h"
@@ -34,6 +36,36 @@
 
 #define XRDP_SURCMD_PREFIX_BYTES 256
 
+/* JPEG quality ladder for content hinted rects */
+#define XRDP_JPEG_QUALITY_TEXT_MIN  90
+#define XRDP_JPEG_QUALITY_VIDEO_MAX 50
+
+/* parallel JPEG, rects are cut into slices of whole 16 line MCU rows */
+#define XRDP_JPEG_MAX_AUTO_THREADS  4
+#define XRDP_JPEG_SLICE_MIN_PIXELS  (128 * 128)
+#define XRDP_JPEG_SLICE_MIN_LINES   64
+
+/* one slice of a crect */
+struct xrdp_jpeg_job
+{
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int quality;
+    int flags;
+    char *out_data;
+    int out_data_bytes;
+    int error;
+};
+
+struct xrdp_jpeg_batch
+{
+    struct xrdp_encoder *self;
+    XRDP_ENC_DATA *enc;
+    struct xrdp_jpeg_job *jobs;
+};
+
 #ifdef XRDP_RFXCODEC
 
 /*
@@ -56,6 +88,17 @@ static const unsigned char rfx_quant_values_lq[] =
     0x88, 0x88, 0x88, 0x88, 0x99
 };
 
+/* used for tiles hinted as text, keeps glyph edges sharp */
+static const unsigned char rfx_quant_values_text[] =
+{
+    0x66, 0x66, 0x66, 0x66, 0x66
+};
+
+#define RFX_QUANT_INDEX_FRAME 0
+#define RFX_QUANT_INDEX_TEXT  1
+#define RFX_QUANT_INDEX_VIDEO 2
+#define RFX_NUM_QUANTS        3
+
 #endif
 
 
@@ -78,9 +121,19 @@ xrdp_enc_data_destructor(void *item, void *closure)
     XRDP_ENC_DATA *enc = (XRDP_ENC_DATA *)item;
     g_free(enc->drects);
     g_free(enc->crects);
+    g_free(enc->crect_hints);
+    g_free(enc->scrolls);
+    g_free(enc->data_copy);
     g_free(enc);
 }
 
+/* Item destructor for self->frame_copy_pool */
+static void
+xrdp_frame_copy_destructor(void *item, void *closure)
+{
+    g_free(item);
+}
+
 /* Item destructor for self->fifo_processed */
 static void
 xrdp_enc_data_done_destructor(void *item, void *closure)
@@ -90,6 +143,37 @@ xrdp_enc_data_done_destructor(void *item, void *closure)
     g_free(enc_done);
 }
 
+/*****************************************************************************/
+/* compressor contexts and slice workers for process_enc_jpg */
+static void
+xrdp_encoder_jpeg_init(struct xrdp_encoder *self, int threads)
+{
+    int index;
+
+    if (threads < 1)
+    {
+        threads = MIN(tc_get_cpu_count(), XRDP_JPEG_MAX_AUTO_THREADS);
+    }
+    /* the encoder thread is one of the threads */
+    if (threads > 1)
+    {
+        self->jpeg_pool = thread_pool_create(threads - 1);
+    }
+    self->num_jpeg_ctx = thread_pool_get_num_workers(self->jpeg_pool) + 1;
+    self->jpeg_ctx = g_new0(void *, self->num_jpeg_ctx);
+    if (self->jpeg_ctx == NULL)
+    {
+        self->num_jpeg_ctx = 0;
+        return;
+    }
+    for (index = 0; index < self->num_jpeg_ctx; index++)
+    {
+        self->jpeg_ctx[index] = libxrdp_codec_jpeg_create();
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_encoder_jpeg_init: %d jpeg encoder threads",
+        self->num_jpeg_ctx);
+}
+
 /*****************************************************************************/
 struct xrdp_encoder *
 xrdp_encoder_create(struct xrdp_mm *mm)
@@ -124,6 +208,8 @@ xrdp_encoder_create(struct xrdp_mm *mm)
             /* XRDP_a8b8g8r8 */
             (32 << 24) | (3 << 16) | (8 << 12) | (8 << 8) | (8 << 4) | 8;
         self->process_enc = process_enc_jpg;
+        client_info->paint_hints_flags = XRDP_PAINT_HINTS_CONTENT;
+        xrdp_encoder_jpeg_init(self, client_info->jpeg_encoder_threads);
     }
 #ifdef XRDP_RFXCODEC
     else if (client_info->rfx_codec_id != 0)
@@ -133,9 +219,11 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         self->in_codec_mode = 1;
         client_info->capture_code = 2;
         self->process_enc = process_enc_rfx;
+        self->tile_crects = 1;
         self->codec_handle = rfxcodec_encode_create(mm->wm->screen->width,
                              mm->wm->screen->height,
                              RFX_FORMAT_BGRA, 0);
+        client_info->paint_hints_flags = XRDP_PAINT_HINTS_CONTENT;
     }
 #endif
     else if (client_info->h264_codec_id != 0)
@@ -157,6 +245,21 @@ xrdp_encoder_create(struct xrdp_mm *mm)
 
     LOG_DEVEL(LOG_LEVEL_INFO, "init_xrdp_encoder: initializing encoder codec_id %d", self->codec_id);
 
+    /* scrolled areas are copied on the client with screen blt orders */
+    if ((client_info->paint_hints_flags != 0) &&
+            !client_info->no_orders_supported)
+    {
+        client_info->paint_hints_flags |= XRDP_PAINT_HINTS_SCROLL;
+        /* find the scrolls Xorg does not tell us about */
+        self->detect_scroll = 1;
+    }
+    /* tile hashes of what the client has, for the 32 bpp codecs */
+    if (client_info->paint_hints_flags != 0)
+    {
+        self->tile_hash = xrdp_tile_hash_create(mm->wm->screen->width,
+                                                mm->wm->screen->height);
+    }
+
     /* setup required FIFOs */
     self->fifo_to_proc = fifo_create(xrdp_enc_data_destructor);
     self->fifo_processed = fifo_create(xrdp_enc_data_done_destructor);
@@ -172,9 +275,28 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     self->xrdp_encoder_term = g_create_wait_obj(buf);
     self->max_compressed_bytes = client_info->max_fastpath_frag_bytes & ~15;
     self->frames_in_flight = client_info->max_unacknowledged_frame_count;
+    if (client_info->max_frames_in_flight > 0)
+    {
+        self->frames_in_flight = MIN(self->frames_in_flight,
+                                     client_info->max_frames_in_flight);
+    }
     /* make sure frames_in_flight is at least 1 */
     self->frames_in_flight = MAX(self->frames_in_flight, 1);
 
+    /* Xorg can only run ahead of the encoder if the encoder works on
+       its own copy of the frame, which needs a 32 bpp capture format */
+    if (self->process_enc != process_enc_h264)
+    {
+        self->max_frames_in_encoder = client_info->max_frames_in_encoder;
+    }
+    if (self->max_frames_in_encoder > 0)
+    {
+        self->frame_copy_pool = fifo_create(xrdp_frame_copy_destructor);
+        LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: pipelining enabled, "
+            "max_frames_in_encoder %d frames_in_flight %d",
+            self->max_frames_in_encoder, self->frames_in_flight);
+    }
+
     /* create thread to process messages */
     tc_thread_create(proc_enc_msg, self);
 
@@ -185,6 +307,8 @@ xrdp_encoder_create(struct xrdp_mm *mm)
 void
 xrdp_encoder_delete(struct xrdp_encoder *self)
 {
+    int index;
+
     LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_encoder_delete:");
     if (self == 0)
     {
@@ -194,6 +318,7 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     {
         return;
     }
+    xrdp_encoder_log_stats(self);
     /* tell worker thread to shut down */
     g_set_wait_obj(self->xrdp_encoder_term);
     g_sleep(1000);
@@ -202,6 +327,12 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
 
     if (self->process_enc == process_enc_jpg)
     {
+        thread_pool_delete(self->jpeg_pool);
+        for (index = 0; index < self->num_jpeg_ctx; index++)
+        {
+            libxrdp_codec_jpeg_delete(self->jpeg_ctx[index]);
+        }
+        g_free(self->jpeg_ctx);
     }
 #ifdef XRDP_RFXCODEC
     else if (self->process_enc == process_enc_rfx)
@@ -218,37 +349,713 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     /* cleanup fifos */
     fifo_delete(self->fifo_to_proc, NULL);
     fifo_delete(self->fifo_processed, NULL);
+    fifo_delete(self->frame_copy_pool, NULL);
     tc_mutex_delete(self->mutex);
+    xrdp_tile_hash_delete(self->tile_hash);
     g_free(self);
 }
 
+/*****************************************************************************/
+/* called from main thread
+   copies the crects of enc->data into a private buffer so Xorg can reuse
+   the shared memory before the encoder has finished with the frame */
+int
+xrdp_encoder_copy_frame(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int line_bytes;
+    int stride;
+    int bytes;
+    char *src;
+    char *dst;
+
+    if ((enc->width < 1) || (enc->height < 1))
+    {
+        return 1;
+    }
+    stride = enc->width * 4;
+    bytes = stride * enc->height;
+    if (bytes != self->frame_copy_bytes)
+    {
+        /* screen size changed, old buffers are no use */
+        fifo_clear(self->frame_copy_pool, NULL);
+        self->frame_copy_spare = 0;
+        self->frame_copy_bytes = bytes;
+    }
+    enc->data_copy = (char *) fifo_remove_item(self->frame_copy_pool);
+    if (enc->data_copy != NULL)
+    {
+        self->frame_copy_spare--;
+    }
+    else
+    {
+        enc->data_copy = g_new(char, bytes);
+        if (enc->data_copy == NULL)
+        {
+            return 1;
+        }
+    }
+    for (index = 0; index < enc->num_crects; index++)
+    {
+        x = enc->crects[index * 4 + 0];
+        y = enc->crects[index * 4 + 1];
+        cx = enc->crects[index * 4 + 2];
+        cy = enc->crects[index * 4 + 3];
+        /* clip, the encoders skip anything outside the frame anyway */
+        cx = MIN(x + cx, enc->width) - MAX(x, 0);
+        cy = MIN(y + cy, enc->height) - MAX(y, 0);
+        x = MAX(x, 0);
+        y = MAX(y, 0);
+        if ((cx < 1) || (cy < 1))
+        {
+            continue;
+        }
+        line_bytes = cx * 4;
+        src = enc->data + y * stride + x * 4;
+        dst = enc->data_copy + y * stride + x * 4;
+        while (cy > 0)
+        {
+            g_memcpy(dst, src, line_bytes);
+            src += stride;
+            dst += stride;
+            cy--;
+        }
+    }
+    enc->data = enc->data_copy;
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from main thread when the encoder is done with enc */
+void
+xrdp_encoder_release_frame(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    if (enc->data_copy == NULL)
+    {
+        return;
+    }
+    /* the pool never needs more than one buffer per credit */
+    if ((self->frame_copy_spare < self->max_frames_in_encoder) &&
+            fifo_add_item(self->frame_copy_pool, enc->data_copy))
+    {
+        self->frame_copy_spare++;
+    }
+    else
+    {
+        g_free(enc->data_copy);
+    }
+    enc->data_copy = NULL;
+    enc->data = NULL;
+}
+
+/*****************************************************************************/
+void
+xrdp_encoder_log_stats(struct xrdp_encoder *self)
+{
+    struct xrdp_encoder_stats *stats;
+
+    stats = &(self->stats);
+    if (stats->frames < 1)
+    {
+        return;
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_encoder: %d frames, encoder queue avg %d.%02d "
+        "max %d, client queue avg %d.%02d max %d, Xorg stalled on encoder %d "
+        "on client %d, scrolls detected %d, unchanged tiles skipped %d",
+        stats->frames,
+        (int) (stats->encoder_depth_sum / stats->frames),
+        (int) (stats->encoder_depth_sum * 100 / stats->frames % 100),
+        stats->encoder_depth_max,
+        (int) (stats->client_depth_sum / stats->frames),
+        (int) (stats->client_depth_sum * 100 / stats->frames % 100),
+        stats->client_depth_max,
+        stats->encoder_stalls, stats->client_stalls,
+        stats->scrolls_detected, stats->tiles_skipped);
+}
+
+/*****************************************************************************/
+/* removes the area sub from 4 * *num_rects rects, rects partly inside
+   sub are split unless whole_only is set in which case they are kept,
+   hints follow their rects, returns error */
+static int
+xrdp_encoder_subtract_rect(short **rects, short **hints, int *num_rects,
+                           const struct xrdp_rect *sub, int whole_only)
+{
+    short *src;
+    short *dst;
+    short *new_rects;
+    short *new_hints;
+    int index;
+    int count;
+    int hint;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int left;
+    int top;
+    int right;
+    int bottom;
+
+    if (*num_rects < 1)
+    {
+        return 0;
+    }
+    /* each rect becomes at most 4 */
+    new_rects = g_new(short, *num_rects * 16);
+    new_hints = NULL;
+    if (*hints != NULL)
+    {
+        new_hints = g_new(short, *num_rects * 4);
+    }
+    if ((new_rects == NULL) || ((*hints != NULL) && (new_hints == NULL)))
+    {
+        g_free(new_rects);
+        g_free(new_hints);
+        return 1;
+    }
+    src = *rects;
+    dst = new_rects;
+    count = 0;
+    for (index = 0; index < *num_rects; index++)
+    {
+        x = src[0];
+        y = src[1];
+        cx = src[2];
+        cy = src[3];
+        src += 4;
+        hint = (*hints != NULL) ? (*hints)[index] : 0;
+        left = MAX(x, sub->left);
+        top = MAX(y, sub->top);
+        right = MIN(x + cx, sub->right);
+        bottom = MIN(y + cy, sub->bottom);
+        if ((right <= left) || (bottom <= top) ||
+                (whole_only && ((left != x) || (top != y) ||
+                                (right != x + cx) || (bottom != y + cy))))
+        {
+            /* outside sub or can not be split */
+            dst[0] = x;
+            dst[1] = y;
+            dst[2] = cx;
+            dst[3] = cy;
+            dst += 4;
+            if (new_hints != NULL)
+            {
+                new_hints[count] = hint;
+            }
+            count++;
+            continue;
+        }
+        /* bands above, below, left and right of the intersection */
+        if (top > y)
+        {
+            dst[0] = x;
+            dst[1] = y;
+            dst[2] = cx;
+            dst[3] = top - y;
+            dst += 4;
+            if (new_hints != NULL)
+            {
+                new_hints[count] = hint;
+            }
+            count++;
+        }
+        if (bottom < y + cy)
+        {
+            dst[0] = x;
+            dst[1] = bottom;
+            dst[2] = cx;
+            dst[3] = y + cy - bottom;
+            dst += 4;
+            if (new_hints != NULL)
+            {
+                new_hints[count] = hint;
+            }
+            count++;
+        }
+        if (left > x)
+        {
+            dst[0] = x;
+            dst[1] = top;
+            dst[2] = left - x;
+            dst[3] = bottom - top;
+            dst += 4;
+            if (new_hints != NULL)
+            {
+                new_hints[count] = hint;
+            }
+            count++;
+        }
+        if (right < x + cx)
+        {
+            dst[0] = right;
+            dst[1] = top;
+            dst[2] = x + cx - right;
+            dst[3] = bottom - top;
+            dst += 4;
+            if (new_hints != NULL)
+            {
+                new_hints[count] = hint;
+            }
+            count++;
+        }
+    }
+    g_free(*rects);
+    g_free(*hints);
+    *rects = new_rects;
+    *hints = new_hints;
+    *num_rects = count;
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   when Xorg did not hint any scrolls, looks for an area of the frame
+   that is a shifted copy of what the client already has.  The shift is
+   sent to the client as a copy and only the newly exposed part is left
+   in the crects for the codec */
+static void
+xrdp_encoder_detect_scroll(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_rect dst_rect;
+    short scroll[6];
+
+    if (!xrdp_tile_hash_find_scroll(self->tile_hash, enc->crects,
+                                    enc->num_crects, scroll))
+    {
+        return;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_encoder_detect_scroll: x %d y %d "
+              "cx %d cy %d dx %d dy %d", scroll[0], scroll[1],
+              scroll[2], scroll[3], scroll[4], scroll[5]);
+    g_free(enc->scrolls);
+    enc->scrolls = g_new(short, 6);
+    if (enc->scrolls == NULL)
+    {
+        return;
+    }
+    g_memcpy(enc->scrolls, scroll, sizeof(scroll));
+    dst_rect.left = scroll[0] + scroll[4];
+    dst_rect.top = scroll[1] + scroll[5];
+    dst_rect.right = dst_rect.left + scroll[2];
+    dst_rect.bottom = dst_rect.top + scroll[3];
+    /* tiles kept by rfx still paint their part of the copied
+       area but with the same pixels so drects can stay */
+    if (xrdp_encoder_subtract_rect(&(enc->crects), &(enc->crect_hints),
+                                   &(enc->num_crects), &dst_rect,
+                                   self->tile_crects) == 0)
+    {
+        enc->num_scrolls = 1;
+        self->stats.scrolls_detected++;
+        /* the copied area no longer matches the hashes of the client */
+        xrdp_tile_hash_invalidate(self->tile_hash, dst_rect.left,
+                                  dst_rect.top, scroll[2], scroll[3]);
+    }
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   removes the tiles the client already has from the crects, codec tiles
+   are dropped whole, other crects lose the unchanged tiles inside them */
+static void
+xrdp_encoder_drop_unchanged(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_tile_hash *tile_hash;
+    struct xrdp_region **regions;
+    struct xrdp_rect rect;
+    short *new_crects;
+    short *new_hints;
+    int index;
+    int jndex;
+    int count;
+    int skipped;
+    int num_regions;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int tx;
+    int ty;
+    int tx1;
+    int ty1;
+
+    tile_hash = self->tile_hash;
+    skipped = 0;
+    if (self->tile_crects)
+    {
+        count = 0;
+        for (index = 0; index < enc->num_crects; index++)
+        {
+            x = enc->crects[index * 4 + 0];
+            y = enc->crects[index * 4 + 1];
+            if (((x % XRDP_TILE_HASH_TILE_SIZE) == 0) &&
+                    ((y % XRDP_TILE_HASH_TILE_SIZE) == 0) &&
+                    xrdp_tile_hash_tile_unchanged(tile_hash,
+                                                  x / XRDP_TILE_HASH_TILE_SIZE,
+                                                  y / XRDP_TILE_HASH_TILE_SIZE))
+            {
+                skipped++;
+                continue;
+            }
+            if (count != index)
+            {
+                g_memcpy(enc->crects + count * 4, enc->crects + index * 4,
+                         sizeof(short) * 4);
+                if (enc->crect_hints != NULL)
+                {
+                    enc->crect_hints[count] = enc->crect_hints[index];
+                }
+            }
+            count++;
+        }
+        enc->num_crects = count;
+        self->stats.tiles_skipped += skipped;
+        return;
+    }
+
+    if (enc->num_crects < 1)
+    {
+        return;
+    }
+    num_regions = enc->num_crects;
+    regions = g_new0(struct xrdp_region *, num_regions);
+    if (regions == NULL)
+    {
+        return;
+    }
+    /* first pass, crect minus its unchanged tiles, NULL if none */
+    count = 0;
+    for (index = 0; index < enc->num_crects; index++)
+    {
+        x = enc->crects[index * 4 + 0];
+        y = enc->crects[index * 4 + 1];
+        cx = enc->crects[index * 4 + 2];
+        cy = enc->crects[index * 4 + 3];
+        /* tiles fully inside the crect */
+        tx = (MAX(x, 0) + XRDP_TILE_HASH_TILE_SIZE - 1) /
+             XRDP_TILE_HASH_TILE_SIZE;
+        ty = (MAX(y, 0) + XRDP_TILE_HASH_TILE_SIZE - 1) /
+             XRDP_TILE_HASH_TILE_SIZE;
+        tx1 = (x + cx >= enc->width) ? tile_hash->tiles_x :
+              (x + cx) / XRDP_TILE_HASH_TILE_SIZE;
+        ty1 = (y + cy >= enc->height) ? tile_hash->tiles_y :
+              (y + cy) / XRDP_TILE_HASH_TILE_SIZE;
+        for (; ty < ty1; ty++)
+        {
+            for (jndex = tx; jndex < tx1; jndex++)
+            {
+                if (!xrdp_tile_hash_tile_unchanged(tile_hash, jndex, ty))
+                {
+                    continue;
+                }
+                if (regions[index] == NULL)
+                {
+                    regions[index] = xrdp_region_create(self->mm->wm);
+                    rect.left = x;
+                    rect.top = y;
+                    rect.right = x + cx;
+                    rect.bottom = y + cy;
+                    xrdp_region_add_rect(regions[index], &rect);
+                }
+                rect.left = jndex * XRDP_TILE_HASH_TILE_SIZE;
+                rect.top = ty * XRDP_TILE_HASH_TILE_SIZE;
+                rect.right = rect.left + XRDP_TILE_HASH_TILE_SIZE;
+                rect.bottom = rect.top + XRDP_TILE_HASH_TILE_SIZE;
+                xrdp_region_subtract_rect(regions[index], &rect);
+                skipped++;
+            }
+        }
+        if (regions[index] == NULL)
+        {
+            count++;
+            continue;
+        }
+        jndex = 0;
+        while (xrdp_region_get_rect(regions[index], jndex, &rect) == 0)
+        {
+            jndex++;
+        }
+        count += jndex;
+    }
+    /* second pass, collect what is left */
+    if (skipped > 0)
+    {
+        new_crects = g_new(short, count * 4 + 4);
+        new_hints = NULL;
+        if (enc->crect_hints != NULL)
+        {
+            new_hints = g_new(short, count + 1);
+        }
+        if ((new_crects != NULL) &&
+                ((enc->crect_hints == NULL) || (new_hints != NULL)))
+        {
+            count = 0;
+            for (index = 0; index < enc->num_crects; index++)
+            {
+                if (regions[index] == NULL)
+                {
+                    g_memcpy(new_crects + count * 4, enc->crects + index * 4,
+                             sizeof(short) * 4);
+                    if (new_hints != NULL)
+                    {
+                        new_hints[count] = enc->crect_hints[index];
+                    }
+                    count++;
+                    continue;
+                }
+                jndex = 0;
+                while (xrdp_region_get_rect(regions[index], jndex,
+                                            &rect) == 0)
+                {
+                    new_crects[count * 4 + 0] = rect.left;
+                    new_crects[count * 4 + 1] = rect.top;
+                    new_crects[count * 4 + 2] = rect.right - rect.left;
+                    new_crects[count * 4 + 3] = rect.bottom - rect.top;
+                    if (new_hints != NULL)
+                    {
+                        new_hints[count] = enc->crect_hints[index];
+                    }
+                    count++;
+                    jndex++;
+                }
+            }
+            g_free(enc->crects);
+            g_free(enc->crect_hints);
+            enc->crects = new_crects;
+            enc->crect_hints = new_hints;
+            enc->num_crects = count;
+            self->stats.tiles_skipped += skipped;
+        }
+        else
+        {
+            g_free(new_crects);
+            g_free(new_hints);
+        }
+    }
+    for (index = 0; index < num_regions; index++)
+    {
+        xrdp_region_delete(regions[index]);
+    }
+    g_free(regions);
+}
+
+/*****************************************************************************/
+/* called from main thread
+   the client wants the area painted again, e.g. Refresh Rect or the end
+   of Suppress Output, so the tiles there must not be dropped as
+   unchanged in the frames that follow */
+void
+xrdp_encoder_invalidate(struct xrdp_encoder *self,
+                        int x, int y, int cx, int cy)
+{
+    if ((self->tile_hash == NULL) || (cx < 1) || (cy < 1))
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    if (self->invalid_x2 <= self->invalid_x1)
+    {
+        self->invalid_x1 = x;
+        self->invalid_y1 = y;
+        self->invalid_x2 = x + cx;
+        self->invalid_y2 = y + cy;
+    }
+    else
+    {
+        self->invalid_x1 = MIN(self->invalid_x1, x);
+        self->invalid_y1 = MIN(self->invalid_y1, y);
+        self->invalid_x2 = MAX(self->invalid_x2, x + cx);
+        self->invalid_y2 = MAX(self->invalid_y2, y + cy);
+    }
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   the area was damaged but did not reach the client, the hashes
+   xrdp_encoder_filter_frame kept for it are not what the client has */
+static void
+xrdp_encoder_not_sent(struct xrdp_encoder *self, int x, int y, int cx, int cy)
+{
+    if (self->tile_hash != NULL)
+    {
+        xrdp_tile_hash_invalidate(self->tile_hash, x, y, cx, cy);
+    }
+}
+
+/*****************************************************************************/
+/* called from encoder thread
+   as above, for the crects of enc from index first on */
+static void
+xrdp_encoder_crects_not_sent(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
+                             int first)
+{
+    int index;
+
+    for (index = first; index < enc->num_crects; index++)
+    {
+        xrdp_encoder_not_sent(self, enc->crects[index * 4 + 0],
+                              enc->crects[index * 4 + 1],
+                              enc->crects[index * 4 + 2],
+                              enc->crects[index * 4 + 3]);
+    }
+}
+
+/*****************************************************************************/
+/* called from encoder thread before the codec gets the frame */
+static void
+xrdp_encoder_filter_frame(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_tile_hash *tile_hash;
+    int index;
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+
+    tile_hash = self->tile_hash;
+    /* areas the main thread asked to repaint */
+    tc_mutex_lock(self->mutex);
+    x1 = self->invalid_x1;
+    y1 = self->invalid_y1;
+    x2 = self->invalid_x2;
+    y2 = self->invalid_y2;
+    self->invalid_x2 = self->invalid_x1;
+    tc_mutex_unlock(self->mutex);
+    if (x2 > x1)
+    {
+        xrdp_tile_hash_invalidate(tile_hash, x1, y1, x2 - x1, y2 - y1);
+    }
+    /* hinted scrolls change the client without us knowing the content */
+    for (index = 0; index < enc->num_scrolls; index++)
+    {
+        xrdp_tile_hash_invalidate(tile_hash,
+                                  enc->scrolls[index * 6 + 0] +
+                                  enc->scrolls[index * 6 + 4],
+                                  enc->scrolls[index * 6 + 1] +
+                                  enc->scrolls[index * 6 + 5],
+                                  enc->scrolls[index * 6 + 2],
+                                  enc->scrolls[index * 6 + 3]);
+    }
+    if (xrdp_tile_hash_begin_frame(tile_hash, enc->data,
+                                   enc->width, enc->height,
+                                   enc->crects, enc->num_crects) != 0)
+    {
+        return;
+    }
+    if (self->detect_scroll && (enc->num_scrolls == 0))
+    {
+        xrdp_encoder_detect_scroll(self, enc);
+    }
+    xrdp_encoder_drop_unchanged(self, enc);
+    xrdp_tile_hash_end_frame(tile_hash);
+}
+
+/*****************************************************************************/
+/* called from encoder thread or a jpeg_pool worker */
+static void
+xrdp_encoder_jpeg_job(void *arg, int index, int worker)
+{
+    struct xrdp_jpeg_batch *batch;
+    struct xrdp_jpeg_job *job;
+    XRDP_ENC_DATA *enc;
+
+    batch = (struct xrdp_jpeg_batch *) arg;
+    job = batch->jobs + index;
+    enc = batch->enc;
+    if ((job->out_data == NULL) || (batch->self->jpeg_ctx[worker] == NULL))
+    {
+        return;
+    }
+    job->error = libxrdp_codec_jpeg_compress_ex(batch->self->jpeg_ctx[worker],
+                 0, enc->data,
+                 enc->width, enc->height,
+                 enc->width * 4,
+                 job->x, job->y,
+                 job->cx, job->cy,
+                 job->quality, job->flags,
+                 job->out_data + 256 + 2,
+                 &(job->out_data_bytes));
+}
+
 /*****************************************************************************/
 /* called from encoder thread */
 static int
 process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 {
     int index;
+    int jndex;
     int x;
     int y;
     int cx;
     int cy;
     int quality;
-    int error;
-    int out_data_bytes;
-    int count;
-    char *out_data;
+    int flags;
+    int threads;
+    int slice_lines;
+    int num_jobs;
+    int last_sent;
+    struct xrdp_jpeg_batch batch;
+    struct xrdp_jpeg_job *job;
     XRDP_ENC_DATA_DONE *enc_done;
     struct fifo *fifo_processed;
     tbus mutex;
     tbus event_processed;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg:");
-    quality = self->codec_quality;
     fifo_processed = self->fifo_processed;
     mutex = self->mutex;
     event_processed = self->xrdp_encoder_event_processed;
-    count = enc->num_crects;
-    for (index = 0; index < count; index++)
+    threads = self->num_jpeg_ctx;
+
+    /* count the slices */
+    num_jobs = 0;
+    for (index = 0; index < enc->num_crects; index++)
+    {
+        cx = enc->crects[index * 4 + 2];
+        cy = enc->crects[index * 4 + 3];
+        if (cx < 1 || cy < 1)
+        {
+            continue;
+        }
+        if ((threads > 1) && (cx * cy >= XRDP_JPEG_SLICE_MIN_PIXELS))
+        {
+            slice_lines = ((cy + threads - 1) / threads + 15) & ~15;
+            slice_lines = MAX(slice_lines, XRDP_JPEG_SLICE_MIN_LINES);
+            num_jobs += (cy + slice_lines - 1) / slice_lines;
+        }
+        else
+        {
+            num_jobs++;
+        }
+    }
+    batch.self = self;
+    batch.enc = enc;
+    batch.jobs = NULL;
+    if ((num_jobs > 0) && (threads > 0))
+    {
+        batch.jobs = g_new0(struct xrdp_jpeg_job, num_jobs);
+        if (batch.jobs == NULL)
+        {
+            num_jobs = 0;
+        }
+    }
+    else
+    {
+        num_jobs = 0;
+    }
+    if (num_jobs == 0)
+    {
+        xrdp_encoder_crects_not_sent(self, enc, 0);
+    }
+
+    /* fill in the slices */
+    job = batch.jobs;
+    for (index = 0; index < enc->num_crects && num_jobs > 0; index++)
     {
         x = enc->crects[index * 4 + 0];
         y = enc->crects[index * 4 + 1];
@@ -260,47 +1067,94 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
             continue;
         }
 
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg: x %d y %d cx %d cy %d", x, y, cx, cy);
+        quality = self->codec_quality;
+        if (enc->crect_hints != NULL)
+        {
+            if (enc->crect_hints[index] == XRDP_ENCODER_CONTENT_TEXT)
+            {
+                quality = MAX(quality, XRDP_JPEG_QUALITY_TEXT_MIN);
+            }
+            else if (enc->crect_hints[index] == XRDP_ENCODER_CONTENT_VIDEO)
+            {
+                quality = MIN(quality, XRDP_JPEG_QUALITY_VIDEO_MAX);
+            }
+        }
+        /* accurate DCT and optimal tables only pay off at high quality */
+        flags = (quality >= XRDP_JPEG_QUALITY_TEXT_MIN) ?
+                XRDP_JPEG_FLAGS_OPTIMIZE : XRDP_JPEG_FLAGS_FAST_DCT;
 
-        out_data_bytes = MAX((cx + 4) * cy * 4, 8192);
-        if ((out_data_bytes < 1) || (out_data_bytes > 16 * 1024 * 1024))
+        slice_lines = cy;
+        if ((threads > 1) && (cx * cy >= XRDP_JPEG_SLICE_MIN_PIXELS))
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 2");
-            return 1;
+            slice_lines = ((cy + threads - 1) / threads + 15) & ~15;
+            slice_lines = MAX(slice_lines, XRDP_JPEG_SLICE_MIN_LINES);
         }
-        out_data = (char *) g_malloc(out_data_bytes + 256 + 2, 0);
-        if (out_data == 0)
+        for (jndex = 0; jndex < cy; jndex += slice_lines)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 3");
-            return 1;
+            job->x = x;
+            job->y = y + jndex;
+            job->cx = cx;
+            job->cy = MIN(slice_lines, cy - jndex);
+            job->quality = quality;
+            job->flags = flags;
+            job->error = -1;
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg: x %d y %d cx %d cy %d",
+                      job->x, job->y, job->cx, job->cy);
+            job->out_data_bytes = MAX((job->cx + 4) * job->cy * 4, 8192);
+            if (job->out_data_bytes > 16 * 1024 * 1024)
+            {
+                LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 2");
+                job->out_data_bytes = 0;
+            }
+            else
+            {
+                job->out_data = g_new(char, job->out_data_bytes + 256 + 2);
+                if (job->out_data == NULL)
+                {
+                    LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 3");
+                    job->out_data_bytes = 0;
+                }
+            }
+            job++;
         }
+    }
+
+    /* compress, slices without a buffer are skipped */
+    thread_pool_run(self->jpeg_pool, num_jobs, xrdp_encoder_jpeg_job,
+                    &batch);
 
-        out_data[256] = 0; /* header bytes */
-        out_data[257] = 0;
-        error = libxrdp_codec_jpeg_compress(self->mm->wm->session, 0, enc->data,
-                                            enc->width, enc->height,
-                                            enc->width * 4, x, y, cx, cy,
-                                            quality,
-                                            out_data + 256 + 2, &out_data_bytes);
-        if (error < 0)
+    last_sent = 0;
+    for (index = 0; index < num_jobs; index++)
+    {
+        job = batch.jobs + index;
+        if ((job->out_data == NULL) || (job->error < 0) ||
+                (job->out_data_bytes < 1))
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: jpeg error %d bytes %d",
-                      error, out_data_bytes);
-            g_free(out_data);
-            return 1;
+            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: jpeg error %d "
+                      "bytes %d", job->error, job->out_data_bytes);
+            g_free(job->out_data);
+            xrdp_encoder_not_sent(self, job->x, job->y, job->cx, job->cy);
+            continue;
         }
-        LOG_DEVEL(LOG_LEVEL_WARNING, "jpeg error %d bytes %d", error, out_data_bytes);
-        enc_done = (XRDP_ENC_DATA_DONE *)
-                   g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
-        enc_done->comp_bytes = out_data_bytes + 2;
+        job->out_data[256] = 0; /* header bytes */
+        job->out_data[257] = 0;
+        enc_done = g_new0(XRDP_ENC_DATA_DONE, 1);
+        if (enc_done == NULL)
+        {
+            g_free(job->out_data);
+            xrdp_encoder_not_sent(self, job->x, job->y, job->cx, job->cy);
+            continue;
+        }
+        enc_done->comp_bytes = job->out_data_bytes + 2;
         enc_done->pad_bytes = 256;
-        enc_done->comp_pad_data = out_data;
+        enc_done->comp_pad_data = job->out_data;
         enc_done->enc = enc;
-        enc_done->last = index == (enc->num_crects - 1);
-        enc_done->x = x;
-        enc_done->y = y;
-        enc_done->cx = cx;
-        enc_done->cy = cy;
+        enc_done->last = index == (num_jobs - 1);
+        enc_done->x = job->x;
+        enc_done->y = job->y;
+        enc_done->cx = job->cx;
+        enc_done->cy = job->cy;
+        last_sent = enc_done->last;
         /* done with msg */
         /* inform main thread done */
         tc_mutex_lock(mutex);
@@ -309,6 +1163,23 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         /* signal completion for main thread */
         g_set_wait_obj(event_processed);
     }
+    g_free(batch.jobs);
+    if (!last_sent)
+    {
+        /* nothing to encode, e.g. a scroll only frame, but you must
+           always send something back so Xorg can get ack */
+        enc_done = g_new0(XRDP_ENC_DATA_DONE, 1);
+        if (enc_done == NULL)
+        {
+            return 1;
+        }
+        enc_done->enc = enc;
+        enc_done->last = 1;
+        tc_mutex_lock(mutex);
+        fifo_add_item(fifo_processed, enc_done);
+        tc_mutex_unlock(mutex);
+        g_set_wait_obj(event_processed);
+    }
     return 0;
 }
 
@@ -329,7 +1200,10 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int all_tiles_written;
     int tiles_left;
     int finished;
-    char *quant_values;
+    unsigned char quant_values[5 * RFX_NUM_QUANTS];
+    const unsigned char *frame_quants;
+    const unsigned char *video_quants;
+    int quant_index;
     char *out_data;
     XRDP_ENC_DATA_DONE *enc_done;
     struct fifo *fifo_processed;
@@ -347,12 +1221,20 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     event_processed = self->xrdp_encoder_event_processed;
 
     if (enc->flags & XRDP_ENCODER_HINT_QUALITY_LOWEST) {
-        quant_values = rfx_quant_values_ulq;
+        frame_quants = rfx_quant_values_ulq;
+        video_quants = rfx_quant_values_ulq;
     } else if (enc->flags & XRDP_ENCODER_HINT_QUALITY_LOW) {
-        quant_values = rfx_quant_values_lq;
+        frame_quants = rfx_quant_values_lq;
+        video_quants = rfx_quant_values_ulq;
     } else {
-        quant_values = rfx_quant_values_default;
+        frame_quants = rfx_quant_values_default;
+        video_quants = rfx_quant_values_lq;
     }
+    /* one quality ladder step per content hint, tiles pick by index */
+    g_memcpy(quant_values + 5 * RFX_QUANT_INDEX_FRAME, frame_quants, 5);
+    g_memcpy(quant_values + 5 * RFX_QUANT_INDEX_TEXT,
+             rfx_quant_values_text, 5);
+    g_memcpy(quant_values + 5 * RFX_QUANT_INDEX_VIDEO, video_quants, 5);
 
     all_tiles_written = 0;
     do
@@ -383,13 +1265,26 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                     y = enc->crects[(index + all_tiles_written) * 4 + 1];
                     cx = enc->crects[(index + all_tiles_written) * 4 + 2];
                     cy = enc->crects[(index + all_tiles_written) * 4 + 3];
+                    quant_index = RFX_QUANT_INDEX_FRAME;
+                    if (enc->crect_hints != NULL)
+                    {
+                        switch (enc->crect_hints[index + all_tiles_written])
+                        {
+                            case XRDP_ENCODER_CONTENT_TEXT:
+                                quant_index = RFX_QUANT_INDEX_TEXT;
+                                break;
+                            case XRDP_ENCODER_CONTENT_VIDEO:
+                                quant_index = RFX_QUANT_INDEX_VIDEO;
+                                break;
+                        }
+                    }
                     tiles[index].x = x;
                     tiles[index].y = y;
                     tiles[index].cx = cx;
                     tiles[index].cy = cy;
-                    tiles[index].quant_y = 0;
-                    tiles[index].quant_cb = 0;
-                    tiles[index].quant_cr = 0;
+                    tiles[index].quant_y = quant_index;
+                    tiles[index].quant_cb = quant_index;
+                    tiles[index].quant_cr = quant_index;
                 }
 
                 count = enc->num_drects;
@@ -411,19 +1306,29 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                                                 &out_data_bytes, enc->data,
                                                 enc->width, enc->height, enc->width * 4,
                                                 rfxrects, enc->num_drects,
-                                                tiles, tiles_left, quant_values, 1);
+                                                tiles, tiles_left,
+                                                (char *) quant_values,
+                                                RFX_NUM_QUANTS);
             }
         }
 
         LOG_DEVEL(LOG_LEVEL_DEBUG,
                   "process_enc_rfx: rfxcodec_encode tiles_written %d",
                   tiles_written);
+        if (tiles_written < 0)
+        {
+            xrdp_encoder_crects_not_sent(self, enc, all_tiles_written);
+        }
         /* only if enc_done->comp_bytes is not zero is something sent
            to the client but you must always send something back even
            on error so Xorg can get ack */
         enc_done = g_new0(XRDP_ENC_DATA_DONE, 1);
         if (enc_done == NULL)
         {
+            if (tiles_written >= 0)
+            {
+                xrdp_encoder_crects_not_sent(self, enc, all_tiles_written);
+            }
             return 1;
         }
         enc_done->comp_bytes = tiles_written > 0 ? out_data_bytes : 0;
@@ -542,6 +1447,10 @@ proc_enc_msg(void *arg)
             while (enc != 0)
             {
                 /* do work */
+                if (self->tile_hash != NULL)
+                {
+                    xrdp_encoder_filter_frame(self, enc);
+                }
                 self->process_enc(self, enc);
                 /* get next msg */
                 tc_mutex_lock(mutex);
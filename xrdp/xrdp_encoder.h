@@ -4,9 +4,25 @@
 
 #include "arch.h"
 struct fifo;
+struct thread_pool;
+struct xrdp_tile_hash;
 
 struct xrdp_enc_data;
 
+/* queue depth metrics for the capture / encode / transmit pipeline */
+struct xrdp_encoder_stats
+{
+    int frames; /* frames received from Xorg */
+    int encoder_depth_max;
+    long encoder_depth_sum; /* sampled once per frame */
+    int client_depth_max;
+    long client_depth_sum; /* sampled once per frame */
+    int encoder_stalls; /* Xorg ack held back by encoder credits */
+    int client_stalls; /* Xorg ack held back by client credits */
+    int scrolls_detected; /* shifts found by the encoder itself */
+    int tiles_skipped; /* damaged tiles the client already had */
+};
+
 /* for codec mode operations */
 struct xrdp_encoder
 {
@@ -24,9 +40,30 @@ struct xrdp_encoder
     int (*process_enc)(struct xrdp_encoder *self, struct xrdp_enc_data *enc);
     void *codec_handle;
     int frame_id_client; /* last frame id received from client */
-    int frame_id_server; /* last frame id received from Xorg */
+    int frame_id_server; /* last frame id encoded and sent to client */
     int frame_id_server_sent;
-    int frames_in_flight;
+    int frames_in_flight; /* encoder -> client credit window */
+    /* Xorg -> encoder pipelining, main thread only */
+    int max_frames_in_encoder; /* Xorg -> encoder credit window, 0 = off */
+    int frame_id_queued; /* last frame id received from Xorg */
+    int frames_in_encoder; /* frames queued or being encoded */
+    struct fifo *frame_copy_pool; /* spare buffers for frame copies */
+    int frame_copy_bytes;
+    int frame_copy_spare; /* buffers in frame_copy_pool */
+    struct xrdp_encoder_stats stats;
+    /* client area to take out of tile_hash before the next frame, set
+       by the main thread under mutex, empty if invalid_x2 <= invalid_x1 */
+    int invalid_x1;
+    int invalid_y1;
+    int invalid_x2;
+    int invalid_y2;
+    /* encoder thread only */
+    struct xrdp_tile_hash *tile_hash; /* what the client has, or NULL */
+    int tile_crects; /* crects are codec tiles and can not be split */
+    int detect_scroll;
+    struct thread_pool *jpeg_pool; /* slice workers, NULL if none */
+    void **jpeg_ctx; /* one compressor per jpeg_pool worker + 1 */
+    int num_jpeg_ctx;
 };
 
 /* used when scheduling tasks in xrdp_encoder.c */
@@ -42,6 +79,10 @@ struct xrdp_enc_data
     int height;
     int flags;
     int frame_id;
+    char *data_copy; /* private copy of data when pipelining, or NULL */
+    short *crect_hints; /* num_crects XRDP_ENCODER_CONTENT_*, or NULL */
+    int num_scrolls;
+    short *scrolls;    /* 6 * num_scrolls, x, y, cx, cy, dx, dy */
 };
 
 typedef struct xrdp_enc_data XRDP_ENC_DATA;
@@ -67,6 +108,15 @@ struct xrdp_encoder *
 xrdp_encoder_create(struct xrdp_mm *mm);
 void
 xrdp_encoder_delete(struct xrdp_encoder *self);
+int
+xrdp_encoder_copy_frame(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+void
+xrdp_encoder_release_frame(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+void
+xrdp_encoder_log_stats(struct xrdp_encoder *self);
+void
+xrdp_encoder_invalidate(struct xrdp_encoder *self,
+                        int x, int y, int cx, int cy);
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg);
 
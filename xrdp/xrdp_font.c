@@ -30,6 +30,10 @@
 #include "log.h"
 #include "string_calls.h"
 
+/* loaded by xrdp_font_preload() for the next xrdp_font_create() */
+static struct xrdp_font *g_preloaded_font = NULL;
+static char g_preloaded_font_path[256];
+
 #if 0 /* not used */
 static char w_char[] =
 {
@@ -137,24 +141,14 @@ get_font_name_from_dpi(const struct xrdp_cfg_globals *globals,
 }
 
 /*****************************************************************************/
-struct xrdp_font *
-xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
+/* the font file for a dpi, falling back to the default font
+   returns NULL if there is none */
+static const char *
+xrdp_font_get_file_path(const struct xrdp_cfg_globals *globals,
+                        unsigned int dpi, char *file_path_buff,
+                        int file_path_buff_size)
 {
-    struct xrdp_font *self;
-    struct stream *s;
-    int fd;
-    int b;
-    int i;
-    int index;
-    int datasize;
-    int file_size;
-    struct xrdp_font_char *f;
-    const char *file_path;
-    char file_path_buff[256];
-    int min_descender;
     char font_name[256];
-    const struct xrdp_cfg_globals *globals = &wm->xrdp_config->cfg_globals;
-    LOG_DEVEL(LOG_LEVEL_TRACE, "in xrdp_font_create");
 
     if (dpi == 0)
     {
@@ -167,17 +161,16 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
     if (font_name[0] == '/')
     {
         /* User specified absolute path */
-        file_path = font_name;
+        g_strncpy(file_path_buff, font_name, file_path_buff_size - 1);
     }
     else
     {
-        g_snprintf(file_path_buff, sizeof(file_path_buff),
+        g_snprintf(file_path_buff, file_path_buff_size,
                    XRDP_SHARE_PATH "/%s",
                    font_name);
-        file_path = file_path_buff;
     }
 
-    if (!g_file_exist(file_path))
+    if (!g_file_exist(file_path_buff))
     {
         /* Try to fall back to the default */
         const char *default_file_path = XRDP_SHARE_PATH "/" DEFAULT_FONT_NAME;
@@ -185,29 +178,47 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
         {
             LOG(LOG_LEVEL_WARNING,
                 "xrdp_font_create: font file [%s] does not exist - using [%s]",
-                file_path, default_file_path);
-            file_path = default_file_path;
+                file_path_buff, default_file_path);
+            g_strncpy(file_path_buff, default_file_path,
+                      file_path_buff_size - 1);
         }
         else
         {
             LOG(LOG_LEVEL_ERROR,
                 "xrdp_font_create: Can't load either [%s] or [%s]",
-                file_path, default_file_path);
-            return 0;
+                file_path_buff, default_file_path);
+            return NULL;
         }
     }
 
+    return file_path_buff;
+}
+
+/*****************************************************************************/
+static struct xrdp_font *
+xrdp_font_load(const char *file_path)
+{
+    struct xrdp_font *self;
+    struct stream *s;
+    int fd;
+    int b;
+    int i;
+    int index;
+    int datasize;
+    int file_size;
+    struct xrdp_font_char *f;
+    int min_descender;
+
     file_size = g_file_get_size(file_path);
 
     if (file_size < 1)
     {
-        LOG(LOG_LEVEL_ERROR, "xrdp_font_create: error reading font from file [%s]",
+        LOG(LOG_LEVEL_ERROR, "xrdp_font_load: error reading font from file [%s]",
             file_path);
         return 0;
     }
 
     self = (struct xrdp_font *)g_malloc(sizeof(struct xrdp_font), 1);
-    self->wm = wm;
     make_stream(s);
     init_stream(s, file_size + 1024);
     fd = g_file_open_ro(file_path);
@@ -249,7 +260,7 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
                 if (datasize < 0 || datasize > 512)
                 {
                     /* shouldn't happen */
-                    LOG(LOG_LEVEL_ERROR, "error in xrdp_font_create, datasize wrong "
+                    LOG(LOG_LEVEL_ERROR, "error in xrdp_font_load, datasize wrong "
                         "width %d, height %d, datasize %d, index %d",
                         f->width, f->height, datasize, index);
                     break;
@@ -270,7 +281,7 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
                 }
                 else
                 {
-                    LOG(LOG_LEVEL_ERROR, "error in xrdp_font_create");
+                    LOG(LOG_LEVEL_ERROR, "error in xrdp_font_load");
                 }
                 index++;
             }
@@ -293,6 +304,70 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
       self->font_items[0].data = g_malloc(3 * 16, 0);
       g_memcpy(self->font_items[0].data, w_char, 3 * 16);
     */
+    return self;
+}
+
+/*****************************************************************************/
+/* load the font for a dpi ahead of a connection, in a process forked
+   before its connection comes in, xrdp_font_create() takes it if it
+   wants the same font */
+int
+xrdp_font_preload(const struct xrdp_cfg_globals *globals, unsigned int dpi)
+{
+    char file_path_buff[256];
+    const char *file_path;
+
+    if (g_preloaded_font != NULL)
+    {
+        return 0;
+    }
+    file_path = xrdp_font_get_file_path(globals, dpi, file_path_buff,
+                                        sizeof(file_path_buff));
+    if (file_path == NULL)
+    {
+        return 1;
+    }
+    g_preloaded_font = xrdp_font_load(file_path);
+    if (g_preloaded_font == NULL)
+    {
+        return 1;
+    }
+    g_strncpy(g_preloaded_font_path, file_path,
+              sizeof(g_preloaded_font_path) - 1);
+    return 0;
+}
+
+/*****************************************************************************/
+struct xrdp_font *
+xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
+{
+    struct xrdp_font *self;
+    const char *file_path;
+    char file_path_buff[256];
+    const struct xrdp_cfg_globals *globals = &wm->xrdp_config->cfg_globals;
+    LOG_DEVEL(LOG_LEVEL_TRACE, "in xrdp_font_create");
+
+    file_path = xrdp_font_get_file_path(globals, dpi, file_path_buff,
+                                        sizeof(file_path_buff));
+    if (file_path == NULL)
+    {
+        return 0;
+    }
+    if ((g_preloaded_font != NULL) &&
+            (g_strcmp(g_preloaded_font_path, file_path) == 0))
+    {
+        self = g_preloaded_font;
+    }
+    else
+    {
+        xrdp_font_delete(g_preloaded_font);
+        self = xrdp_font_load(file_path);
+    }
+    g_preloaded_font = NULL;
+    if (self != NULL)
+    {
+        self->wm = wm;
+    }
     LOG_DEVEL(LOG_LEVEL_TRACE, "out xrdp_font_create");
     return self;
 }
@@ -26,6 +26,22 @@
 #include "log.h"
 #include "string_calls.h"
 
+/* most listen worker processes, see xrdp_listen_run_workers() */
+#define MAX_LISTEN_WORKERS 64
+/* a listen worker exiting sooner than this after it started has failed
+   to start, and is given up on after this many in a row */
+#define WORKER_QUICK_EXIT_MS 10000
+#define MAX_WORKER_QUICK_EXITS 5
+/* most children forked ahead of connections, see xrdp_listen_fill_pool() */
+#define MAX_POOL_CHILDREN 32
+
+/* a child forked ahead of its connection */
+struct xrdp_pool_child
+{
+    int pid;
+    int sck; /* our end of a socket pair, the connection is sent over it */
+};
+
 /* 'g_process' is protected by the semaphore 'g_process_sem'.  One thread sets
    g_process and waits for the other to process it */
 static tbus g_process_sem = 0;
@@ -64,6 +80,8 @@ xrdp_listen_create(void)
     self->trans_list = list_create();
     self->process_list = list_create();
     self->fork_list = list_create();
+    self->pool_list = list_create();
+    self->pool_list->auto_free = 1;
 
     if (g_process_sem == 0)
     {
@@ -72,6 +90,24 @@ xrdp_listen_create(void)
     return self;
 }
 
+/*****************************************************************************/
+/* close our ends of the pool sockets, in the parent this lets the children
+   go, in a child it is just tidying up */
+static void
+xrdp_listen_close_pool(struct xrdp_listen *self)
+{
+    int index;
+    struct xrdp_pool_child *child;
+
+    for (index = 0; index < self->pool_list->count; index++)
+    {
+        child = (struct xrdp_pool_child *)
+                list_get_item(self->pool_list, index);
+        g_sck_close(child->sck);
+    }
+    list_clear(self->pool_list);
+}
+
 /*****************************************************************************/
 void
 xrdp_listen_delete(struct xrdp_listen *self)
@@ -99,6 +135,13 @@ xrdp_listen_delete(struct xrdp_listen *self)
         g_process_sem = 0;
     }
 
+    if (self->pool_list != NULL)
+    {
+        /* the children see their sockets close and exit */
+        xrdp_listen_close_pool(self);
+        list_delete(self->pool_list);
+    }
+
     g_delete_wait_obj(self->pro_done_event);
     list_delete(self->process_list);
     list_delete(self->fork_list);
@@ -231,6 +274,18 @@ xrdp_listen_get_startup_params(struct xrdp_listen *self)
                         val = (char *)list_get_item(values, index);
                         startup_params->use_vsock = g_text2bool(val);
                     }
+
+                    if (g_strcasecmp(val, "workers") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        startup_params->workers = g_atoi(val);
+                    }
+
+                    if (g_strcasecmp(val, "fork_pool") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        startup_params->fork_pool = g_atoi(val);
+                    }
                 }
             }
         }
@@ -655,6 +710,7 @@ static int
 xrdp_listen_process_startup_params(struct xrdp_listen *self)
 {
     int mode; /* TRANS_MODE_TCP*, TRANS_MODE_UNIX, TRANS_MODE_VSOCK */
+    int is_tcp;
     int error;
     int cont;
     int bytes;
@@ -677,6 +733,15 @@ xrdp_listen_process_startup_params(struct xrdp_listen *self)
         }
         LOG(LOG_LEVEL_INFO, "address [%s] port [%s] mode %d",
             address, port, mode);
+        is_tcp = (mode == TRANS_MODE_TCP) ||
+                 (mode == TRANS_MODE_TCP4) ||
+                 (mode == TRANS_MODE_TCP6);
+        if ((startup_params->workers > 0) && !is_tcp &&
+                (self->worker_index != 0))
+        {
+            /* only tcp ports can be shared, the first worker has the rest */
+            continue;
+        }
         ltrans = trans_create(mode, 16, 16);
         if (ltrans == NULL)
         {
@@ -684,6 +749,7 @@ xrdp_listen_process_startup_params(struct xrdp_listen *self)
             xrdp_listen_stop_all_listen(self);
             return 1;
         }
+        ltrans->reuse_port = is_tcp && (startup_params->workers > 0);
         LOG(LOG_LEVEL_INFO, "listening to port %s on %s",
             port, address);
         error = trans_listen_address(ltrans, port, address);
@@ -694,9 +760,7 @@ xrdp_listen_process_startup_params(struct xrdp_listen *self)
             xrdp_listen_stop_all_listen(self);
             return 1;
         }
-        if ((mode == TRANS_MODE_TCP) ||
-                (mode == TRANS_MODE_TCP4) ||
-                (mode == TRANS_MODE_TCP6))
+        if (is_tcp)
         {
             if (startup_params->tcp_nodelay)
             {
@@ -767,41 +831,61 @@ xrdp_listen_process_startup_params(struct xrdp_listen *self)
     return 0;
 }
 
+/*****************************************************************************/
+/* in a child just forked to run a session */
+static void
+xrdp_listen_child_init(struct xrdp_listen *self)
+{
+    int index;
+    struct trans *ltrans;
+
+    /* recreate some main globals */
+    xrdp_child_fork();
+    /* recreate the process done wait object, not used in fork mode */
+    /* close, don't delete this */
+    g_close_wait_obj(self->pro_done_event);
+    xrdp_listen_create_pro_done(self);
+    /* delete listener, child need not listen */
+    for (index = 0; index < self->trans_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->trans_list, index);
+        trans_delete_from_child(ltrans);
+    }
+    list_delete(self->trans_list);
+    self->trans_list = NULL;
+    /* nor does it send connections to the pool */
+    xrdp_listen_close_pool(self);
+}
+
+/*****************************************************************************/
+/* run the session of a connection in a forked child */
+static void
+xrdp_listen_child_run(struct xrdp_listen *self, struct trans *server_trans)
+{
+    struct xrdp_process *process;
+
+    /* new connect instance */
+    process = xrdp_process_create(self, 0);
+    process->server_trans = server_trans;
+    g_process = process;
+    xrdp_process_run(0);
+    tc_sem_dec(g_process_sem);
+    xrdp_process_delete(process);
+}
+
 /*****************************************************************************/
 static int
 xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
 {
     int pid;
-    int index;
-    struct xrdp_process *process;
-    struct trans *ltrans;
 
     pid = g_fork();
 
     if (pid == 0)
     {
         /* child */
-        /* recreate some main globals */
-        xrdp_child_fork();
-        /* recreate the process done wait object, not used in fork mode */
-        /* close, don't delete this */
-        g_close_wait_obj(self->pro_done_event);
-        xrdp_listen_create_pro_done(self);
-        /* delete listener, child need not listen */
-        for (index = 0; index < self->trans_list->count; index++)
-        {
-            ltrans = (struct trans *) list_get_item(self->trans_list, index);
-            trans_delete_from_child(ltrans);
-        }
-        list_delete(self->trans_list);
-        self->trans_list = NULL;
-        /* new connect instance */
-        process = xrdp_process_create(self, 0);
-        process->server_trans = server_trans;
-        g_process = process;
-        xrdp_process_run(0);
-        tc_sem_dec(g_process_sem);
-        xrdp_process_delete(process);
+        xrdp_listen_child_init(self);
+        xrdp_listen_child_run(self, server_trans);
         /* mark this process to exit */
         g_set_term(1);
         return 1;
@@ -812,6 +896,206 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
     return 0;
 }
 
+/*****************************************************************************/
+/* read just the xrdp.ini settings xrdp_font_preload() uses, as
+   load_xrdp_config() does
+   returns error */
+static int
+xrdp_listen_read_font_config(const char *xrdp_ini,
+                             struct xrdp_cfg_globals *globals)
+{
+    struct list *names;
+    struct list *values;
+    const char *name;
+    const char *value;
+    int index;
+    int rv;
+
+    g_memset(globals, 0, sizeof(*globals));
+    globals->default_dpi = 96;
+    names = list_create();
+    values = list_create();
+    rv = 1;
+    if ((names != NULL) && (values != NULL))
+    {
+        names->auto_free = 1;
+        values->auto_free = 1;
+        rv = file_by_name_read_section(xrdp_ini, "globals", names, values);
+    }
+    for (index = 0; (rv == 0) && (index < names->count); index++)
+    {
+        name = (const char *)list_get_item(names, index);
+        value = (const char *)list_get_item(values, index);
+        if (g_strcmp(name, "default_dpi") == 0)
+        {
+            globals->default_dpi = g_atoi(value);
+        }
+        else if (g_strcmp(name, "fv1_select") == 0)
+        {
+            g_strncpy(globals->fv1_select, value,
+                      sizeof(globals->fv1_select) - 1);
+        }
+    }
+    list_delete(names);
+    list_delete(values);
+    return rv;
+}
+
+/*****************************************************************************/
+/* in a pool child, do what every session does before it knows its client
+   then wait to be sent a connection
+   returns the connection, or NULL if xrdp is stopping */
+static struct trans *
+xrdp_listen_pool_child_wait(struct xrdp_listen *self, int sck)
+{
+    struct xrdp_cfg_globals globals;
+    struct trans *server_trans;
+    intptr_t robjs[2];
+    int fds[1];
+    unsigned int fdcount;
+    int mode;
+    int bytes;
+
+    libxrdp_preload_config(self->startup_params->xrdp_ini);
+    if (xrdp_listen_read_font_config(self->startup_params->xrdp_ini,
+                                     &globals) == 0)
+    {
+        xrdp_font_preload(&globals, globals.default_dpi);
+    }
+
+    robjs[0] = g_get_term();
+    robjs[1] = sck;
+    while (!g_is_wait_obj_set(sck))
+    {
+        if (g_obj_wait(robjs, 2, 0, 0, -1) != 0)
+        {
+            /* error, should not get here */
+            g_sleep(100);
+        }
+        if (g_is_wait_obj_set(robjs[0]))
+        {
+            return NULL;
+        }
+    }
+    fdcount = 0;
+    bytes = g_sck_recv_fd_set(sck, &mode, sizeof(mode), fds, 1, &fdcount);
+    if ((bytes != sizeof(mode)) || (fdcount != 1))
+    {
+        /* the parent has gone */
+        if ((bytes > 0) && (fdcount == 1))
+        {
+            g_sck_close(fds[0]);
+        }
+        return NULL;
+    }
+    server_trans = trans_create(mode, 16, 16);
+    if (server_trans == NULL)
+    {
+        g_sck_close(fds[0]);
+        return NULL;
+    }
+    server_trans->sck = fds[0];
+    server_trans->type1 = TRANS_TYPE_SERVER;
+    server_trans->status = TRANS_STATUS_UP;
+    g_file_set_cloexec(server_trans->sck, 1);
+    return server_trans;
+}
+
+/*****************************************************************************/
+/* fork children ahead of connections until the pool is full, so a
+   connection doesn't wait for fork() and the setting up after it
+   returns 1 in a child when its session is over, 0 in the parent */
+static int
+xrdp_listen_fill_pool(struct xrdp_listen *self)
+{
+    struct xrdp_pool_child *child;
+    struct trans *server_trans;
+    int sck[2];
+    int pid;
+
+    if (!self->startup_params->fork)
+    {
+        return 0;
+    }
+    while (self->pool_list->count < self->startup_params->fork_pool)
+    {
+        if (g_sck_local_socketpair(sck) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_listen_fill_pool: "
+                "g_sck_local_socketpair failed: %s", g_get_strerror());
+            return 0;
+        }
+        pid = g_fork();
+        if (pid == 0)
+        {
+            /* child */
+            g_sck_close(sck[0]);
+            xrdp_listen_child_init(self);
+            server_trans = xrdp_listen_pool_child_wait(self, sck[1]);
+            g_sck_close(sck[1]);
+            if (server_trans != NULL)
+            {
+                xrdp_listen_child_run(self, server_trans);
+            }
+            /* mark this process to exit */
+            g_set_term(1);
+            return 1;
+        }
+        /* parent */
+        g_sck_close(sck[1]);
+        if (pid < 0)
+        {
+            g_sck_close(sck[0]);
+            return 0;
+        }
+        g_file_set_cloexec(sck[0], 1);
+        child = g_new0(struct xrdp_pool_child, 1);
+        child->pid = pid;
+        child->sck = sck[0];
+        list_add_item(self->pool_list, (intptr_t) child);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* send a new connection to a child in the pool
+   returns error, the pool is empty for one */
+static int
+xrdp_listen_send_to_pool(struct xrdp_listen *self, struct trans *server_trans)
+{
+    struct xrdp_pool_child *child;
+    int fds[1];
+    int mode;
+    int bytes;
+
+    while (self->pool_list->count > 0)
+    {
+        child = (struct xrdp_pool_child *) list_get_item(self->pool_list, 0);
+        mode = server_trans->mode;
+        fds[0] = server_trans->sck;
+        bytes = g_sck_send_fd_set(child->sck, &mode, sizeof(mode), fds, 1);
+        if (bytes == sizeof(mode))
+        {
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "connection sent to pool child %d",
+                      child->pid);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_WARNING, "pool child %d did not take a connection",
+                child->pid);
+        }
+        g_sck_close(child->sck);
+        list_remove_item(self->pool_list, 0);
+        if (bytes == sizeof(mode))
+        {
+            /* the child has its own copy of the socket */
+            trans_delete(server_trans);
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /*****************************************************************************/
 /* a new connection is coming in */
 int
@@ -846,6 +1130,219 @@ xrdp_listen_conn_in(struct trans *self, struct trans *new_self)
     return 0;
 }
 
+/*****************************************************************************/
+/* fork listen worker 'index', the parent keeps the read end of a pipe
+   that the worker holds the write end of, it is readable once the
+   worker has gone
+   returns 1 in the worker, 0 in the parent or -1 on error */
+static int
+xrdp_listen_start_worker(struct xrdp_listen *self, int index,
+                         int *pids, int *fds)
+{
+    int pipe_fds[2];
+    int lindex;
+
+    if (g_pipe(pipe_fds) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_listen_start_worker: g_pipe failed: %s",
+            g_get_strerror());
+        return -1;
+    }
+    pids[index] = g_fork();
+    if (pids[index] == 0)
+    {
+        /* worker */
+        g_file_close(pipe_fds[0]);
+        g_file_set_cloexec(pipe_fds[1], 1);
+        for (lindex = 0; lindex < self->startup_params->workers; lindex++)
+        {
+            if (fds[lindex] > 0)
+            {
+                g_file_close(fds[lindex]);
+            }
+        }
+        xrdp_child_fork();
+        g_close_wait_obj(self->pro_done_event);
+        xrdp_listen_create_pro_done(self);
+        self->worker_index = index;
+        return 1;
+    }
+    g_file_close(pipe_fds[1]);
+    if (pids[index] < 0)
+    {
+        g_file_close(pipe_fds[0]);
+        return -1;
+    }
+    fds[index] = pipe_fds[0];
+    LOG(LOG_LEVEL_INFO, "started listen worker %d with pid %d",
+        index, pids[index]);
+    return 0;
+}
+
+/*****************************************************************************/
+/* start the listen workers and restart any that exit until xrdp is
+   stopped, each worker listens on the tcp ports with SO_REUSEPORT so the
+   kernel shares connections out between them, and runs its sessions as
+   threads
+   a worker that keeps exiting soon after it starts is restarted after a
+   growing delay, and left stopped after MAX_WORKER_QUICK_EXITS in a row
+   returns 1 in a worker, which goes on to listen, 0 in the parent when
+   done or -1 on error */
+static int
+xrdp_listen_run_workers(struct xrdp_listen *self)
+{
+    int pids[MAX_LISTEN_WORKERS];
+    int fds[MAX_LISTEN_WORKERS];
+    int started[MAX_LISTEN_WORKERS];
+    int quick_exits[MAX_LISTEN_WORKERS];
+    int restarting[MAX_LISTEN_WORKERS];
+    int restart_at[MAX_LISTEN_WORKERS];
+    intptr_t robjs[MAX_LISTEN_WORKERS + 2];
+    int robjs_count;
+    int workers;
+    int running;
+    int index;
+    int timeout;
+    int now;
+    int rv;
+    intptr_t term_obj;
+    intptr_t sync_obj;
+
+    workers = self->startup_params->workers;
+    if (workers > MAX_LISTEN_WORKERS)
+    {
+        LOG(LOG_LEVEL_WARNING, "workers %d too many, using %d",
+            workers, MAX_LISTEN_WORKERS);
+        workers = MAX_LISTEN_WORKERS;
+        self->startup_params->workers = workers;
+    }
+    if (self->startup_params->fork)
+    {
+        LOG(LOG_LEVEL_INFO, "fork is not used with workers, sessions run "
+            "as threads in the workers");
+        self->startup_params->fork = 0;
+    }
+    g_memset(fds, 0, sizeof(fds));
+    g_memset(quick_exits, 0, sizeof(quick_exits));
+    g_memset(restarting, 0, sizeof(restarting));
+    g_memset(restart_at, 0, sizeof(restart_at));
+    rv = 0;
+    for (index = 0; index < workers; index++)
+    {
+        rv = xrdp_listen_start_worker(self, index, pids, fds);
+        if (rv != 0)
+        {
+            break;
+        }
+        started[index] = g_time3();
+    }
+    term_obj = g_get_term();
+    sync_obj = g_get_sync_event();
+    while (rv == 0)
+    {
+        robjs_count = 0;
+        robjs[robjs_count++] = term_obj;
+        robjs[robjs_count++] = sync_obj;
+        running = 0;
+        timeout = -1;
+        now = g_time3();
+        for (index = 0; index < workers; index++)
+        {
+            if (fds[index] > 0)
+            {
+                robjs[robjs_count++] = fds[index];
+                running++;
+            }
+            else if (restarting[index])
+            {
+                running++;
+                if ((timeout < 0) || (restart_at[index] - now < timeout))
+                {
+                    timeout = MAX(restart_at[index] - now, 1);
+                }
+            }
+        }
+        if (running == 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "all the listen workers have given up, "
+                "stopping");
+            rv = -1;
+            break;
+        }
+        if (g_obj_wait(robjs, robjs_count, 0, 0, timeout) != 0)
+        {
+            /* error, should not get here */
+            g_sleep(100);
+        }
+        if (g_is_wait_obj_set(term_obj))
+        {
+            LOG(LOG_LEVEL_INFO, "Received termination signal, stopping the "
+                "listen workers");
+            break;
+        }
+        if (g_is_wait_obj_set(sync_obj))
+        {
+            g_reset_wait_obj(sync_obj);
+            g_process_waiting_function();
+        }
+        now = g_time3();
+        for (index = 0; index < workers; index++)
+        {
+            if ((fds[index] > 0) && g_is_wait_obj_set(fds[index]))
+            {
+                g_file_close(fds[index]);
+                fds[index] = 0;
+                if (now - started[index] < WORKER_QUICK_EXIT_MS)
+                {
+                    quick_exits[index]++;
+                }
+                else
+                {
+                    quick_exits[index] = 0;
+                }
+                if (quick_exits[index] >= MAX_WORKER_QUICK_EXITS)
+                {
+                    LOG(LOG_LEVEL_ERROR, "listen worker %d with pid %d has "
+                        "exited %d times in a row soon after starting, not "
+                        "restarting it", index, pids[index],
+                        quick_exits[index]);
+                    continue;
+                }
+                /* 1, 2, 4, 8 ... seconds if it can not start */
+                restarting[index] = 1;
+                restart_at[index] = now + ((quick_exits[index] == 0) ? 0 :
+                                           1000 << (quick_exits[index] - 1));
+                LOG(LOG_LEVEL_WARNING, "listen worker %d with pid %d has "
+                    "exited, restarting it in %d ms", index, pids[index],
+                    restart_at[index] - now);
+            }
+            if (restarting[index] && (now - restart_at[index] >= 0))
+            {
+                restarting[index] = 0;
+                rv = xrdp_listen_start_worker(self, index, pids, fds);
+                if (rv != 0)
+                {
+                    break;
+                }
+                started[index] = g_time3();
+            }
+        }
+    }
+    if (rv == 1)
+    {
+        return 1;
+    }
+    for (index = 0; index < workers; index++)
+    {
+        if (fds[index] > 0)
+        {
+            g_sigterm(pids[index]);
+            g_file_close(fds[index]);
+        }
+    }
+    return rv;
+}
+
 /*****************************************************************************/
 /* wait for incoming connections
    passes through trans_listen_address return value */
@@ -856,11 +1353,13 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
     int cont;
     int index;
     int timeout;
-    intptr_t robjs[32];
+    int error;
+    intptr_t robjs[32 + MAX_POOL_CHILDREN];
     intptr_t term_obj;
     intptr_t sync_obj;
     intptr_t done_obj;
     struct trans *ltrans;
+    struct xrdp_pool_child *pool_child;
 
     self->status = 1;
     if (xrdp_listen_get_startup_params(self) != 0)
@@ -869,18 +1368,40 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         self->status = -1;
         return 1;
     }
+    if (self->startup_params->workers > 0)
+    {
+        error = xrdp_listen_run_workers(self);
+        if (error != 1)
+        {
+            /* the parent only looks after the workers */
+            self->status = -1;
+            return (error == 0) ? 0 : 1;
+        }
+    }
     if (xrdp_listen_process_startup_params(self) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "xrdp_listen_main_loop: xrdp_listen_get_port failed");
         self->status = -1;
         return 1;
     }
+    if (self->startup_params->fork_pool > MAX_POOL_CHILDREN)
+    {
+        LOG(LOG_LEVEL_WARNING, "fork_pool %d too big, using %d",
+            self->startup_params->fork_pool, MAX_POOL_CHILDREN);
+        self->startup_params->fork_pool = MAX_POOL_CHILDREN;
+    }
     term_obj = g_get_term(); /*Global termination event */
     sync_obj = g_get_sync_event();
     done_obj = self->pro_done_event;
     cont = 1;
     while (cont)
     {
+        if (xrdp_listen_fill_pool(self) != 0)
+        {
+            /* a pool child whose session is over */
+            break;
+        }
+
         /* build the wait obj list */
         robjs_count = 0;
         robjs[robjs_count++] = term_obj;
@@ -888,6 +1409,13 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         robjs[robjs_count++] = done_obj;
         timeout = -1;
 
+        for (index = 0; index < self->pool_list->count; index++)
+        {
+            pool_child = (struct xrdp_pool_child *)
+                         list_get_item(self->pool_list, index);
+            robjs[robjs_count++] = pool_child->sck;
+        }
+
         for (index = 0; index < self->trans_list->count; index++)
         {
             ltrans = (struct trans *)
@@ -932,6 +1460,22 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
             xrdp_listen_delete_done_pro(self);
         }
 
+        /* a pool child's socket only reads when it has gone */
+        for (index = self->pool_list->count - 1; index >= 0; index--)
+        {
+            pool_child = (struct xrdp_pool_child *)
+                         list_get_item(self->pool_list, index);
+            if (g_is_wait_obj_set(pool_child->sck))
+            {
+                LOG(LOG_LEVEL_WARNING, "pool child %d has exited",
+                    pool_child->pid);
+                g_sck_close(pool_child->sck);
+                list_remove_item(self->pool_list, index);
+                /* don't spin if they can not start */
+                g_sleep(100);
+            }
+        }
+
         /* Run the callback when accept() returns a new socket*/
         for (index = 0; index < self->trans_list->count; index++)
         {
@@ -951,6 +1495,10 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         {
             ltrans = (struct trans *) list_get_item(self->fork_list, 0);
             list_remove_item(self->fork_list, 0);
+            if (xrdp_listen_send_to_pool(self, ltrans) == 0)
+            {
+                continue;
+            }
             if (xrdp_listen_fork(self, ltrans) != 0)
             {
                 cont = 0;
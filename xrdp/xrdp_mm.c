@@ -421,6 +421,7 @@ xrdp_mm_setup_mod1(struct xrdp_mm *self)
             self->mod->server_paint_rect_bpp = server_paint_rect_bpp;
             self->mod->server_composite = server_composite;
             self->mod->server_paint_rects = server_paint_rects;
+            self->mod->server_paint_rects_ex = server_paint_rects_ex;
             self->mod->server_session_info = server_session_info;
             self->mod->server_set_pointer_large = server_set_pointer_large;
             self->mod->si = &(self->wm->session->si);
@@ -1598,6 +1599,14 @@ xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_suppress_output: suppress %d "
               "left %d top %d right %d bottom %d",
               suppress, left, top, right, bottom);
+    if ((suppress == 0) && (self->encoder != NULL))
+    {
+        /* the client may have dropped what it had while suppressed, the
+           repaint that follows must not be skipped as unchanged */
+        xrdp_encoder_invalidate(self->encoder, 0, 0,
+                                self->wm->screen->width,
+                                self->wm->screen->height);
+    }
     if (self->mod != NULL)
     {
         if (self->mod->mod_suppress_output != NULL)
@@ -2906,21 +2915,90 @@ static int
 xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
 {
     int fif;
+    int frame_id;
     struct xrdp_encoder *encoder;
 
     encoder = self->encoder;
+    if (encoder->max_frames_in_encoder > 0)
+    {
+        /* pipelined, Xorg can capture the next frame as soon as the
+           encoder has a credit for it */
+        frame_id = encoder->frame_id_queued;
+    }
+    else
+    {
+        frame_id = encoder->frame_id_server;
+    }
+    if (frame_id <= encoder->frame_id_server_sent)
+    {
+        return 0;
+    }
+    if ((encoder->max_frames_in_encoder > 0) &&
+            (encoder->frames_in_encoder >= encoder->max_frames_in_encoder))
+    {
+        encoder->stats.encoder_stalls++;
+        return 0;
+    }
     fif = encoder->frames_in_flight;
-    if (encoder->frame_id_client + fif > encoder->frame_id_server)
+    if (self->wm->client_info->use_frame_acks &&
+            (encoder->frame_id_client + fif <= encoder->frame_id_server))
     {
-        if (encoder->frame_id_server > encoder->frame_id_server_sent)
+        encoder->stats.client_stalls++;
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_update_module_ack: frame_id %d "
+              "frames_in_encoder %d frame_id_client %d frame_id_server %d",
+              frame_id, encoder->frames_in_encoder,
+              encoder->frame_id_client, encoder->frame_id_server);
+    encoder->frame_id_server_sent = frame_id;
+    self->mod->mod_frame_ack(self->mod, 0, frame_id);
+    return 0;
+}
+
+/*****************************************************************************/
+/* copies the scrolled areas of a frame on the client, the encoder only
+   gets the newly exposed pixels */
+static void
+xrdp_mm_send_scrolls(struct xrdp_mm *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_egfx_rect src_rect;
+    struct xrdp_egfx_point dst_point;
+    struct xrdp_session *session;
+    short *s;
+    int index;
+
+    session = self->wm->session;
+    if (self->egfx_up)
+    {
+        s = enc->scrolls;
+        for (index = 0; index < enc->num_scrolls; index++)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_update_module_ack: frame_id_server %d",
-                      encoder->frame_id_server);
-            encoder->frame_id_server_sent = encoder->frame_id_server;
-            self->mod->mod_frame_ack(self->mod, 0, encoder->frame_id_server);
+            src_rect.x1 = s[0];
+            src_rect.y1 = s[1];
+            src_rect.x2 = s[0] + s[2];
+            src_rect.y2 = s[1] + s[3];
+            dst_point.x = s[0] + s[4];
+            dst_point.y = s[1] + s[5];
+            xrdp_egfx_send_surface_to_surface(self->egfx,
+                                              self->egfx->surface_id,
+                                              self->egfx->surface_id,
+                                              &src_rect, 1, &dst_point);
+            s += 6;
         }
+        return;
     }
-    return 0;
+    if (libxrdp_orders_init(session) != 0)
+    {
+        return;
+    }
+    s = enc->scrolls;
+    for (index = 0; index < enc->num_scrolls; index++)
+    {
+        libxrdp_orders_screen_blt(session, s[0] + s[4], s[1] + s[5],
+                                  s[2], s[3], s[0], s[1], 0xcc, NULL);
+        s += 6;
+    }
+    libxrdp_orders_send(session);
 }
 
 /*****************************************************************************/
@@ -2935,6 +3013,8 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_process_enc_done:");
 
+    /* frame markers, scrolls and small tiles share PDUs */
+    libxrdp_fastpath_pack_begin(self->wm->session);
     while (1)
     {
         tc_mutex_lock(self->encoder->mutex);
@@ -2952,6 +3032,12 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         y = enc_done->y;
         cx = enc_done->cx;
         cy = enc_done->cy;
+        if (enc_done->enc->num_scrolls > 0)
+        {
+            /* before any pixels of this frame */
+            xrdp_mm_send_scrolls(self, enc_done->enc);
+            enc_done->enc->num_scrolls = 0;
+        }
         if (enc_done->comp_bytes > 0)
         {
             if (!enc_done->continuation)
@@ -2976,7 +3062,10 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         if (enc_done->last)
         {
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: last set");
-            if (self->wm->client_info->use_frame_acks == 0)
+            self->encoder->frames_in_encoder--;
+            xrdp_encoder_release_frame(self->encoder, enc_done->enc);
+            if ((self->wm->client_info->use_frame_acks == 0) &&
+                    (self->encoder->max_frames_in_encoder == 0))
             {
                 self->mod->mod_frame_ack(self->mod,
                                          enc_done->enc->flags,
@@ -2989,12 +3078,14 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             }
             g_free(enc_done->enc->drects);
             g_free(enc_done->enc->crects);
+            g_free(enc_done->enc->crect_hints);
+            g_free(enc_done->enc->scrolls);
             g_free(enc_done->enc);
         }
         g_free(enc_done->comp_pad_data);
         g_free(enc_done);
     }
-    return 0;
+    return libxrdp_fastpath_pack_end(self->wm->session);
 }
 
 /*****************************************************************************/
@@ -3353,10 +3444,13 @@ server_composite(struct xrdp_mod *mod, int srcidx, int srcformat,
 }
 
 /*****************************************************************************/
+/* crect_hints and scrolls can be NULL, see
+   process_server_paint_rect_shmem_hints() in xup */
 int
-server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
-                   int num_crects, short *crects, char *data, int width,
-                   int height, int flags, int frame_id)
+server_paint_rects_ex(struct xrdp_mod *mod, int num_drects, short *drects,
+                      int num_crects, short *crects, short *crect_hints,
+                      int num_scrolls, short *scrolls, char *data,
+                      int width, int height, int flags, int frame_id)
 {
     struct xrdp_wm *wm;
     struct xrdp_mm *mm;
@@ -3365,6 +3459,7 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
     short *s;
     int index;
     XRDP_ENC_DATA *enc_data;
+    struct xrdp_encoder *encoder;
 
     wm = (struct xrdp_wm *)(mod->wm);
     mm = wm->mm;
@@ -3400,6 +3495,26 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
         g_memcpy(enc_data->drects, drects, sizeof(short) * num_drects * 4);
         g_memcpy(enc_data->crects, crects, sizeof(short) * num_crects * 4);
 
+        if (crect_hints != NULL)
+        {
+            enc_data->crect_hints = g_new(short, num_crects + 1);
+            if (enc_data->crect_hints != NULL)
+            {
+                g_memcpy(enc_data->crect_hints, crect_hints,
+                         sizeof(short) * num_crects);
+            }
+        }
+        if ((scrolls != NULL) && (num_scrolls > 0))
+        {
+            enc_data->scrolls = g_new(short, num_scrolls * 6);
+            if (enc_data->scrolls != NULL)
+            {
+                g_memcpy(enc_data->scrolls, scrolls,
+                         sizeof(short) * num_scrolls * 6);
+                enc_data->num_scrolls = num_scrolls;
+            }
+        }
+
         enc_data->mod = mod;
         enc_data->num_drects = num_drects;
         enc_data->num_crects = num_crects;
@@ -3413,13 +3528,45 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
             LOG_DEVEL(LOG_LEVEL_WARNING, "server_paint_rects: error");
         }
 
+        encoder = mm->encoder;
+        if (encoder->max_frames_in_encoder > 0)
+        {
+            if (xrdp_encoder_copy_frame(encoder, enc_data) != 0)
+            {
+                g_free(enc_data->drects);
+                g_free(enc_data->crects);
+                g_free(enc_data->crect_hints);
+                g_free(enc_data->scrolls);
+                g_free(enc_data);
+                return 1;
+            }
+        }
+
         /* insert into fifo for encoder thread to process */
-        tc_mutex_lock(mm->encoder->mutex);
-        fifo_add_item(mm->encoder->fifo_to_proc, (void *) enc_data);
-        tc_mutex_unlock(mm->encoder->mutex);
+        tc_mutex_lock(encoder->mutex);
+        fifo_add_item(encoder->fifo_to_proc, (void *) enc_data);
+        tc_mutex_unlock(encoder->mutex);
 
         /* signal xrdp_encoder thread */
-        g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
+        g_set_wait_obj(encoder->xrdp_encoder_event_to_proc);
+
+        encoder->frame_id_queued = frame_id;
+        encoder->frames_in_encoder++;
+        encoder->stats.frames++;
+        encoder->stats.encoder_depth_sum += encoder->frames_in_encoder;
+        encoder->stats.encoder_depth_max = MAX(encoder->stats.encoder_depth_max,
+                                               encoder->frames_in_encoder);
+        if (wm->client_info->use_frame_acks)
+        {
+            index = encoder->frame_id_server - encoder->frame_id_client;
+            encoder->stats.client_depth_sum += index;
+            encoder->stats.client_depth_max =
+                MAX(encoder->stats.client_depth_max, index);
+        }
+        if (encoder->max_frames_in_encoder > 0)
+        {
+            xrdp_mm_update_module_frame_ack(mm);
+        }
 
         return 0;
     }
@@ -3431,6 +3578,13 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
     {
         return 0;
     }
+    s = scrolls;
+    for (index = 0; index < num_scrolls; index++)
+    {
+        server_screen_blt(mod, s[0] + s[4], s[1] + s[5], s[2], s[3],
+                          s[0], s[1]);
+        s += 6;
+    }
     b = xrdp_bitmap_create_with_data(width, height, wm->screen->bpp,
                                      data, wm);
     s = crects;
@@ -3445,6 +3599,17 @@ server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
     return 0;
 }
 
+/*****************************************************************************/
+int
+server_paint_rects(struct xrdp_mod *mod, int num_drects, short *drects,
+                   int num_crects, short *crects, char *data, int width,
+                   int height, int flags, int frame_id)
+{
+    return server_paint_rects_ex(mod, num_drects, drects, num_crects, crects,
+                                 NULL, 0, NULL, data, width, height,
+                                 flags, frame_id);
+}
+
 /*****************************************************************************/
 int
 server_session_info(struct xrdp_mod *mod, const char *data, int data_bytes)
@@ -1091,6 +1091,8 @@ xrdp_painter_copy(struct xrdp_painter *self,
     int w;
     int h;
     int index;
+    int num_tiles;
+    struct xrdp_bitmap **tiles;
     struct list *del_list;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_painter_copy:");
@@ -1286,13 +1288,20 @@ xrdp_painter_copy(struct xrdp_painter *self,
         x += dx;
         y += dy;
         palette_id = 0;
-        j = srcy;
 
-        while (j < (srcy + cy))
+        /* make all the tiles first so the ones the client does not have
+           can be compressed together */
+        num_tiles = ((cx + 63) / 64) * ((cy + 63) / 64);
+        tiles = g_new(struct xrdp_bitmap *, num_tiles);
+        if (tiles == NULL)
         {
-            i = srcx;
-
-            while (i < (srcx + cx))
+            xrdp_region_delete(region);
+            return 1;
+        }
+        index = 0;
+        for (j = srcy; j < (srcy + cy); j += 64)
+        {
+            for (i = srcx; i < (srcx + cx); i += 64)
             {
                 w = MIN(64, ((srcx + cx) - i));
                 h = MIN(64, ((srcy + cy) - j));
@@ -1303,6 +1312,23 @@ xrdp_painter_copy(struct xrdp_painter *self,
                 xrdp_bitmap_copy_box(src, b, i, j, w, h);
                 xrdp_bitmap_hash_crc(b);
 #endif
+                tiles[index++] = b;
+            }
+        }
+        xrdp_cache_prepare_bitmaps(self->wm->cache, tiles, num_tiles);
+
+        index = 0;
+        j = srcy;
+
+        while (j < (srcy + cy))
+        {
+            i = srcx;
+
+            while (i < (srcx + cx))
+            {
+                w = MIN(64, ((srcx + cx) - i));
+                h = MIN(64, ((srcy + cy) - j));
+                b = tiles[index++];
                 bitmap_id = xrdp_cache_add_bitmap(self->wm->cache, b, self->wm->hints);
                 cache_id = HIWORD(bitmap_id);
                 cache_idx = LOWORD(bitmap_id);
@@ -1333,6 +1359,8 @@ xrdp_painter_copy(struct xrdp_painter *self,
             j += 64;
         }
 
+        xrdp_cache_prepare_done(self->wm->cache);
+        g_free(tiles);
         xrdp_region_delete(region);
     }
 
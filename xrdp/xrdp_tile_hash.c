@@ -0,0 +1,684 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Per tile line hashes of the frame last sent to the client
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "xrdp_tile_hash.h"
+
+#define TILE_SIZE XRDP_TILE_HASH_TILE_SIZE
+
+/* shorter shifts than this are not worth a screen blt */
+#define SCROLL_MIN_LINES 64
+/* lines sampled when voting for a shift */
+#define SCROLL_SAMPLE_STEP 8
+/* samples matching more lines than this are ignored, e.g. blank lines */
+#define SCROLL_MAX_MATCHES 8
+#define SCROLL_MAX_CANDIDATES 32
+
+#define HASH_SEED 0x2d358dccu
+
+/* murmur3 style mixing, alpha is ignored */
+#define HASH_ROUND(_h, _v) \
+    do \
+    { \
+        (_h) ^= ((_v) & 0x00ffffffu) * 0xcc9e2d51u; \
+        (_h) = (((_h) << 13) | ((_h) >> 19)) * 5 + 0xe6546b64u; \
+    } while (0)
+
+struct scroll_vote
+{
+    int shift;
+    int votes;
+};
+
+/*****************************************************************************/
+/* 0 is reserved for unknown content */
+static unsigned int
+hash_final(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return (h == 0) ? 1 : h;
+}
+
+/*****************************************************************************/
+/* combines count line segment hashes, 0 if any segment is unknown */
+static unsigned int
+hash_combine(const unsigned int *hashes, int count, int step)
+{
+    unsigned int h;
+    unsigned int v;
+    int index;
+
+    h = HASH_SEED;
+    for (index = 0; index < count; index++)
+    {
+        v = hashes[index * step];
+        if (v == 0)
+        {
+            return 0;
+        }
+        h ^= v * 0xcc9e2d51u;
+        h = ((h << 13) | (h >> 19)) * 5 + 0xe6546b64u;
+    }
+    return hash_final(h);
+}
+
+/*****************************************************************************/
+struct xrdp_tile_hash *
+xrdp_tile_hash_create(int width, int height)
+{
+    struct xrdp_tile_hash *self;
+    int tiles_x;
+    int tiles_y;
+    int lines;
+
+    if ((width < 1) || (height < 1))
+    {
+        return NULL;
+    }
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    lines = MAX(width, height);
+    self = g_new0(struct xrdp_tile_hash, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->tiles_x = tiles_x;
+    self->tiles_y = tiles_y;
+    self->row_hashes = g_new0(unsigned int, height * tiles_x);
+    self->col_hashes = g_new0(unsigned int, tiles_y * width);
+    self->next_row_hashes = g_new0(unsigned int, height * tiles_x);
+    self->next_col_hashes = g_new0(unsigned int, tiles_y * width);
+    self->tile_cover = g_new0(int, tiles_y * tiles_x);
+    self->cur_lines = g_new(unsigned int, lines);
+    self->prev_lines = g_new(unsigned int, lines);
+    if ((self->row_hashes == NULL) || (self->col_hashes == NULL) ||
+            (self->next_row_hashes == NULL) ||
+            (self->next_col_hashes == NULL) ||
+            (self->tile_cover == NULL) ||
+            (self->cur_lines == NULL) || (self->prev_lines == NULL))
+    {
+        xrdp_tile_hash_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_hash_delete(struct xrdp_tile_hash *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->row_hashes);
+    g_free(self->col_hashes);
+    g_free(self->next_row_hashes);
+    g_free(self->next_col_hashes);
+    g_free(self->tile_cover);
+    g_free(self->cur_lines);
+    g_free(self->prev_lines);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* hashes every pixel row and column of one tile into the next_ arrays */
+static void
+hash_tile(struct xrdp_tile_hash *self, const char *data, int tx, int ty)
+{
+    unsigned int col_acc[TILE_SIZE];
+    unsigned int h;
+    unsigned int pixel;
+    const unsigned int *src;
+    unsigned int *row_out;
+    unsigned int *col_out;
+    int x0;
+    int y0;
+    int tw;
+    int th;
+    int stride;
+    int index;
+    int y;
+
+    x0 = tx * TILE_SIZE;
+    y0 = ty * TILE_SIZE;
+    tw = MIN(TILE_SIZE, self->width - x0);
+    th = MIN(TILE_SIZE, self->height - y0);
+    stride = self->width * 4;
+    for (index = 0; index < tw; index++)
+    {
+        col_acc[index] = HASH_SEED;
+    }
+    row_out = self->next_row_hashes + y0 * self->tiles_x + tx;
+    for (y = 0; y < th; y++)
+    {
+        src = (const unsigned int *) (data + (y0 + y) * stride + x0 * 4);
+        h = HASH_SEED;
+        for (index = 0; index < tw; index++)
+        {
+            pixel = src[index];
+            HASH_ROUND(h, pixel);
+            HASH_ROUND(col_acc[index], pixel);
+        }
+        *row_out = hash_final(h);
+        row_out += self->tiles_x;
+    }
+    col_out = self->next_col_hashes + ty * self->width + x0;
+    for (index = 0; index < tw; index++)
+    {
+        col_out[index] = hash_final(col_acc[index]);
+    }
+}
+
+/*****************************************************************************/
+/* marks a partly damaged tile as unknown */
+static void
+clear_tile(struct xrdp_tile_hash *self, int tx, int ty)
+{
+    unsigned int *row_out;
+    int x0;
+    int y0;
+    int tw;
+    int th;
+    int y;
+
+    x0 = tx * TILE_SIZE;
+    y0 = ty * TILE_SIZE;
+    tw = MIN(TILE_SIZE, self->width - x0);
+    th = MIN(TILE_SIZE, self->height - y0);
+    row_out = self->next_row_hashes + y0 * self->tiles_x + tx;
+    for (y = 0; y < th; y++)
+    {
+        *row_out = 0;
+        row_out += self->tiles_x;
+    }
+    g_memset(self->next_col_hashes + ty * self->width + x0, 0,
+             tw * sizeof(unsigned int));
+}
+
+/*****************************************************************************/
+/* the client content of the area changed without the encoder, e.g. a
+   scroll hinted by Xorg */
+void
+xrdp_tile_hash_invalidate(struct xrdp_tile_hash *self,
+                          int x, int y, int cx, int cy)
+{
+    int tx;
+    int ty;
+    int tx1;
+    int ty1;
+    int x0;
+    int y0;
+    int tw;
+    int th;
+    int offset;
+    int index;
+
+    cx = MIN(x + cx, self->width) - MAX(x, 0);
+    cy = MIN(y + cy, self->height) - MAX(y, 0);
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if ((cx < 1) || (cy < 1))
+    {
+        return;
+    }
+    tx1 = (x + cx - 1) / TILE_SIZE;
+    ty1 = (y + cy - 1) / TILE_SIZE;
+    for (ty = y / TILE_SIZE; ty <= ty1; ty++)
+    {
+        y0 = ty * TILE_SIZE;
+        th = MIN(TILE_SIZE, self->height - y0);
+        for (tx = x / TILE_SIZE; tx <= tx1; tx++)
+        {
+            x0 = tx * TILE_SIZE;
+            tw = MIN(TILE_SIZE, self->width - x0);
+            offset = y0 * self->tiles_x + tx;
+            for (index = 0; index < th; index++)
+            {
+                self->row_hashes[offset] = 0;
+                offset += self->tiles_x;
+            }
+            g_memset(self->col_hashes + ty * self->width + x0, 0,
+                     tw * sizeof(unsigned int));
+        }
+    }
+}
+
+/*****************************************************************************/
+/* hashes the tiles of a new frame, data only has to be valid inside
+   crects, returns error */
+int
+xrdp_tile_hash_begin_frame(struct xrdp_tile_hash *self, const char *data,
+                           int width, int height,
+                           const short *crects, int num_crects)
+{
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int tx;
+    int ty;
+    int tx1;
+    int ty1;
+    int tw;
+    int th;
+    int *cover;
+
+    if ((width != self->width) || (height != self->height))
+    {
+        return 1;
+    }
+    for (index = 0; index < num_crects; index++)
+    {
+        x = crects[index * 4 + 0];
+        y = crects[index * 4 + 1];
+        cx = crects[index * 4 + 2];
+        cy = crects[index * 4 + 3];
+        cx = MIN(x + cx, width) - MAX(x, 0);
+        cy = MIN(y + cy, height) - MAX(y, 0);
+        x = MAX(x, 0);
+        y = MAX(y, 0);
+        if ((cx < 1) || (cy < 1))
+        {
+            continue;
+        }
+        tx1 = (x + cx - 1) / TILE_SIZE;
+        ty1 = (y + cy - 1) / TILE_SIZE;
+        for (ty = y / TILE_SIZE; ty <= ty1; ty++)
+        {
+            th = MIN(y + cy, (ty + 1) * TILE_SIZE) -
+                 MAX(y, ty * TILE_SIZE);
+            for (tx = x / TILE_SIZE; tx <= tx1; tx++)
+            {
+                tw = MIN(x + cx, (tx + 1) * TILE_SIZE) -
+                     MAX(x, tx * TILE_SIZE);
+                self->tile_cover[ty * self->tiles_x + tx] += tw * th;
+            }
+        }
+    }
+    cover = self->tile_cover;
+    for (ty = 0; ty < self->tiles_y; ty++)
+    {
+        th = MIN(TILE_SIZE, height - ty * TILE_SIZE);
+        for (tx = 0; tx < self->tiles_x; tx++)
+        {
+            if (*cover != 0)
+            {
+                tw = MIN(TILE_SIZE, width - tx * TILE_SIZE);
+                /* overlapping crects count as partly damaged, the
+                   pixels not covered may be stale */
+                if (*cover == tw * th)
+                {
+                    hash_tile(self, data, tx, ty);
+                }
+                else
+                {
+                    clear_tile(self, tx, ty);
+                }
+            }
+            cover++;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* cur[index] == prev[index - shift], finds the shift with the most
+   votes and the longest run of lines it explains, returns run length */
+static int
+find_shift(const unsigned int *cur, const unsigned int *prev, int count,
+           int *shift, int *start)
+{
+    struct scroll_vote votes[SCROLL_MAX_CANDIDATES];
+    int num_votes;
+    int matches;
+    int best;
+    int index;
+    int jndex;
+    int kndex;
+    int first;
+    int end;
+    int run;
+    int run_start;
+    int best_run;
+    unsigned int h;
+
+    num_votes = 0;
+    for (index = 0; index < count; index += SCROLL_SAMPLE_STEP)
+    {
+        h = cur[index];
+        if ((h == 0) || ((index > 0) && (cur[index - 1] == h)))
+        {
+            continue;
+        }
+        matches = 0;
+        for (jndex = 0; jndex < count; jndex++)
+        {
+            if (prev[jndex] == h)
+            {
+                matches++;
+            }
+        }
+        if ((matches < 1) || (matches > SCROLL_MAX_MATCHES))
+        {
+            continue;
+        }
+        for (jndex = 0; jndex < count; jndex++)
+        {
+            if ((prev[jndex] != h) || (jndex == index))
+            {
+                continue;
+            }
+            for (kndex = 0; kndex < num_votes; kndex++)
+            {
+                if (votes[kndex].shift == index - jndex)
+                {
+                    votes[kndex].votes++;
+                    break;
+                }
+            }
+            if ((kndex == num_votes) && (num_votes < SCROLL_MAX_CANDIDATES))
+            {
+                votes[num_votes].shift = index - jndex;
+                votes[num_votes].votes = 1;
+                num_votes++;
+            }
+        }
+    }
+    best = -1;
+    for (kndex = 0; kndex < num_votes; kndex++)
+    {
+        if ((votes[kndex].votes > 1) &&
+                ((best < 0) || (votes[kndex].votes > votes[best].votes)))
+        {
+            best = kndex;
+        }
+    }
+    if (best < 0)
+    {
+        return 0;
+    }
+    *shift = votes[best].shift;
+    first = MAX(0, *shift);
+    end = MIN(count, count + *shift);
+    best_run = 0;
+    run = 0;
+    run_start = first;
+    for (index = first; index < end; index++)
+    {
+        h = cur[index];
+        if ((h != 0) && (h == prev[index - *shift]))
+        {
+            if (run == 0)
+            {
+                run_start = index;
+            }
+            run++;
+            if (run > best_run)
+            {
+                best_run = run;
+                *start = run_start;
+            }
+        }
+        else
+        {
+            run = 0;
+        }
+    }
+    return best_run;
+}
+
+/*****************************************************************************/
+/* looks for a vertical or horizontal shift of the damaged area between
+   the client frame and the frame passed to begin_frame.  The damaged
+   area must be a rectangle fully covered by crects.
+   On success scroll is x, y, cx, cy, dx, dy of the source area and
+   1 is returned */
+int
+xrdp_tile_hash_find_scroll(struct xrdp_tile_hash *self,
+                           const short *crects, int num_crects,
+                           short *scroll)
+{
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int left;
+    int top;
+    int right;
+    int bottom;
+    int t0;
+    int t1;
+    int count;
+    int run;
+    int shift;
+    int start;
+    int best_area;
+    long area;
+
+    if (num_crects < 1)
+    {
+        return 0;
+    }
+    left = self->width;
+    top = self->height;
+    right = 0;
+    bottom = 0;
+    area = 0;
+    for (index = 0; index < num_crects; index++)
+    {
+        x = crects[index * 4 + 0];
+        y = crects[index * 4 + 1];
+        cx = crects[index * 4 + 2];
+        cy = crects[index * 4 + 3];
+        cx = MIN(x + cx, self->width) - MAX(x, 0);
+        cy = MIN(y + cy, self->height) - MAX(y, 0);
+        x = MAX(x, 0);
+        y = MAX(y, 0);
+        if ((cx < 1) || (cy < 1))
+        {
+            continue;
+        }
+        left = MIN(left, x);
+        top = MIN(top, y);
+        right = MAX(right, x + cx);
+        bottom = MAX(bottom, y + cy);
+        area += (long) cx * cy;
+    }
+    if ((right <= left) || (bottom <= top) ||
+            (area != (long) (right - left) * (bottom - top)))
+    {
+        return 0;
+    }
+    best_area = 0;
+
+    /* vertical, compare rows of the tile columns inside the area */
+    t0 = (left + TILE_SIZE - 1) / TILE_SIZE;
+    t1 = (right == self->width) ? self->tiles_x : right / TILE_SIZE;
+    count = bottom - top;
+    if ((t1 > t0) && (count >= SCROLL_MIN_LINES))
+    {
+        for (index = 0; index < count; index++)
+        {
+            y = (top + index) * self->tiles_x + t0;
+            self->cur_lines[index] =
+                hash_combine(self->next_row_hashes + y, t1 - t0, 1);
+            self->prev_lines[index] =
+                hash_combine(self->row_hashes + y, t1 - t0, 1);
+        }
+        run = find_shift(self->cur_lines, self->prev_lines, count,
+                         &shift, &start);
+        if (run >= SCROLL_MIN_LINES)
+        {
+            x = t0 * TILE_SIZE;
+            cx = MIN(t1 * TILE_SIZE, self->width) - x;
+            best_area = run * cx;
+            scroll[0] = x;
+            scroll[1] = top + start - shift;
+            scroll[2] = cx;
+            scroll[3] = run;
+            scroll[4] = 0;
+            scroll[5] = shift;
+        }
+    }
+
+    /* horizontal, compare columns of the tile rows inside the area */
+    t0 = (top + TILE_SIZE - 1) / TILE_SIZE;
+    t1 = (bottom == self->height) ? self->tiles_y : bottom / TILE_SIZE;
+    count = right - left;
+    if ((t1 > t0) && (count >= SCROLL_MIN_LINES))
+    {
+        for (index = 0; index < count; index++)
+        {
+            x = t0 * self->width + left + index;
+            self->cur_lines[index] =
+                hash_combine(self->next_col_hashes + x, t1 - t0,
+                             self->width);
+            self->prev_lines[index] =
+                hash_combine(self->col_hashes + x, t1 - t0, self->width);
+        }
+        run = find_shift(self->cur_lines, self->prev_lines, count,
+                         &shift, &start);
+        if (run >= SCROLL_MIN_LINES)
+        {
+            y = t0 * TILE_SIZE;
+            cy = MIN(t1 * TILE_SIZE, self->height) - y;
+            if (run * cy > best_area)
+            {
+                best_area = run * cy;
+                scroll[0] = left + start - shift;
+                scroll[1] = y;
+                scroll[2] = run;
+                scroll[3] = cy;
+                scroll[4] = shift;
+                scroll[5] = 0;
+            }
+        }
+    }
+    return best_area > 0;
+}
+
+/*****************************************************************************/
+/* after begin_frame, returns 1 if the tile was fully damaged but the
+   client already has the same pixels */
+int
+xrdp_tile_hash_tile_unchanged(struct xrdp_tile_hash *self, int tx, int ty)
+{
+    int x0;
+    int y0;
+    int tw;
+    int th;
+    int x;
+    int y;
+    int offset;
+    const unsigned int *next;
+    const unsigned int *prev;
+
+    if ((tx < 0) || (ty < 0) || (tx >= self->tiles_x) || (ty >= self->tiles_y))
+    {
+        return 0;
+    }
+    x0 = tx * TILE_SIZE;
+    y0 = ty * TILE_SIZE;
+    tw = MIN(TILE_SIZE, self->width - x0);
+    th = MIN(TILE_SIZE, self->height - y0);
+    if (self->tile_cover[ty * self->tiles_x + tx] != tw * th)
+    {
+        return 0;
+    }
+    offset = y0 * self->tiles_x + tx;
+    for (y = 0; y < th; y++)
+    {
+        if ((self->row_hashes[offset] == 0) ||
+                (self->row_hashes[offset] != self->next_row_hashes[offset]))
+        {
+            return 0;
+        }
+        offset += self->tiles_x;
+    }
+    next = self->next_col_hashes + ty * self->width + x0;
+    prev = self->col_hashes + ty * self->width + x0;
+    for (x = 0; x < tw; x++)
+    {
+        if ((prev[x] == 0) || (prev[x] != next[x]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* the frame passed to begin_frame is now what the client has */
+void
+xrdp_tile_hash_end_frame(struct xrdp_tile_hash *self)
+{
+    int tx;
+    int ty;
+    int x0;
+    int y0;
+    int tw;
+    int th;
+    int y;
+    int offset;
+    int *cover;
+
+    cover = self->tile_cover;
+    for (ty = 0; ty < self->tiles_y; ty++)
+    {
+        y0 = ty * TILE_SIZE;
+        th = MIN(TILE_SIZE, self->height - y0);
+        for (tx = 0; tx < self->tiles_x; tx++)
+        {
+            if (*cover != 0)
+            {
+                x0 = tx * TILE_SIZE;
+                tw = MIN(TILE_SIZE, self->width - x0);
+                offset = y0 * self->tiles_x + tx;
+                for (y = 0; y < th; y++)
+                {
+                    self->row_hashes[offset] = self->next_row_hashes[offset];
+                    offset += self->tiles_x;
+                }
+                offset = ty * self->width + x0;
+                g_memcpy(self->col_hashes + offset,
+                         self->next_col_hashes + offset,
+                         tw * sizeof(unsigned int));
+                *cover = 0;
+            }
+            cover++;
+        }
+    }
+}
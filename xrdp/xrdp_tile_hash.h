@@ -0,0 +1,65 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Per tile line hashes of the frame last sent to the client
+ */
+
+#ifndef _XRDP_TILE_HASH_H
+#define _XRDP_TILE_HASH_H
+
+#define XRDP_TILE_HASH_TILE_SIZE 64
+
+/* Each 64x64 tile of the screen is described by the hashes of its pixel
+   rows (row_hashes) and pixel columns (col_hashes).  A hash of 0 means
+   the content is not known, e.g. the tile was only partly damaged.
+   All functions are called from the encoder thread. */
+struct xrdp_tile_hash
+{
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    unsigned int *row_hashes; /* height * tiles_x, as on the client */
+    unsigned int *col_hashes; /* tiles_y * width, as on the client */
+    unsigned int *next_row_hashes; /* frame being encoded */
+    unsigned int *next_col_hashes;
+    int *tile_cover; /* tiles_y * tiles_x, damaged pixels per tile */
+    unsigned int *cur_lines; /* MAX(width, height), scratch */
+    unsigned int *prev_lines;
+};
+
+struct xrdp_tile_hash *
+xrdp_tile_hash_create(int width, int height);
+void
+xrdp_tile_hash_delete(struct xrdp_tile_hash *self);
+void
+xrdp_tile_hash_invalidate(struct xrdp_tile_hash *self,
+                          int x, int y, int cx, int cy);
+int
+xrdp_tile_hash_begin_frame(struct xrdp_tile_hash *self, const char *data,
+                           int width, int height,
+                           const short *crects, int num_crects);
+int
+xrdp_tile_hash_find_scroll(struct xrdp_tile_hash *self,
+                           const short *crects, int num_crects,
+                           short *scroll);
+int
+xrdp_tile_hash_tile_unchanged(struct xrdp_tile_hash *self, int tx, int ty);
+void
+xrdp_tile_hash_end_frame(struct xrdp_tile_hash *self);
+
+#endif
@@ -174,7 +174,14 @@ struct xrdp_mod
     int (*server_set_pointer_large)(struct xrdp_mod *v, int x, int y,
                                     char *data, char *mask, int bpp,
                                     int width, int height);
-    tintptr server_dumby[100 - 47]; /* align, 100 minus the number of server
+    int (*server_paint_rects_ex)(struct xrdp_mod *v,
+                                 int num_drects, short *drects,
+                                 int num_crects, short *crects,
+                                 short *crect_hints,
+                                 int num_scrolls, short *scrolls,
+                                 char *data, int width, int height,
+                                 int flags, int frame_id);
+    tintptr server_dumby[100 - 48]; /* align, 100 minus the number of server
                                      functions above */
     /* common */
     tintptr handle; /* pointer to self as int */
@@ -303,6 +310,7 @@ struct xrdp_cache
     /* pointer */
     int pointer_stamp;
     struct xrdp_pointer_item pointer_items[32];
+    unsigned int pointer_hashes[32];
     int pointer_cache_entries;
     int brush_stamp;
     struct xrdp_brush_item brush_items[64];
@@ -558,6 +566,8 @@ struct xrdp_listen
     struct list *fork_list;
     tbus pro_done_event;
     struct xrdp_startup_params *startup_params;
+    int worker_index; /* which listen worker this is, see workers below */
+    struct list *pool_list; /* children forked ahead, see fork_pool below */
 };
 
 /* region */
@@ -694,6 +704,8 @@ struct xrdp_startup_params
     int tcp_nodelay;
     int tcp_keepalive;
     int use_vsock;
+    int workers; /* listen worker processes sharing the tcp ports, 0 for none */
+    int fork_pool; /* children forked ahead of connections when forking */
 };
 
 /*
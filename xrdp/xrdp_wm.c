@@ -28,6 +28,7 @@
 #include "ms-rdpbcgr.h"
 #include "log.h"
 #include "string_calls.h"
+#include "xrdp_encoder.h"
 
 /*****************************************************************************/
 struct xrdp_wm *
@@ -2000,6 +2001,12 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
             /* like the rest, it's from RDP_PDU_DATA with code 33 */
             /* it's the rdp client asking for a screen update */
             MAKERECT(rect, param1, param2, param3, param4);
+            if (wm->mm->encoder != NULL)
+            {
+                /* it no longer has what the tile hashes say */
+                xrdp_encoder_invalidate(wm->mm->encoder,
+                                        param1, param2, param3, param4);
+            }
             rv = xrdp_bitmap_invalidate(wm->screen, &rect);
             break;
         case 0x5555: /* called from xrdp_channel.c, channel data has come in,
@@ -1116,6 +1116,51 @@ send_suppress_output(struct mod *mod, int suppress,
     return 0;
 }
 
+/******************************************************************************/
+/* maps (or remaps) the screen memory area shared with the X server
+   returns the pixels or NULL */
+static char *
+get_screen_shmem_pixels(struct mod *amod, int shmem_id)
+{
+    /* Do we need to map (or remap) the memory
+     * area shared with the X server ? */
+    if (amod->screen_shmem_id_mapped == 0 ||
+            amod->screen_shmem_id != shmem_id)
+    {
+        if (amod->screen_shmem_id_mapped != 0)
+        {
+            g_shmdt(amod->screen_shmem_pixels);
+        }
+        amod->screen_shmem_pixels = (char *) g_shmat(shmem_id);
+        if (amod->screen_shmem_pixels == (void *) -1)
+        {
+            /* failed */
+            if (amod->screen_shmem_id_mapped == 0)
+            {
+                LOG(LOG_LEVEL_ERROR,
+                    "Can't attach to shared memory id %d [%s]",
+                    shmem_id, g_get_strerror());
+            }
+            else
+            {
+                LOG(LOG_LEVEL_ERROR,
+                    "Can't attach to shared memory id %d from id %d [%s]",
+                    shmem_id, amod->screen_shmem_id, g_get_strerror());
+            }
+            amod->screen_shmem_id = 0;
+            amod->screen_shmem_pixels = 0;
+            amod->screen_shmem_id_mapped = 0;
+        }
+        else
+        {
+            amod->screen_shmem_id = shmem_id;
+            amod->screen_shmem_id_mapped = 1;
+        }
+    }
+
+    return amod->screen_shmem_pixels;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1176,45 +1221,10 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     bmpdata = 0;
     if (flags == 0) /* screen */
     {
-        /* Do we need to map (or remap) the memory
-         * area shared with the X server ? */
-        if (amod->screen_shmem_id_mapped == 0 ||
-                amod->screen_shmem_id != shmem_id)
+        bmpdata = get_screen_shmem_pixels(amod, shmem_id);
+        if (bmpdata != 0)
         {
-            if (amod->screen_shmem_id_mapped != 0)
-            {
-                g_shmdt(amod->screen_shmem_pixels);
-            }
-            amod->screen_shmem_pixels = (char *) g_shmat(shmem_id);
-            if (amod->screen_shmem_pixels == (void *) -1)
-            {
-                /* failed */
-                if (amod->screen_shmem_id_mapped == 0)
-                {
-                    LOG(LOG_LEVEL_ERROR,
-                        "Can't attach to shared memory id %d [%s]",
-                        shmem_id, g_get_strerror());
-                }
-                else
-                {
-                    LOG(LOG_LEVEL_ERROR,
-                        "Can't attach to shared memory id %d from id %d [%s]",
-                        shmem_id, amod->screen_shmem_id, g_get_strerror());
-                }
-                amod->screen_shmem_id = 0;
-                amod->screen_shmem_pixels = 0;
-                amod->screen_shmem_id_mapped = 0;
-            }
-            else
-            {
-                amod->screen_shmem_id = shmem_id;
-                amod->screen_shmem_id_mapped = 1;
-            }
-        }
-
-        if (amod->screen_shmem_pixels != 0)
-        {
-            bmpdata = amod->screen_shmem_pixels + shmem_offset;
+            bmpdata += shmem_offset;
         }
     }
     else
@@ -1247,6 +1257,137 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* return error
+   same as server_paint_rect_shmem_ex, followed by a content hint
+   (XRDP_ENCODER_CONTENT_*) for each copied rect and a list of
+   scrolled areas, each one a source rect and the offset it moved by */
+static int
+process_server_paint_rect_shmem_hints(struct mod *amod, struct stream *s)
+{
+    int num_drects;
+    int num_crects;
+    int num_scrolls;
+    int flags;
+    int frame_id;
+    int shmem_id;
+    int shmem_offset;
+    int width;
+    int height;
+    int index;
+    int rv;
+    tsi16 *ldrects;
+    tsi16 *lcrects;
+    tsi16 *lhints;
+    tsi16 *lscrolls;
+    char *bmpdata;
+
+    LOG(LOG_LEVEL_TRACE, "process_server_paint_rect_shmem_hints:");
+
+    if (!s_check_rem_and_log(s, 2, "process_server_paint_rect_shmem_hints"))
+    {
+        return 1;
+    }
+    in_uint16_le(s, num_drects);
+    if (!s_check_rem_and_log(s, num_drects * 8 + 2,
+                             "process_server_paint_rect_shmem_hints"))
+    {
+        return 1;
+    }
+    ldrects = g_new(tsi16, num_drects * 4 + 1);
+    for (index = 0; index < num_drects * 4; index++)
+    {
+        in_sint16_le(s, ldrects[index]);
+    }
+
+    in_uint16_le(s, num_crects);
+    if (!s_check_rem_and_log(s, num_crects * 10 + 22,
+                             "process_server_paint_rect_shmem_hints"))
+    {
+        g_free(ldrects);
+        return 1;
+    }
+    lcrects = g_new(tsi16, num_crects * 4 + 1);
+    for (index = 0; index < num_crects * 4; index++)
+    {
+        in_sint16_le(s, lcrects[index]);
+    }
+
+    in_uint32_le(s, flags);
+    in_uint32_le(s, frame_id);
+    in_uint32_le(s, shmem_id);
+    in_uint32_le(s, shmem_offset);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+
+    lhints = g_new(tsi16, num_crects + 1);
+    for (index = 0; index < num_crects; index++)
+    {
+        in_sint16_le(s, lhints[index]);
+    }
+
+    in_uint16_le(s, num_scrolls);
+    if (!s_check_rem_and_log(s, num_scrolls * 12,
+                             "process_server_paint_rect_shmem_hints"))
+    {
+        g_free(lhints);
+        g_free(lcrects);
+        g_free(ldrects);
+        return 1;
+    }
+    lscrolls = g_new(tsi16, num_scrolls * 6 + 1);
+    for (index = 0; index < num_scrolls * 6; index++)
+    {
+        in_sint16_le(s, lscrolls[index]);
+    }
+
+    bmpdata = 0;
+    if (flags == 0) /* screen */
+    {
+        bmpdata = get_screen_shmem_pixels(amod, shmem_id);
+        if (bmpdata != 0)
+        {
+            bmpdata += shmem_offset;
+        }
+    }
+    else
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "process_server_paint_rect_shmem_hints:"
+                  " flags=%d frame_id=%d, shmem_id=%d, shmem_offset=%d,"
+                  " width=%d, height=%d",
+                  flags, frame_id, shmem_id, shmem_offset,
+                  width, height);
+    }
+
+    if (bmpdata == 0)
+    {
+        rv = 1;
+    }
+    else if (amod->server_paint_rects_ex != 0)
+    {
+        rv = amod->server_paint_rects_ex(amod, num_drects, ldrects,
+                                         num_crects, lcrects, lhints,
+                                         num_scrolls, lscrolls,
+                                         bmpdata, width, height,
+                                         flags, frame_id);
+    }
+    else
+    {
+        /* scrolls can not be dropped, the X server has not copied
+           the scrolled pixels */
+        LOG(LOG_LEVEL_ERROR, "process_server_paint_rect_shmem_hints: "
+            "not supported by this xrdp");
+        rv = 1;
+    }
+
+    g_free(lscrolls);
+    g_free(lhints);
+    g_free(lcrects);
+    g_free(ldrects);
+
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1532,6 +1673,9 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
         case 63: /* server_set_pointer_shmfd */
             rv = process_server_set_pointer_shmfd(mod, s);
             break;
+        case 70: /* server_paint_rect_shmem_hints */
+            rv = process_server_paint_rect_shmem_hints(mod, s);
+            break;
         default:
             LOG_DEVEL(LOG_LEVEL_WARNING,
                       "lib_mod_process_orders: unknown order type %d", type);
@@ -160,7 +160,14 @@ struct mod
     int (*server_set_pointer_large)(struct mod *v, int x, int y,
                                     char *data, char *mask, int bpp,
                                     int width, int height);
-    tintptr server_dumby[100 - 47]; /* align, 100 minus the number of server
+    int (*server_paint_rects_ex)(struct mod *v,
+                                 int num_drects, short *drects,
+                                 int num_crects, short *crects,
+                                 short *crect_hints,
+                                 int num_scrolls, short *scrolls,
+                                 char *data, int width, int height,
+                                 int flags, int frame_id);
+    tintptr server_dumby[100 - 48]; /* align, 100 minus the number of server
                                      functions above */
     /* common */
     tintptr handle; /* pointer to self as long */